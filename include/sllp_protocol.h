@@ -0,0 +1,201 @@
+/*
+ * Sirius Low Level Control Protocol Definitions
+ * Version 0.1
+ * CON - Controls Group
+ * LNLS - Brazilian Synchrotron Light Laboratory
+ *
+ * Shared by the server and client libraries.
+ */
+
+#ifndef SLLP_PROTOCOL_H
+#define	SLLP_PROTOCOL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define SLLP_HEADER_SIZE        2   // Command code and encoded payload size
+#define SLLP_MAX_MESSAGE    16388   // Header plus the largest payload, a curve
+                                    // block with its ID and offset
+#define SLLP_MAX_PAYLOAD    (SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE)
+
+#define SLLP_MAX_VARIABLES    128
+#define SLLP_MAX_GROUPS       128
+#define SLLP_MAX_CURVES       128
+#define SLLP_MAX_VAR_SIZE     127
+
+#define SLLP_WRITABLE        0x80   // Flag of writable entities in lists
+
+#define SLLP_CURVE_BLOCK_SIZE 16384
+#define SLLP_CURVE_CSUM_SIZE     16
+#define SLLP_CURVE_INFO_SIZE     18 // Writable, nblocks and checksum
+#define SLLP_DOUBLE_SIZE          8 // IEEE 754 double, big-endian
+
+enum sllp_err
+{
+    SLLP_SUCCESS,                   // Operation executed successfully
+    SLLP_ERR_PARAM_INVALID,         // An invalid parameter was passed
+    SLLP_ERR_PARAM_OUT_OF_RANGE,    // A param not in the acceptable range was
+                                    // passed
+    SLLP_ERR_OUT_OF_MEMORY,         // Not enough memory to complete operation
+    SLLP_ERR_COMM,                  // A system call on a socket or file failed
+    SLLP_ERR_REFUSED,               // The server answered a request with an
+                                    // error or an unexpected answer
+    SLLP_ERR_CHECKSUM,              // Data transferred doesn't match the
+                                    // checksum the server has for it
+
+    SLLP_ERR_MAX
+};
+
+// How the samples of a curve are laid out, in the server's byte order, for
+// the commands that interpret them
+enum sllp_sample_type
+{
+    SLLP_SAMPLE_NONE,               // Opaque bytes
+    SLLP_SAMPLE_INT16,
+    SLLP_SAMPLE_INT32,
+    SLLP_SAMPLE_FLOAT32,
+
+    SLLP_SAMPLE_MAX
+};
+
+enum command_code
+{
+    CMD_QUERY_STATUS = 0x00,
+    CMD_STATUS,
+    CMD_QUERY_VARS_LIST,
+    CMD_VARS_LIST,
+    CMD_QUERY_GROUPS_LIST,
+    CMD_GROUPS_LIST,
+    CMD_QUERY_GROUP,
+    CMD_GROUP,
+    CMD_QUERY_CURVES_LIST,
+    CMD_CURVES_LIST,
+    CMD_QUERY_CURVE_CSUMS,
+    CMD_CURVE_CSUMS,
+
+    CMD_READ_VAR = 0x10,
+    CMD_VAR_READING,
+    CMD_READ_GROUP,
+    CMD_GROUP_READING,
+
+    CMD_WRITE_VAR = 0x20,
+    CMD_WRITE_GROUP = 0x22,
+
+    CMD_CREATE_GROUP = 0x30,
+    CMD_GROUP_CREATED,
+    CMD_REMOVE_ALL_GROUPS,
+
+    CMD_CURVE_TRANSMIT = 0x40,
+    CMD_CURVE_BLOCK,
+    CMD_CURVE_RECALC_CSUM,
+    CMD_CURVE_TRANSMIT_RANGE,       // ID, first and last block, answered with
+                                    // a CMD_CURVE_BLOCK for each block
+    CMD_CURVE_READ,                 // ID, offset (4 bytes) and length (2
+                                    // bytes), big-endian
+    CMD_CURVE_DATA,                 // The bytes read, padded
+    CMD_QUERY_CURVE_ENVELOPE,       // ID and number of points (2 bytes,
+                                    // big-endian)
+    CMD_CURVE_ENVELOPE,             // Sample type, then the minimum and
+                                    // maximum sample of each point
+    CMD_QUERY_CURVE_STATS,          // ID, first and last block
+    CMD_CURVE_STATS,                // Sample type, minimum and maximum
+                                    // sample, sum of the samples and of their
+                                    // squares (doubles, big-endian)
+
+    CMD_OK = 0xE0,
+    CMD_ERR_MALFORMED_MESSAGE,
+    CMD_ERR_OP_NOT_SUPPORTED,
+    CMD_ERR_INVALID_ID,
+    CMD_ERR_INVALID_VALUE,
+    CMD_ERR_INVALID_PAYLOAD_SIZE,
+    CMD_ERR_READ_ONLY,
+    CMD_ERR_INSUFFICIENT_MEMORY,
+    CMD_ERR_INTERNAL,
+
+    CMD_MAX
+};
+
+/**
+ * Size of a payload, given the size field of a message header. Sizes up to
+ * 127 bytes are encoded as is. Larger ones are encoded as 0x80 | n, meaning
+ * 128*n + 130 bytes.
+ */
+static inline uint16_t sllp_decode_size (uint8_t size)
+{
+    if(size < 0x80)
+        return size;
+
+    size &= 0x7F;
+
+    return 128*size + 130;
+}
+
+/**
+ * Size field of a message header for a payload of the given size. Sizes that
+ * can't be encoded exactly are rounded up to the next encodable one, so
+ * receivers must expect payloads padded with zeros.
+ */
+static inline uint8_t sllp_encode_size (uint16_t size)
+{
+    if(size < 0x80)
+        return size;
+
+    if(size <= 130)
+        return 0x80;
+
+    size -= 130;
+
+    return 0x80 | (size/128 + (size%128 != 0));
+}
+
+/**
+ * Size of a sample of the given type, 0 for opaque bytes or an unknown type.
+ */
+static inline unsigned int sllp_sample_size (uint8_t type)
+{
+    switch(type)
+    {
+    case SLLP_SAMPLE_INT16:
+        return 2;
+
+    case SLLP_SAMPLE_INT32:
+    case SLLP_SAMPLE_FLOAT32:
+        return 4;
+
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Encode a double in SLLP_DOUBLE_SIZE bytes, big-endian.
+ */
+static inline void sllp_encode_double (double value, uint8_t *data)
+{
+    uint64_t bits;
+    int i;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    for(i = SLLP_DOUBLE_SIZE - 1; i >= 0; --i, bits >>= 8)
+        data[i] = bits;
+}
+
+/**
+ * Decode a double encoded by sllp_encode_double.
+ */
+static inline double sllp_decode_double (const uint8_t *data)
+{
+    uint64_t bits = 0;
+    double value;
+    int i;
+
+    for(i = 0; i < SLLP_DOUBLE_SIZE; ++i)
+        bits = bits << 8 | data[i];
+
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+#endif	/* SLLP_PROTOCOL_H */
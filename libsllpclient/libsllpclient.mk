@@ -1 +1,3 @@
-libsllpclient_OBJS_LIB = libsllpclient/sllp_client.o
+libsllpclient_OBJS_LIB = libsllpclient/sllp_client.o \
+	libsllpserver/md5/md5_mb.o
+libsllpclient_LIBS_LIB = -lm
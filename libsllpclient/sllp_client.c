@@ -1,6 +1,1943 @@
 #include "sllp_client.h"
+#include "libsllpserver/md5/md5_mb.h"
 
-void sllp_client_stub()
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define TX_SIZE         (4*SLLP_MAX_MESSAGE)
+#define INFLIGHT_BYTES  (256*1024)  // Requests and answers in flight, so
+                                    // neither direction fills up while the
+                                    // other waits
+#define QUEUE_EVENTS    64          // Events handled per epoll_wait
+
+// What the client knows about the server, queried once and kept until a
+// command that changes it is sent
+struct client_model
+{
+    bool vars_valid, groups_valid, curves_valid;
+
+    unsigned int vars_count;
+    struct sllp_client_var vars[SLLP_MAX_VARIABLES];
+
+    unsigned int groups_count;
+    struct sllp_client_group groups[SLLP_MAX_GROUPS];
+
+    unsigned int curves_count;
+    struct sllp_client_curve curves[SLLP_MAX_CURVES];
+};
+
+// Checksum of a curve as the server computes it, the MD5 of the MD5s of its
+// blocks. Blocks are added in order and hashed in parallel, a batch at a time.
+struct curve_hash
+{
+    const uint8_t *batch[MD5_MB_MAX_LANES];
+    unsigned int batch_count;
+
+    unsigned int count;
+    uint8_t digests[256][SLLP_CURVE_CSUM_SIZE];
+};
+
+struct sllp_client_queue
+{
+    int epfd;
+};
+
+// A request made by an asynchronous call, holding its frame until the window
+// lets it in
+struct client_async
+{
+    struct sllp_client_request req;
+    struct client_async *next;      // In the backlog
+    uint16_t framed;
+    uint8_t frame[];
+};
+
+struct sllp_client
+{
+    sllp_client_send_t send;
+    sllp_client_recv_t recv;
+    void *user;
+    int fd;                         // Socket given to sllp_client_new_fd, or -1
+    bool broken;                    // The connection was lost
+
+    // Completion queue the client is attached to, if any
+    sllp_client_queue_t *queue;
+    bool polling_out;
+
+    // Asynchronous requests waiting for room in the window, oldest first
+    struct client_async *backlog, *backlog_tail;
+
+    struct client_model model;
+
+    // Requests in flight, oldest first
+    struct sllp_client_request *head, *tail;
+    unsigned int inflight;
+    uint32_t inflight_bytes;
+
+    // Requests not sent yet
+    size_t tx_len;
+    uint8_t tx[TX_SIZE];
+
+    // Received bytes not making up a whole answer yet. Room for two answers,
+    // so the rest of one is never short of space.
+    size_t rx_len;
+    uint8_t rx[2*SLLP_MAX_MESSAGE];
+};
+
+// <editor-fold defaultstate="collapsed" desc="Auxiliary functions">
+static enum sllp_err client_queue (sllp_client_t *client,
+                                   struct sllp_client_request *req,
+                                   uint8_t code, const uint8_t *prefix,
+                                   uint16_t prefix_size,
+                                   const uint8_t *payload, uint16_t size,
+                                   uint8_t skip, uint16_t parts);
+static enum sllp_err client_queue_async (sllp_client_t *client, uint8_t code,
+                                         const uint8_t *prefix,
+                                         uint16_t prefix_size,
+                                         const uint8_t *payload, uint16_t size,
+                                         uint8_t expect, uint8_t skip,
+                                         uint16_t answer_max,
+                                         sllp_client_cb_t cb, void *user);
+static bool window_full (sllp_client_t *client, uint32_t cost);
+static uint16_t frame_size (uint16_t payload_size);
+static void frame_encode (uint8_t *frame, uint8_t code, const uint8_t *prefix,
+                          uint16_t prefix_size, const uint8_t *payload,
+                          uint16_t size);
+static void client_track (sllp_client_t *client,
+                          struct sllp_client_request *req, uint8_t code);
+static void client_admit (sllp_client_t *client);
+static void client_pump (sllp_client_t *client);
+static void client_watch (sllp_client_t *client);
+static void client_service (sllp_client_t *client, uint32_t events);
+static enum sllp_err client_call (sllp_client_t *client, uint8_t code,
+                                  const uint8_t *prefix, uint16_t prefix_size,
+                                  const uint8_t *payload, uint16_t size,
+                                  uint8_t answer_code, uint8_t *answer,
+                                  uint16_t answer_max, uint16_t *answer_size);
+static enum sllp_err client_load_vars (sllp_client_t *client);
+static enum sllp_err client_load_groups (sllp_client_t *client);
+static enum sllp_err client_load_curves (sllp_client_t *client);
+static enum sllp_err client_curve_size (sllp_client_t *client, uint8_t id,
+                                        size_t *size);
+static enum sllp_err client_transfer (sllp_client_t *client, uint8_t id,
+                                      unsigned int nblocks, uint8_t *data,
+                                      bool upload, unsigned int window,
+                                      uint8_t *checksum);
+static void curve_read_request (uint8_t *request, uint8_t id,
+                                uint32_t offset, uint16_t len);
+static double sample_value (uint8_t type, const uint8_t *sample);
+static void curve_hash_add (struct curve_hash *hash, const uint8_t *block);
+static void curve_hash_final (struct curve_hash *hash, uint8_t *checksum);
+static enum sllp_err client_receive (sllp_client_t *client);
+static enum sllp_err client_parse (sllp_client_t *client);
+static void client_complete (sllp_client_t *client, struct client_async *async,
+                             uint8_t code, const uint8_t *data, uint16_t size);
+static void client_fail (sllp_client_t *client);
+static enum sllp_err curves_count (sllp_client_t *client, const uint8_t *list,
+                                   uint16_t size, unsigned int *count);
+static int fd_send (void *user, const uint8_t *data, size_t len);
+static ssize_t fd_recv (void *user, uint8_t *data, size_t len);
+// </editor-fold>
+
+sllp_client_t *sllp_client_new (sllp_client_send_t send,
+                                sllp_client_recv_t recv, void *user)
+{
+    if(!send || !recv)
+        return NULL;
+
+    sllp_client_t *client = malloc(sizeof(*client));
+
+    if(!client)
+        return NULL;
+
+    client->send = send;
+    client->recv = recv;
+    client->user = user;
+    client->fd = -1;
+    client->broken = false;
+    client->queue = NULL;
+    client->polling_out = false;
+    client->backlog = client->backlog_tail = NULL;
+    sllp_client_invalidate(client);
+    client->head = client->tail = NULL;
+    client->inflight = 0;
+    client->inflight_bytes = 0;
+    client->tx_len = 0;
+    client->rx_len = 0;
+
+    return client;
+}
+
+sllp_client_t *sllp_client_new_fd (int fd)
+{
+    if(fd < 0)
+        return NULL;
+
+    sllp_client_t *client = sllp_client_new(fd_send, fd_recv,
+                                            (void *) (intptr_t) fd);
+    if(client)
+        client->fd = fd;
+
+    return client;
+}
+
+enum sllp_err sllp_client_destroy (sllp_client_t *client)
+{
+    if(!client)
+        return SLLP_ERR_PARAM_INVALID;
+
+    // Asynchronous requests are completed, detaching the client
+    client_fail(client);
+    free(client);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_submit (sllp_client_t *client,
+                                  struct sllp_client_request *req,
+                                  uint8_t code, const uint8_t *payload,
+                                  uint16_t size)
+{
+    return client_queue(client, req, code, NULL, 0, payload, size, 0, 1);
+}
+
+enum sllp_err sllp_client_flush (sllp_client_t *client)
+{
+    if(!client)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(client->broken)
+        return SLLP_ERR_COMM;
+
+    if(client->tx_len && client->send(client->user, client->tx,
+                                      client->tx_len))
+    {
+        client_fail(client);
+        return SLLP_ERR_COMM;
+    }
+
+    client->tx_len = 0;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_wait (sllp_client_t *client,
+                                struct sllp_client_request *req)
+{
+    if(!client || !req)
+        return SLLP_ERR_PARAM_INVALID;
+
+    while(!req->done && client->head)
+        if(client_receive(client))
+            break;
+
+    // Not a request of this client
+    if(!req->done)
+        return SLLP_ERR_PARAM_INVALID;
+
+    return req->err;
+}
+
+enum sllp_err sllp_client_query_status (sllp_client_t *client,
+                                        uint8_t *status, uint16_t *size)
+{
+    if(!status || !size)
+        return SLLP_ERR_PARAM_INVALID;
+
+    return client_call(client, CMD_QUERY_STATUS, NULL, 0, NULL, 0, CMD_STATUS,
+                       status, *size, size);
+}
+
+enum sllp_err sllp_client_get_vars (sllp_client_t *client,
+                                    struct sllp_client_var *vars,
+                                    unsigned int *count)
+{
+    if(!client || !vars || !count)
+        return SLLP_ERR_PARAM_INVALID;
+
+    enum sllp_err err = client_load_vars(client);
+    if(err)
+        return err;
+
+    memcpy(vars, client->model.vars, client->model.vars_count*sizeof(*vars));
+    *count = client->model.vars_count;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_get_groups (sllp_client_t *client,
+                                      struct sllp_client_group *groups,
+                                      unsigned int *count)
+{
+    if(!client || !groups || !count)
+        return SLLP_ERR_PARAM_INVALID;
+
+    enum sllp_err err = client_load_groups(client);
+    if(err)
+        return err;
+
+    memcpy(groups, client->model.groups,
+           client->model.groups_count*sizeof(*groups));
+    *count = client->model.groups_count;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_get_group (sllp_client_t *client, uint8_t id,
+                                     struct sllp_client_group *group)
+{
+    if(!client || !group)
+        return SLLP_ERR_PARAM_INVALID;
+
+    enum sllp_err err = client_load_groups(client);
+    if(err)
+        return err;
+
+    if(id >= client->model.groups_count)
+        return SLLP_ERR_REFUSED;
+
+    *group = client->model.groups[id];
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_get_curves (sllp_client_t *client,
+                                      struct sllp_client_curve *curves,
+                                      unsigned int *count)
+{
+    if(!client || !curves || !count)
+        return SLLP_ERR_PARAM_INVALID;
+
+    enum sllp_err err = client_load_curves(client);
+    if(err)
+        return err;
+
+    memcpy(curves, client->model.curves,
+           client->model.curves_count*sizeof(*curves));
+    *count = client->model.curves_count;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_invalidate (sllp_client_t *client)
+{
+    if(!client)
+        return SLLP_ERR_PARAM_INVALID;
+
+    client->model.vars_valid = false;
+    client->model.groups_valid = false;
+    client->model.curves_valid = false;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_get_curve_csums (sllp_client_t *client, uint8_t id,
+                                     uint8_t (*digests)[SLLP_CURVE_CSUM_SIZE],
+                                     unsigned int *count)
+{
+    if(!digests || !count)
+        return SLLP_ERR_PARAM_INVALID;
+
+    // The answer may be padded, so the blocks are counted from the list
+    enum sllp_err err = client_load_curves(client);
+    if(err)
+        return err;
+
+    if(id >= client->model.curves_count)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    unsigned int nblocks = client->model.curves[id].nblocks + 1;
+    uint8_t answer[1 + 256*SLLP_CURVE_CSUM_SIZE + 128];
+    uint16_t size;
+
+    err = client_call(client, CMD_QUERY_CURVE_CSUMS, &id, 1, NULL, 0,
+                      CMD_CURVE_CSUMS, answer, sizeof(answer), &size);
+    if(err)
+        return err;
+
+    if(size < 1 + nblocks*SLLP_CURVE_CSUM_SIZE || answer[0] != id)
+        return SLLP_ERR_REFUSED;
+
+    *count = nblocks;
+    memcpy(digests, answer + 1, nblocks*SLLP_CURVE_CSUM_SIZE);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_read_var (sllp_client_t *client, uint8_t id,
+                                    uint8_t *value, uint8_t *size)
+{
+    if(!value)
+        return SLLP_ERR_PARAM_INVALID;
+
+    uint16_t answer_size;
+
+    enum sllp_err err = client_call(client, CMD_READ_VAR, &id, 1, NULL, 0,
+                                    CMD_VAR_READING, value, SLLP_MAX_VAR_SIZE,
+                                    &answer_size);
+    if(!err && size)
+        *size = answer_size;
+
+    return err;
+}
+
+enum sllp_err sllp_client_read_vars (sllp_client_t *client,
+                                     const uint8_t *ids, uint8_t **values,
+                                     uint8_t *sizes, unsigned int count)
+{
+    if(!client || !ids || !values)
+        return SLLP_ERR_PARAM_INVALID;
+
+    // Keep the window full: each read waited on makes room for the next one
+    struct sllp_client_request reqs[SLLP_CLIENT_WINDOW];
+    enum sllp_err err = SLLP_SUCCESS;
+
+    unsigned int i;
+    for(i = 0; i < count + SLLP_CLIENT_WINDOW; ++i)
+    {
+        struct sllp_client_request *req = &reqs[i % SLLP_CLIENT_WINDOW];
+
+        if(i >= SLLP_CLIENT_WINDOW && i - SLLP_CLIENT_WINDOW < count)
+        {
+            unsigned int done = i - SLLP_CLIENT_WINDOW;
+            enum sllp_err req_err = sllp_client_wait(client, req);
+
+            if(!req_err && req->code != CMD_VAR_READING)
+                req_err = SLLP_ERR_REFUSED;
+
+            if(!req_err && sizes)
+                sizes[done] = req->size;
+
+            err = err ? err : req_err;
+        }
+
+        if(i < count)
+        {
+            req->answer = values[i];
+            req->answer_max = SLLP_MAX_VAR_SIZE;
+
+            enum sllp_err req_err = sllp_client_submit(client, req,
+                                                       CMD_READ_VAR, &ids[i],
+                                                       1);
+            // Nothing is left in flight if it failed
+            if(req_err)
+                return req_err;
+        }
+    }
+
+    return err;
+}
+
+enum sllp_err sllp_client_read_group (sllp_client_t *client, uint8_t id,
+                                      uint8_t *data, uint16_t *size)
+{
+    if(!data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    uint16_t answer_size;
+
+    enum sllp_err err = client_call(client, CMD_READ_GROUP, &id, 1, NULL, 0,
+                                    CMD_GROUP_READING, data,
+                                    SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE,
+                                    &answer_size);
+    if(!err && size)
+        *size = answer_size;
+
+    return err;
+}
+
+enum sllp_err sllp_client_group_values (sllp_client_t *client, uint8_t id,
+                                        const uint8_t *data, uint16_t size,
+                                        struct sllp_client_value *values,
+                                        unsigned int *count)
+{
+    if(!client || !data || !values || !count)
+        return SLLP_ERR_PARAM_INVALID;
+
+    enum sllp_err err = client_load_groups(client);
+    if(err)
+        return err;
+
+    const struct client_model *model = &client->model;
+
+    if(id >= model->groups_count)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    const struct sllp_client_group *group = &model->groups[id];
+
+    if(size < group->data_size)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    // Values follow each other in the order of the group's variables
+    unsigned int i;
+    for(i = 0; i < group->vars_count; ++i)
+    {
+        const struct sllp_client_var *var = &model->vars[group->vars[i]];
+
+        values[i].id = var->id;
+        values[i].size = var->size;
+        values[i].data = data;
+        data += var->size;
+    }
+
+    *count = group->vars_count;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_read_group_values (sllp_client_t *client,
+                                             uint8_t id, uint8_t *data,
+                                             struct sllp_client_value *values,
+                                             unsigned int *count)
+{
+    uint16_t size;
+
+    enum sllp_err err = sllp_client_read_group(client, id, data, &size);
+    if(err)
+        return err;
+
+    return sllp_client_group_values(client, id, data, size, values, count);
+}
+
+enum sllp_err sllp_client_write_var (sllp_client_t *client, uint8_t id,
+                                     const uint8_t *value, uint8_t size)
+{
+    if(!value)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!size || size > SLLP_MAX_VAR_SIZE)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    return client_call(client, CMD_WRITE_VAR, &id, 1, value, size, CMD_OK,
+                       NULL, 0, NULL);
+}
+
+enum sllp_err sllp_client_write_group (sllp_client_t *client, uint8_t id,
+                                       const uint8_t *data, uint16_t size)
+{
+    if(!data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!size || size > SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE - 1)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    return client_call(client, CMD_WRITE_GROUP, &id, 1, data, size, CMD_OK,
+                       NULL, 0, NULL);
+}
+
+enum sllp_err sllp_client_create_group (sllp_client_t *client,
+                                        const uint8_t *ids, unsigned int count,
+                                        uint8_t *id)
+{
+    if(!ids)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!count || count > SLLP_MAX_VARIABLES)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    uint8_t answer;
+
+    enum sllp_err err = client_call(client, CMD_CREATE_GROUP, NULL, 0, ids,
+                                    count, CMD_GROUP_CREATED, &answer, 1,
+                                    NULL);
+    if(!err && id)
+        *id = answer & ~SLLP_WRITABLE;
+
+    return err;
+}
+
+enum sllp_err sllp_client_remove_all_groups (sllp_client_t *client)
+{
+    return client_call(client, CMD_REMOVE_ALL_GROUPS, NULL, 0, NULL, 0,
+                       CMD_OK, NULL, 0, NULL);
+}
+
+enum sllp_err sllp_client_read_curve_block (sllp_client_t *client, uint8_t id,
+                                            uint8_t block, uint8_t *data)
+{
+    if(!data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    uint8_t request[2] = {id, block};
+    uint8_t answer[2 + SLLP_CURVE_BLOCK_SIZE];
+    uint16_t size;
+
+    enum sllp_err err = client_call(client, CMD_CURVE_TRANSMIT, request,
+                                    sizeof(request), NULL, 0, CMD_CURVE_BLOCK,
+                                    answer, sizeof(answer), &size);
+    if(err)
+        return err;
+
+    if(size != sizeof(answer) || answer[0] != id || answer[1] != block)
+        return SLLP_ERR_REFUSED;
+
+    memcpy(data, answer + 2, SLLP_CURVE_BLOCK_SIZE);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_read_curve_range (sllp_client_t *client, uint8_t id,
+                                            uint8_t first, uint8_t last,
+                                            uint8_t *data)
+{
+    if(!client || !data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(first > last)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    struct sllp_client_request req;
+    uint8_t request[3] = {id, first, last};
+    uint16_t count = last - first + 1;
+
+    // Each answer starts with the ID and the index of its block
+    req.answer = data;
+    req.answer_max = count*SLLP_CURVE_BLOCK_SIZE;
+
+    enum sllp_err err = client_queue(client, &req, CMD_CURVE_TRANSMIT_RANGE,
+                                     request, sizeof(request), NULL, 0, 2,
+                                     count);
+    if(err)
+        return err;
+
+    err = sllp_client_wait(client, &req);
+    if(err)
+        return err;
+
+    if(req.code != CMD_CURVE_BLOCK || req.size != req.answer_max)
+        return SLLP_ERR_REFUSED;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_read_curve_data (sllp_client_t *client, uint8_t id,
+                                           uint32_t offset, uint16_t len,
+                                           uint8_t *data)
+{
+    if(!data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!len || len > SLLP_CURVE_BLOCK_SIZE)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    uint8_t request[7];
+    uint8_t answer[SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE];
+    uint16_t size;
+
+    curve_read_request(request, id, offset, len);
+
+    // The answer is padded to its encoded size
+    enum sllp_err err = client_call(client, CMD_CURVE_READ, request,
+                                    sizeof(request), NULL, 0, CMD_CURVE_DATA,
+                                    answer, sizeof(answer), &size);
+    if(err)
+        return err;
+
+    if(size < len)
+        return SLLP_ERR_REFUSED;
+
+    memcpy(data, answer, len);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_read_curve_envelope (sllp_client_t *client,
+                                               uint8_t id, uint16_t points,
+                                               uint8_t *type, uint8_t *data)
+{
+    if(!type || !data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!points)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    uint8_t request[3] = {id, points >> 8, points};
+    uint8_t answer[SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE];
+    uint16_t size;
+
+    enum sllp_err err = client_call(client, CMD_QUERY_CURVE_ENVELOPE, request,
+                                    sizeof(request), NULL, 0,
+                                    CMD_CURVE_ENVELOPE, answer,
+                                    sizeof(answer), &size);
+    if(err)
+        return err;
+
+    unsigned int pair = 2*sllp_sample_size(answer[0]);
+
+    if(!pair || size < 1 + points*pair)
+        return SLLP_ERR_REFUSED;
+
+    *type = answer[0];
+    memcpy(data, answer + 1, points*pair);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_read_curve_stats (sllp_client_t *client, uint8_t id,
+                                            uint8_t first, uint8_t last,
+                                            struct sllp_client_stats *stats)
+{
+    if(!stats)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(first > last)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    uint8_t request[3] = {id, first, last};
+    uint8_t answer[1 + 2*4 + 2*SLLP_DOUBLE_SIZE];
+    uint16_t size;
+
+    enum sllp_err err = client_call(client, CMD_QUERY_CURVE_STATS, request,
+                                    sizeof(request), NULL, 0, CMD_CURVE_STATS,
+                                    answer, sizeof(answer), &size);
+    if(err)
+        return err;
+
+    unsigned int sample = sllp_sample_size(answer[0]);
+
+    if(!sample || size != 1 + 2*sample + 2*SLLP_DOUBLE_SIZE)
+        return SLLP_ERR_REFUSED;
+
+    double sum = sllp_decode_double(answer + 1 + 2*sample);
+    double squares = sllp_decode_double(answer + 1 + 2*sample +
+                                        SLLP_DOUBLE_SIZE);
+
+    stats->type = answer[0];
+    stats->count = (last - first + 1)*(SLLP_CURVE_BLOCK_SIZE/sample);
+    stats->min = sample_value(answer[0], answer + 1);
+    stats->max = sample_value(answer[0], answer + 1 + sample);
+    stats->mean = sum/stats->count;
+    stats->rms = sqrt(squares/stats->count);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_write_curve_block (sllp_client_t *client,
+                                             uint8_t id, uint8_t block,
+                                             const uint8_t *data)
+{
+    if(!data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    uint8_t prefix[2] = {id, block};
+
+    return client_call(client, CMD_CURVE_BLOCK, prefix, sizeof(prefix), data,
+                       SLLP_CURVE_BLOCK_SIZE, CMD_OK, NULL, 0, NULL);
+}
+
+enum sllp_err sllp_client_recalc_csum (sllp_client_t *client, uint8_t id)
+{
+    return client_call(client, CMD_CURVE_RECALC_CSUM, &id, 1, NULL, 0, CMD_OK,
+                       NULL, 0, NULL);
+}
+
+enum sllp_err sllp_client_download_curve (sllp_client_t *client, uint8_t id,
+                                          uint8_t *data, unsigned int window,
+                                          uint8_t *checksum)
+{
+    if(!client || !data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    size_t size;
+    uint8_t received[SLLP_CURVE_CSUM_SIZE];
+
+    enum sllp_err err = client_curve_size(client, id, &size);
+    if(err)
+        return err;
+
+    err = client_transfer(client, id, size/SLLP_CURVE_BLOCK_SIZE, data, false,
+                          window, received);
+    if(err)
+        return err;
+
+    if(checksum)
+        memcpy(checksum, received, SLLP_CURVE_CSUM_SIZE);
+
+    // The cached list may be older than the blocks
+    if(memcmp(client->model.curves[id].checksum, received,
+              SLLP_CURVE_CSUM_SIZE))
+    {
+        client->model.curves_valid = false;
+
+        err = client_load_curves(client);
+        if(err)
+            return err;
+
+        if(id >= client->model.curves_count ||
+           memcmp(client->model.curves[id].checksum, received,
+                  SLLP_CURVE_CSUM_SIZE))
+            return SLLP_ERR_CHECKSUM;
+    }
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_upload_curve (sllp_client_t *client, uint8_t id,
+                                        const uint8_t *data,
+                                        unsigned int window,
+                                        uint8_t *checksum)
+{
+    if(!client || !data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    size_t size;
+    uint8_t sent[SLLP_CURVE_CSUM_SIZE];
+
+    enum sllp_err err = client_curve_size(client, id, &size);
+    if(err)
+        return err;
+
+    // Only read when uploading
+    err = client_transfer(client, id, size/SLLP_CURVE_BLOCK_SIZE,
+                          (uint8_t *) data, true, window, sent);
+    if(err)
+        return err;
+
+    if(checksum)
+        memcpy(checksum, sent, SLLP_CURVE_CSUM_SIZE);
+
+    // Drops the cached list, which is queried again
+    err = sllp_client_recalc_csum(client, id);
+    if(err)
+        return err;
+
+    err = client_load_curves(client);
+    if(err)
+        return err;
+
+    if(id >= client->model.curves_count ||
+       memcmp(client->model.curves[id].checksum, sent, SLLP_CURVE_CSUM_SIZE))
+        return SLLP_ERR_CHECKSUM;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_download_curve_file (sllp_client_t *client,
+                                               uint8_t id, const char *path,
+                                               unsigned int window,
+                                               uint8_t *checksum)
+{
+    if(!client || !path)
+        return SLLP_ERR_PARAM_INVALID;
+
+    size_t size;
+
+    enum sllp_err err = client_curve_size(client, id, &size);
+    if(err)
+        return err;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if(fd < 0)
+        return SLLP_ERR_COMM;
+
+    uint8_t *map = MAP_FAILED;
+
+    if(!ftruncate(fd, size))
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if(map == MAP_FAILED)
+    {
+        close(fd);
+        return SLLP_ERR_COMM;
+    }
+
+    err = sllp_client_download_curve(client, id, map, window, checksum);
+
+    // The data is written back even if it doesn't match the checksum
+    if(munmap(map, size) || close(fd))
+        err = err ? err : SLLP_ERR_COMM;
+
+    return err;
+}
+
+enum sllp_err sllp_client_upload_curve_file (sllp_client_t *client,
+                                             uint8_t id, const char *path,
+                                             unsigned int window,
+                                             uint8_t *checksum)
+{
+    if(!client || !path)
+        return SLLP_ERR_PARAM_INVALID;
+
+    size_t size;
+
+    enum sllp_err err = client_curve_size(client, id, &size);
+    if(err)
+        return err;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0)
+        return SLLP_ERR_COMM;
+
+    struct stat st;
+
+    if(fstat(fd, &st))
+    {
+        close(fd);
+        return SLLP_ERR_COMM;
+    }
+
+    if((size_t) st.st_size != size)
+    {
+        close(fd);
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+    }
+
+    uint8_t *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if(map == MAP_FAILED)
+        return SLLP_ERR_COMM;
+
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    err = sllp_client_upload_curve(client, id, map, window, checksum);
+
+    munmap(map, size);
+
+    return err;
+}
+
+sllp_client_queue_t *sllp_client_queue_new (void)
+{
+    sllp_client_queue_t *queue = malloc(sizeof(*queue));
+
+    if(!queue)
+        return NULL;
+
+    queue->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if(queue->epfd < 0)
+    {
+        free(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+enum sllp_err sllp_client_queue_destroy (sllp_client_queue_t *queue)
+{
+    if(!queue)
+        return SLLP_ERR_PARAM_INVALID;
+
+    close(queue->epfd);
+    free(queue);
+
+    return SLLP_SUCCESS;
+}
+
+int sllp_client_queue_fd (sllp_client_queue_t *queue)
+{
+    return queue ? queue->epfd : -1;
+}
+
+enum sllp_err sllp_client_queue_process (sllp_client_queue_t *queue,
+                                         int timeout)
+{
+    if(!queue)
+        return SLLP_ERR_PARAM_INVALID;
+
+    struct epoll_event events[QUEUE_EVENTS];
+
+    int n = epoll_wait(queue->epfd, events, QUEUE_EVENTS, timeout);
+
+    if(n < 0)
+        return errno == EINTR ? SLLP_SUCCESS : SLLP_ERR_COMM;
+
+    int i;
+    for(i = 0; i < n; ++i)
+        client_service(events[i].data.ptr, events[i].events);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_attach (sllp_client_t *client,
+                                  sllp_client_queue_t *queue)
+{
+    if(!client || !queue || client->fd < 0 || client->queue)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(client->broken)
+        return SLLP_ERR_COMM;
+
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = client,
+    };
+
+    if(epoll_ctl(queue->epfd, EPOLL_CTL_ADD, client->fd, &event))
+        return SLLP_ERR_COMM;
+
+    client->queue = queue;
+    client->polling_out = false;
+
+    // Sends still pending
+    client_pump(client);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_client_submit_async (sllp_client_t *client, uint8_t code,
+                                        const uint8_t *payload, uint16_t size,
+                                        sllp_client_cb_t cb, void *user)
+{
+    return client_queue_async(client, code, NULL, 0, payload, size, 0, 0,
+                              SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE, cb, user);
+}
+
+enum sllp_err sllp_client_read_var_async (sllp_client_t *client, uint8_t id,
+                                          sllp_client_cb_t cb, void *user)
+{
+    return client_queue_async(client, CMD_READ_VAR, &id, 1, NULL, 0,
+                              CMD_VAR_READING, 0, SLLP_MAX_VAR_SIZE, cb, user);
+}
+
+enum sllp_err sllp_client_read_group_async (sllp_client_t *client, uint8_t id,
+                                            sllp_client_cb_t cb, void *user)
+{
+    uint16_t answer_max = SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE;
+
+    // The size of the reading is known if the group is
+    if(client && client->model.groups_valid &&
+       id < client->model.groups_count)
+        answer_max = frame_size(client->model.groups[id].data_size) -
+                     SLLP_HEADER_SIZE;
+
+    return client_queue_async(client, CMD_READ_GROUP, &id, 1, NULL, 0,
+                              CMD_GROUP_READING, 0, answer_max, cb, user);
+}
+
+enum sllp_err sllp_client_write_var_async (sllp_client_t *client, uint8_t id,
+                                           const uint8_t *value, uint8_t size,
+                                           sllp_client_cb_t cb, void *user)
+{
+    if(!value)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!size || size > SLLP_MAX_VAR_SIZE)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    return client_queue_async(client, CMD_WRITE_VAR, &id, 1, value, size,
+                              CMD_OK, 0, 0, cb, user);
+}
+
+enum sllp_err sllp_client_write_group_async (sllp_client_t *client,
+                                             uint8_t id, const uint8_t *data,
+                                             uint16_t size,
+                                             sllp_client_cb_t cb, void *user)
+{
+    if(!data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!size || size > SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE - 1)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    return client_queue_async(client, CMD_WRITE_GROUP, &id, 1, data, size,
+                              CMD_OK, 0, 0, cb, user);
+}
+
+enum sllp_err sllp_client_read_curve_block_async (sllp_client_t *client,
+                                                  uint8_t id, uint8_t block,
+                                                  sllp_client_cb_t cb,
+                                                  void *user)
+{
+    uint8_t request[2] = {id, block};
+
+    return client_queue_async(client, CMD_CURVE_TRANSMIT, request,
+                              sizeof(request), NULL, 0, CMD_CURVE_BLOCK, 2,
+                              2 + SLLP_CURVE_BLOCK_SIZE, cb, user);
+}
+
+enum sllp_err sllp_client_read_curve_data_async (sllp_client_t *client,
+                                                 uint8_t id, uint32_t offset,
+                                                 uint16_t len,
+                                                 sllp_client_cb_t cb,
+                                                 void *user)
+{
+    if(!len || len > SLLP_CURVE_BLOCK_SIZE)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    uint8_t request[7];
+
+    curve_read_request(request, id, offset, len);
+
+    return client_queue_async(client, CMD_CURVE_READ, request,
+                              sizeof(request), NULL, 0, CMD_CURVE_DATA, 0,
+                              frame_size(len) - SLLP_HEADER_SIZE, cb, user);
+}
+
+enum sllp_err sllp_client_write_curve_block_async (sllp_client_t *client,
+                                                   uint8_t id, uint8_t block,
+                                                   const uint8_t *data,
+                                                   sllp_client_cb_t cb,
+                                                   void *user)
+{
+    if(!data)
+        return SLLP_ERR_PARAM_INVALID;
+
+    uint8_t prefix[2] = {id, block};
+
+    return client_queue_async(client, CMD_CURVE_BLOCK, prefix, sizeof(prefix),
+                              data, SLLP_CURVE_BLOCK_SIZE, CMD_OK, 0, 0, cb,
+                              user);
+}
+
+// Queue a request whose payload is prefix followed by payload, padded to its
+// encoded size. It's answered with parts messages, unless refused, and the
+// first skip bytes of each aren't stored.
+static enum sllp_err client_queue (sllp_client_t *client,
+                                   struct sllp_client_request *req,
+                                   uint8_t code, const uint8_t *prefix,
+                                   uint16_t prefix_size,
+                                   const uint8_t *payload, uint16_t size,
+                                   uint8_t skip, uint16_t parts)
+{
+    if(!client || !req || (size && !payload))
+        return SLLP_ERR_PARAM_INVALID;
+
+    uint32_t total = prefix_size + size;
+
+    if(total > SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    if(client->broken)
+        return SLLP_ERR_COMM;
+
+    uint16_t framed = frame_size(total);
+
+    req->async = false;
+    req->skip = skip;
+    req->parts = parts;
+    req->cost = framed + parts*(SLLP_HEADER_SIZE + skip) + req->answer_max;
+
+    // Asynchronous requests made before go first. Make room by receiving the
+    // oldest answers.
+    while(client->backlog || window_full(client, req->cost))
+    {
+        client_admit(client);
+
+        if(client->backlog || window_full(client, req->cost))
+            if(client_receive(client))
+                return SLLP_ERR_COMM;
+    }
+
+    if(client->tx_len + framed > TX_SIZE && sllp_client_flush(client))
+        return SLLP_ERR_COMM;
+
+    frame_encode(client->tx + client->tx_len, code, prefix, prefix_size,
+                 payload, size);
+    client->tx_len += framed;
+
+    client_track(client, req, code);
+
+    return SLLP_SUCCESS;
+}
+
+// Queue an asynchronous request, to be sent as soon as the window lets it
+static enum sllp_err client_queue_async (sllp_client_t *client, uint8_t code,
+                                         const uint8_t *prefix,
+                                         uint16_t prefix_size,
+                                         const uint8_t *payload, uint16_t size,
+                                         uint8_t expect, uint8_t skip,
+                                         uint16_t answer_max,
+                                         sllp_client_cb_t cb, void *user)
+{
+    if(!client || !client->queue || (size && !payload))
+        return SLLP_ERR_PARAM_INVALID;
+
+    uint32_t total = prefix_size + size;
+
+    if(total > SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    if(client->broken)
+        return SLLP_ERR_COMM;
+
+    uint16_t framed = frame_size(total);
+    struct client_async *async = malloc(sizeof(*async) + framed);
+
+    if(!async)
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    frame_encode(async->frame, code, prefix, prefix_size, payload, size);
+    async->framed = framed;
+    async->next = NULL;
+
+    async->req.async = true;
+    async->req.cost = framed + SLLP_HEADER_SIZE + answer_max;
+    async->req.cb = cb;
+    async->req.cb_user = user;
+    async->req.expect = expect;
+    async->req.skip = skip;
+
+    if(client->backlog_tail)
+        client->backlog_tail->next = async;
+    else
+        client->backlog = async;
+    client->backlog_tail = async;
+
+    // Sent by the next pass of the queue, along with whatever else is
+    // queued by then
+    client_admit(client);
+    client_watch(client);
+
+    return SLLP_SUCCESS;
+}
+
+// Whether a request of the given cost has to wait for answers to be sent
+static bool window_full (sllp_client_t *client, uint32_t cost)
+{
+    return client->head && (client->inflight == SLLP_CLIENT_WINDOW ||
+                            client->inflight_bytes + cost > INFLIGHT_BYTES);
+}
+
+static uint16_t frame_size (uint16_t payload_size)
+{
+    return SLLP_HEADER_SIZE + sllp_decode_size(sllp_encode_size(payload_size));
+}
+
+static void frame_encode (uint8_t *frame, uint8_t code, const uint8_t *prefix,
+                          uint16_t prefix_size, const uint8_t *payload,
+                          uint16_t size)
+{
+    uint16_t total = prefix_size + size;
+    uint16_t framed = frame_size(total);
+
+    frame[0] = code;
+    frame[1] = sllp_encode_size(total);
+    if(prefix_size)
+        memcpy(frame + SLLP_HEADER_SIZE, prefix, prefix_size);
+    if(size)
+        memcpy(frame + SLLP_HEADER_SIZE + prefix_size, payload, size);
+    memset(frame + SLLP_HEADER_SIZE + total, 0,
+           framed - SLLP_HEADER_SIZE - total);
+}
+
+// Put a request whose frame is in tx in flight
+static void client_track (sllp_client_t *client,
+                          struct sllp_client_request *req, uint8_t code)
+{
+    req->done = false;
+    req->err = SLLP_SUCCESS;
+    req->code = 0;
+    req->size = 0;
+    req->next = NULL;
+
+    if(client->tail)
+        client->tail->next = req;
+    else
+        client->head = req;
+    client->tail = req;
+
+    ++client->inflight;
+    client->inflight_bytes += req->cost;
+
+    // The model is queried again after the request, if needed
+    switch(code)
+    {
+    case CMD_CREATE_GROUP:
+    case CMD_REMOVE_ALL_GROUPS:
+        client->model.groups_valid = false;
+        break;
+
+    case CMD_QUERY_CURVE_CSUMS:
+    case CMD_CURVE_RECALC_CSUM:
+        client->model.curves_valid = false;
+        break;
+    }
+}
+
+// Move asynchronous requests from the backlog to tx, as far as the window
+// and tx let them
+static void client_admit (sllp_client_t *client)
+{
+    struct client_async *async;
+
+    while((async = client->backlog))
+    {
+        if(window_full(client, async->req.cost) ||
+           client->tx_len + async->framed > TX_SIZE)
+            break;
+
+        memcpy(client->tx + client->tx_len, async->frame, async->framed);
+        client->tx_len += async->framed;
+
+        client->backlog = async->next;
+        if(!client->backlog)
+            client->backlog_tail = NULL;
+
+        client_track(client, &async->req, async->frame[0]);
+    }
+}
+
+// Send as much as the socket takes without blocking, admitting requests
+// from the backlog as tx drains
+static void client_pump (sllp_client_t *client)
+{
+    while(!client->broken)
+    {
+        client_admit(client);
+
+        if(!client->tx_len)
+            break;
+
+        ssize_t n = send(client->fd, client->tx, client->tx_len,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if(n < 0 && errno == EINTR)
+            continue;
+
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        if(n <= 0)
+        {
+            client_fail(client);
+            return;
+        }
+
+        client->tx_len -= n;
+        memmove(client->tx, client->tx + n, client->tx_len);
+    }
+
+    client_watch(client);
+}
+
+// Wait for the socket to take more data only while there's some to send. The
+// backlog waits for answers instead.
+static void client_watch (sllp_client_t *client)
+{
+    bool out = client->tx_len;
+
+    if(!client->queue || client->broken || out == client->polling_out)
+        return;
+
+    struct epoll_event event = {
+        .events = EPOLLIN | (out ? EPOLLOUT : 0),
+        .data.ptr = client,
+    };
+
+    epoll_ctl(client->queue->epfd, EPOLL_CTL_MOD, client->fd, &event);
+    client->polling_out = out;
+}
+
+// Handle the readiness of the socket of an attached client
+static void client_service (sllp_client_t *client, uint32_t events)
+{
+    if(events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+    {
+        while(!client->broken)
+        {
+            size_t space = sizeof(client->rx) - client->rx_len;
+            ssize_t n = recv(client->fd, client->rx + client->rx_len, space,
+                             MSG_DONTWAIT);
+
+            if(n < 0 && errno == EINTR)
+                continue;
+
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+
+            if(n <= 0)
+            {
+                client_fail(client);
+                return;
+            }
+
+            client->rx_len += n;
+
+            if(client_parse(client))
+                return;
+
+            // Drained. The queue is level triggered, anything arriving
+            // later shows up in the next pass.
+            if(n < space)
+                break;
+        }
+    }
+
+    client_pump(client);
+}
+
+// Send a request and wait for its answer, which must have the given code
+static enum sllp_err client_call (sllp_client_t *client, uint8_t code,
+                                  const uint8_t *prefix, uint16_t prefix_size,
+                                  const uint8_t *payload, uint16_t size,
+                                  uint8_t answer_code, uint8_t *answer,
+                                  uint16_t answer_max, uint16_t *answer_size)
+{
+    struct sllp_client_request req;
+
+    req.answer = answer;
+    req.answer_max = answer_max;
+
+    enum sllp_err err = client_queue(client, &req, code, prefix, prefix_size,
+                                     payload, size, 0, 1);
+    if(err)
+        return err;
+
+    err = sllp_client_wait(client, &req);
+    if(err)
+        return err;
+
+    if(req.code != answer_code)
+        return SLLP_ERR_REFUSED;
+
+    if(answer_size)
+        *answer_size = req.size;
+
+    return SLLP_SUCCESS;
+}
+
+// Query the variables list, unless it's cached
+static enum sllp_err client_load_vars (sllp_client_t *client)
+{
+    struct client_model *model = &client->model;
+
+    if(model->vars_valid)
+        return SLLP_SUCCESS;
+
+    uint8_t list[SLLP_MAX_VARIABLES + 2];
+    uint16_t size;
+
+    enum sllp_err err = client_call(client, CMD_QUERY_VARS_LIST, NULL, 0,
+                                    NULL, 0, CMD_VARS_LIST, list, sizeof(list),
+                                    &size);
+    if(err)
+        return err;
+
+    // A full list is padded
+    model->vars_count = size > SLLP_MAX_VARIABLES ? SLLP_MAX_VARIABLES : size;
+
+    unsigned int i;
+    for(i = 0; i < model->vars_count; ++i)
+    {
+        model->vars[i].id = i;
+        model->vars[i].writable = list[i] & SLLP_WRITABLE;
+        model->vars[i].size = list[i] & ~SLLP_WRITABLE;
+    }
+
+    model->vars_valid = true;
+
+    return SLLP_SUCCESS;
+}
+
+// Query the groups list and the variables of every group, unless they're
+// cached
+static enum sllp_err client_load_groups (sllp_client_t *client)
+{
+    struct client_model *model = &client->model;
+
+    if(model->groups_valid)
+        return SLLP_SUCCESS;
+
+    // Data sizes come from the variables
+    enum sllp_err err = client_load_vars(client);
+    if(err)
+        return err;
+
+    uint8_t list[SLLP_MAX_GROUPS + 2];
+    uint16_t size;
+
+    err = client_call(client, CMD_QUERY_GROUPS_LIST, NULL, 0, NULL, 0,
+                      CMD_GROUPS_LIST, list, sizeof(list), &size);
+    if(err)
+        return err;
+
+    unsigned int n = size > SLLP_MAX_GROUPS ? SLLP_MAX_GROUPS : size;
+
+    // Query the variables of every group in a single round trip
+    struct sllp_client_request reqs[SLLP_MAX_GROUPS];
+    uint8_t answers[SLLP_MAX_GROUPS][SLLP_MAX_VARIABLES + 2];
+
+    unsigned int i;
+    for(i = 0; i < n; ++i)
+    {
+        struct sllp_client_group *group = &model->groups[i];
+        uint8_t id = i;
+
+        group->id = id;
+        group->writable = list[i] & SLLP_WRITABLE;
+        group->vars_count = list[i] & ~SLLP_WRITABLE;
+
+        reqs[i].answer = answers[i];
+        reqs[i].answer_max = sizeof(answers[i]);
+
+        // A failed submission leaves nothing in flight
+        err = sllp_client_submit(client, &reqs[i], CMD_QUERY_GROUP, &id, 1);
+        if(err)
+            return err;
+    }
+
+    for(i = 0; i < n; ++i)
+    {
+        struct sllp_client_group *group = &model->groups[i];
+        enum sllp_err req_err = sllp_client_wait(client, &reqs[i]);
+
+        if(!req_err && (reqs[i].code != CMD_GROUP ||
+                        reqs[i].size < group->vars_count))
+            req_err = SLLP_ERR_REFUSED;
+
+        if(req_err)
+        {
+            err = err ? err : req_err;
+            continue;
+        }
+
+        memcpy(group->vars, answers[i], group->vars_count);
+
+        group->data_size = 0;
+
+        unsigned int j;
+        for(j = 0; j < group->vars_count; ++j)
+        {
+            if(group->vars[j] >= model->vars_count)
+            {
+                err = err ? err : SLLP_ERR_REFUSED;
+                break;
+            }
+            group->data_size += model->vars[group->vars[j]].size;
+        }
+    }
+
+    if(err)
+        return err;
+
+    model->groups_count = n;
+    model->groups_valid = true;
+
+    return SLLP_SUCCESS;
+}
+
+// Query the curves list, unless it's cached
+static enum sllp_err client_load_curves (sllp_client_t *client)
+{
+    struct client_model *model = &client->model;
+
+    if(model->curves_valid)
+        return SLLP_SUCCESS;
+
+    uint8_t list[SLLP_MAX_CURVES*SLLP_CURVE_INFO_SIZE + 128];
+    uint16_t size;
+
+    enum sllp_err err = client_call(client, CMD_QUERY_CURVES_LIST, NULL, 0,
+                                    NULL, 0, CMD_CURVES_LIST, list,
+                                    sizeof(list), &size);
+    if(err)
+        return err;
+
+    unsigned int count;
+
+    err = curves_count(client, list, size, &count);
+    if(err)
+        return err;
+
+    model->curves_count = count;
+
+    unsigned int i;
+    for(i = 0; i < model->curves_count; ++i)
+    {
+        struct sllp_client_curve *curve = &model->curves[i];
+        const uint8_t *info = list + i*SLLP_CURVE_INFO_SIZE;
+
+        curve->id = i;
+        curve->writable = info[0];
+        curve->nblocks = info[1];
+        memcpy(curve->checksum, info + 2, SLLP_CURVE_CSUM_SIZE);
+    }
+
+    model->curves_valid = true;
+
+    return SLLP_SUCCESS;
+}
+
+// Size of a curve, from the curves list
+static enum sllp_err client_curve_size (sllp_client_t *client, uint8_t id,
+                                        size_t *size)
+{
+    enum sllp_err err = client_load_curves(client);
+    if(err)
+        return err;
+
+    if(id >= client->model.curves_count)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    *size = (client->model.curves[id].nblocks + 1)*
+            (size_t) SLLP_CURVE_BLOCK_SIZE;
+
+    return SLLP_SUCCESS;
+}
+
+// Send or receive the blocks of a curve, keeping the window full, and get
+// the checksum of the data. Each block is hashed once it's in data for good:
+// received blocks while the next ones are on their way, sent blocks before
+// they go.
+static enum sllp_err client_transfer (sllp_client_t *client, uint8_t id,
+                                      unsigned int nblocks, uint8_t *data,
+                                      bool upload, unsigned int window,
+                                      uint8_t *checksum)
+{
+    struct sllp_client_request reqs[SLLP_CLIENT_WINDOW];
+    struct curve_hash hash = {.batch_count = 0, .count = 0};
+    enum sllp_err err = SLLP_SUCCESS;
+
+    if(!window || window > SLLP_CLIENT_WINDOW)
+        window = SLLP_CLIENT_WINDOW;
+
+    unsigned int i;
+    for(i = 0; i < nblocks + window; ++i)
+    {
+        struct sllp_client_request *req = &reqs[i % window];
+
+        if(i >= window && i - window < nblocks)
+        {
+            enum sllp_err req_err = sllp_client_wait(client, req);
+
+            if(!req_err && (upload ? req->code != CMD_OK :
+                            req->code != CMD_CURVE_BLOCK ||
+                            req->size != SLLP_CURVE_BLOCK_SIZE))
+                req_err = SLLP_ERR_REFUSED;
+
+            if(!upload)
+                curve_hash_add(&hash,
+                               data + (i - window)*SLLP_CURVE_BLOCK_SIZE);
+
+            err = err ? err : req_err;
+        }
+
+        if(i < nblocks)
+        {
+            uint8_t *block = data + i*SLLP_CURVE_BLOCK_SIZE;
+            uint8_t request[2] = {id, (uint8_t) i};
+            enum sllp_err req_err;
+
+            if(upload)
+            {
+                curve_hash_add(&hash, block);
+
+                req->answer = NULL;
+                req->answer_max = 0;
+                req_err = client_queue(client, req, CMD_CURVE_BLOCK, request,
+                                       sizeof(request), block,
+                                       SLLP_CURVE_BLOCK_SIZE, 0, 1);
+            }
+            else
+            {
+                // The answer starts with the ID and the index of the block
+                req->answer = block;
+                req->answer_max = SLLP_CURVE_BLOCK_SIZE;
+                req_err = client_queue(client, req, CMD_CURVE_TRANSMIT,
+                                       request, sizeof(request), NULL, 0, 2,
+                                       1);
+            }
+
+            // Nothing is left in flight if it failed
+            if(req_err)
+                return req_err;
+        }
+    }
+
+    if(!err)
+        curve_hash_final(&hash, checksum);
+
+    return err;
+}
+
+// Payload of a CMD_CURVE_READ: ID, then offset and length, big-endian
+static void curve_read_request (uint8_t *request, uint8_t id,
+                                uint32_t offset, uint16_t len)
+{
+    request[0] = id;
+    request[1] = offset >> 24;
+    request[2] = offset >> 16;
+    request[3] = offset >> 8;
+    request[4] = offset;
+    request[5] = len >> 8;
+    request[6] = len;
+}
+
+// A sample of the given type, in host byte order
+static double sample_value (uint8_t type, const uint8_t *sample)
+{
+    int16_t i16;
+    int32_t i32;
+    float f;
+
+    switch(type)
+    {
+    case SLLP_SAMPLE_INT16:
+        memcpy(&i16, sample, sizeof(i16));
+        return i16;
+
+    case SLLP_SAMPLE_INT32:
+        memcpy(&i32, sample, sizeof(i32));
+        return i32;
+
+    default:
+        memcpy(&f, sample, sizeof(f));
+        return f;
+    }
+}
+
+static void curve_hash_add (struct curve_hash *hash, const uint8_t *block)
+{
+    hash->batch[hash->batch_count++] = block;
+
+    if(hash->batch_count == MD5_MB_MAX_LANES)
+    {
+        md5_digest_mb(hash->batch, SLLP_CURVE_BLOCK_SIZE,
+                      hash->digests + hash->count, hash->batch_count);
+        hash->count += hash->batch_count;
+        hash->batch_count = 0;
+    }
+}
+
+static void curve_hash_final (struct curve_hash *hash, uint8_t *checksum)
 {
-	return;
+    if(hash->batch_count)
+    {
+        md5_digest_mb(hash->batch, SLLP_CURVE_BLOCK_SIZE,
+                      hash->digests + hash->count, hash->batch_count);
+        hash->count += hash->batch_count;
+        hash->batch_count = 0;
+    }
+
+    md5_digest(&hash->digests[0][0], hash->count*SLLP_CURVE_CSUM_SIZE,
+               checksum);
+}
+
+// Send what is queued, then receive once, completing every request whose
+// answer arrived whole
+static enum sllp_err client_receive (sllp_client_t *client)
+{
+    if(sllp_client_flush(client))
+        return SLLP_ERR_COMM;
+
+    ssize_t n = client->recv(client->user, client->rx + client->rx_len,
+                             sizeof(client->rx) - client->rx_len);
+
+    if(n <= 0)
+    {
+        client_fail(client);
+        return SLLP_ERR_COMM;
+    }
+
+    client->rx_len += n;
+
+    return client_parse(client);
+}
+
+// Complete the requests whose answers are whole in rx
+static enum sllp_err client_parse (sllp_client_t *client)
+{
+    size_t pos = 0;
+
+    while(client->rx_len - pos >= SLLP_HEADER_SIZE)
+    {
+        const uint8_t *frame = client->rx + pos;
+        uint16_t size = sllp_decode_size(frame[1]);
+
+        if(client->rx_len - pos < SLLP_HEADER_SIZE + size)
+            break;
+
+        struct sllp_client_request *req = client->head;
+
+        // An answer nobody asked for
+        if(!req)
+        {
+            client_fail(client);
+            return SLLP_ERR_COMM;
+        }
+
+        pos += SLLP_HEADER_SIZE + size;
+
+        if(!req->async)
+        {
+            // Error answers are shorter than what's skipped
+            uint16_t skip = size < req->skip ? size : req->skip;
+            uint16_t len = size - skip;
+
+            // Several answers are stored one after the other
+            if(!req->err && req->size + len <= req->answer_max)
+                memcpy(req->answer + req->size,
+                       frame + SLLP_HEADER_SIZE + skip, len);
+            else
+                req->err = SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+            req->code = frame[0];
+            req->size += len;
+
+            // An error answer is the only one
+            if(--req->parts && frame[0] <= CMD_OK)
+                continue;
+        }
+
+        client->head = req->next;
+        if(!client->head)
+            client->tail = NULL;
+
+        --client->inflight;
+        client->inflight_bytes -= req->cost;
+
+        if(req->async)
+            client_complete(client, (struct client_async *) req, frame[0],
+                            frame + SLLP_HEADER_SIZE, size);
+        else
+            req->done = true;
+    }
+
+    client->rx_len -= pos;
+    memmove(client->rx, client->rx + pos, client->rx_len);
+
+    return SLLP_SUCCESS;
+}
+
+// Hand the answer of an asynchronous request to its callback, straight from
+// rx, and free the request. A NULL data means the connection was lost.
+static void client_complete (sllp_client_t *client, struct client_async *async,
+                             uint8_t code, const uint8_t *data, uint16_t size)
+{
+    struct sllp_client_request *req = &async->req;
+    enum sllp_err err = SLLP_SUCCESS;
+
+    if(!data)
+        err = SLLP_ERR_COMM;
+    else if(req->expect && (code != req->expect || size < req->skip))
+        err = SLLP_ERR_REFUSED;
+    else
+    {
+        data += req->skip;
+        size -= req->skip;
+    }
+
+    if(req->cb)
+        req->cb(client, err, code, err ? NULL : data, err ? 0 : size,
+                req->cb_user);
+
+    free(async);
+}
+
+// The connection is lost: every request in flight is done with an error
+static void client_fail (sllp_client_t *client)
+{
+    struct sllp_client_request *req = client->head, *next;
+    struct client_async *async = client->backlog, *async_next;
+
+    client->broken = true;
+    client->head = client->tail = NULL;
+    client->backlog = client->backlog_tail = NULL;
+    client->inflight = 0;
+    client->inflight_bytes = 0;
+    client->tx_len = 0;
+
+    if(client->queue)
+        epoll_ctl(client->queue->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+
+    for(; req; req = next)
+    {
+        next = req->next;
+
+        if(req->async)
+            client_complete(client, (struct client_async *) req, 0, NULL, 0);
+        else
+        {
+            req->err = SLLP_ERR_COMM;
+            req->done = true;
+        }
+    }
+
+    for(; async; async = async_next)
+    {
+        async_next = async->next;
+        client_complete(client, async, 0, NULL, 0);
+    }
+}
+
+// How many curves a curves list holds. Lists larger than 127 bytes are padded
+// with zeros, but a read-only curve of a single block is listed as zeros too
+// until its checksum is first calculated. Trailing entries of zeros are then
+// told apart by asking for their digests, which only existing curves have.
+static enum sllp_err curves_count (sllp_client_t *client, const uint8_t *list,
+                                   uint16_t size, unsigned int *count)
+{
+    static const uint8_t zeros[SLLP_CURVE_INFO_SIZE];
+    unsigned int n = size/SLLP_CURVE_INFO_SIZE;
+
+    if(n > SLLP_MAX_CURVES)
+        n = SLLP_MAX_CURVES;
+
+    *count = n;
+
+    if(size < 0x80)
+        return SLLP_SUCCESS;
+
+    unsigned int first = n;
+
+    while(first && !memcmp(list + (first - 1)*SLLP_CURVE_INFO_SIZE, zeros,
+                           SLLP_CURVE_INFO_SIZE))
+        --first;
+
+    for(*count = first; *count < n; ++*count)
+    {
+        uint8_t id = *count;
+        uint8_t answer[1 + SLLP_CURVE_CSUM_SIZE];
+
+        enum sllp_err err = client_call(client, CMD_QUERY_CURVE_CSUMS, &id, 1,
+                                        NULL, 0, CMD_CURVE_CSUMS, answer,
+                                        sizeof(answer), NULL);
+        if(err == SLLP_ERR_REFUSED)
+            break;
+        if(err)
+            return err;
+    }
+
+    return SLLP_SUCCESS;
+}
+
+static int fd_send (void *user, const uint8_t *data, size_t len)
+{
+    int fd = (intptr_t) user;
+
+    while(len)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+
+        // Pipes and serial ports
+        if(n < 0 && errno == ENOTSOCK)
+            n = write(fd, data, len);
+
+        if(n < 0 && errno == EINTR)
+            continue;
+
+        if(n <= 0)
+            return -1;
+
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static ssize_t fd_recv (void *user, uint8_t *data, size_t len)
+{
+    int fd = (intptr_t) user;
+    ssize_t n;
+
+    do
+        n = read(fd, data, len);
+    while(n < 0 && errno == EINTR);
+
+    return n;
 }
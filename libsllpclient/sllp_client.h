@@ -1,15 +1,757 @@
-/* 
+/*
  * Sirius Low Level Control Protocol Client Library API
  * Version 0.1
  * Bruno Martins
  * CON - Controls Group
- * LNLS - Brazilian Synchrotron Light Laboratory 
+ * LNLS - Brazilian Synchrotron Light Laboratory
  */
 
 #ifndef SLLP_CLIENT_H
 #define	SLLP_CLIENT_H
 
-void sllp_client_stub();
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
 
-#endif
+#include "sllp_protocol.h"
 
+#define SLLP_CLIENT_WINDOW  64      // Requests in flight on a connection
+
+typedef struct sllp_client sllp_client_t;   // Type of the client handle
+
+// Type of the completion queue handle
+typedef struct sllp_client_queue sllp_client_queue_t;
+
+// Send len bytes to the server. Returns 0 if all of them were sent.
+typedef int (*sllp_client_send_t) (void *user, const uint8_t *data,
+                                   size_t len);
+
+// Receive up to len bytes from the server, waiting for at least one. Returns
+// how many bytes were received, 0 or less if the connection is lost.
+typedef ssize_t (*sllp_client_recv_t) (void *user, uint8_t *data, size_t len);
+
+// Completion of an asynchronous request. data points to the payload of the
+// answer, valid until the callback returns, or is NULL if err isn't
+// SLLP_SUCCESS.
+typedef void (*sllp_client_cb_t) (sllp_client_t *client, enum sllp_err err,
+                                  uint8_t code, const uint8_t *data,
+                                  uint16_t size, void *user);
+
+struct sllp_client_var
+{
+    uint8_t id;                     // ID of the variable, used in the protocol.
+    bool    writable;               // Determine if the variable is writable.
+    uint8_t size;                   // Size of the value of the variable.
+};
+
+struct sllp_client_group
+{
+    uint8_t id;                     // ID of the group, used in the protocol.
+    bool    writable;               // Determine if the group is writable.
+    uint8_t vars_count;             // How many variables the group contains.
+    uint8_t vars[SLLP_MAX_VARIABLES];   // Their IDs, in protocol order.
+    uint16_t data_size;             // Size of the values of the variables.
+};
+
+struct sllp_client_curve
+{
+    uint8_t id;                     // ID of the curve, used in the protocol.
+    bool    writable;               // Determine if the curve is writable.
+    uint8_t nblocks;                // Index of the last block of the curve.
+    uint8_t checksum[SLLP_CURVE_CSUM_SIZE];
+};
+
+// Statistics of blocks of a curve with a sample type
+struct sllp_client_stats
+{
+    uint8_t  type;                  // Sample type, from enum sllp_sample_type.
+    uint32_t count;                 // How many samples the blocks hold.
+    double   min, max;
+    double   mean;
+    double   rms;                   // Root mean square.
+};
+
+// Value of a variable within a group reading
+struct sllp_client_value
+{
+    uint8_t       id;               // ID of the variable.
+    uint8_t       size;             // Size of the value.
+    const uint8_t *data;            // The value, within the reading.
+};
+
+// A request in flight, owned by the caller until it's answered
+struct sllp_client_request
+{
+    uint8_t       *answer;          // Buffer for the payload of the answer.
+    uint32_t      answer_max;       // Size of the buffer.
+
+    // Filled in when the answer arrives
+    bool          done;
+    enum sllp_err err;              // SLLP_SUCCESS or why the answer was lost.
+    uint8_t       code;             // Command code of the answer.
+    uint32_t      size;             // Size of its payload, including the
+                                    // padding up to the encoded size.
+
+    // Private
+    struct sllp_client_request *next;
+    uint32_t      cost;
+    bool          async;
+    sllp_client_cb_t cb;
+    void          *cb_user;
+    uint8_t       expect;           // Answer code of typed calls, or 0.
+    uint8_t       skip;             // Answer bytes not handed to cb.
+    uint16_t      parts;            // Answers still to arrive.
+};
+
+/**
+ * Allocate a new client talking to a server through the given transport.
+ *
+ * @param send [input] Function sending bytes to the server.
+ * @param recv [input] Function receiving bytes from the server.
+ * @param user [input] Passed to send and recv.
+ *
+ * @return A client handle or NULL if send or recv is a NULL pointer or there
+ *         isn't enough memory.
+ */
+sllp_client_t *sllp_client_new (sllp_client_send_t send,
+                                sllp_client_recv_t recv, void *user);
+
+/**
+ * Allocate a new client talking to a server through a connected socket, pipe
+ * or serial port. The descriptor isn't closed by sllp_client_destroy.
+ *
+ * @param fd [input] Blocking file descriptor connected to the server.
+ *
+ * @return A client handle or NULL if fd is negative or there isn't enough
+ *         memory.
+ */
+sllp_client_t *sllp_client_new_fd (int fd);
+
+/**
+ * Deallocate a client. Requests still in flight are abandoned, asynchronous
+ * ones are completed with SLLP_ERR_COMM.
+ *
+ * @param client [input] The client to be destroyed.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client is a NULL pointer.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_destroy (sllp_client_t *client);
+
+/**
+ * Queue a request. Requests are answered in the order they were submitted, so
+ * many can be in flight on the connection: the request is sent along with
+ * the others when the queue is flushed or waited on. If SLLP_CLIENT_WINDOW
+ * requests, or too many bytes, are already in flight, the oldest answers are
+ * received first.
+ *
+ * The caller fills in answer and answer_max. The request, the answer buffer
+ * and nothing else must be touched until the request is done.
+ *
+ * @param client [input] The client handle.
+ * @param req [input] The request.
+ * @param code [input] Command code of the request.
+ * @param payload [input] Payload of the request, if size isn't 0.
+ * @param size [input] Size of the payload.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client or req is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: size is larger than the largest
+ *                                    payload.</li>
+ *   <li>SLLP_ERR_COMM: the connection is lost.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_submit (sllp_client_t *client,
+                                  struct sllp_client_request *req,
+                                  uint8_t code, const uint8_t *payload,
+                                  uint16_t size);
+
+/**
+ * Send every queued request.
+ *
+ * @param client [input] The client handle.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client is a NULL pointer.</li>
+ *   <li>SLLP_ERR_COMM: the connection is lost.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_flush (sllp_client_t *client);
+
+/**
+ * Wait for a request to be answered, along with the requests submitted
+ * before it. The request is done afterwards, with err telling whether its
+ * answer arrived.
+ *
+ * @param client [input] The client handle.
+ * @param req [input] A request submitted to the client.
+ *
+ * @return The err field of the request, or SLLP_ERR_PARAM_INVALID if client
+ *         or req is a NULL pointer.
+ */
+enum sllp_err sllp_client_wait (sllp_client_t *client,
+                                struct sllp_client_request *req);
+
+/**
+ * Forget the model of the server kept by the client: variables, groups and
+ * curves are queried again the next time they're needed.
+ *
+ * The model is only invalidated by the client when it sends a command that
+ * changes it (creating or removing groups, updating the checksums of curves).
+ * Changes made by other clients, or a server restarted behind the same
+ * transport, call for this.
+ *
+ * @param client [input] The client handle.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client is a NULL pointer.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_invalidate (sllp_client_t *client);
+
+/*
+ * Typed calls. Each one sends a command and waits for its answer, after the
+ * answers of any requests already in flight. Besides the errors listed, they
+ * all return SLLP_ERR_PARAM_INVALID if a pointer is NULL, SLLP_ERR_COMM if
+ * the connection is lost and SLLP_ERR_REFUSED if the server answers with an
+ * error.
+ *
+ * Answers larger than 127 bytes are padded by the protocol, so sizes read
+ * back round up to the next encodable size.
+ *
+ * Variables, groups and curves are served from the model of the server kept
+ * by the client, which is only queried when it's missing or invalidated.
+ */
+
+/**
+ * Query the status of the server.
+ *
+ * @param status [output] The status payload.
+ * @param size [input/output] Size of status as input, how many bytes were
+ *                            answered as output.
+ */
+enum sllp_err sllp_client_query_status (sllp_client_t *client,
+                                        uint8_t *status, uint16_t *size);
+
+/**
+ * List the variables of the server.
+ *
+ * @param vars [output] Room for SLLP_MAX_VARIABLES variables.
+ * @param count [output] How many variables the server has.
+ */
+enum sllp_err sllp_client_get_vars (sllp_client_t *client,
+                                    struct sllp_client_var *vars,
+                                    unsigned int *count);
+
+/**
+ * List the groups of the server, along with their variables. The groups are
+ * queried all at once.
+ *
+ * @param groups [output] Room for SLLP_MAX_GROUPS groups.
+ * @param count [output] How many groups the server has.
+ */
+enum sllp_err sllp_client_get_groups (sllp_client_t *client,
+                                      struct sllp_client_group *groups,
+                                      unsigned int *count);
+
+/**
+ * Get a group, along with its variables.
+ *
+ * @param id [input] ID of the group.
+ * @param group [output] The group.
+ */
+enum sllp_err sllp_client_get_group (sllp_client_t *client, uint8_t id,
+                                     struct sllp_client_group *group);
+
+/**
+ * List the curves of the server. Long lists are padded with zeros, which
+ * also describe a read-only curve of a single block whose checksum is still
+ * unset, so such curves at the end of the list cost a CMD_QUERY_CURVE_CSUMS
+ * each to tell them apart from the padding.
+ *
+ * @param curves [output] Room for SLLP_MAX_CURVES curves.
+ * @param count [output] How many curves the server has.
+ */
+enum sllp_err sllp_client_get_curves (sllp_client_t *client,
+                                      struct sllp_client_curve *curves,
+                                      unsigned int *count);
+
+/**
+ * Query the digests of the blocks of a curve.
+ *
+ * @param id [input] ID of the curve.
+ * @param digests [output] Room for 256 digests.
+ * @param count [output] How many blocks the curve has.
+ */
+enum sllp_err sllp_client_get_curve_csums (sllp_client_t *client, uint8_t id,
+                                     uint8_t (*digests)[SLLP_CURVE_CSUM_SIZE],
+                                     unsigned int *count);
+
+/**
+ * Read the value of a variable.
+ *
+ * @param id [input] ID of the variable.
+ * @param value [output] Room for SLLP_MAX_VAR_SIZE bytes.
+ * @param size [output] Size of the value. Can be NULL.
+ */
+enum sllp_err sllp_client_read_var (sllp_client_t *client, uint8_t id,
+                                    uint8_t *value, uint8_t *size);
+
+/**
+ * Read the values of several variables, with all the reads in flight at
+ * once.
+ *
+ * @param ids [input] IDs of the variables.
+ * @param values [output] For each variable, room for SLLP_MAX_VAR_SIZE bytes.
+ * @param sizes [output] Sizes of the values. Can be NULL.
+ * @param count [input] How many variables to read.
+ */
+enum sllp_err sllp_client_read_vars (sllp_client_t *client,
+                                     const uint8_t *ids, uint8_t **values,
+                                     uint8_t *sizes, unsigned int count);
+
+/**
+ * Read the values of the variables of a group.
+ *
+ * @param id [input] ID of the group.
+ * @param data [output] Room for SLLP_MAX_MESSAGE bytes.
+ * @param size [output] Size of the values. Can be NULL.
+ */
+enum sllp_err sllp_client_read_group (sllp_client_t *client, uint8_t id,
+                                      uint8_t *data, uint16_t *size);
+
+/**
+ * Split a group reading into the values of its variables, after the layout
+ * of the group. The reading can come from sllp_client_read_group or from a
+ * submitted CMD_READ_GROUP request.
+ *
+ * @param id [input] ID of the group.
+ * @param data [input] The reading.
+ * @param size [input] Size of the reading.
+ * @param values [output] Room for a value per variable of the group,
+ *                        pointing into data.
+ * @param count [output] How many variables the group contains.
+ *
+ * @return Also SLLP_ERR_PARAM_OUT_OF_RANGE if there's no such group or the
+ *         reading is too short for it.
+ */
+enum sllp_err sllp_client_group_values (sllp_client_t *client, uint8_t id,
+                                        const uint8_t *data, uint16_t size,
+                                        struct sllp_client_value *values,
+                                        unsigned int *count);
+
+/**
+ * Read a group and split the reading into the values of its variables, as
+ * sllp_client_read_group followed by sllp_client_group_values.
+ *
+ * @param id [input] ID of the group.
+ * @param data [output] Room for SLLP_MAX_MESSAGE bytes, pointed to by values.
+ * @param values [output] Room for a value per variable of the group.
+ * @param count [output] How many variables the group contains.
+ */
+enum sllp_err sllp_client_read_group_values (sllp_client_t *client,
+                                             uint8_t id, uint8_t *data,
+                                             struct sllp_client_value *values,
+                                             unsigned int *count);
+
+/**
+ * Write the value of a variable.
+ *
+ * @param id [input] ID of the variable.
+ * @param value [input] The value.
+ * @param size [input] Size of the value.
+ *
+ * @return Also SLLP_ERR_PARAM_OUT_OF_RANGE if size is 0 or larger than
+ *         SLLP_MAX_VAR_SIZE.
+ */
+enum sllp_err sllp_client_write_var (sllp_client_t *client, uint8_t id,
+                                     const uint8_t *value, uint8_t size);
+
+/**
+ * Write the values of the variables of a group.
+ *
+ * @param id [input] ID of the group.
+ * @param data [input] The values, in protocol order.
+ * @param size [input] Size of the values.
+ *
+ * @return Also SLLP_ERR_PARAM_OUT_OF_RANGE if size is 0 or too large.
+ */
+enum sllp_err sllp_client_write_group (sllp_client_t *client, uint8_t id,
+                                       const uint8_t *data, uint16_t size);
+
+/**
+ * Create a group of variables.
+ *
+ * @param ids [input] IDs of the variables.
+ * @param count [input] How many variables.
+ * @param id [output] ID of the new group. Can be NULL.
+ *
+ * @return Also SLLP_ERR_PARAM_OUT_OF_RANGE if count is 0 or larger than
+ *         SLLP_MAX_VARIABLES.
+ */
+enum sllp_err sllp_client_create_group (sllp_client_t *client,
+                                        const uint8_t *ids, unsigned int count,
+                                        uint8_t *id);
+
+/**
+ * Remove all the groups created by clients.
+ */
+enum sllp_err sllp_client_remove_all_groups (sllp_client_t *client);
+
+/**
+ * Read a block of a curve.
+ *
+ * @param id [input] ID of the curve.
+ * @param block [input] Index of the block.
+ * @param data [output] Room for SLLP_CURVE_BLOCK_SIZE bytes.
+ */
+enum sllp_err sllp_client_read_curve_block (sllp_client_t *client, uint8_t id,
+                                            uint8_t block, uint8_t *data);
+
+/**
+ * Read a range of blocks of a curve with a single request, which the server
+ * answers with a message per block. Unlike a window of block reads, nothing
+ * has to be sent while the blocks arrive. The range
+ * counts as a whole against the bytes in flight, so other requests wait for
+ * a large range to be received.
+ *
+ * @param id [input] ID of the curve.
+ * @param first [input] Index of the first block.
+ * @param last [input] Index of the last block.
+ * @param data [output] Room for (last - first + 1)*SLLP_CURVE_BLOCK_SIZE
+ *                      bytes.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client or data is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: first is greater than last.</li>
+ *   <li>SLLP_ERR_COMM: the connection was lost.</li>
+ *   <li>SLLP_ERR_REFUSED: the range is past the curve, or the server
+ *                         doesn't support range requests.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_read_curve_range (sllp_client_t *client, uint8_t id,
+                                            uint8_t first, uint8_t last,
+                                            uint8_t *data);
+
+/**
+ * Read part of a curve, which may span blocks. Only the bytes asked for are
+ * transmitted.
+ *
+ * @param id [input] ID of the curve.
+ * @param offset [input] Offset of the first byte, from the start of the
+ *                       curve.
+ * @param len [input] How many bytes to read, from 1 to SLLP_CURVE_BLOCK_SIZE.
+ * @param data [output] Room for len bytes.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client or data is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: len is 0 or too large.</li>
+ *   <li>SLLP_ERR_COMM: the connection was lost.</li>
+ *   <li>SLLP_ERR_REFUSED: the bytes are past the curve, or the server doesn't
+ *                         support partial reads.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_read_curve_data (sllp_client_t *client, uint8_t id,
+                                           uint32_t offset, uint16_t len,
+                                           uint8_t *data);
+
+/**
+ * Read an envelope of a curve, to draw an overview of it: the minimum and
+ * maximum sample of each of a number of points spanning the curve. Only
+ * curves whose server declares a sample type have one.
+ *
+ * @param id [input] ID of the curve.
+ * @param points [input] How many points. At most 64 per block of the curve,
+ *                       and 4096 for 16-bit samples or 2048 for 32-bit ones.
+ * @param type [output] Sample type of the curve, from enum
+ *                      sllp_sample_type.
+ * @param data [output] A pair of samples per point, minimum then maximum, in
+ *                      the server's byte order. 8*points bytes are enough
+ *                      for any sample type.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client, type or data is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: points is 0.</li>
+ *   <li>SLLP_ERR_COMM: the connection was lost.</li>
+ *   <li>SLLP_ERR_REFUSED: the curve has no sample type, points is too large
+ *                         or the server doesn't support envelopes.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_read_curve_envelope (sllp_client_t *client,
+                                               uint8_t id, uint16_t points,
+                                               uint8_t *type, uint8_t *data);
+
+/**
+ * Read statistics of blocks of a curve, which the server keeps for curves
+ * with a sample type. Only a few bytes are transferred, whatever the size of
+ * the blocks.
+ *
+ * @param id [input] ID of the curve.
+ * @param first [input] First block.
+ * @param last [input] Last block.
+ * @param stats [output] Statistics of the samples of blocks first to last.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client or stats is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: first is greater than last.</li>
+ *   <li>SLLP_ERR_COMM: the connection was lost.</li>
+ *   <li>SLLP_ERR_REFUSED: the curve has no sample type, last is past the
+ *                         curve or the server doesn't support
+ *                         statistics.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_read_curve_stats (sllp_client_t *client, uint8_t id,
+                                            uint8_t first, uint8_t last,
+                                            struct sllp_client_stats *stats);
+
+/**
+ * Write a block of a curve.
+ *
+ * @param id [input] ID of the curve.
+ * @param block [input] Index of the block.
+ * @param data [input] SLLP_CURVE_BLOCK_SIZE bytes.
+ */
+enum sllp_err sllp_client_write_curve_block (sllp_client_t *client,
+                                             uint8_t id, uint8_t block,
+                                             const uint8_t *data);
+
+/**
+ * Have the server bring the checksum of a curve up to date.
+ *
+ * @param id [input] ID of the curve.
+ */
+enum sllp_err sllp_client_recalc_csum (sllp_client_t *client, uint8_t id);
+
+/**
+ * Download a whole curve, keeping up to window block requests in flight.
+ * Blocks are stored straight into data as they arrive and hashed while the
+ * next ones are on their way, into the checksum the server keeps for the
+ * curve (the MD5 of the MD5s of its blocks). It's compared with the one in
+ * the curves list, which is queried again if the cached one doesn't match.
+ *
+ * @param id [input] ID of the curve.
+ * @param data [output] Room for (nblocks + 1)*SLLP_CURVE_BLOCK_SIZE bytes.
+ * @param window [input] Most block requests in flight, up to
+ *                       SLLP_CLIENT_WINDOW. 0 picks SLLP_CLIENT_WINDOW. Each
+ *                       block also counts against the bytes the client keeps
+ *                       in flight, which bounds the window further.
+ * @param checksum [output] Checksum of the data received, if not NULL.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client or data is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: there's no curve with the given ID.</li>
+ *   <li>SLLP_ERR_COMM: the connection was lost.</li>
+ *   <li>SLLP_ERR_REFUSED: the server refused to transmit a block.</li>
+ *   <li>SLLP_ERR_CHECKSUM: the data doesn't match the server's checksum,
+ *                          e.g. blocks were written after it was last
+ *                          recalculated. The data is stored anyway.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_download_curve (sllp_client_t *client, uint8_t id,
+                                          uint8_t *data, unsigned int window,
+                                          uint8_t *checksum);
+
+/**
+ * Upload a whole curve, keeping up to window blocks in flight and hashing
+ * them as they are sent. The server is then asked to recalculate the
+ * checksum of the curve, which must match the one of the data sent.
+ *
+ * @param id [input] ID of the curve.
+ * @param data [input] (nblocks + 1)*SLLP_CURVE_BLOCK_SIZE bytes.
+ * @param window [input] As in sllp_client_download_curve.
+ * @param checksum [output] Checksum of the data sent, if not NULL.
+ *
+ * @return SLLP_SUCCESS or one of the errors of sllp_client_download_curve.
+ *         SLLP_ERR_REFUSED also means the curve isn't writable.
+ */
+enum sllp_err sllp_client_upload_curve (sllp_client_t *client, uint8_t id,
+                                        const uint8_t *data,
+                                        unsigned int window,
+                                        uint8_t *checksum);
+
+/**
+ * Download a whole curve into a file, through a shared mapping of it: blocks
+ * are stored in the page cache as they arrive. The file is created if
+ * needed and truncated to the size of the curve.
+ *
+ * @param path [input] Path of the file.
+ *
+ * The other parameters and the errors are as in sllp_client_download_curve.
+ * SLLP_ERR_COMM also means the file couldn't be created, mapped or written.
+ */
+enum sllp_err sllp_client_download_curve_file (sllp_client_t *client,
+                                               uint8_t id, const char *path,
+                                               unsigned int window,
+                                               uint8_t *checksum);
+
+/**
+ * Upload a whole curve from a file, mapped in memory and read ahead
+ * sequentially.
+ *
+ * @param path [input] Path of the file. Its size must be the one of the
+ *                     curve, or SLLP_ERR_PARAM_OUT_OF_RANGE is returned.
+ *
+ * The other parameters and the errors are as in sllp_client_upload_curve.
+ * SLLP_ERR_COMM also means the file couldn't be opened or mapped.
+ */
+enum sllp_err sllp_client_upload_curve_file (sllp_client_t *client,
+                                             uint8_t id, const char *path,
+                                             unsigned int window,
+                                             uint8_t *checksum);
+
+/*
+ * Asynchronous calls. Clients connected through sockets are attached to a
+ * completion queue, which serves many of them from a single thread: each
+ * call queues a request and returns, and the callback given to it is run
+ * by sllp_client_queue_process when the answer arrives. Answers are handed
+ * to the callbacks straight from the receive buffer of the client.
+ *
+ * Asynchronous requests go out in the order they were made, through the
+ * same window as the others, and synchronous calls made on an attached
+ * client wait for them to be sent first. Callbacks may make asynchronous
+ * calls, but must not make synchronous ones nor destroy the client.
+ */
+
+/**
+ * Allocate a new completion queue.
+ *
+ * @return A queue handle or NULL if there isn't enough memory or the
+ *         queue's epoll instance couldn't be created.
+ */
+sllp_client_queue_t *sllp_client_queue_new (void);
+
+/**
+ * Deallocate a completion queue. Clients attached to it must be destroyed
+ * first.
+ *
+ * @param queue [input] The queue to be destroyed.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: queue is a NULL pointer.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_queue_destroy (sllp_client_queue_t *queue);
+
+/**
+ * File descriptor of a completion queue, readable whenever
+ * sllp_client_queue_process has work to do. It can be added to an external
+ * epoll or poll loop.
+ *
+ * @param queue [input] The queue.
+ *
+ * @return The descriptor, or -1 if queue is a NULL pointer.
+ */
+int sllp_client_queue_fd (sllp_client_queue_t *queue);
+
+/**
+ * Send and receive on the clients of a completion queue whose sockets are
+ * ready, running the callbacks of the requests answered.
+ *
+ * @param queue [input] The queue.
+ * @param timeout [input] Milliseconds to wait for a socket to be ready: 0
+ *                        doesn't wait, -1 waits indefinitely.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: queue is a NULL pointer.</li>
+ *   <li>SLLP_ERR_COMM: the queue's epoll instance failed.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_queue_process (sllp_client_queue_t *queue,
+                                         int timeout);
+
+/**
+ * Attach a client to a completion queue, allowing asynchronous calls on it.
+ *
+ * @param client [input] A client created by sllp_client_new_fd on a socket.
+ * @param queue [input] The queue.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client or queue is a NULL pointer, the client
+ *                               wasn't created on a descriptor or is already
+ *                               attached.</li>
+ *   <li>SLLP_ERR_COMM: the descriptor can't be polled or the connection is
+ *                      lost.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_attach (sllp_client_t *client,
+                                  sllp_client_queue_t *queue);
+
+/**
+ * Queue a request of any command. The callback gets the answer as is.
+ *
+ * @param client [input] An attached client.
+ * @param code [input] Command code of the request.
+ * @param payload [input] Payload of the request, if size isn't 0.
+ * @param size [input] Size of the payload.
+ * @param cb [input] Called with the answer. Can be NULL.
+ * @param user [input] Passed to cb.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: client is a NULL pointer or not attached.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: size is larger than the largest
+ *                                    payload.</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: the request couldn't be allocated.</li>
+ *   <li>SLLP_ERR_COMM: the connection is lost.</li>
+ * </ul>
+ */
+enum sllp_err sllp_client_submit_async (sllp_client_t *client, uint8_t code,
+                                        const uint8_t *payload, uint16_t size,
+                                        sllp_client_cb_t cb, void *user);
+
+/*
+ * Typed asynchronous calls. They return like sllp_client_submit_async, and
+ * check their arguments like their synchronous counterparts. Their callbacks
+ * get SLLP_ERR_REFUSED if the server answers with an error, and the data
+ * read, if any: the value of a variable, the values of a group or a block of
+ * a curve.
+ */
+
+enum sllp_err sllp_client_read_var_async (sllp_client_t *client, uint8_t id,
+                                          sllp_client_cb_t cb, void *user);
+
+enum sllp_err sllp_client_read_group_async (sllp_client_t *client, uint8_t id,
+                                            sllp_client_cb_t cb, void *user);
+
+enum sllp_err sllp_client_write_var_async (sllp_client_t *client, uint8_t id,
+                                           const uint8_t *value, uint8_t size,
+                                           sllp_client_cb_t cb, void *user);
+
+enum sllp_err sllp_client_write_group_async (sllp_client_t *client,
+                                             uint8_t id, const uint8_t *data,
+                                             uint16_t size,
+                                             sllp_client_cb_t cb, void *user);
+
+enum sllp_err sllp_client_read_curve_block_async (sllp_client_t *client,
+                                                  uint8_t id, uint8_t block,
+                                                  sllp_client_cb_t cb,
+                                                  void *user);
+
+// The callback gets the bytes read, padded: the first len are the data.
+enum sllp_err sllp_client_read_curve_data_async (sllp_client_t *client,
+                                                 uint8_t id, uint32_t offset,
+                                                 uint16_t len,
+                                                 sllp_client_cb_t cb,
+                                                 void *user);
+
+enum sllp_err sllp_client_write_curve_block_async (sllp_client_t *client,
+                                                   uint8_t id, uint8_t block,
+                                                   const uint8_t *data,
+                                                   sllp_client_cb_t cb,
+                                                   void *user);
+
+#endif	/* SLLP_CLIENT_H */
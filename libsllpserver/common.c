@@ -1,5 +1,75 @@
 #include "common.h"
 #include "sllp_server.h"
+#include "md5/md5_mb.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// <editor-fold defaultstate="collapsed" desc="Auxiliary functions">
+static void envelope_store (struct sllp_curve *curve,
+                            struct curve_envelopes *envelopes, uint8_t block,
+                            const uint8_t *bins,
+                            const struct envelope_sums *sums);
+static void envelopes_refresh (struct sllp_instance *sllp,
+                               struct sllp_curve *curve,
+                               struct curve_envelopes *envelopes,
+                               uint8_t first, uint8_t last);
+// </editor-fold>
+
+void *instance_alloc (struct sllp_instance *sllp, size_t size)
+{
+    if(!sllp->arena.enabled)
+        return malloc(size);
+
+    size = ARENA_ROUND(size);
+
+    if(size > sllp->arena.left)
+        return NULL;
+
+    void *ptr = sllp->arena.next;
+
+    sllp->arena.next += size;
+    sllp->arena.left -= size;
+
+    return ptr;
+}
+
+void instance_free (struct sllp_instance *sllp, void *ptr)
+{
+    if(!sllp->arena.enabled)
+        free(ptr);
+}
+
+size_t curve_digests_size (const struct sllp_curve *curve)
+{
+    return sizeof(struct curve_digests) + (curve->nblocks + 1)*CURVE_CSUM_SIZE;
+}
+
+size_t curve_envelopes_size (const struct sllp_curve *curve)
+{
+    if(!curve->sample_type)
+        return 0;
+
+    size_t bins = (curve->nblocks + 1)*ENVELOPE_BINS*2*
+                  sllp_sample_size(curve->sample_type);
+
+    return sizeof(struct curve_envelopes) + bins +
+           (curve->nblocks + 1)*sizeof(struct envelope_sums);
+}
+
+void instance_lock (struct sllp_instance *sllp)
+{
+    if(sllp->concurrent)
+        while(__atomic_test_and_set(&sllp->lock, __ATOMIC_ACQUIRE))
+            ;
+}
+
+void instance_unlock (struct sllp_instance *sllp)
+{
+    if(sllp->concurrent)
+        __atomic_clear(&sllp->lock, __ATOMIC_RELEASE);
+}
 
 enum sllp_err group_init (struct sllp_group *group, uint8_t id, bool writable)
 {
@@ -9,7 +79,477 @@ enum sllp_err group_init (struct sllp_group *group, uint8_t id, bool writable)
     group->id = id;
     group->writable = writable;
     group->data_size = 0;
-    sllp_list_init(&group->vars_list);
+    group->vars_count = 0;
+    group->vars[0] = NULL;
+    memset(group->members, 0, sizeof(group->members));
+    group->runs_count = 0;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err group_add_var (struct sllp_group *group, struct sllp_var *var)
+{
+    if(!group || !var)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(group_contains(group, var->id))
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    if(group->vars_count == MAX_VARIABLES)
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    group->members[var->id/32] |= 1u << var->id%32;
+    group->ids[group->vars_count] = var->id;
+    group->vars[group->vars_count++] = var;
+    group->vars[group->vars_count] = NULL;
+
+    group->writable = group->writable && var->writable;
+    group->data_size += var->size;
+
+    // Extend the read plan, merging with the last run if var starts right
+    // where it ends
+    struct group_run *run = group->runs + group->runs_count;
+
+    if(group->runs_count && run[-1].data + run[-1].size == var->data)
+        run[-1].size += var->size;
+    else
+    {
+        run->data = var->data;
+        run->size = var->size;
+        ++group->runs_count;
+    }
 
     return SLLP_SUCCESS;
 }
+
+void group_read (struct sllp_group *group, uint8_t *data)
+{
+    const struct group_run *run = group->runs;
+    const struct group_run *end = run + group->runs_count;
+
+    for(; run < end; ++run)
+    {
+        memcpy(data, run->data, run->size);
+        data += run->size;
+    }
+}
+
+void group_write (struct sllp_group *group, const uint8_t *data)
+{
+    const struct group_run *run = group->runs;
+    const struct group_run *end = run + group->runs_count;
+
+    for(; run < end; ++run)
+    {
+        memcpy(run->data, data, run->size);
+        data += run->size;
+    }
+}
+
+int group_read_iov (struct sllp_group *group, struct iovec *iov)
+{
+    unsigned int i;
+
+    for(i = 0; i < group->runs_count; ++i)
+    {
+        iov[i].iov_base = group->runs[i].data;
+        iov[i].iov_len  = group->runs[i].size;
+    }
+
+    return group->runs_count;
+}
+
+void group_snapshot (struct sllp_group *group, struct sllp_group *snapshot)
+{
+    unsigned int start;
+
+    do
+    {
+        start = seq_read_begin(&group->seq);
+
+        snapshot->id = group->id;
+        snapshot->writable = group->writable;
+        snapshot->data_size = group->data_size;
+        snapshot->vars_count = group->vars_count;
+        snapshot->runs_count = group->runs_count;
+        memcpy(snapshot->members, group->members, sizeof(snapshot->members));
+
+        // Counts may be torn, but never exceed the arrays
+        memcpy(snapshot->vars, group->vars,
+               snapshot->vars_count*sizeof(*snapshot->vars));
+        memcpy(snapshot->runs, group->runs,
+               snapshot->runs_count*sizeof(*snapshot->runs));
+    }
+    while(seq_read_retry(&group->seq, start));
+
+    snapshot->vars[snapshot->vars_count] = NULL;
+}
+
+void group_read_seq (struct sllp_instance *sllp, struct sllp_group *group,
+                     uint8_t *data)
+{
+    unsigned int start[MAX_VARIABLES];
+    unsigned int i;
+    bool retry;
+
+    do
+    {
+        for(i = 0; i < group->vars_count; ++i)
+            start[i] = seq_read_begin(&sllp->vars.seq[group->vars[i]->id]);
+
+        group_read(group, data);
+
+        retry = false;
+        for(i = 0; i < group->vars_count && !retry; ++i)
+            retry = seq_read_retry(&sllp->vars.seq[group->vars[i]->id],
+                                   start[i]);
+    }
+    while(retry);
+}
+
+void group_write_seq (struct sllp_instance *sllp, struct sllp_group *group,
+                      const uint8_t *data)
+{
+    unsigned int i;
+
+    for(i = 0; i < group->vars_count; ++i)
+        seq_write_lock(&sllp->vars.seq[group->vars[i]->id]);
+
+    group_write(group, data);
+
+    for(i = 0; i < group->vars_count; ++i)
+        seq_write_unlock(&sllp->vars.seq[group->vars[i]->id]);
+}
+
+void var_read_seq (struct sllp_instance *sllp, struct sllp_var *var,
+                   uint8_t *data)
+{
+    unsigned int *seq = &sllp->vars.seq[var->id];
+    unsigned int start;
+
+    do
+    {
+        start = seq_read_begin(seq);
+        memcpy(data, var->data, var->size);
+    }
+    while(seq_read_retry(seq, start));
+}
+
+void var_write_seq (struct sllp_instance *sllp, struct sllp_var *var,
+                    const uint8_t *data)
+{
+    unsigned int *seq = &sllp->vars.seq[var->id];
+
+    seq_write_lock(seq);
+    memcpy(var->data, data, var->size);
+    seq_write_unlock(seq);
+}
+
+void curve_read_block (struct sllp_instance *sllp, struct sllp_curve *curve,
+                       uint8_t block, uint8_t *data)
+{
+    if(curve->get_block_ptr)
+        memcpy(data, curve->get_block_ptr(curve, block), CURVE_BLOCK_DATA_SIZE);
+    else if(sllp->curves.prefetch[curve->id])
+        prefetch_read(sllp->curves.prefetch[curve->id], block, data);
+    else
+        curve->read_block(curve, block, data);
+}
+
+void curve_read_range (struct sllp_instance *sllp, struct sllp_curve *curve,
+                       uint32_t offset, uint16_t len, uint8_t *data)
+{
+    if(curve->read_range && !curve->get_block_ptr &&
+       !sllp->curves.prefetch[curve->id])
+    {
+        curve->read_range(curve, offset, len, data);
+        return;
+    }
+
+    uint8_t block[CURVE_BLOCK_DATA_SIZE];
+
+    while(len)
+    {
+        uint8_t index = offset/CURVE_BLOCK_DATA_SIZE;
+        uint16_t start = offset % CURVE_BLOCK_DATA_SIZE;
+        uint16_t part = CURVE_BLOCK_DATA_SIZE - start;
+
+        if(part > len)
+            part = len;
+
+        if(curve->get_block_ptr)
+            memcpy(data, curve->get_block_ptr(curve, index) + start, part);
+        else if(part == CURVE_BLOCK_DATA_SIZE)
+            curve_read_block(sllp, curve, index, data);
+        else
+        {
+            curve_read_block(sllp, curve, index, block);
+            memcpy(data, block + start, part);
+        }
+
+        offset += part;
+        data += part;
+        len -= part;
+    }
+}
+
+int curve_read_range_iov (struct sllp_curve *curve, uint32_t offset,
+                          uint16_t len, struct iovec *iov)
+{
+    int count = 0;
+
+    while(len)
+    {
+        uint8_t index = offset/CURVE_BLOCK_DATA_SIZE;
+        uint16_t start = offset % CURVE_BLOCK_DATA_SIZE;
+        uint16_t part = CURVE_BLOCK_DATA_SIZE - start;
+
+        if(part > len)
+            part = len;
+
+        iov[count].iov_base = (uint8_t *) curve->get_block_ptr(curve, index) +
+                              start;
+        iov[count++].iov_len = part;
+
+        offset += part;
+        len -= part;
+    }
+
+    return count;
+}
+
+void curve_write_block (struct sllp_instance *sllp, struct sllp_curve *curve,
+                        uint8_t block, uint8_t *data)
+{
+    uint8_t digest[CURVE_CSUM_SIZE];
+    uint8_t bins[ENVELOPE_MAX_SIZE];
+    struct envelope_sums sums;
+
+    md5_digest(data, CURVE_BLOCK_DATA_SIZE, digest);
+
+    if(sllp->curves.prefetch[curve->id])
+        prefetch_write(sllp->curves.prefetch[curve->id], block, data);
+    else
+        curve->write_block(curve, block, data);
+
+    struct curve_digests *digests = sllp->curves.digests[curve->id];
+    struct curve_envelopes *envelopes = sllp->curves.envelopes[curve->id];
+
+    if(envelopes)
+        envelope_block(curve->sample_type, data, bins, &sums);
+
+    instance_lock(sllp);
+    memcpy(digests->block[block], digest, CURVE_CSUM_SIZE);
+    digests->dirty[block/8] &= ~(1 << (block % 8));
+    ++digests->generations[block];
+    if(envelopes)
+        envelope_store(curve, envelopes, block, bins, &sums);
+    instance_unlock(sllp);
+}
+
+void curve_update_csum (struct sllp_instance *sllp, struct sllp_curve *curve,
+                        uint8_t *copy)
+{
+    struct curve_digests *digests = sllp->curves.digests[curve->id];
+    unsigned int nblocks = curve->nblocks + 1;
+    uint8_t block[CURVE_BLOCK_DATA_SIZE];
+    uint8_t dirty[sizeof(digests->dirty)];
+    uint32_t generations[256];
+
+    // Take the dirty blocks. They are read and hashed without the lock, as
+    // reading may be slow, and their digests stored unless they change again
+    // meanwhile.
+    instance_lock(sllp);
+    memcpy(dirty, digests->dirty, sizeof(dirty));
+    memcpy(generations, digests->generations, nblocks*sizeof(*generations));
+    instance_unlock(sllp);
+
+    // Dirty blocks are read in batches and hashed in parallel, in place if
+    // they are resident. Without room for a batch, they are hashed one by one,
+    // as in static instances, which keep off the heap, or while another thread
+    // uses the batch buffer.
+    uint8_t *buf = NULL;
+
+    if(!curve->get_block_ptr && !sllp->arena.enabled &&
+       !__atomic_test_and_set(&sllp->curves.csum_busy, __ATOMIC_ACQUIRE))
+    {
+        if(!sllp->curves.csum_buf)
+            sllp->curves.csum_buf = malloc(MD5_MB_MAX_LANES*
+                                           CURVE_BLOCK_DATA_SIZE);
+        buf = sllp->curves.csum_buf;
+
+        if(!buf)
+            __atomic_clear(&sllp->curves.csum_busy, __ATOMIC_RELEASE);
+    }
+
+    unsigned int batch_max = buf || curve->get_block_ptr ?
+                             MD5_MB_MAX_LANES : 1;
+    const uint8_t *batch[MD5_MB_MAX_LANES];
+    uint8_t batch_ids[MD5_MB_MAX_LANES];
+    uint8_t batch_digests[MD5_MB_MAX_LANES][CURVE_CSUM_SIZE];
+    unsigned int count = 0;
+
+    unsigned int i;
+    for(i = 0; i < nblocks; ++i)
+    {
+        if(dirty[i/8] & (1 << (i % 8)))
+        {
+            if(curve->get_block_ptr)
+                batch[count] = curve->get_block_ptr(curve, (uint8_t) i);
+            else
+            {
+                uint8_t *data = buf ? buf + count*CURVE_BLOCK_DATA_SIZE :
+                                      block;
+
+                curve_read_block(sllp, curve, (uint8_t) i, data);
+                batch[count] = data;
+            }
+
+            batch_ids[count++] = i;
+        }
+
+        if(count == batch_max || (count && i == nblocks - 1))
+        {
+            md5_digest_mb(batch, CURVE_BLOCK_DATA_SIZE, batch_digests, count);
+
+            instance_lock(sllp);
+
+            unsigned int j;
+            for(j = 0; j < count; ++j)
+            {
+                uint8_t id = batch_ids[j];
+
+                if(digests->generations[id] != generations[id])
+                    continue;
+
+                memcpy(digests->block[id], batch_digests[j], CURVE_CSUM_SIZE);
+                digests->dirty[id/8] &= ~(1 << (id % 8));
+            }
+
+            instance_unlock(sllp);
+            count = 0;
+        }
+    }
+
+    if(buf)
+        __atomic_clear(&sllp->curves.csum_busy, __ATOMIC_RELEASE);
+
+    // Hashing the digests is quick
+    instance_lock(sllp);
+    md5_digest(&digests->block[0][0], nblocks*CURVE_CSUM_SIZE,
+               curve->checksum);
+    memcpy(sllp->curves.info[curve->id] + 2, curve->checksum,
+           CURVE_CSUM_SIZE);
+    if(copy)
+        memcpy(copy, &digests->block[0][0], nblocks*CURVE_CSUM_SIZE);
+    instance_unlock(sllp);
+}
+
+void curve_envelope (struct sllp_instance *sllp, struct sllp_curve *curve,
+                     uint16_t points, uint8_t *data)
+{
+    struct curve_envelopes *envelopes = sllp->curves.envelopes[curve->id];
+    unsigned int pair = 2*sllp_sample_size(curve->sample_type);
+
+    envelopes_refresh(sllp, curve, envelopes, 0, curve->nblocks);
+
+    // Point k covers bins k*bins/points up to (k+1)*bins/points
+    unsigned int bins = (curve->nblocks + 1)*ENVELOPE_BINS;
+    unsigned int first = 0;
+
+    instance_lock(sllp);
+
+    unsigned int i;
+    for(i = 0; i < points; ++i)
+    {
+        unsigned int end = (i + 1)*bins/points;
+
+        envelope_merge(curve->sample_type, envelopes->bins + first*pair,
+                       end - first, data + i*pair);
+        first = end;
+    }
+
+    instance_unlock(sllp);
+}
+
+void curve_stats (struct sllp_instance *sllp, struct sllp_curve *curve,
+                  uint8_t first, uint8_t last, uint8_t *pair,
+                  struct envelope_sums *sums)
+{
+    struct curve_envelopes *envelopes = sllp->curves.envelopes[curve->id];
+    unsigned int size = 2*sllp_sample_size(curve->sample_type)*ENVELOPE_BINS;
+
+    envelopes_refresh(sllp, curve, envelopes, first, last);
+
+    instance_lock(sllp);
+
+    envelope_merge(curve->sample_type, envelopes->bins + first*size,
+                   (last - first + 1)*ENVELOPE_BINS, pair);
+
+    sums->sum = sums->squares = 0;
+
+    unsigned int i;
+    for(i = first; i <= last; ++i)
+    {
+        sums->sum += envelopes->sums[i].sum;
+        sums->squares += envelopes->sums[i].squares;
+    }
+
+    instance_unlock(sllp);
+}
+
+// Store the envelope of a block. Called with the instance lock held.
+static void envelope_store (struct sllp_curve *curve,
+                            struct curve_envelopes *envelopes, uint8_t block,
+                            const uint8_t *bins,
+                            const struct envelope_sums *sums)
+{
+    unsigned int size = 2*sllp_sample_size(curve->sample_type)*ENVELOPE_BINS;
+
+    memcpy(envelopes->bins + block*size, bins, size);
+    envelopes->sums[block] = *sums;
+    envelopes->stale[block/8] &= ~(1 << (block % 8));
+}
+
+// Bring the envelopes of blocks first to last up to date, reading the stale
+// ones without the instance lock. An envelope is only stored if its block
+// hasn't changed meanwhile, otherwise it stays stale until the next refresh.
+static void envelopes_refresh (struct sllp_instance *sllp,
+                               struct sllp_curve *curve,
+                               struct curve_envelopes *envelopes,
+                               uint8_t first, uint8_t last)
+{
+    struct curve_digests *digests = sllp->curves.digests[curve->id];
+    uint8_t block[CURVE_BLOCK_DATA_SIZE];
+    uint8_t bins[ENVELOPE_MAX_SIZE];
+    struct envelope_sums sums;
+    uint8_t stale[sizeof(envelopes->stale)];
+    uint32_t generations[256];
+
+    instance_lock(sllp);
+    memcpy(stale, envelopes->stale, sizeof(stale));
+    memcpy(generations + first, digests->generations + first,
+           (last - first + 1)*sizeof(*generations));
+    instance_unlock(sllp);
+
+    unsigned int i;
+    for(i = first; i <= last; ++i)
+    {
+        if(!(stale[i/8] & (1 << (i % 8))))
+            continue;
+
+        const uint8_t *data = block;
+
+        if(curve->get_block_ptr)
+            data = curve->get_block_ptr(curve, (uint8_t) i);
+        else
+            curve_read_block(sllp, curve, (uint8_t) i, block);
+
+        envelope_block(curve->sample_type, data, bins, &sums);
+
+        instance_lock(sllp);
+        if(digests->generations[i] == generations[i])
+            envelope_store(curve, envelopes, i, bins, &sums);
+        instance_unlock(sllp);
+    }
+}
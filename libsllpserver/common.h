@@ -5,35 +5,131 @@
 #include <stdint.h>
 
 #include "sllp_server.h"
-#include "sllp_list.h"
+#include "curve_prefetch.h"
+#include "curve_envelope.h"
 
 #define VARIABLE_MIN_SIZE 1u
-#define VARIABLE_MAX_SIZE 127u
+#define VARIABLE_MAX_SIZE SLLP_MAX_VAR_SIZE
 
-#define CURVE_INFO_SIZE 18u
-#define CURVE_CSUM_SIZE 16
-#define CURVE_BLOCK_DATA_SIZE 16384
+#define CURVE_INFO_SIZE SLLP_CURVE_INFO_SIZE
+#define CURVE_CSUM_SIZE SLLP_CURVE_CSUM_SIZE
+#define CURVE_BLOCK_DATA_SIZE SLLP_CURVE_BLOCK_SIZE
 
-#define MAX_VARIABLES 128u
-#define MAX_GROUPS 128u
-#define MAX_CURVES 128u
+#define MAX_VARIABLES SLLP_MAX_VARIABLES
+#define MAX_GROUPS SLLP_MAX_GROUPS
+#define MAX_CURVES SLLP_MAX_CURVES
+
+// Allocations from the arena of a static instance are rounded up to keep
+// them aligned for any type
+#define ARENA_ALIGN 16u
+#define ARENA_ROUND(size) \
+    (((size) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+// A stretch of contiguous user memory covering one or more consecutive
+// variables of a group
+struct group_run
+{
+    uint8_t  *data;                 // Start of the run.
+    uint16_t size;                  // How many bytes the run spans.
+};
 
 struct sllp_group
 {
+    unsigned int     seq;           // Sequence lock guarding the group's
+                                    // contents in concurrent mode.
     uint8_t          id;            // ID of the group, used in the protocol.
     bool             writable;      // Determine if the group is writable.
-    uint8_t          data_size;     // How many bytes all variable's values
+    uint16_t         data_size;     // How many bytes all variable's values
                                     // amount to.
-    struct sllp_list vars_list;     // List of the variables contained in the
-                                    // group.
+    unsigned int     vars_count;    // How many variables the group contains.
+    struct sllp_var *vars[MAX_VARIABLES+1]; // Variables contained in the group,
+                                    // in insertion order. NULL-terminated, so
+                                    // it can be handed to the hook as is.
+    uint8_t          ids[MAX_VARIABLES]; // Their IDs: the payload of CMD_GROUP.
+    uint32_t         members[MAX_VARIABLES/32]; // Bitmap of the same IDs.
+
+    // Read plan: the variables' values, in protocol order, as a list of runs.
+    // Variables adjacent in user memory share a single run.
+    unsigned int     runs_count;
+    struct group_run runs[MAX_VARIABLES];
+};
+
+// Digests of the blocks of a curve, kept up to date as blocks are written.
+// The checksum of the curve is the MD5 of all the block digests, in order.
+struct curve_digests
+{
+    uint8_t dirty[256/8];           // Bitmap of the blocks whose digest is out
+                                    // of date.
+    uint32_t generations[256];      // Bumped by each write or change of a
+                                    // block. Too wide to wrap around while
+                                    // a block is read.
+    uint8_t block[][CURVE_CSUM_SIZE];
+};
+
+// Envelopes of the blocks of a curve with a sample type: ENVELOPE_BINS pairs
+// of minimum and maximum samples per block, and the sums of its samples.
+// Calculated when a client writes a block, or on demand.
+struct curve_envelopes
+{
+    uint8_t stale[256/8];           // Bitmap of the blocks whose envelope is
+                                    // out of date.
+    struct envelope_sums *sums;     // One per block, past the bins.
+    uint8_t bins[];
 };
 
 struct sllp_instance
 {
-    struct sllp_list vars_list, groups_list, curves_list;
+    // Registered entities, indexed by their protocol ID
+    struct
+    {
+        struct sllp_var *list[MAX_VARIABLES];
+        unsigned int seq[MAX_VARIABLES];    // Sequence lock of each value
+        uint8_t info[MAX_VARIABLES];        // Payload of CMD_VARS_LIST
+        unsigned int count;
+    } vars;
+
+    // Groups removed by CMD_REMOVE_ALL_GROUPS stay allocated past count, to be
+    // reused by the next CMD_CREATE_GROUP
+    struct
+    {
+        struct sllp_group *list[MAX_GROUPS];
+        uint8_t info[MAX_GROUPS];           // Payload of CMD_GROUPS_LIST
+        unsigned int count;
+        unsigned int fixed;         // Standard groups and those of a table,
+                                    // which clients can't remove.
+    } groups;
+
+    struct sllp_command *commands[256]; // Added by the user, by code
+
+    struct
+    {
+        struct sllp_curve *list[MAX_CURVES];
+        struct curve_prefetch *prefetch[MAX_CURVES]; // Read-ahead engines
+        struct curve_digests *digests[MAX_CURVES];
+        struct curve_envelopes *envelopes[MAX_CURVES]; // NULL without a
+                                    // sample type
+        uint8_t info[MAX_CURVES][CURVE_INFO_SIZE]; // Payload of
+                                    // CMD_CURVES_LIST
+        uint8_t *csum_buf;          // Blocks being hashed in parallel
+        bool csum_busy;             // Whether a thread is using csum_buf
+        unsigned int count;
+    } curves;
+
     struct sllp_group group_all, group_read, group_write;
-    struct sllp_var *modified_list[MAX_VARIABLES+1];
     sllp_hook_t hook;
+
+    // Memory of an instance created by sllp_new_static, where everything is
+    // allocated from
+    struct
+    {
+        bool    enabled;
+        uint8_t *next;
+        size_t  left;
+    } arena;
+
+    bool concurrent;                // Whether sllp_set_concurrent was enabled
+    bool lock;                      // Serializes commands that modify groups
+                                    // or more than one variable.
 };
 
 enum group_id
@@ -45,8 +141,200 @@ enum group_id
     GROUP_STANDARD_COUNT,
 };
 
+/*
+ * Sequence locks. A writer makes the counter odd while it modifies the guarded
+ * data; readers copy the data and retry if the counter was odd or changed
+ * meanwhile. Writers exclude each other by acquiring the counter with a CAS.
+ */
+static inline unsigned int seq_read_begin (const unsigned int *seq)
+{
+    unsigned int start;
+
+    while((start = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1)
+        ;
+
+    return start;
+}
+
+static inline bool seq_read_retry (const unsigned int *seq, unsigned int start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+static inline void seq_write_lock (unsigned int *seq)
+{
+    unsigned int start;
+
+    do
+        start = __atomic_load_n(seq, __ATOMIC_RELAXED) & ~1u;
+    while(!__atomic_compare_exchange_n(seq, &start, start + 1, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_write_unlock (unsigned int *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+// Whether a group contains the variable of the given ID
+static inline bool group_contains (const struct sllp_group *group, uint8_t id)
+{
+    return group->members[id/32] & (1u << id%32);
+}
+
+// Entry of a group in CMD_GROUPS_LIST
+static inline void group_list_update (struct sllp_instance *sllp,
+                                      struct sllp_group *group)
+{
+    sllp->groups.info[group->id] = (group->writable ? SLLP_WRITABLE : 0) +
+                                   group->vars_count;
+}
+
+// Number of groups, safe to call while another thread creates or removes groups
+static inline unsigned int groups_count (struct sllp_instance *sllp)
+{
+    return __atomic_load_n(&sllp->groups.count, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Serialize commands that change the instance's groups or write more than one
+ * variable. No-ops unless the instance is in concurrent mode.
+ */
+void instance_lock (struct sllp_instance *sllp);
+void instance_unlock (struct sllp_instance *sllp);
+
+/*
+ * Allocate memory for an instance, from its arena if it was created by
+ * sllp_new_static and from the heap otherwise. instance_free releases it,
+ * and is a no-op for arena memory.
+ */
+void *instance_alloc (struct sllp_instance *sllp, size_t size);
+void instance_free (struct sllp_instance *sllp, void *ptr);
+
+// Size of the block digests and envelopes of a curve, as allocated
+size_t curve_digests_size (const struct sllp_curve *curve);
+size_t curve_envelopes_size (const struct sllp_curve *curve);
+
 enum sllp_err group_init (struct sllp_group *group, uint8_t id, bool writable);
 
+/**
+ * Append a variable to a group, updating its size and write permission.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either group or var is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: var is already in the group.</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: the group is full.</li>
+ * </ul>
+ */
+enum sllp_err group_add_var (struct sllp_group *group, struct sllp_var *var);
 
-#endif	/* COMMON_H */
+/**
+ * Copy the values of all the variables of a group to data, following the
+ * group's read plan. data must hold at least group->data_size bytes.
+ */
+void group_read (struct sllp_group *group, uint8_t *data);
 
+/**
+ * Copy data to all the variables of a group, following the group's read plan.
+ * data must hold group->data_size bytes.
+ */
+void group_write (struct sllp_group *group, const uint8_t *data);
+
+/**
+ * Reference the values of all the variables of a group in iov, one entry per
+ * run of the group's read plan. iov must have room for group->runs_count
+ * entries.
+ *
+ * @return How many entries of iov were filled.
+ */
+int group_read_iov (struct sllp_group *group, struct iovec *iov);
+
+/**
+ * Copy a consistent view of a group to snapshot, which can then be used to
+ * read the group even if it's being recreated by another thread.
+ */
+void group_snapshot (struct sllp_group *group, struct sllp_group *snapshot);
+
+/**
+ * Concurrent mode versions of group_read and group_write. Each value is read
+ * or written under the sequence lock of its variable, and a read is retried
+ * until it doesn't overlap with any write. group_write_seq must be called
+ * with the instance lock held.
+ */
+void group_read_seq (struct sllp_instance *sllp, struct sllp_group *group,
+                     uint8_t *data);
+void group_write_seq (struct sllp_instance *sllp, struct sllp_group *group,
+                      const uint8_t *data);
+
+/**
+ * Concurrent mode read and write of a single variable.
+ */
+void var_read_seq (struct sllp_instance *sllp, struct sllp_var *var,
+                   uint8_t *data);
+void var_write_seq (struct sllp_instance *sllp, struct sllp_var *var,
+                    const uint8_t *data);
+
+/**
+ * Read a block of a curve, through its read-ahead engine if it has one.
+ */
+void curve_read_block (struct sllp_instance *sllp, struct sllp_curve *curve,
+                       uint8_t block, uint8_t *data);
+
+/**
+ * Read len bytes of a curve starting at offset, which must be within the
+ * curve. Uses read_range if the curve has it and no read-ahead, and the
+ * blocks covered otherwise.
+ */
+void curve_read_range (struct sllp_instance *sllp, struct sllp_curve *curve,
+                       uint32_t offset, uint16_t len, uint8_t *data);
+
+/**
+ * Reference len bytes of a curve with a get_block_ptr callback in iov, one
+ * entry per block covered.
+ *
+ * @return How many entries of iov were filled.
+ */
+int curve_read_range_iov (struct sllp_curve *curve, uint32_t offset,
+                          uint16_t len, struct iovec *iov);
+
+/**
+ * Write a block of a curve, through its read-ahead engine if it has one, and
+ * update the block's digest, and envelope if it has a sample type, from data.
+ */
+void curve_write_block (struct sllp_instance *sllp, struct sllp_curve *curve,
+                        uint8_t block, uint8_t *data);
+
+/**
+ * Bring the block digests of a curve up to date, reading and hashing only the
+ * dirty blocks, and derive curve->checksum from them. Blocks are read without
+ * the instance lock. Unless copy is NULL, the block digests are copied to it
+ * along with the checksum, so that they are consistent in concurrent mode.
+ */
+void curve_update_csum (struct sllp_instance *sllp, struct sllp_curve *curve,
+                        uint8_t *copy);
+
+/**
+ * Envelope of a curve with a sample type, in points pairs of minimum and
+ * maximum samples. Each point covers whole bins of the block envelopes, which
+ * are brought up to date first, reading stale blocks without the instance
+ * lock. points must be between 1 and the number of bins of the curve.
+ */
+void curve_envelope (struct sllp_instance *sllp, struct sllp_curve *curve,
+                     uint16_t points, uint8_t *data);
+
+/**
+ * Statistics of blocks first to last of a curve with a sample type, from the
+ * block envelopes, which are brought up to date first as in curve_envelope.
+ *
+ * @param pair [output] Minimum and maximum sample.
+ * @param sums [output] Sums of the samples and of their squares.
+ */
+void curve_stats (struct sllp_instance *sllp, struct sllp_curve *curve,
+                  uint8_t first, uint8_t last, uint8_t *pair,
+                  struct envelope_sums *sums);
+
+#endif	/* COMMON_H */
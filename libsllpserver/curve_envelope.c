@@ -0,0 +1,242 @@
+#include "curve_envelope.h"
+
+#include <string.h>
+
+typedef void (*envelope_kernel_t) (const uint8_t *block, uint8_t *bins,
+                                   struct envelope_sums *sums);
+
+/*
+ * Envelope of the bins of a block and sums of its samples, one vector of
+ * samples at a time. Lanes are selected with comparison masks, so the same
+ * code serves every sample type and instruction set. Sums are accumulated
+ * within each bin as the sample type's accumulator defines, and in doubles
+ * across bins.
+ */
+#define ENVELOPE_KERNEL(func, type, mask, vec_size, target, accumulator)      \
+target static void func (const uint8_t *block, uint8_t *bins,                 \
+                         struct envelope_sums *sums)                          \
+{                                                                             \
+    typedef type vec __attribute__((vector_size(vec_size)));                  \
+    typedef mask vmask __attribute__((vector_size(vec_size)));                \
+    unsigned int b, i;                                                        \
+                                                                              \
+    sums->sum = sums->squares = 0;                                            \
+                                                                              \
+    for(b = 0; b < ENVELOPE_BINS; ++b)                                        \
+    {                                                                         \
+        const uint8_t *bin = block + b*ENVELOPE_BIN_SIZE;                     \
+        vec lo, hi, v;                                                        \
+        vmask less, more;                                                     \
+                                                                              \
+        accumulator##_INIT(v);                                                \
+                                                                              \
+        memcpy(&lo, bin, sizeof(lo));                                         \
+        hi = v = lo;                                                          \
+        accumulator##_ADD(v);                                                 \
+                                                                              \
+        for(i = sizeof(v); i < ENVELOPE_BIN_SIZE; i += sizeof(v))             \
+        {                                                                     \
+            memcpy(&v, bin + i, sizeof(v));                                   \
+            less = v < lo;                                                    \
+            more = v > hi;                                                    \
+            lo = (vec) (((vmask) lo & ~less) | ((vmask) v & less));           \
+            hi = (vec) (((vmask) hi & ~more) | ((vmask) v & more));           \
+            accumulator##_ADD(v);                                             \
+        }                                                                     \
+                                                                              \
+        type min = lo[0], max = hi[0];                                        \
+                                                                              \
+        for(i = 1; i < sizeof(v)/sizeof(type); ++i)                           \
+        {                                                                     \
+            if(lo[i] < min)                                                   \
+                min = lo[i];                                                  \
+            if(hi[i] > max)                                                   \
+                max = hi[i];                                                  \
+        }                                                                     \
+                                                                              \
+        memcpy(bins, &min, sizeof(min));                                      \
+        memcpy(bins + sizeof(min), &max, sizeof(max));                        \
+        bins += 2*sizeof(type);                                               \
+                                                                              \
+        accumulator##_REDUCE(sums);                                           \
+    }                                                                         \
+}
+
+// Pairs of 16-bit samples are split into the low and high halves of 32-bit
+// lanes, sign extended. A bin's sums fit those lanes, and so do the squares
+// of a pair, at most 2^31: their sums carry into a second vector of lanes,
+// making them exact 64-bit integers.
+#define INT16_INIT(v)                                                         \
+    typedef int32_t vint __attribute__((vector_size(sizeof(v))));             \
+    typedef uint32_t vuint __attribute__((vector_size(sizeof(v))));           \
+    vint sum = {0};                                                           \
+    vuint squares = {0}, carries = {0}
+
+#define INT16_ADD(v)                                                          \
+    do {                                                                      \
+        vint low = ((vint) v << 16) >> 16;                                    \
+        vint high = (vint) v >> 16;                                           \
+        vuint pair = (vuint) (low*low) + (vuint) (high*high);                 \
+        sum += low + high;                                                    \
+        squares += pair;                                                      \
+        carries -= (vuint) (squares < pair);                                  \
+    } while(0)
+
+#define INT16_REDUCE(sums)                                                    \
+    for(i = 0; i < sizeof(sum)/sizeof(sum[0]); ++i)                           \
+    {                                                                         \
+        sums->sum += sum[i];                                                  \
+        sums->squares += carries[i]*4294967296.0 + squares[i];                \
+    }
+
+// 32-bit samples are summed in double lanes, which keep the sums of integers
+// exact, each half of a vector in its own vectors of the same size
+#define WIDE_INIT(v)                                                          \
+    typedef __typeof__(v[0]) vhalf                                            \
+        __attribute__((vector_size(sizeof(v)/2)));                            \
+    typedef double vdbl __attribute__((vector_size(sizeof(v))));              \
+    vdbl sum[2] = {{0}}, squares[2] = {{0}}
+
+#define WIDE_ADD(v)                                                           \
+    do {                                                                      \
+        vhalf half[2];                                                        \
+        memcpy(half, &v, sizeof(half));                                       \
+        vdbl d0 = __builtin_convertvector(half[0], vdbl);                     \
+        vdbl d1 = __builtin_convertvector(half[1], vdbl);                     \
+        sum[0] += d0;                                                         \
+        sum[1] += d1;                                                         \
+        squares[0] += d0*d0;                                                  \
+        squares[1] += d1*d1;                                                  \
+    } while(0)
+
+#define WIDE_REDUCE(sums)                                                     \
+    for(i = 0; i < sizeof(sum[0])/sizeof(double); ++i)                        \
+    {                                                                         \
+        sums->sum += sum[0][i] + sum[1][i];                                   \
+        sums->squares += squares[0][i] + squares[1][i];                       \
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+ENVELOPE_KERNEL(envelope_int16_sse2, int16_t, int16_t, 16, TARGET_SSE2,
+                INT16)
+ENVELOPE_KERNEL(envelope_int32_sse2, int32_t, int32_t, 16, TARGET_SSE2,
+                WIDE)
+ENVELOPE_KERNEL(envelope_float_sse2, float, int32_t, 16, TARGET_SSE2,
+                WIDE)
+ENVELOPE_KERNEL(envelope_int16_avx2, int16_t, int16_t, 32, TARGET_AVX2,
+                INT16)
+ENVELOPE_KERNEL(envelope_int32_avx2, int32_t, int32_t, 32, TARGET_AVX2,
+                WIDE)
+ENVELOPE_KERNEL(envelope_float_avx2, float, int32_t, 32, TARGET_AVX2,
+                WIDE)
+
+#endif
+
+// Vectors the compiler maps to whatever the target has, or splits
+ENVELOPE_KERNEL(envelope_int16_generic, int16_t, int16_t, 16, ,
+                INT16)
+ENVELOPE_KERNEL(envelope_int32_generic, int32_t, int32_t, 16, ,
+                WIDE)
+ENVELOPE_KERNEL(envelope_float_generic, float, int32_t, 16, ,
+                WIDE)
+
+// Merge of pairs of samples, on the few bins of each point
+#define ENVELOPE_MERGE(func, type)                                            \
+static void func (const uint8_t *bins, unsigned int count, uint8_t *pair)     \
+{                                                                             \
+    type min, max, v;                                                         \
+                                                                              \
+    memcpy(&min, bins, sizeof(min));                                          \
+    memcpy(&max, bins + sizeof(min), sizeof(max));                            \
+                                                                              \
+    while(--count)                                                            \
+    {                                                                         \
+        bins += 2*sizeof(type);                                               \
+        memcpy(&v, bins, sizeof(v));                                          \
+        if(v < min)                                                           \
+            min = v;                                                          \
+        memcpy(&v, bins + sizeof(v), sizeof(v));                              \
+        if(v > max)                                                           \
+            max = v;                                                          \
+    }                                                                         \
+                                                                              \
+    memcpy(pair, &min, sizeof(min));                                          \
+    memcpy(pair + sizeof(min), &max, sizeof(max));                            \
+}
+
+ENVELOPE_MERGE(envelope_merge_int16, int16_t)
+ENVELOPE_MERGE(envelope_merge_int32, int32_t)
+ENVELOPE_MERGE(envelope_merge_float, float)
+
+struct envelope_engine
+{
+    const char *name;
+    envelope_kernel_t kernels[SLLP_SAMPLE_MAX]; // Indexed by sample type
+};
+
+// <editor-fold defaultstate="collapsed" desc="Auxiliary functions">
+static const struct envelope_engine *engine_select (void);
+// </editor-fold>
+
+void envelope_block (uint8_t type, const uint8_t *block, uint8_t *bins,
+                     struct envelope_sums *sums)
+{
+    engine_select()->kernels[type](block, bins, sums);
+}
+
+void envelope_merge (uint8_t type, const uint8_t *bins, unsigned int count,
+                     uint8_t *pair)
+{
+    if(type == SLLP_SAMPLE_INT16)
+        envelope_merge_int16(bins, count, pair);
+    else if(type == SLLP_SAMPLE_INT32)
+        envelope_merge_int32(bins, count, pair);
+    else
+        envelope_merge_float(bins, count, pair);
+}
+
+const char *envelope_engine (void)
+{
+    return engine_select()->name;
+}
+
+// Choose the widest instruction set the CPU supports, once
+static const struct envelope_engine *engine_select (void)
+{
+    static const struct envelope_engine engines[] = {
+#if defined(__x86_64__) || defined(__i386__)
+        {"avx2", {NULL, envelope_int16_avx2, envelope_int32_avx2,
+                  envelope_float_avx2}},
+        {"sse2", {NULL, envelope_int16_sse2, envelope_int32_sse2,
+                  envelope_float_sse2}},
+#endif
+        {"generic", {NULL, envelope_int16_generic, envelope_int32_generic,
+                     envelope_float_generic}},
+    };
+    static const struct envelope_engine *selected;
+
+    const struct envelope_engine *engine = __atomic_load_n(&selected,
+                                                           __ATOMIC_RELAXED);
+
+    if(engine)
+        return engine;
+
+    engine = &engines[sizeof(engines)/sizeof(engines[0]) - 1];
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2"))
+        engine = &engines[0];
+    else if(__builtin_cpu_supports("sse2"))
+        engine = &engines[1];
+#endif
+
+    __atomic_store_n(&selected, engine, __ATOMIC_RELAXED);
+
+    return engine;
+}
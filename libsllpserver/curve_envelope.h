@@ -0,0 +1,46 @@
+#ifndef CURVE_ENVELOPE_H
+#define	CURVE_ENVELOPE_H
+
+#include <stdint.h>
+
+#include "sllp_protocol.h"
+
+#define ENVELOPE_BINS       64      // Bins each block is summarized in
+#define ENVELOPE_BIN_SIZE   (SLLP_CURVE_BLOCK_SIZE/ENVELOPE_BINS)
+#define ENVELOPE_MAX_SIZE   (ENVELOPE_BINS*2*4) // Bins of a block of the
+                                                // widest sample type
+
+// Sums of the samples of a block, for statistics
+struct envelope_sums
+{
+    double sum;
+    double squares;
+};
+
+/**
+ * Minimum and maximum sample of each bin of a block, in host byte order, and
+ * sums of its samples, in a single pass. The instruction set is chosen at run
+ * time, from what the CPU supports.
+ *
+ * @param type [input] Sample type of the curve, from enum sllp_sample_type.
+ * @param block [input] The block, SLLP_CURVE_BLOCK_SIZE bytes.
+ * @param bins [output] ENVELOPE_BINS pairs of samples, minimum then maximum.
+ * @param sums [output] Sum of the samples and of their squares.
+ */
+void envelope_block (uint8_t type, const uint8_t *block, uint8_t *bins,
+                     struct envelope_sums *sums);
+
+/**
+ * Merge count consecutive pairs of samples, as filled in by envelope_block,
+ * into one.
+ */
+void envelope_merge (uint8_t type, const uint8_t *bins, unsigned int count,
+                     uint8_t *pair);
+
+/**
+ * Name of the instruction set envelope_block uses: "avx2", "sse2" or
+ * "generic".
+ */
+const char *envelope_engine (void);
+
+#endif	/* CURVE_ENVELOPE_H */
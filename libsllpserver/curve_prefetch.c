@@ -0,0 +1,267 @@
+#include "curve_prefetch.h"
+#include "common.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum slot_state
+{
+    SLOT_EMPTY,
+    SLOT_LOADING,                   // Being read by the worker
+    SLOT_READY,
+};
+
+struct prefetch_slot
+{
+    enum slot_state state;
+    uint8_t block;
+    unsigned int users;             // Transmissions copying the block out
+    uint8_t *data;
+};
+
+struct curve_prefetch
+{
+    struct sllp_curve *curve;
+    unsigned int depth;
+
+    pthread_t thread;
+    pthread_mutex_t io;             // Serializes read_block and write_block
+
+    pthread_mutex_t lock;           // Guards everything below
+    pthread_cond_t wake;            // The worker may have something to do
+    pthread_cond_t ready;           // A slot finished loading
+    bool stop;
+    unsigned int generation;        // Incremented by every write
+
+    // Blocks to be kept in memory, the ones following the last transmitted
+    unsigned int window_first, window_last;
+
+    unsigned int slots_count;
+    struct prefetch_slot slots[];
+};
+
+// <editor-fold defaultstate="collapsed" desc="Auxiliary functions">
+static void *prefetch_run (void *arg);
+static struct prefetch_slot *slot_find (struct curve_prefetch *pf,
+                                        unsigned int block);
+static struct prefetch_slot *slot_evictable (struct curve_prefetch *pf);
+// </editor-fold>
+
+struct curve_prefetch *prefetch_new (struct sllp_curve *curve,
+                                     unsigned int depth)
+{
+    // One slot more than the depth: the transmitted block stays in memory
+    // while the following ones are read
+    unsigned int slots_count = depth + 1;
+
+    struct curve_prefetch *pf = malloc(sizeof(*pf) +
+                                       slots_count*sizeof(pf->slots[0]));
+
+    if(!pf)
+        return NULL;
+
+    uint8_t *data = malloc(slots_count*CURVE_BLOCK_DATA_SIZE);
+
+    if(!data)
+        goto prefetch_new_err;
+
+    pf->curve = curve;
+    pf->depth = depth;
+    pf->stop = false;
+    pf->generation = 0;
+    pf->window_first = 1;
+    pf->window_last = 0;
+    pf->slots_count = slots_count;
+
+    unsigned int i;
+    for(i = 0; i < slots_count; ++i)
+    {
+        pf->slots[i].state = SLOT_EMPTY;
+        pf->slots[i].users = 0;
+        pf->slots[i].data = data + i*CURVE_BLOCK_DATA_SIZE;
+    }
+
+    pthread_mutex_init(&pf->io, NULL);
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->wake, NULL);
+    pthread_cond_init(&pf->ready, NULL);
+
+    if(pthread_create(&pf->thread, NULL, prefetch_run, pf))
+        goto prefetch_new_err_thread;
+
+    return pf;
+
+prefetch_new_err_thread:
+    pthread_cond_destroy(&pf->ready);
+    pthread_cond_destroy(&pf->wake);
+    pthread_mutex_destroy(&pf->lock);
+    pthread_mutex_destroy(&pf->io);
+    free(data);
+prefetch_new_err:
+    free(pf);
+
+    return NULL;
+}
+
+void prefetch_destroy (struct curve_prefetch *pf)
+{
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = true;
+    pthread_cond_signal(&pf->wake);
+    pthread_mutex_unlock(&pf->lock);
+
+    pthread_join(pf->thread, NULL);
+
+    pthread_cond_destroy(&pf->ready);
+    pthread_cond_destroy(&pf->wake);
+    pthread_mutex_destroy(&pf->lock);
+    pthread_mutex_destroy(&pf->io);
+    free(pf->slots[0].data);
+    free(pf);
+}
+
+void prefetch_transmit (struct curve_prefetch *pf, uint8_t block,
+                        uint8_t *data)
+{
+    struct prefetch_slot *slot;
+
+    pthread_mutex_lock(&pf->lock);
+
+    // Wait for the block if it's being read. A write may discard it meanwhile.
+    while((slot = slot_find(pf, block)) && slot->state == SLOT_LOADING)
+        pthread_cond_wait(&pf->ready, &pf->lock);
+
+    // Read the following blocks while this one is sent
+    pf->window_first = block + 1;
+    pf->window_last = block + pf->depth;
+    if(pf->window_last > pf->curve->nblocks)
+        pf->window_last = pf->curve->nblocks;
+
+    pthread_cond_signal(&pf->wake);
+
+    if(!slot)
+    {
+        pthread_mutex_unlock(&pf->lock);
+        prefetch_read(pf, block, data);
+        return;
+    }
+
+    ++slot->users;
+    pthread_mutex_unlock(&pf->lock);
+
+    memcpy(data, slot->data, CURVE_BLOCK_DATA_SIZE);
+
+    pthread_mutex_lock(&pf->lock);
+    if(!--slot->users)
+        pthread_cond_signal(&pf->wake);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+void prefetch_read (struct curve_prefetch *pf, uint8_t block, uint8_t *data)
+{
+    pthread_mutex_lock(&pf->io);
+    pf->curve->read_block(pf->curve, block, data);
+    pthread_mutex_unlock(&pf->io);
+}
+
+void prefetch_write (struct curve_prefetch *pf, uint8_t block, uint8_t *data)
+{
+    pthread_mutex_lock(&pf->io);
+    pf->curve->write_block(pf->curve, block, data);
+
+    // Discard the old copy, and any read that may have got the old contents.
+    // The io lock is still held, so no read can start before this.
+    pthread_mutex_lock(&pf->lock);
+    ++pf->generation;
+
+    struct prefetch_slot *slot = slot_find(pf, block);
+    if(slot && slot->state == SLOT_READY)
+        slot->state = SLOT_EMPTY;
+
+    pthread_cond_signal(&pf->wake);
+    pthread_mutex_unlock(&pf->lock);
+
+    pthread_mutex_unlock(&pf->io);
+}
+
+static void *prefetch_run (void *arg)
+{
+    struct curve_prefetch *pf = arg;
+
+    pthread_mutex_lock(&pf->lock);
+
+    while(!pf->stop)
+    {
+        // First block of the window not in memory yet
+        unsigned int block;
+        for(block = pf->window_first; block <= pf->window_last; ++block)
+            if(!slot_find(pf, block))
+                break;
+
+        struct prefetch_slot *slot = NULL;
+
+        if(block <= pf->window_last)
+            slot = slot_evictable(pf);
+
+        if(!slot)
+        {
+            pthread_cond_wait(&pf->wake, &pf->lock);
+            continue;
+        }
+
+        slot->state = SLOT_LOADING;
+        slot->block = block;
+        unsigned int generation = pf->generation;
+
+        pthread_mutex_unlock(&pf->lock);
+
+        prefetch_read(pf, block, slot->data);
+
+        pthread_mutex_lock(&pf->lock);
+
+        slot->state = generation == pf->generation ? SLOT_READY : SLOT_EMPTY;
+        pthread_cond_broadcast(&pf->ready);
+    }
+
+    pthread_mutex_unlock(&pf->lock);
+
+    return NULL;
+}
+
+// Slot holding or loading a block, if any
+static struct prefetch_slot *slot_find (struct curve_prefetch *pf,
+                                        unsigned int block)
+{
+    unsigned int i;
+    for(i = 0; i < pf->slots_count; ++i)
+        if(pf->slots[i].state != SLOT_EMPTY && pf->slots[i].block == block)
+            return &pf->slots[i];
+
+    return NULL;
+}
+
+// Slot that can be loaded with another block: empty or holding a block out of
+// the window, and not being copied out
+static struct prefetch_slot *slot_evictable (struct curve_prefetch *pf)
+{
+    struct prefetch_slot *victim = NULL;
+
+    unsigned int i;
+    for(i = 0; i < pf->slots_count; ++i)
+    {
+        struct prefetch_slot *slot = &pf->slots[i];
+
+        if(slot->users || slot->state == SLOT_LOADING)
+            continue;
+
+        if(slot->state == SLOT_EMPTY)
+            return slot;
+
+        if(slot->block < pf->window_first || slot->block > pf->window_last)
+            victim = slot;
+    }
+
+    return victim;
+}
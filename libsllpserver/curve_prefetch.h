@@ -0,0 +1,47 @@
+#ifndef CURVE_PREFETCH_H
+#define	CURVE_PREFETCH_H
+
+#include <stdint.h>
+
+#include "sllp_server.h"
+
+// Read-ahead engine of a curve. Every block access of a curve that has one
+// must go through it, as it serializes the calls to read_block and
+// write_block with its worker thread.
+struct curve_prefetch;
+
+/**
+ * Start a read-ahead engine for a curve.
+ *
+ * @param curve [input] The curve whose blocks are read ahead.
+ * @param depth [input] How many blocks to read past each transmitted one.
+ *
+ * @return The engine or NULL if there wasn't enough memory or the worker
+ *         thread couldn't be created.
+ */
+struct curve_prefetch *prefetch_new (struct sllp_curve *curve,
+                                     unsigned int depth);
+
+/**
+ * Stop the worker thread of an engine and deallocate it.
+ */
+void prefetch_destroy (struct curve_prefetch *pf);
+
+/**
+ * Get a block to be transmitted, from memory if it was read ahead, and
+ * schedule the reading of the blocks that follow it.
+ */
+void prefetch_transmit (struct curve_prefetch *pf, uint8_t block,
+                        uint8_t *data);
+
+/**
+ * Read a block from the device, bypassing the read-ahead buffers.
+ */
+void prefetch_read (struct curve_prefetch *pf, uint8_t block, uint8_t *data);
+
+/**
+ * Write a block to the device, discarding any copy read ahead.
+ */
+void prefetch_write (struct curve_prefetch *pf, uint8_t block, uint8_t *data);
+
+#endif	/* CURVE_PREFETCH_H */
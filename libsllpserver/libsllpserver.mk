@@ -1,5 +1,10 @@
 libsllpserver_OBJS_LIB = libsllpserver/common.o \
 	libsllpserver/message.o \
-	libsllpserver/sllp_list.o \
 	libsllpserver/sllp_server.o \
-	libsllpserver/md5/md5.o
+	libsllpserver/sllp_net.o \
+	libsllpserver/sllp_net_uring.o \
+	libsllpserver/curve_prefetch.o \
+	libsllpserver/curve_envelope.o \
+	libsllpserver/sllp_curve_mmap.o \
+	libsllpserver/md5/md5.o \
+	libsllpserver/md5/md5_mb.o
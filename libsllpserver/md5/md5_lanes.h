@@ -0,0 +1,74 @@
+/*
+ * Multi-buffer MD5 over SIMD lanes. Included by md5_mb.c once per instruction
+ * set, with these defined:
+ *
+ *   MD5_LANES_FUNC    name of the function to be defined
+ *   MD5_LANES_VEC     vector type of MD5_LANES uint32_t
+ *   MD5_LANES         how many buffers are hashed in parallel
+ *   MD5_LANES_TARGET  function attribute enabling the instruction set
+ *
+ * The function hashes exactly MD5_LANES buffers of len bytes each.
+ */
+
+static MD5_LANES_TARGET
+void MD5_LANES_FUNC (const uint8_t *const *data, size_t len,
+                     uint8_t (*digests)[MD5_DIGEST_SIZE])
+{
+    typedef MD5_LANES_VEC vec;
+
+    vec a = (vec){0} + 0x67452301u;
+    vec b = (vec){0} + 0xefcdab89u;
+    vec c = (vec){0} + 0x98badcfeu;
+    vec d = (vec){0} + 0x10325476u;
+
+    // The last bytes of every buffer, followed by the padding and the length
+    // in bits: one or two more blocks, laid out the same in every lane
+    size_t full = len/64, rest = len % 64;
+    size_t blocks = full + (rest < 56 ? 1 : 2);
+    uint8_t tail[MD5_LANES][128];
+
+    unsigned int l;
+    for(l = 0; l < MD5_LANES; ++l)
+    {
+        memset(tail[l], 0, sizeof(tail[l]));
+        memcpy(tail[l], data[l] + full*64, rest);
+        tail[l][rest] = 0x80;
+        store_le64(tail[l] + (blocks - full)*64 - 8, (uint64_t) len << 3);
+    }
+
+    size_t i;
+    for(i = 0; i < blocks; ++i)
+    {
+        // Transpose: word j of every lane goes to x[j]
+        uint32_t words[16][MD5_LANES];
+        vec x[16];
+
+        for(l = 0; l < MD5_LANES; ++l)
+        {
+            const uint8_t *block = i < full ? data[l] + i*64 :
+                                              tail[l] + (i - full)*64;
+            unsigned int j;
+            for(j = 0; j < 16; ++j)
+                words[j][l] = load_le32(block + 4*j);
+        }
+
+        memcpy(x, words, sizeof(x));
+
+        vec aa = a, bb = b, cc = c, dd = d;
+
+        MD5_ROUNDS(a, b, c, d, x);
+
+        a += aa;
+        b += bb;
+        c += cc;
+        d += dd;
+    }
+
+    for(l = 0; l < MD5_LANES; ++l)
+    {
+        store_le32(digests[l], a[l]);
+        store_le32(digests[l] + 4, b[l]);
+        store_le32(digests[l] + 8, c[l]);
+        store_le32(digests[l] + 12, d[l]);
+    }
+}
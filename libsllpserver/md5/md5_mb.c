@@ -0,0 +1,180 @@
+#include "md5_mb.h"
+#include "md5_rounds.h"
+
+#include <string.h>
+
+static inline uint32_t load_le32 (const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline void store_le32 (uint8_t *p, uint32_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void store_le64 (uint8_t *p, uint64_t v)
+{
+    store_le32(p, (uint32_t) v);
+    store_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+typedef uint32_t vec4 __attribute__((vector_size(16)));
+typedef uint32_t vec8 __attribute__((vector_size(32)));
+
+#define MD5_LANES_FUNC      md5_lanes_sse2
+#define MD5_LANES_VEC       vec4
+#define MD5_LANES           4
+#define MD5_LANES_TARGET    __attribute__((target("sse2")))
+#include "md5_lanes.h"
+#undef MD5_LANES_FUNC
+#undef MD5_LANES_VEC
+#undef MD5_LANES
+#undef MD5_LANES_TARGET
+
+#define MD5_LANES_FUNC      md5_lanes_avx2
+#define MD5_LANES_VEC       vec8
+#define MD5_LANES           8
+#define MD5_LANES_TARGET    __attribute__((target("avx2")))
+#include "md5_lanes.h"
+#undef MD5_LANES_FUNC
+#undef MD5_LANES_VEC
+#undef MD5_LANES
+#undef MD5_LANES_TARGET
+
+#endif
+
+typedef void (*md5_lanes_t) (const uint8_t *const *data, size_t len,
+                             uint8_t (*digests)[MD5_DIGEST_SIZE]);
+
+struct md5_engine
+{
+    const char *name;
+    unsigned int lanes;             // 1 for the scalar implementation
+    md5_lanes_t hash;
+};
+
+// <editor-fold defaultstate="collapsed" desc="Auxiliary functions">
+static void md5_transform (uint32_t state[4], const uint8_t *block);
+static const struct md5_engine *engine_select (void);
+// </editor-fold>
+
+void md5_digest (const uint8_t *data, size_t len,
+                 uint8_t digest[MD5_DIGEST_SIZE])
+{
+    uint32_t state[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    uint8_t tail[128];
+
+    size_t full = len/64, rest = len % 64;
+    size_t i;
+    for(i = 0; i < full; ++i)
+        md5_transform(state, data + i*64);
+
+    // Last bytes, padding and length in bits
+    size_t tail_len = rest < 56 ? 64 : 128;
+    memset(tail, 0, tail_len);
+    memcpy(tail, data + full*64, rest);
+    tail[rest] = 0x80;
+    store_le64(tail + tail_len - 8, (uint64_t) len << 3);
+
+    for(i = 0; i < tail_len; i += 64)
+        md5_transform(state, tail + i);
+
+    for(i = 0; i < 4; ++i)
+        store_le32(digest + 4*i, state[i]);
+}
+
+void md5_digest_mb (const uint8_t *const *data, size_t len,
+                    uint8_t (*digests)[MD5_DIGEST_SIZE], unsigned int n)
+{
+    const struct md5_engine *engine = engine_select();
+
+    // Lanes left over by the last group are filled with the last buffer. A
+    // single buffer isn't worth the SIMD setup.
+    while(n > 1 && engine->lanes > 1)
+    {
+        const uint8_t *group[MD5_MB_MAX_LANES];
+        uint8_t out[MD5_MB_MAX_LANES][MD5_DIGEST_SIZE];
+        unsigned int count = n < engine->lanes ? n : engine->lanes;
+
+        unsigned int i;
+        for(i = 0; i < engine->lanes; ++i)
+            group[i] = data[i < count ? i : count - 1];
+
+        engine->hash(group, len, out);
+        memcpy(digests, out, count*MD5_DIGEST_SIZE);
+
+        data += count;
+        digests += count;
+        n -= count;
+    }
+
+    for(; n; --n)
+        md5_digest(*data++, len, *digests++);
+}
+
+const char *md5_mb_engine (void)
+{
+    return engine_select()->name;
+}
+
+static void md5_transform (uint32_t state[4], const uint8_t *block)
+{
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t x[16];
+
+    unsigned int i;
+    for(i = 0; i < 16; ++i)
+        x[i] = load_le32(block + 4*i);
+
+    MD5_ROUNDS(a, b, c, d, x);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+// Choose the widest instruction set the CPU supports, once
+static const struct md5_engine *engine_select (void)
+{
+    static const struct md5_engine engines[] = {
+#if defined(__x86_64__) || defined(__i386__)
+        {"avx2", 8, md5_lanes_avx2},
+        {"sse2", 4, md5_lanes_sse2},
+#endif
+        {"scalar", 1, NULL},
+    };
+    static const struct md5_engine *selected;
+
+    const struct md5_engine *engine = __atomic_load_n(&selected,
+                                                      __ATOMIC_RELAXED);
+
+    if(engine)
+        return engine;
+
+    engine = &engines[sizeof(engines)/sizeof(engines[0]) - 1];
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2"))
+        engine = &engines[0];
+    else if(__builtin_cpu_supports("sse2"))
+        engine = &engines[1];
+#endif
+
+    __atomic_store_n(&selected, engine, __ATOMIC_RELAXED);
+
+    return engine;
+}
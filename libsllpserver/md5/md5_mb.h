@@ -0,0 +1,36 @@
+#ifndef MD5_MB_H
+#define	MD5_MB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MD5_DIGEST_SIZE 16
+#define MD5_MB_MAX_LANES 8          // Most buffers hashed in parallel
+
+/**
+ * MD5 digest of a whole buffer. Same result as MD5Init, MD5Update and
+ * MD5Final, with a faster implementation of the transform.
+ */
+void md5_digest (const uint8_t *data, size_t len,
+                 uint8_t digest[MD5_DIGEST_SIZE]);
+
+/**
+ * MD5 digests of n buffers of the same length. Groups of buffers are hashed
+ * in parallel, one per SIMD lane: 8 at a time with AVX2, 4 with SSE2. The
+ * instruction set is chosen at run time, from what the CPU supports.
+ *
+ * @param data [input] Array of n buffers, len bytes each.
+ * @param len [input] Length of every buffer.
+ * @param digests [output] Array of n digests, digests[i] of data[i].
+ * @param n [input] How many buffers to hash.
+ */
+void md5_digest_mb (const uint8_t *const *data, size_t len,
+                    uint8_t (*digests)[MD5_DIGEST_SIZE], unsigned int n);
+
+/**
+ * Name of the instruction set md5_digest_mb uses: "avx2", "sse2" or
+ * "scalar".
+ */
+const char *md5_mb_engine (void);
+
+#endif	/* MD5_MB_H */
@@ -1,58 +1,10 @@
 #include "common.h"
 #include "message.h"
-#include "md5/md5.h"
 
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 
-#define HEADER_LEN 2
-
-#define WRITABLE 0x80
-#define READ_ONLY 0x00
-
-enum command_code
-{
-    CMD_QUERY_STATUS = 0x00,
-    CMD_STATUS,
-    CMD_QUERY_VARS_LIST,
-    CMD_VARS_LIST,
-    CMD_QUERY_GROUPS_LIST,
-    CMD_GROUPS_LIST,
-    CMD_QUERY_GROUP,
-    CMD_GROUP,
-    CMD_QUERY_CURVES_LIST,
-    CMD_CURVES_LIST,
-
-    CMD_READ_VAR = 0x10,
-    CMD_VAR_READING,
-    CMD_READ_GROUP,
-    CMD_GROUP_READING,
-
-    CMD_WRITE_VAR = 0x20,
-    CMD_WRITE_GROUP = 0x22,
-
-    CMD_CREATE_GROUP = 0x30,
-    CMD_GROUP_CREATED,
-    CMD_REMOVE_ALL_GROUPS,
-
-    CMD_CURVE_TRANSMIT = 0x40,
-    CMD_CURVE_BLOCK,
-    CMD_CURVE_RECALC_CSUM,
-
-    CMD_OK = 0xE0,
-    CMD_ERR_MALFORMED_MESSAGE,
-    CMD_ERR_OP_NOT_SUPPORTED,
-    CMD_ERR_INVALID_ID,
-    CMD_ERR_INVALID_VALUE,
-    CMD_ERR_INVALID_PAYLOAD_SIZE,
-    CMD_ERR_READ_ONLY,
-    CMD_ERR_INSUFFICIENT_MEMORY,
-    CMD_ERR_INTERNAL,
-
-    CMD_MAX
-};
-
 struct raw_message
 {
     uint8_t command_code;
@@ -65,12 +17,27 @@ struct message
     enum command_code command_code;
     uint16_t payload_size;
     uint8_t *payload;
+
+    // Only used by answers. If iov is not NULL, commands that read values are
+    // allowed to reference them in iov instead of copying them to payload.
+    // iovcnt is the number of entries used, 0 meaning that the whole answer
+    // is in payload.
+    struct iovec *iov;
+    int iovcnt;
 };
 
 // <editor-fold defaultstate="collapsed" desc="Auxiliary functions">
 static enum sllp_err message_process(sllp_instance_t *sllp,
                                      struct message *recv_msg,
-                                     struct message *send_msg);
+                                     struct message *send_msg, bool read_hook,
+                                     struct sllp_stream *stream);
+
+static void message_finish(struct message *send_msg,
+                           struct sllp_raw_packet *send_pkt,
+                           struct iovec *iov, int *iovcnt);
+
+static void curve_transmit(sllp_instance_t *sllp, struct sllp_curve *curve,
+                           uint8_t block, struct message *send_msg);
 
 static enum sllp_err message_set_answer(struct message *msg,
                                         enum command_code code);
@@ -78,14 +45,15 @@ static enum sllp_err message_set_answer(struct message *msg,
 static bool is_payload_size_equal_to(struct message *msg,struct message *answer,
                                      uint16_t size, bool greater_or_equal);
 
-static uint16_t decode_size(uint8_t size);
-static uint8_t encode_size(uint16_t size);
 static bool is_size_ok(uint16_t packet_size, uint16_t payload_size);
 // </editor-fold>
 
-enum sllp_err packet_process (sllp_instance_t *sllp,
-                              struct sllp_raw_packet *recv_pkt,
-                              struct sllp_raw_packet *send_pkt)
+static enum sllp_err packet_process_common (sllp_instance_t *sllp,
+                                            struct sllp_raw_packet *recv_pkt,
+                                            struct sllp_raw_packet *send_pkt,
+                                            struct iovec *iov, int *iovcnt,
+                                            bool read_hook,
+                                            struct sllp_stream *stream)
 {
     if(!sllp || !recv_pkt || !send_pkt)
         return SLLP_ERR_PARAM_INVALID;
@@ -98,487 +66,972 @@ enum sllp_err packet_process (sllp_instance_t *sllp,
     struct message recv_msg, send_msg;
    
     recv_msg.command_code = (enum command_code) recv_raw_msg->command_code;
-    recv_msg.payload_size = decode_size(recv_raw_msg->encoded_size);
+    recv_msg.payload_size = sllp_decode_size(recv_raw_msg->encoded_size);
     recv_msg.payload      = recv_raw_msg->payload;    
 
     send_msg.payload      = send_raw_msg->payload;
+    send_msg.iov          = iov ? iov + 1 : NULL;
+    send_msg.iovcnt       = 0;
 
     // Check inconsistency between the size of the received data and the size
     // specified in the message header
+    if(stream)
+        stream->pending = false;
+
     if(!is_size_ok(recv_pkt->len, recv_msg.payload_size))
         message_set_answer(&send_msg, CMD_ERR_MALFORMED_MESSAGE);
     else
-        message_process(sllp, &recv_msg, &send_msg);
+        message_process(sllp, &recv_msg, &send_msg, read_hook, stream);
 
-    send_raw_msg->command_code = send_msg.command_code;
-    send_raw_msg->encoded_size = encode_size(send_msg.payload_size);
-    send_pkt->len = send_msg.payload_size + 2;
+    message_finish(&send_msg, send_pkt, iov, iovcnt);
 
     return SLLP_SUCCESS;
 }
 
-static enum sllp_err message_process(sllp_instance_t *sllp,
-                                     struct message *recv_msg,
-                                     struct message *send_msg)
+enum sllp_err packet_process (sllp_instance_t *sllp,
+                              struct sllp_raw_packet *recv_pkt,
+                              struct sllp_raw_packet *send_pkt)
 {
-    if(!recv_msg || !send_msg)
+    return packet_process_common(sllp, recv_pkt, send_pkt, NULL, NULL, true,
+                                 NULL);
+}
+
+enum sllp_err packet_process_iov (sllp_instance_t *sllp,
+                                  struct sllp_raw_packet *recv_pkt,
+                                  struct sllp_raw_packet *send_pkt,
+                                  struct iovec *iov, int *iovcnt)
+{
+    if(!iov || !iovcnt)
         return SLLP_ERR_PARAM_INVALID;
 
-    sllp->modified_list[0] = NULL;
+    return packet_process_common(sllp, recv_pkt, send_pkt, iov, iovcnt, true,
+                                 NULL);
+}
 
-    switch(recv_msg->command_code)
-    {
+enum sllp_err packet_process_stream (sllp_instance_t *sllp,
+                                     struct sllp_raw_packet *recv_pkt,
+                                     struct sllp_raw_packet *send_pkt,
+                                     struct iovec *iov, int *iovcnt,
+                                     struct sllp_stream *stream)
+{
+    if(!stream || (iov && !iovcnt))
+        return SLLP_ERR_PARAM_INVALID;
 
-    /*case CMD_QUERY_STATUS:          //Answer with CMD_STATUS
-     
-        // Set answer code
-        message_set_answer(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
-        break;*/
+    return packet_process_common(sllp, recv_pkt, send_pkt, iov, iovcnt, true,
+                                 stream);
+}
 
-    case CMD_QUERY_VARS_LIST:       // Answer with CMD_VARS_LIST
-    {
-        // Check payload size
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 0, false))
-            break;
+enum sllp_err packet_stream_next (sllp_instance_t *sllp,
+                                  struct sllp_stream *stream,
+                                  struct sllp_raw_packet *send_pkt,
+                                  struct iovec *iov, int *iovcnt)
+{
+    if(!sllp || !stream || !send_pkt || (iov && !iovcnt))
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(!stream->pending)
+        return SLLP_ERR_PARAM_INVALID;
+
+    struct message send_msg;
+
+    send_msg.payload = send_pkt->data + HEADER_LEN;
+    send_msg.iov     = iov ? iov + 1 : NULL;
+    send_msg.iovcnt  = 0;
 
-        // Set answer's command_code and payload_size
-        message_set_answer(send_msg, CMD_VARS_LIST);
+    // The range was checked when the request was processed
+    curve_transmit(sllp, sllp->curves.list[stream->curve],
+                   (uint8_t) stream->next, &send_msg);
 
-        // Variables are in order of their ID's
-        struct sllp_var *var = NULL;
+    stream->pending = stream->next++ < stream->last;
+
+    message_finish(&send_msg, send_pkt, iov, iovcnt);
+
+    return SLLP_SUCCESS;
+}
+
+// Collect in list the variables a request would read, skipping the ones
+// already marked in seen. Returns false if the request is not a valid read.
+static bool read_request_vars (sllp_instance_t *sllp,
+                               struct sllp_raw_packet *pkt,
+                               struct sllp_var **list, unsigned int *count,
+                               uint32_t *seen)
+{
+    struct raw_message *raw_msg = (struct raw_message *) pkt->data;
+    uint16_t payload_size = sllp_decode_size(raw_msg->encoded_size);
 
-        int i;
-        for(i = 0; i < sllp->vars_list.count; ++i)
+    if(!is_size_ok(pkt->len, payload_size) || payload_size != 1)
+        return false;
+
+    struct sllp_var *single[2] = {NULL, NULL};
+    struct sllp_var **vars;
+    struct sllp_group snapshot;
+    uint8_t id = raw_msg->payload[0];
+
+    switch(raw_msg->command_code)
+    {
+    case CMD_READ_VAR:
+        if(id >= sllp->vars.count)
+            return false;
+        single[0] = sllp->vars.list[id];
+        vars = single;
+        break;
+
+    case CMD_READ_GROUP:
+        if(id >= groups_count(sllp))
+            return false;
+
+        if(sllp->concurrent)
         {
-            sllp_list_value_at(&sllp->vars_list, i, (void**) &var);
-            send_msg->payload[i] = (*var).writable ? WRITABLE : READ_ONLY;
-            send_msg->payload[i] += var->size;
+            group_snapshot(sllp->groups.list[id], &snapshot);
+            vars = snapshot.vars;
         }
-        send_msg->payload_size = sllp->vars_list.count;
+        else
+            vars = sllp->groups.list[id]->vars;
         break;
+
+    default:
+        return false;
     }
-    
-    case CMD_QUERY_GROUPS_LIST:     // Answer with CMD_GROUPS_LIST        
-    {
-        // Check payload size
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 0, false))
-            break;
 
-        // Set answer's command_code and payload_size
-        message_set_answer(send_msg, CMD_GROUPS_LIST);
+    for(; *vars; ++vars)
+    {
+        uint8_t var_id = (*vars)->id;
 
-        // Iterate
-        struct sllp_group *grp;
+        if(seen[var_id/32] & (1u << var_id%32))
+            continue;
 
-        int i;
-        for(i = 0; i < sllp->groups_list.count; ++i)
-        {
-            sllp_list_value_at(&sllp->groups_list, i, (void**) &grp);
-            send_msg->payload[i] = grp->writable ? WRITABLE : READ_ONLY;
-            send_msg->payload[i] += grp->vars_list.count;
-        }
-        send_msg->payload_size = sllp->groups_list.count;
-        break;
+        seen[var_id/32] |= 1u << var_id%32;
+        list[(*count)++] = *vars;
     }
-    
-    case CMD_QUERY_GROUP:           // Answer with CMD_GROUP
+
+    return true;
+}
+
+enum sllp_err packet_process_batch (sllp_instance_t *sllp,
+                                    struct sllp_raw_packet *recv_pkts,
+                                    struct sllp_raw_packet *send_pkts,
+                                    unsigned int count)
+{
+    if(!sllp || !recv_pkts || !send_pkts)
+        return SLLP_ERR_PARAM_INVALID;
+
+    struct sllp_var *modified_list[MAX_VARIABLES+1];
+    unsigned int i = 0;
+
+    while(i < count)
     {
-        // Check payload size
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 1, false))
-            break;
+        // Find the run of consecutive reads starting at i, gathering the union
+        // of the variables they touch
+        uint32_t seen[(MAX_VARIABLES + 31)/32] = {0};
+        unsigned int nvars = 0;
+        unsigned int last = i;
 
-        // Set answer code
-        message_set_answer(send_msg, CMD_GROUP);
+        if(sllp->hook)
+            while(last < count &&
+                  read_request_vars(sllp, &recv_pkts[last], modified_list,
+                                    &nvars, seen))
+                ++last;
 
-        // Get desired group
-        struct sllp_group *grp;
-        
-        if(sllp_list_value_at(&sllp->groups_list, recv_msg->payload[0],
-                              (void**) &grp))
+        if(last == i)
         {
-            message_set_answer(send_msg, CMD_ERR_INVALID_ID);
-            break;
+            packet_process_common(sllp, &recv_pkts[i], &send_pkts[i], NULL,
+                                  NULL, true, NULL);
+            ++i;
+            continue;
         }
 
-        // Iterate over group's variables
-        struct sllp_var *var;
+        // One hook for the whole run
+        modified_list[nvars] = NULL;
+        sllp->hook(SLLP_OP_READ, modified_list);
 
-        int i;
-        for(i = 0; i < grp->vars_list.count; ++i)
-        {
-            sllp_list_value_at(&grp->vars_list, i, (void**) &var);
-            send_msg->payload[i] = var->id;
-        }
-        
-        send_msg->payload_size = grp->vars_list.count;
-        break;
+        for(; i < last; ++i)
+            packet_process_common(sllp, &recv_pkts[i], &send_pkts[i], NULL,
+                                  NULL, false, NULL);
     }
 
-    case CMD_QUERY_CURVES_LIST:
+    return SLLP_SUCCESS;
+}
+
+// Answer with size bytes kept up to date by the instance, referenced in place
+// if they can't change before the answer is sent
+static void message_answer_cached (struct message *send_msg,
+                                   const uint8_t *data, uint16_t size,
+                                   bool in_place)
+{
+    send_msg->payload_size = size;
+
+    if(in_place && send_msg->iov && size)
     {
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 0, false))
-            break;
+        send_msg->iov[0].iov_base = (void *) data;
+        send_msg->iov[0].iov_len  = size;
+        send_msg->iovcnt = 1;
+    }
+    else
+        memcpy(send_msg->payload, data, size);
+}
 
-        message_set_answer(send_msg, CMD_CURVES_LIST);
+// Concurrent mode part of CMD_QUERY_GROUP: the IDs of a group that may be
+// recreated meanwhile
+static void query_group_seq (struct sllp_group *grp, struct message *send_msg)
+{
+    unsigned int start, count;
 
-        struct sllp_curve *curve;
-        uint8_t *payloadp = send_msg->payload;
-        int i;
-        for(i = 0; i < sllp->curves_list.count; ++i)
-        {
-            sllp_list_value_at(&sllp->curves_list, i, (void** )&curve);
+    do
+    {
+        start = seq_read_begin(&grp->seq);
 
-            (*payloadp++) = curve->writable;
-            (*payloadp++) = curve->nblocks;
-            memcpy(payloadp, curve->checksum, sizeof(curve->checksum));
-            payloadp += sizeof(curve->checksum);
-        }
-        send_msg->payload_size = sllp->curves_list.count*CURVE_INFO_SIZE;
+        // The count may be torn, but never exceeds the array
+        count = __atomic_load_n(&grp->vars_count, __ATOMIC_RELAXED);
+        memcpy(send_msg->payload, grp->ids, count);
+    }
+    while(seq_read_retry(&grp->seq, start));
 
-        break;
+    send_msg->payload_size = count;
+}
+
+// Concurrent mode part of CMD_READ_GROUP. It works on a snapshot of the group,
+// kept out of the stack of message_process.
+static __attribute__((noinline))
+void read_group_seq (sllp_instance_t *sllp, struct sllp_group *grp,
+                     struct message *send_msg, bool read_hook)
+{
+    struct sllp_group snapshot;
+
+    group_snapshot(grp, &snapshot);
+
+    if(read_hook && sllp->hook)
+        sllp->hook(SLLP_OP_READ, snapshot.vars);
+
+    group_read_seq(sllp, &snapshot, send_msg->payload);
+    send_msg->payload_size = snapshot.data_size;
+}
+
+// Answer with CMD_VARS_LIST
+static void cmd_query_vars_list (sllp_instance_t *sllp,
+                                 struct message *recv_msg,
+                                 struct message *send_msg, bool read_hook,
+                                 struct sllp_stream *stream)
+{
+    message_set_answer(send_msg, CMD_VARS_LIST);
+
+    // Variables don't change once packets are processed
+    message_answer_cached(send_msg, sllp->vars.info, sllp->vars.count, true);
+}
+
+// Answer with CMD_GROUPS_LIST
+static void cmd_query_groups_list (sllp_instance_t *sllp,
+                                   struct message *recv_msg,
+                                   struct message *send_msg, bool read_hook,
+                                   struct sllp_stream *stream)
+{
+    message_set_answer(send_msg, CMD_GROUPS_LIST);
+    message_answer_cached(send_msg, sllp->groups.info, groups_count(sllp),
+                          !sllp->concurrent);
+}
+
+// Answer with CMD_GROUP
+static void cmd_query_group (sllp_instance_t *sllp, struct message *recv_msg,
+                             struct message *send_msg, bool read_hook,
+                             struct sllp_stream *stream)
+{
+    // Set answer code
+    message_set_answer(send_msg, CMD_GROUP);
+
+    // Get desired group
+    if(recv_msg->payload[0] >= groups_count(sllp))
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
     }
 
-    case CMD_READ_VAR:          // Answer with CMD_VAR_READING
+    struct sllp_group *grp = sllp->groups.list[recv_msg->payload[0]];
+
+    if(sllp->concurrent)
     {
-        // Check payload size
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 1, false))
-            break;
+        query_group_seq(grp, send_msg);
+        return;
+    }
 
-        // Set answer code
-        message_set_answer(send_msg, CMD_VAR_READING);
+    message_answer_cached(send_msg, grp->ids, grp->vars_count, true);
+}
 
-        // Get desired variable
-        struct sllp_var *var;
-        if(sllp_list_value_at(&sllp->vars_list, recv_msg->payload[0],
-                             (void**) &var))
-        {
-            message_set_answer(send_msg, CMD_ERR_INVALID_ID);
-            break;
-        }
+static void cmd_query_curves_list (sllp_instance_t *sllp,
+                                   struct message *recv_msg,
+                                   struct message *send_msg, bool read_hook,
+                                   struct sllp_stream *stream)
+{
+    message_set_answer(send_msg, CMD_CURVES_LIST);
+
+    // Checksums may be recalculated by other threads, under the lock
+    instance_lock(sllp);
+    message_answer_cached(send_msg, &sllp->curves.info[0][0],
+                          sllp->curves.count*CURVE_INFO_SIZE,
+                          !sllp->concurrent);
+    instance_unlock(sllp);
+}
 
-        if(sllp->hook)
-        {
-            sllp->modified_list[0] = var;
-            sllp->modified_list[1] = NULL;
-            sllp->hook(SLLP_OP_READ, sllp->modified_list);
-        }
+static void cmd_query_curve_csums (sllp_instance_t *sllp,
+                                   struct message *recv_msg,
+                                   struct message *send_msg, bool read_hook,
+                                   struct sllp_stream *stream)
+{
+    uint8_t id = recv_msg->payload[0];
+    if(id >= sllp->curves.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
+
+    struct sllp_curve *curve = sllp->curves.list[id];
+    uint16_t size = (curve->nblocks + 1)*CURVE_CSUM_SIZE;
+
+    // Copied under the lock, as blocks written meanwhile update their digests
+    curve_update_csum(sllp, curve, send_msg->payload + 1);
 
-        send_msg->payload_size = var->size;
+    message_set_answer(send_msg, CMD_CURVE_CSUMS);
+    send_msg->payload[0] = id;
+    send_msg->payload_size = 1 + size;
+}
+
+// Answer with CMD_VAR_READING
+static void cmd_read_var (sllp_instance_t *sllp, struct message *recv_msg,
+                          struct message *send_msg, bool read_hook,
+                          struct sllp_stream *stream)
+{
+    // Set answer code
+    message_set_answer(send_msg, CMD_VAR_READING);
+
+    // Get desired variable
+    if(recv_msg->payload[0] >= sllp->vars.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
+
+    struct sllp_var *var = sllp->vars.list[recv_msg->payload[0]];
+
+    if(read_hook && sllp->hook)
+    {
+        struct sllp_var *modified_list[2] = {var, NULL};
+        sllp->hook(SLLP_OP_READ, modified_list);
+    }
+
+    send_msg->payload_size = var->size;
+
+    // Values can't be referenced in place while other threads write them
+    if(sllp->concurrent)
+        var_read_seq(sllp, var, send_msg->payload);
+    else if(send_msg->iov)
+    {
+        send_msg->iov[0].iov_base = var->data;
+        send_msg->iov[0].iov_len  = var->size;
+        send_msg->iovcnt = 1;
+    }
+    else
         memcpy(send_msg->payload, var->data, var->size);
+}
 
-        break;
+// Answer with CMD_GROUP_READING
+static void cmd_read_group (sllp_instance_t *sllp, struct message *recv_msg,
+                            struct message *send_msg, bool read_hook,
+                            struct sllp_stream *stream)
+{
+    // Set answer code
+    message_set_answer(send_msg, CMD_GROUP_READING);
+
+    // Get desired group
+    if(recv_msg->payload[0] >= groups_count(sllp))
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
     }
 
-    case CMD_READ_GROUP:
+    struct sllp_group *grp = sllp->groups.list[recv_msg->payload[0]];
+
+    if(sllp->concurrent)
     {
-        // Check payload size
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 1, false))
-            break;
+        read_group_seq(sllp, grp, send_msg, read_hook);
+        return;
+    }
 
-        // Set answer code
-        message_set_answer(send_msg, CMD_GROUP_READING);
+    // Call hook
+    if(read_hook && sllp->hook)
+        sllp->hook(SLLP_OP_READ, grp->vars);
 
-        // Get desired group
-        struct sllp_group *grp;
+    if(send_msg->iov)
+        send_msg->iovcnt = group_read_iov(grp, send_msg->iov);
+    else
+        group_read(grp, send_msg->payload);
 
-        if(sllp_list_value_at(&sllp->groups_list, recv_msg->payload[0],
-                               (void**) &grp))
-        {
-            message_set_answer(send_msg, CMD_ERR_INVALID_ID);
-            break;
-        }
+    send_msg->payload_size = grp->data_size;
+}
 
-        // Call hook
-        if(sllp->hook)
-        {
-            sllp_list_copy_to_vector(&grp->vars_list,
-                                     (void**) sllp->modified_list);
-            sllp->hook(SLLP_OP_READ, sllp->modified_list);
-        }
+// Takes at least two bytes: one for the ID, at least one for the value
+static void cmd_write_var (sllp_instance_t *sllp, struct message *recv_msg,
+                           struct message *send_msg, bool read_hook,
+                           struct sllp_stream *stream)
+{
+    // Set answer code
+    message_set_answer(send_msg, CMD_OK);
 
-        // Iterate over group's variables
-        struct sllp_var *var;
-        uint8_t *payloadp = send_msg->payload;
-        int i = 0;        
+    // Check ID
+    if(recv_msg->payload[0] >= sllp->vars.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
 
-        while(!sllp_list_value_at(&grp->vars_list, i, (void**) &var))
-        {
-            memcpy(payloadp, var->data, var->size);
-            payloadp += var->size;
-            ++i;
-        }
-        send_msg->payload_size = grp->data_size;
+    struct sllp_var *var = sllp->vars.list[recv_msg->payload[0]];
 
-        break;
+    // Check payload size
+    if(!is_payload_size_equal_to(recv_msg, send_msg, var->size + 1, false))
+        return;
+
+    // Check write permission
+    if(!var->writable)
+    {
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        return;
     }
-    
-    case CMD_WRITE_VAR:
+
+    // Everything is OK, perform the write operation
+    if(sllp->concurrent)
+        var_write_seq(sllp, var, recv_msg->payload + 1);
+    else
+        memcpy(var->data, recv_msg->payload + 1, var->size);
+
+    // Call hook
+    if(sllp->hook)
     {
-        // Check to see if body has at least two bytes (one for id, at least one
-        // for the value)
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 2, true))
-            break;
+        struct sllp_var *modified_list[2] = {var, NULL};
+        sllp->hook(SLLP_OP_WRITE, modified_list);
+    }
+}
 
-        // Set answer code
-        message_set_answer(send_msg, CMD_OK);
+// Takes at least two bytes: one for the ID, at least one for the values
+static void cmd_write_group (sllp_instance_t *sllp, struct message *recv_msg,
+                             struct message *send_msg, bool read_hook,
+                             struct sllp_stream *stream)
+{
+    // Set answer code
+    message_set_answer(send_msg, CMD_OK);
 
-        // Check ID
-        struct sllp_var *var;
-        if(sllp_list_value_at(&sllp->vars_list, recv_msg->payload[0],
-                               (void**) &var))
-        {
-            message_set_answer(send_msg, CMD_ERR_INVALID_ID);
-            break;
-        }
+    // Check ID
+    if(recv_msg->payload[0] >= groups_count(sllp))
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
 
-        // Check payload size
-        if(!is_payload_size_equal_to(recv_msg, send_msg, var->size + 1, false))
-            break;
+    // Keep the group from being recreated while it's written. It may have been
+    // removed since its ID was checked.
+    struct sllp_var *written[MAX_VARIABLES+1];
+    bool call_hook = false;
 
-        // Check write permission
-        if(!var->writable)
-        {
-            message_set_answer(send_msg, CMD_ERR_READ_ONLY);
-            break;
-        }
+    instance_lock(sllp);
 
-        // Everything is OK, perform the write operation
-        memcpy(var->data, recv_msg->payload + 1, var->size);
+    if(recv_msg->payload[0] >= sllp->groups.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        goto cmd_write_group_end;
+    }
 
-        // Call hook
-        if(sllp->hook)
+    struct sllp_group *grp = sllp->groups.list[recv_msg->payload[0]];
+
+    // Check payload size
+    if(!is_payload_size_equal_to(recv_msg, send_msg, grp->data_size + 1,
+                                 false))
+        goto cmd_write_group_end;
+
+    // Check write permission
+    if(!grp->writable)
+    {
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        goto cmd_write_group_end;
+    }
+
+    // Everything is OK, perform the write operation
+    if(sllp->concurrent)
+        group_write_seq(sllp, grp, recv_msg->payload + 1);
+    else
+        group_write(grp, recv_msg->payload + 1);
+
+    // The hook gets its own copy of the variables, as the group may change
+    // once unlocked
+    if(sllp->hook)
+    {
+        memcpy(written, grp->vars, (grp->vars_count + 1)*sizeof(written[0]));
+        call_hook = true;
+    }
+
+cmd_write_group_end:
+    instance_unlock(sllp);
+
+    // Call hook
+    if(call_hook)
+        sllp->hook(SLLP_OP_WRITE, written);
+}
+
+// Takes at least one variable to put on the group
+static void cmd_create_group (sllp_instance_t *sllp, struct message *recv_msg,
+                              struct message *send_msg, bool read_hook,
+                              struct sllp_stream *stream)
+{
+    // A variable can't appear twice in a group
+    if(recv_msg->payload_size > sllp->vars.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+        return;
+    }
+
+    instance_lock(sllp);
+
+    unsigned int count = sllp->groups.count;
+
+    if(count == MAX_GROUPS)
+    {
+        message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+        goto cmd_group_create_end;
+    }
+
+    // Reuse a previously removed group or allocate a new one
+    struct sllp_group *grp = sllp->groups.list[count];
+
+    if(!grp)
+    {
+        grp = instance_alloc(sllp, sizeof(*grp));
+
+        if(!grp)
         {
-            sllp->modified_list[0] = var;
-            sllp->modified_list[1] = NULL;
-            sllp->hook(SLLP_OP_WRITE, sllp->modified_list);
+            message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
+            goto cmd_group_create_end;
         }
 
-        break;
+        grp->seq = 0;
+        sllp->groups.list[count] = grp;
     }
 
-    case CMD_WRITE_GROUP:
-    {
-        // Check to see if body has at least two bytes (one for id, at least one
-        // for the values)
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 2, true))
-            break;
+    // Readers still holding the removed group will notice the change
+    seq_write_lock(&grp->seq);
 
-        // Check ID
-        struct sllp_group *grp;
-        if(sllp_list_value_at(&sllp->groups_list,
-                               (unsigned int) recv_msg->payload, (void**) &grp))
+    // Initialize group
+    group_init(grp, count, true);
+
+    // Populate group
+    int i;
+    for(i = 0; i < recv_msg->payload_size; ++i)
+    {
+        if(recv_msg->payload[i] >= sllp->vars.count)
         {
             message_set_answer(send_msg, CMD_ERR_INVALID_ID);
             break;
         }
 
-        // Check payload size
-        if(!is_payload_size_equal_to(recv_msg, send_msg, grp->data_size + 1,
-                                     false))
-            break;
-
-        // Check write permission
-        if(!grp->writable)
+        if(group_add_var(grp, sllp->vars.list[recv_msg->payload[i]]))
         {
-            message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+            message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
             break;
         }
+    }
 
-        // Everything is OK, iterate
-        int i = 0;
-        struct sllp_var *var;
-        uint8_t *payloadp = recv_msg->payload + 1;
+    seq_write_unlock(&grp->seq);
 
-        while(!sllp_list_value_at(&grp->vars_list, i, (void**) &var))
-        {
-            memcpy(var->data, payloadp, var->size);
-            payloadp += var->size;
-            ++i;
-        }
+    if(i < recv_msg->payload_size)
+        goto cmd_group_create_end;
 
-        // Call hook
-        if(sllp->hook)
-        {
-            sllp_list_copy_to_vector(&grp->vars_list,
-                                     (void**) sllp->modified_list);
-            sllp->hook(SLLP_OP_WRITE, sllp->modified_list);
-        }
+    // Publish the group, listed first
+    group_list_update(sllp, grp);
+    __atomic_store_n(&sllp->groups.count, count + 1, __ATOMIC_RELEASE);
 
-        break;
+    message_set_answer(send_msg, CMD_GROUP_CREATED);
+    send_msg->payload_size = 1;
+    send_msg->payload[0] = grp->writable ? SLLP_WRITABLE : 0;
+    send_msg->payload[0] += grp->id;
+
+cmd_group_create_end:
+    instance_unlock(sllp);
+}
+
+static void cmd_remove_all_groups (sllp_instance_t *sllp,
+                                   struct message *recv_msg,
+                                   struct message *send_msg, bool read_hook,
+                                   struct sllp_stream *stream)
+{
+    message_set_answer(send_msg, CMD_OK);
+
+    // Removed groups are kept for reuse
+    instance_lock(sllp);
+    __atomic_store_n(&sllp->groups.count, sllp->groups.fixed,
+                     __ATOMIC_RELEASE);
+    instance_unlock(sllp);
+}
+
+// Answer with CMD_CURVE_BLOCK
+static void cmd_curve_transmit (sllp_instance_t *sllp,
+                                struct message *recv_msg,
+                                struct message *send_msg, bool read_hook,
+                                struct sllp_stream *stream)
+{
+    if(recv_msg->payload[0] >= sllp->curves.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
     }
 
-    case CMD_CREATE_GROUP:
+    struct sllp_curve *curve = sllp->curves.list[recv_msg->payload[0]];
+
+    uint8_t block_offset = recv_msg->payload[1];
+    
+    if(block_offset > curve->nblocks)
     {
-        // Check if there's at least one variable to put on the group
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 1, true))
-            break;
+        message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
+        return;
+    }
+    
+    curve_transmit(sllp, curve, block_offset, send_msg);
+}
 
-        if(is_payload_size_equal_to(recv_msg, send_msg, 
-                                    sllp->vars_list.count + 1, true))
-            break;
+// Answer with a CMD_CURVE_BLOCK per block
+static void cmd_curve_transmit_range (sllp_instance_t *sllp,
+                                      struct message *recv_msg,
+                                      struct message *send_msg, bool read_hook,
+                                      struct sllp_stream *stream)
+{
+    // Only callers able to send several answers can take it
+    if(!stream)
+    {
+        message_set_answer(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+        return;
+    }
 
-        if(sllp->groups_list.count == MAX_GROUPS)
-        {
-            message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
-            break;
-        }
+    if(recv_msg->payload[0] >= sllp->curves.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
 
-        message_set_answer(send_msg, CMD_GROUP_CREATED);
+    struct sllp_curve *curve = sllp->curves.list[recv_msg->payload[0]];
 
-        // Allocate group structure
-        struct sllp_group *grp;
-        grp = malloc(sizeof(*grp));
+    uint8_t first = recv_msg->payload[1];
+    uint8_t last = recv_msg->payload[2];
 
-        if(!grp)
-        {
-            message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
-            break;
-        }        
+    if(first > last || last > curve->nblocks)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
+        return;
+    }
 
-        // Initialize group
-        group_init(grp, sllp->groups_list.count, true);
+    curve_transmit(sllp, curve, first, send_msg);
 
-        // Populate group
-        int i;
-        for(i = 0; i < recv_msg->payload_size; ++i)
-        {
-            struct sllp_var *var;
-            if(!sllp_list_value_at(&sllp->vars_list, recv_msg->payload[i],
-                                  (void**) &var ))
-            {
-                message_set_answer(send_msg, CMD_ERR_INVALID_ID);
-                goto cmd_group_create_err;                
-            }
-
-            if(!sllp_list_add(&grp->vars_list, (void*) var))
-            {
-                message_set_answer(send_msg, CMD_ERR_INSUFFICIENT_MEMORY);
-                goto cmd_group_create_err; 
-            }
-
-            grp->writable = grp->writable && var->writable;
-            grp->data_size += var->size;
-        }
+    // The rest of the blocks is left to packet_stream_next
+    stream->curve = curve->id;
+    stream->next = first + 1;
+    stream->last = last;
+    stream->pending = first < last;
+}
 
-        message_set_answer(send_msg, CMD_GROUP_CREATED);
-        send_msg->payload_size = 1;
-        send_msg->payload[0] = grp->writable ? WRITABLE : READ_ONLY;
-        send_msg->payload[0] += grp->id;
-        break;
+// Answer with CMD_CURVE_DATA
+static void cmd_curve_read (sllp_instance_t *sllp,
+                            struct message *recv_msg,
+                            struct message *send_msg, bool read_hook,
+                            struct sllp_stream *stream)
+{
+    const uint8_t *payload = recv_msg->payload;
 
-cmd_group_create_err:
-        sllp_list_clear(&grp->vars_list);
-        free(grp);
-        break;
+    if(payload[0] >= sllp->curves.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
     }
 
-    case CMD_REMOVE_ALL_GROUPS:
+    struct sllp_curve *curve = sllp->curves.list[payload[0]];
+
+    uint32_t offset = (uint32_t) payload[1] << 24 | payload[2] << 16 |
+                      payload[3] << 8 | payload[4];
+    uint16_t len = payload[5] << 8 | payload[6];
+    uint32_t size = (curve->nblocks + 1)*CURVE_BLOCK_DATA_SIZE;
+
+    if(!len || len > CURVE_BLOCK_DATA_SIZE || offset >= size ||
+       len > size - offset)
     {
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 0, false))
-            break;
+        message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
+        return;
+    }
 
-        message_set_answer(send_msg, CMD_OK);
-        
-        sllp_list_trim(&sllp->groups_list, GROUP_STANDARD_COUNT);
+    message_set_answer(send_msg, CMD_CURVE_DATA);
+    send_msg->payload_size = len;
 
-        break;
+    // Resident bytes are referenced in place
+    if(curve->get_block_ptr && send_msg->iov && !sllp->concurrent)
+        send_msg->iovcnt = curve_read_range_iov(curve, offset, len,
+                                                send_msg->iov);
+    else
+        curve_read_range(sllp, curve, offset, len, send_msg->payload);
+}
+
+// Answer with CMD_CURVE_ENVELOPE
+static void cmd_query_curve_envelope (sllp_instance_t *sllp,
+                                      struct message *recv_msg,
+                                      struct message *send_msg, bool read_hook,
+                                      struct sllp_stream *stream)
+{
+    const uint8_t *payload = recv_msg->payload;
+
+    if(payload[0] >= sllp->curves.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
     }
 
-    case CMD_CURVE_TRANSMIT:
+    struct sllp_curve *curve = sllp->curves.list[payload[0]];
+
+    if(!curve->sample_type)
     {
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 2, false))
-            break;
+        message_set_answer(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+        return;
+    }
 
-        struct sllp_curve *curve;
-        if(sllp_list_value_at(&sllp->curves_list, recv_msg->payload[0],
-                               (void**) &curve))
-        {
-            message_set_answer(send_msg, CMD_ERR_INVALID_ID);
-            break;
-        }
+    // At least a bin per point, and all of them in a single answer
+    uint16_t points = payload[1] << 8 | payload[2];
+    unsigned int pair = 2*sllp_sample_size(curve->sample_type);
 
-        uint8_t block_offset = recv_msg->payload[1];
-        
-        if(block_offset > curve->nblocks)
-        {
-            message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
-            break;
-        }
-        
-        message_set_answer(send_msg, CMD_CURVE_BLOCK);
-        send_msg->payload[0] = curve->id;
-        send_msg->payload[1] = block_offset;
+    if(!points || points > (curve->nblocks + 1)*ENVELOPE_BINS ||
+       1 + points*pair > SLLP_MAX_MESSAGE - SLLP_HEADER_SIZE)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
+        return;
+    }
 
-        curve->read_block(curve, block_offset, send_msg->payload + 2);
-        send_msg->payload_size = 2 + CURVE_BLOCK_DATA_SIZE;
-        break;
+    message_set_answer(send_msg, CMD_CURVE_ENVELOPE);
+    send_msg->payload[0] = curve->sample_type;
+    curve_envelope(sllp, curve, points, send_msg->payload + 1);
+    send_msg->payload_size = 1 + points*pair;
+}
+
+// Answer with CMD_CURVE_STATS
+static void cmd_query_curve_stats (sllp_instance_t *sllp,
+                                   struct message *recv_msg,
+                                   struct message *send_msg, bool read_hook,
+                                   struct sllp_stream *stream)
+{
+    const uint8_t *payload = recv_msg->payload;
+
+    if(payload[0] >= sllp->curves.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
     }
 
-    case CMD_CURVE_BLOCK:
+    struct sllp_curve *curve = sllp->curves.list[payload[0]];
+
+    if(!curve->sample_type)
     {
-        if(!is_payload_size_equal_to(recv_msg, send_msg,
-                                     2 + CURVE_BLOCK_DATA_SIZE, false))
-            break;
+        message_set_answer(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
+        return;
+    }
 
-        uint8_t id = recv_msg->payload[0];
-        struct sllp_curve *curve;
-        if(sllp_list_value_at(&sllp->curves_list, id, (void**) &curve))
-        {
-            message_set_answer(send_msg, CMD_ERR_INVALID_ID);
-            break;
-        }
+    if(payload[1] > payload[2] || payload[2] > curve->nblocks)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
+        return;
+    }
 
-        uint8_t block_offset = recv_msg->payload[1];
-        if(block_offset > curve->nblocks)
-        {
-            message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
-            break;
-        }
+    unsigned int pair = 2*sllp_sample_size(curve->sample_type);
+    struct envelope_sums sums;
+
+    message_set_answer(send_msg, CMD_CURVE_STATS);
+    send_msg->payload[0] = curve->sample_type;
+    curve_stats(sllp, curve, payload[1], payload[2],
+                send_msg->payload + 1, &sums);
+    sllp_encode_double(sums.sum, send_msg->payload + 1 + pair);
+    sllp_encode_double(sums.squares,
+                       send_msg->payload + 1 + pair + SLLP_DOUBLE_SIZE);
+    send_msg->payload_size = 1 + pair + 2*SLLP_DOUBLE_SIZE;
+}
 
-        curve->write_block(curve, block_offset, recv_msg->payload + 2);
-        
-        message_set_answer(send_msg, CMD_OK);
-        break;
+static void cmd_curve_block (sllp_instance_t *sllp,
+                             struct message *recv_msg,
+                             struct message *send_msg, bool read_hook,
+                             struct sllp_stream *stream)
+{
+    uint8_t id = recv_msg->payload[0];
+    if(id >= sllp->curves.count)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
     }
+
+    struct sllp_curve *curve = sllp->curves.list[id];
+
+    uint8_t block_offset = recv_msg->payload[1];
+    if(block_offset > curve->nblocks)
+    {
+        message_set_answer(send_msg, CMD_ERR_INVALID_VALUE);
+        return;
+    }
+
+    if(!curve->writable)
+    {
+        message_set_answer(send_msg, CMD_ERR_READ_ONLY);
+        return;
+    }
+
+    curve_write_block(sllp, curve, block_offset, recv_msg->payload + 2);
     
-    case CMD_CURVE_RECALC_CSUM:
+    message_set_answer(send_msg, CMD_OK);
+}
+
+static void cmd_curve_recalc_csum (sllp_instance_t *sllp,
+                                   struct message *recv_msg,
+                                   struct message *send_msg, bool read_hook,
+                                   struct sllp_stream *stream)
+{
+    uint8_t id = recv_msg->payload[0];
+    if(id >= sllp->curves.count)
     {
-        if(!is_payload_size_equal_to(recv_msg, send_msg, 1, false))
-            break;
+        message_set_answer(send_msg, CMD_ERR_INVALID_ID);
+        return;
+    }
 
-        uint8_t id = recv_msg->payload[0];
-        struct sllp_curve *curve;
-        if(!sllp_list_value_at(&sllp->curves_list, id, (void**) &curve))
-        {
-            message_set_answer(send_msg, CMD_ERR_INVALID_ID);
-            break;
-        }
+    curve_update_csum(sllp, sllp->curves.list[id], NULL);
+
+    message_set_answer(send_msg, CMD_OK);
+}
 
-        unsigned int nblocks = curve->nblocks + 1;
-        uint8_t block[CURVE_BLOCK_DATA_SIZE];
-        MD5_CTX md5ctx;
+// Answer a command added with sllp_register_command
+static void custom_process (sllp_instance_t *sllp, struct sllp_command *command,
+                            struct message *recv_msg, struct message *send_msg)
+{
+    uint16_t size = 0;
 
-        MD5Init(&md5ctx);
+    send_msg->command_code = command->handler(command, recv_msg->payload,
+                                              recv_msg->payload_size,
+                                              send_msg->payload,
+                                              SLLP_MAX_PAYLOAD, &size);
+    send_msg->payload_size = size;
 
-        unsigned int i;
-        for(i = 0; i < nblocks; ++i)
-        {
-            curve->read_block(curve, (uint8_t)i, block);
-            MD5Update(&md5ctx, block, CURVE_BLOCK_DATA_SIZE);
-        }
-        MD5Final(curve->checksum, &md5ctx);
+    // An answer that doesn't fit isn't sent, even partially
+    if(size > SLLP_MAX_PAYLOAD)
+        message_set_answer(send_msg, CMD_ERR_INVALID_PAYLOAD_SIZE);
+}
 
-        message_set_answer(send_msg, CMD_OK);
-        break;
+// Handler of a command, called once the size of the request is checked
+typedef void (*command_handler) (sllp_instance_t *sllp,
+                                 struct message *recv_msg,
+                                 struct message *send_msg, bool read_hook,
+                                 struct sllp_stream *stream);
+
+struct command
+{
+    command_handler handler;
+    uint16_t        size;           // Payload size of requests
+    bool            at_least;       // Whether size is only the minimum
+};
+
+// Built-in commands, indexed by their code
+static const struct command commands[256] =
+{
+    [CMD_QUERY_VARS_LIST]       = {cmd_query_vars_list,      0, false},
+    [CMD_QUERY_GROUPS_LIST]     = {cmd_query_groups_list,    0, false},
+    [CMD_QUERY_GROUP]           = {cmd_query_group,          1, false},
+    [CMD_QUERY_CURVES_LIST]     = {cmd_query_curves_list,    0, false},
+    [CMD_QUERY_CURVE_CSUMS]     = {cmd_query_curve_csums,    1, false},
+    [CMD_READ_VAR]              = {cmd_read_var,             1, false},
+    [CMD_READ_GROUP]            = {cmd_read_group,           1, false},
+    [CMD_WRITE_VAR]             = {cmd_write_var,            2, true},
+    [CMD_WRITE_GROUP]           = {cmd_write_group,          2, true},
+    [CMD_CREATE_GROUP]          = {cmd_create_group,         1, true},
+    [CMD_REMOVE_ALL_GROUPS]     = {cmd_remove_all_groups,    0, false},
+    [CMD_CURVE_TRANSMIT]        = {cmd_curve_transmit,       2, false},
+    [CMD_CURVE_TRANSMIT_RANGE]  = {cmd_curve_transmit_range, 3, false},
+    [CMD_CURVE_READ]            = {cmd_curve_read,           7, false},
+    [CMD_QUERY_CURVE_ENVELOPE]  = {cmd_query_curve_envelope, 3, false},
+    [CMD_QUERY_CURVE_STATS]     = {cmd_query_curve_stats,    3, false},
+    [CMD_CURVE_BLOCK]           = {cmd_curve_block,
+                                   2 + CURVE_BLOCK_DATA_SIZE, false},
+    [CMD_CURVE_RECALC_CSUM]     = {cmd_curve_recalc_csum,    1, false},
+};
+
+bool command_is_builtin (uint8_t code)
+{
+    return commands[code].handler != NULL;
+}
+
+static enum sllp_err message_process(sllp_instance_t *sllp,
+                                     struct message *recv_msg,
+                                     struct message *send_msg, bool read_hook,
+                                     struct sllp_stream *stream)
+{
+    if(!recv_msg || !send_msg)
+        return SLLP_ERR_PARAM_INVALID;
+
+    const struct command *command = &commands[recv_msg->command_code];
+    struct sllp_command *custom;
+
+    if(command->handler)
+    {
+        if(is_payload_size_equal_to(recv_msg, send_msg, command->size,
+                                    command->at_least))
+            command->handler(sllp, recv_msg, send_msg, read_hook, stream);
     }
-        
-    default:
+    else if((custom = sllp->commands[recv_msg->command_code]))
+    {
+        if(is_payload_size_equal_to(recv_msg, send_msg, custom->size,
+                                    custom->at_least))
+            custom_process(sllp, custom, recv_msg, send_msg);
+    }
+    else
         message_set_answer(send_msg, CMD_ERR_OP_NOT_SUPPORTED);
-        break;
 
+    return SLLP_SUCCESS;
+}
+
+// Fill in the header of an answer and, if there's a scatter/gather list, its
+// first entry
+static void message_finish (struct message *send_msg,
+                            struct sllp_raw_packet *send_pkt,
+                            struct iovec *iov, int *iovcnt)
+{
+    struct raw_message *send_raw_msg = (struct raw_message *) send_pkt->data;
+
+    send_raw_msg->command_code = send_msg->command_code;
+    send_raw_msg->encoded_size = sllp_encode_size(send_msg->payload_size);
+    send_pkt->len = send_msg->payload_size + 2;
+
+    if(iov)
+    {
+        // The header always comes from send_pkt, followed either by the
+        // entries set by message_process or by the payload built in place
+        iov[0].iov_base = send_pkt->data;
+        iov[0].iov_len  = send_msg->iovcnt ? HEADER_LEN : send_pkt->len;
+        *iovcnt = send_msg->iovcnt + 1;
     }
+}
 
-    return SLLP_SUCCESS;
+// Answer with a block of a curve
+static void curve_transmit (sllp_instance_t *sllp, struct sllp_curve *curve,
+                            uint8_t block, struct message *send_msg)
+{
+    message_set_answer(send_msg, CMD_CURVE_BLOCK);
+    send_msg->payload[0] = curve->id;
+    send_msg->payload[1] = block;
+
+    send_msg->payload_size = 2 + CURVE_BLOCK_DATA_SIZE;
+
+    if(curve->get_block_ptr && send_msg->iov && !sllp->concurrent)
+    {
+        // Resident block referenced in place, after its ID and offset
+        send_msg->iov[0].iov_base = send_msg->payload;
+        send_msg->iov[0].iov_len  = 2;
+        send_msg->iov[1].iov_base = (void *) curve->get_block_ptr(curve, block);
+        send_msg->iov[1].iov_len  = CURVE_BLOCK_DATA_SIZE;
+        send_msg->iovcnt = 2;
+    }
+    else if(sllp->curves.prefetch[curve->id])
+        prefetch_transmit(sllp->curves.prefetch[curve->id], block,
+                          send_msg->payload + 2);
+    else
+        curve_read_block(sllp, curve, block, send_msg->payload + 2);
 }
 
 static enum sllp_err message_set_answer (struct message *msg, 
@@ -612,26 +1065,6 @@ static bool is_payload_size_equal_to (struct message *msg,
     return false;
 }
 
-static uint16_t decode_size(uint8_t size)
-{
-    if(size < 0x80)
-        return size;
-
-    size &= 0x7F;
-
-    return 128*size + 130;
-}
-
-static uint8_t encode_size(uint16_t size)
-{
-    if(size < 0x80)
-        return size;
-
-    size -= 130;
-
-    return size/128 + (size%128 != 0);
-}
-
 static bool is_size_ok(uint16_t packet_size, uint16_t payload_size)
 {
     if(packet_size < HEADER_LEN)
@@ -6,6 +6,8 @@
 
 #include "sllp_server.h"
 
+#define HEADER_LEN SLLP_HEADER_SIZE
+
 /**
  * Interprets a message and execute its command, preparing an answer for it.
  *
@@ -25,5 +27,85 @@ enum sllp_err packet_process (sllp_instance_t *sllp,
                               struct sllp_raw_packet *recv_pkt,
                               struct sllp_raw_packet *send_pkt);
 
+/**
+ * Same as packet_process, but describes the answer in iov. Values of variables
+ * are referenced in place instead of being copied to send_pkt, which holds
+ * the header and any answer that has to be generated.
+ *
+ * @param iov [output] At least SLLP_MAX_IOV entries.
+ * @param iovcnt [output] How many entries of iov were filled.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp, recv_pkt, send_pkt, iov or
+ *                               iovcnt is a NULL pointer.</li>
+ * </ul>
+ */
+enum sllp_err packet_process_iov (sllp_instance_t *sllp,
+                                  struct sllp_raw_packet *recv_pkt,
+                                  struct sllp_raw_packet *send_pkt,
+                                  struct iovec *iov, int *iovcnt);
+
+/**
+ * Same as packet_process_iov, also taking requests answered with several
+ * messages, whose first answer goes to send_pkt. The rest are left to
+ * packet_stream_next, while stream->pending is set. iov may be NULL, in which
+ * case answers are built whole in send_pkt.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp, recv_pkt, send_pkt or stream is
+ *                               a NULL pointer, or iov isn't but iovcnt
+ *                               is.</li>
+ * </ul>
+ */
+enum sllp_err packet_process_stream (sllp_instance_t *sllp,
+                                     struct sllp_raw_packet *recv_pkt,
+                                     struct sllp_raw_packet *send_pkt,
+                                     struct iovec *iov, int *iovcnt,
+                                     struct sllp_stream *stream);
+
+/**
+ * Prepare the next answer of a stream started by packet_process_stream.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp, stream or send_pkt is a NULL
+ *                               pointer, iov isn't but iovcnt is, or the
+ *                               stream isn't pending.</li>
+ * </ul>
+ */
+enum sllp_err packet_stream_next (sllp_instance_t *sllp,
+                                  struct sllp_stream *stream,
+                                  struct sllp_raw_packet *send_pkt,
+                                  struct iovec *iov, int *iovcnt);
+
+/**
+ * Process count packets in order, as if packet_process was called for each
+ * of them. Runs of consecutive read commands fire a single SLLP_OP_READ hook
+ * with the union of the variables they read.
+ *
+ * @param sllp [input] SLLP lib instance to be manipulated
+ * @param recv_pkts [input] Array of count received packets.
+ * @param send_pkts [output] Array of count packets to be sent back.
+ * @param count [input] How many packets to process.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: either sllp, recv_pkts or send_pkts is a
+ *                               NULL pointer.</li>
+ * </ul>
+ */
+enum sllp_err packet_process_batch (sllp_instance_t *sllp,
+                                    struct sllp_raw_packet *recv_pkts,
+                                    struct sllp_raw_packet *send_pkts,
+                                    unsigned int count);
+
+/**
+ * Whether a command code is taken by one of the commands handled by the
+ * library.
+ */
+bool command_is_builtin (uint8_t code);
+
 #endif	/* COMMAND_H */
 
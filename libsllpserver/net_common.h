@@ -0,0 +1,71 @@
+#ifndef NET_COMMON_H
+#define	NET_COMMON_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sllp_net.h"
+
+#define MAX_LISTENERS 8
+
+// Everything registered with an epoll instance starts with a handle, telling
+// what the event refers to
+enum net_kind
+{
+    NET_STOP,
+    NET_LISTENER,
+    NET_CONN,
+};
+
+struct net_handle
+{
+    enum net_kind kind;
+    int fd;
+};
+
+struct net_conn;
+
+struct net_worker
+{
+    struct sllp_net *net;
+    pthread_t thread;
+    int epfd;
+    struct net_conn *conns;         // Connections accepted by this worker
+    bool ready;                     // Serving, its backend settled
+};
+
+struct sllp_net
+{
+    sllp_instance_t *sllp;
+    bool running;
+    enum sllp_net_backend backend;
+
+    struct net_handle stop;         // Event signaled to stop the workers
+    struct net_handle listeners[MAX_LISTENERS];
+    unsigned int listeners_count;
+    char *unix_paths[MAX_LISTENERS];
+
+    unsigned int workers_count;
+    struct net_worker workers[];
+};
+
+// Source of the bytes padding answers up to the size encoded in their header
+extern const uint8_t net_padding[128];
+
+/**
+ * Check whether the running kernel supports everything the io_uring backend
+ * needs.
+ */
+bool uring_supported (void);
+
+/**
+ * Serve the listeners of worker->net with io_uring until the stop event is
+ * signaled. Sets worker->ready once the ring is set up.
+ *
+ * @return false if the ring couldn't be set up, in which case the worker
+ *         must fall back to epoll.
+ */
+bool uring_worker_run (struct net_worker *worker);
+
+#endif	/* NET_COMMON_H */
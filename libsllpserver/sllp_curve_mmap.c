@@ -0,0 +1,172 @@
+#include "sllp_curve_mmap.h"
+#include "sllp_server.h"
+#include "common.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SYNC_BLOCKS 16              // Written blocks flushed at a time
+
+// <editor-fold defaultstate="collapsed" desc="Auxiliary functions">
+static const uint8_t *mmap_get_block_ptr (struct sllp_curve *curve,
+                                          uint8_t block);
+static void mmap_write_block (struct sllp_curve *curve, uint8_t block,
+                              uint8_t *data);
+static int mmap_flush (struct sllp_curve_mmap *mc, int flags);
+// </editor-fold>
+
+enum sllp_err sllp_curve_init_mmap (struct sllp_curve_mmap *mc,
+                                    const char *path, bool writable)
+{
+    if(!mc || !path)
+        return SLLP_ERR_PARAM_INVALID;
+
+    int fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+
+    if(fd < 0)
+        return SLLP_ERR_COMM;
+
+    struct stat st;
+
+    if(fstat(fd, &st))
+    {
+        close(fd);
+        return SLLP_ERR_COMM;
+    }
+
+    if(!st.st_size || st.st_size % CURVE_BLOCK_DATA_SIZE ||
+       st.st_size > 256*CURVE_BLOCK_DATA_SIZE)
+    {
+        close(fd);
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+    }
+
+    uint8_t *map = mmap(NULL, st.st_size,
+                        PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED,
+                        fd, 0);
+
+    if(map == MAP_FAILED)
+    {
+        close(fd);
+        return SLLP_ERR_COMM;
+    }
+
+    // Clients download curves in order
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    mc->fd = fd;
+    mc->map = map;
+    mc->size = st.st_size;
+    mc->dirty_first = mc->dirty_end = 0;
+    mc->dirty_blocks = 0;
+    mc->lock = false;
+
+    mc->curve.writable = writable;
+    mc->curve.nblocks = st.st_size/CURVE_BLOCK_DATA_SIZE - 1;
+    mc->curve.sample_type = SLLP_SAMPLE_NONE;
+    mc->curve.read_block = NULL;
+    mc->curve.write_block = writable ? mmap_write_block : NULL;
+    mc->curve.get_block_ptr = mmap_get_block_ptr;
+    mc->curve.read_range = NULL;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_curve_sync_mmap (struct sllp_curve_mmap *mc)
+{
+    if(!mc)
+        return SLLP_ERR_PARAM_INVALID;
+
+    return mmap_flush(mc, MS_SYNC) ? SLLP_ERR_COMM : SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_curve_close_mmap (struct sllp_curve_mmap *mc)
+{
+    if(!mc)
+        return SLLP_ERR_PARAM_INVALID;
+
+    int err = mmap_flush(mc, MS_SYNC);
+
+    munmap(mc->map, mc->size);
+    close(mc->fd);
+    mc->map = NULL;
+    mc->fd = -1;
+
+    return err ? SLLP_ERR_COMM : SLLP_SUCCESS;
+}
+
+static const uint8_t *mmap_get_block_ptr (struct sllp_curve *curve,
+                                          uint8_t block)
+{
+    struct sllp_curve_mmap *mc = (struct sllp_curve_mmap *) curve;
+
+    return mc->map + block*CURVE_BLOCK_DATA_SIZE;
+}
+
+static void mmap_write_block (struct sllp_curve *curve, uint8_t block,
+                              uint8_t *data)
+{
+    struct sllp_curve_mmap *mc = (struct sllp_curve_mmap *) curve;
+    size_t offset = block*CURVE_BLOCK_DATA_SIZE;
+
+    memcpy(mc->map + offset, data, CURVE_BLOCK_DATA_SIZE);
+
+    while(__atomic_test_and_set(&mc->lock, __ATOMIC_ACQUIRE))
+        ;
+
+    if(mc->dirty_first == mc->dirty_end)
+    {
+        mc->dirty_first = offset;
+        mc->dirty_end = offset + CURVE_BLOCK_DATA_SIZE;
+    }
+    else
+    {
+        if(offset < mc->dirty_first)
+            mc->dirty_first = offset;
+        if(offset + CURVE_BLOCK_DATA_SIZE > mc->dirty_end)
+            mc->dirty_end = offset + CURVE_BLOCK_DATA_SIZE;
+    }
+
+    // Uploads end with the last block
+    bool flush = ++mc->dirty_blocks == SYNC_BLOCKS ||
+                 block == mc->curve.nblocks;
+
+    __atomic_clear(&mc->lock, __ATOMIC_RELEASE);
+
+    if(flush)
+        mmap_flush(mc, MS_ASYNC);
+}
+
+// Flush the written bytes to the file, or the whole mapping if waiting for
+// it. Returns msync's result.
+static int mmap_flush (struct sllp_curve_mmap *mc, int flags)
+{
+    while(__atomic_test_and_set(&mc->lock, __ATOMIC_ACQUIRE))
+        ;
+
+    size_t first = mc->dirty_first, end = mc->dirty_end;
+    mc->dirty_first = mc->dirty_end = 0;
+    mc->dirty_blocks = 0;
+
+    __atomic_clear(&mc->lock, __ATOMIC_RELEASE);
+
+    // Waiting covers earlier asynchronous flushes too
+    if(flags & MS_SYNC)
+    {
+        first = 0;
+        end = mc->curve.writable ? mc->size : 0;
+    }
+
+    if(first == end)
+        return 0;
+
+    // msync wants a page aligned address
+    size_t page = sysconf(_SC_PAGESIZE);
+    first -= first % page;
+
+    return msync(mc->map + first, end - first, flags);
+}
@@ -0,0 +1,91 @@
+/*
+ * Sirius Low Level Control Protocol File-Backed Curves
+ * Version 0.1
+ * CON - Controls Group
+ * LNLS - Brazilian Synchrotron Light Laboratory
+ */
+
+#ifndef SLLP_CURVE_MMAP_H
+#define	SLLP_CURVE_MMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sllp_server.h"
+
+// A curve whose blocks are the contents of a file, mapped in memory
+struct sllp_curve_mmap
+{
+    struct sllp_curve curve;        // The curve to be registered
+
+    int fd;
+    uint8_t *map;
+    size_t size;
+
+    // Written bytes not yet flushed to the file
+    size_t dirty_first, dirty_end;
+    unsigned int dirty_blocks;
+    bool lock;                      // Guards the written bytes' bookkeeping
+};
+
+/**
+ * Map a file as a curve. The file must hold between 1 and 256 blocks of 16384
+ * bytes. The curve is filled in and can then be registered with
+ * sllp_register_curve: its blocks are transmitted and hashed straight from
+ * the mapping (see get_block_ptr), so a download only costs page faults,
+ * and the kernel is told to read the file ahead sequentially.
+ *
+ * Blocks written by clients are copied to the mapping, which is flushed to
+ * the file asynchronously every few blocks and when the last block of the
+ * curve is written.
+ *
+ * The curve holds opaque bytes: its sample_type may be set before registering
+ * it. The user field of the curve is untouched.
+ *
+ * @param mc [output] The curve to be initialized.
+ * @param path [input] Path of the file.
+ * @param writable [input] Whether clients may write to the curve. The file
+ *                         is opened for writing if so.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: mc or path is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: the size of the file is not a multiple
+ *                                    of 16384 or it holds more than 256
+ *                                    blocks.</li>
+ *   <li>SLLP_ERR_COMM: the file couldn't be opened or mapped.</li>
+ * </ul>
+ */
+enum sllp_err sllp_curve_init_mmap (struct sllp_curve_mmap *mc,
+                                    const char *path, bool writable);
+
+/**
+ * Flush the blocks written to a file-backed curve, waiting for them to reach
+ * the file.
+ *
+ * @param mc [input] The curve to be flushed.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: mc is a NULL pointer.</li>
+ *   <li>SLLP_ERR_COMM: the file couldn't be written.</li>
+ * </ul>
+ */
+enum sllp_err sllp_curve_sync_mmap (struct sllp_curve_mmap *mc);
+
+/**
+ * Flush a file-backed curve, unmap it and close its file. The curve must not
+ * be used by a SLLP instance anymore.
+ *
+ * @param mc [input] The curve to be closed.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: mc is a NULL pointer.</li>
+ *   <li>SLLP_ERR_COMM: the file couldn't be written.</li>
+ * </ul>
+ */
+enum sllp_err sllp_curve_close_mmap (struct sllp_curve_mmap *mc);
+
+#endif	/* SLLP_CURVE_MMAP_H */
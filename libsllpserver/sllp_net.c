@@ -0,0 +1,599 @@
+#define _GNU_SOURCE                 // accept4
+
+#include "sllp_net.h"
+#include "sllp_server.h"
+#include "message.h"
+#include "net_common.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+struct net_conn
+{
+    struct net_handle handle;
+    struct net_conn *prev, *next;
+
+    uint16_t rx_len;                // Received bytes not yet processed
+    uint16_t out_pos, out_len;      // Answer bytes waiting to be sent
+    struct sllp_stream stream;      // Answers owed to the last message
+
+    uint8_t rx[SLLP_MAX_MESSAGE];   // Received messages
+    uint8_t tx[SLLP_MAX_MESSAGE];   // Header and generated answers
+    uint8_t out[SLLP_MAX_MESSAGE];  // Part of an answer the socket didn't take
+};
+
+#define MAX_EVENTS 64
+
+const uint8_t net_padding[128] = {0};
+
+// <editor-fold defaultstate="collapsed" desc="Auxiliary functions">
+static void *worker_run (void *arg);
+static void conn_accept (struct net_worker *worker, struct net_handle *lst);
+static void conn_close (struct net_worker *worker, struct net_conn *conn);
+static bool conn_read (struct net_worker *worker, struct net_conn *conn);
+static bool conn_flush (struct net_worker *worker, struct net_conn *conn);
+static bool conn_process (struct net_worker *worker, struct net_conn *conn);
+static bool conn_answer (struct net_worker *worker, struct net_conn *conn,
+                         uint16_t len, struct iovec *iov, int iovcnt);
+static bool conn_send (struct net_worker *worker, struct net_conn *conn,
+                       struct iovec *iov, int iovcnt);
+static enum sllp_err listener_add (struct sllp_net *net, int fd);
+// </editor-fold>
+
+sllp_net_t *sllp_net_new (sllp_instance_t *sllp, unsigned int workers)
+{
+    if(!sllp || !workers)
+        return NULL;
+
+    struct sllp_net *net = malloc(sizeof(*net) +
+                                  workers*sizeof(struct net_worker));
+
+    if(!net)
+        return NULL;
+
+    memset(net, 0, sizeof(*net) + workers*sizeof(struct net_worker));
+
+    net->sllp = sllp;
+    net->backend = SLLP_NET_EPOLL;
+    net->workers_count = workers;
+    net->stop.kind = NET_STOP;
+    net->stop.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if(net->stop.fd < 0)
+    {
+        free(net);
+        return NULL;
+    }
+
+    return net;
+}
+
+enum sllp_err sllp_net_destroy (sllp_net_t *net)
+{
+    if(!net)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(net->running)
+        sllp_net_stop(net);
+
+    unsigned int i;
+    for(i = 0; i < net->listeners_count; ++i)
+    {
+        close(net->listeners[i].fd);
+
+        if(net->unix_paths[i])
+        {
+            unlink(net->unix_paths[i]);
+            free(net->unix_paths[i]);
+        }
+    }
+
+    close(net->stop.fd);
+    free(net);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_net_set_backend (sllp_net_t *net,
+                                    enum sllp_net_backend backend)
+{
+    if(!net || net->running)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(backend != SLLP_NET_EPOLL && backend != SLLP_NET_IO_URING)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    net->backend = backend;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_net_backend sllp_net_get_backend (sllp_net_t *net)
+{
+    return net ? net->backend : SLLP_NET_EPOLL;
+}
+
+enum sllp_err sllp_net_listen_tcp (sllp_net_t *net, const char *address,
+                                   uint16_t *port)
+{
+    if(!net || !port || net->running)
+        return SLLP_ERR_PARAM_INVALID;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(*port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if(address && inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(net->listeners_count == MAX_LISTENERS)
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if(fd < 0)
+        return SLLP_ERR_COMM;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    socklen_t len = sizeof(addr);
+
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+       listen(fd, SOMAXCONN) ||
+       getsockname(fd, (struct sockaddr *) &addr, &len))
+    {
+        close(fd);
+        return SLLP_ERR_COMM;
+    }
+
+    *port = ntohs(addr.sin_port);
+
+    return listener_add(net, fd);
+}
+
+enum sllp_err sllp_net_listen_unix (sllp_net_t *net, const char *path)
+{
+    if(!net || !path || net->running)
+        return SLLP_ERR_PARAM_INVALID;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+        return SLLP_ERR_PARAM_INVALID;
+
+    strcpy(addr.sun_path, path);
+
+    if(net->listeners_count == MAX_LISTENERS)
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    char *path_copy = strdup(path);
+
+    if(!path_copy)
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if(fd < 0)
+    {
+        free(path_copy);
+        return SLLP_ERR_COMM;
+    }
+
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+       listen(fd, SOMAXCONN))
+    {
+        close(fd);
+        free(path_copy);
+        return SLLP_ERR_COMM;
+    }
+
+    net->unix_paths[net->listeners_count] = path_copy;
+
+    return listener_add(net, fd);
+}
+
+enum sllp_err sllp_net_start (sllp_net_t *net)
+{
+    if(!net || net->running)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(net->workers_count > 1)
+        sllp_set_concurrent(net->sllp, true);
+
+    if(net->backend == SLLP_NET_IO_URING && !uring_supported())
+        net->backend = SLLP_NET_EPOLL;
+
+    // Clear a previous stop request
+    uint64_t value;
+    if(read(net->stop.fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        return SLLP_ERR_COMM;
+
+    unsigned int i, j;
+    for(i = 0; i < net->workers_count; ++i)
+    {
+        struct net_worker *worker = &net->workers[i];
+
+        worker->net = net;
+        worker->conns = NULL;
+        worker->ready = false;
+        worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+        if(worker->epfd < 0)
+            goto start_err;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &net->stop;
+
+        if(epoll_ctl(worker->epfd, EPOLL_CTL_ADD, net->stop.fd, &ev))
+            goto start_err_epoll;
+
+        // Every worker waits on every listener, but each connection is only
+        // woken up in one of them
+        for(j = 0; j < net->listeners_count; ++j)
+        {
+            ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+            ev.data.ptr = &net->listeners[j];
+
+            if(epoll_ctl(worker->epfd, EPOLL_CTL_ADD, net->listeners[j].fd,
+                         &ev))
+                goto start_err_epoll;
+        }
+
+        if(pthread_create(&worker->thread, NULL, worker_run, worker))
+            goto start_err_epoll;
+    }
+
+    // Wait for the workers to settle on a backend, so that a fallback to epoll
+    // shows in net->backend once started
+    for(i = 0; i < net->workers_count; ++i)
+        while(!__atomic_load_n(&net->workers[i].ready, __ATOMIC_ACQUIRE))
+            sched_yield();
+
+    net->running = true;
+
+    return SLLP_SUCCESS;
+
+start_err_epoll:
+    close(net->workers[i].epfd);
+start_err:
+    // Stop the workers already running
+    j = net->workers_count;
+    net->workers_count = i;
+    net->running = true;
+    sllp_net_stop(net);
+    net->workers_count = j;
+
+    return SLLP_ERR_OUT_OF_MEMORY;
+}
+
+enum sllp_err sllp_net_stop (sllp_net_t *net)
+{
+    if(!net || !net->running)
+        return SLLP_ERR_PARAM_INVALID;
+
+    uint64_t value = 1;
+    if(write(net->stop.fd, &value, sizeof(value)) < 0)
+        return SLLP_ERR_COMM;
+
+    unsigned int i;
+    for(i = 0; i < net->workers_count; ++i)
+    {
+        struct net_worker *worker = &net->workers[i];
+
+        pthread_join(worker->thread, NULL);
+
+        while(worker->conns)
+            conn_close(worker, worker->conns);
+
+        close(worker->epfd);
+    }
+
+    net->running = false;
+
+    return SLLP_SUCCESS;
+}
+
+static enum sllp_err listener_add (struct sllp_net *net, int fd)
+{
+    net->listeners[net->listeners_count].kind = NET_LISTENER;
+    net->listeners[net->listeners_count].fd = fd;
+    ++net->listeners_count;
+
+    return SLLP_SUCCESS;
+}
+
+static void *worker_run (void *arg)
+{
+    struct net_worker *worker = arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    if(__atomic_load_n(&worker->net->backend, __ATOMIC_RELAXED) ==
+       SLLP_NET_IO_URING)
+    {
+        if(uring_worker_run(worker))
+            return NULL;
+
+        // The ring couldn't be set up: serve with epoll, and tell
+        __atomic_store_n(&worker->net->backend, SLLP_NET_EPOLL,
+                         __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&worker->ready, true, __ATOMIC_RELEASE);
+
+    for(;;)
+    {
+        int n = epoll_wait(worker->epfd, events, MAX_EVENTS, -1);
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        int i;
+        for(i = 0; i < n; ++i)
+        {
+            struct net_handle *handle = events[i].data.ptr;
+
+            switch(handle->kind)
+            {
+            case NET_STOP:
+                return NULL;
+
+            case NET_LISTENER:
+                conn_accept(worker, handle);
+                break;
+
+            case NET_CONN:
+            {
+                struct net_conn *conn = (struct net_conn *) handle;
+                bool alive = true;
+
+                if(events[i].events & EPOLLOUT)
+                    alive = conn_flush(worker, conn);
+
+                if(alive && events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    alive = conn_read(worker, conn);
+
+                if(!alive)
+                    conn_close(worker, conn);
+                break;
+            }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void conn_accept (struct net_worker *worker, struct net_handle *lst)
+{
+    int fd;
+
+    while((fd = accept4(lst->fd, NULL, NULL,
+                        SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        struct net_conn *conn = malloc(sizeof(*conn));
+
+        if(!conn)
+        {
+            close(fd);
+            continue;
+        }
+
+        // Answers are small and latency bound. Fails harmlessly on Unix
+        // sockets.
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        conn->handle.kind = NET_CONN;
+        conn->handle.fd = fd;
+        conn->rx_len = 0;
+        conn->out_pos = conn->out_len = 0;
+        conn->stream.pending = false;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+
+        if(epoll_ctl(worker->epfd, EPOLL_CTL_ADD, fd, &ev))
+        {
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        conn->prev = NULL;
+        conn->next = worker->conns;
+        if(worker->conns)
+            worker->conns->prev = conn;
+        worker->conns = conn;
+    }
+}
+
+static void conn_close (struct net_worker *worker, struct net_conn *conn)
+{
+    if(conn->prev)
+        conn->prev->next = conn->next;
+    else
+        worker->conns = conn->next;
+
+    if(conn->next)
+        conn->next->prev = conn->prev;
+
+    close(conn->handle.fd);
+    free(conn);
+}
+
+// Returns false if the connection must be closed
+static bool conn_read (struct net_worker *worker, struct net_conn *conn)
+{
+    ssize_t n = recv(conn->handle.fd, conn->rx + conn->rx_len,
+                     sizeof(conn->rx) - conn->rx_len, 0);
+
+    if(n == 0)
+        return false;
+
+    if(n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    conn->rx_len += n;
+
+    return conn_process(worker, conn);
+}
+
+// Answer every complete message in rx, stopping if the socket can't take more
+// data. Returns false if the connection must be closed.
+static bool conn_process (struct net_worker *worker, struct net_conn *conn)
+{
+    struct iovec iov[SLLP_MAX_IOV + 1];
+    uint16_t pos = 0;
+    int iovcnt;
+
+    while(!conn->out_len)
+    {
+        struct sllp_raw_packet response = { .data = conn->tx };
+
+        // The rest of the answers to the last message go first
+        if(conn->stream.pending)
+        {
+            sllp_stream_next(worker->net->sllp, &conn->stream, &response, iov,
+                             &iovcnt);
+
+            if(!conn_answer(worker, conn, response.len, iov, iovcnt))
+                return false;
+            continue;
+        }
+
+        if(conn->rx_len - pos < HEADER_LEN)
+            break;
+
+        uint16_t len = HEADER_LEN + sllp_decode_size(conn->rx[pos + 1]);
+
+        if(conn->rx_len - pos < len)
+            break;
+
+        struct sllp_raw_packet request = { .data = conn->rx + pos, .len = len };
+
+        sllp_process_stream(worker->net->sllp, &request, &response, iov,
+                            &iovcnt, &conn->stream);
+        pos += len;
+
+        if(!conn_answer(worker, conn, response.len, iov, iovcnt))
+            return false;
+    }
+
+    conn->rx_len -= pos;
+    memmove(conn->rx, conn->rx + pos, conn->rx_len);
+
+    return true;
+}
+
+// Send an answer of len bytes prepared in tx, padded to the size its header
+// tells. Returns false if the connection must be closed.
+static bool conn_answer (struct net_worker *worker, struct net_conn *conn,
+                         uint16_t len, struct iovec *iov, int iovcnt)
+{
+    uint16_t framed = HEADER_LEN + sllp_decode_size(conn->tx[1]);
+
+    if(framed > len)
+    {
+        iov[iovcnt].iov_base = (void *) net_padding;
+        iov[iovcnt].iov_len = framed - len;
+        ++iovcnt;
+    }
+
+    return conn_send(worker, conn, iov, iovcnt);
+}
+
+// Send an answer, keeping what the socket doesn't take in out. Returns false
+// if the connection must be closed.
+static bool conn_send (struct net_worker *worker, struct net_conn *conn,
+                       struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    ssize_t n = sendmsg(conn->handle.fd, &msg, MSG_NOSIGNAL);
+
+    if(n < 0)
+    {
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return false;
+        n = 0;
+    }
+
+    // Copy what is left, the iov entries may point to values that will change
+    int i;
+    for(i = 0; i < iovcnt; ++i)
+    {
+        if(n >= iov[i].iov_len)
+        {
+            n -= iov[i].iov_len;
+            continue;
+        }
+
+        memcpy(conn->out + conn->out_len, (uint8_t *) iov[i].iov_base + n,
+               iov[i].iov_len - n);
+        conn->out_len += iov[i].iov_len - n;
+        n = 0;
+    }
+
+    if(!conn->out_len)
+        return true;
+
+    // Stop reading until the answer is out
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = conn;
+
+    return !epoll_ctl(worker->epfd, EPOLL_CTL_MOD, conn->handle.fd, &ev);
+}
+
+// Send pending answer bytes. Returns false if the connection must be closed.
+static bool conn_flush (struct net_worker *worker, struct net_conn *conn)
+{
+    ssize_t n = send(conn->handle.fd, conn->out + conn->out_pos,
+                     conn->out_len - conn->out_pos, MSG_NOSIGNAL);
+
+    if(n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    conn->out_pos += n;
+
+    if(conn->out_pos < conn->out_len)
+        return true;
+
+    conn->out_pos = conn->out_len = 0;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+
+    if(epoll_ctl(worker->epfd, EPOLL_CTL_MOD, conn->handle.fd, &ev))
+        return false;
+
+    // Resume with the messages that arrived meanwhile
+    return conn_process(worker, conn);
+}
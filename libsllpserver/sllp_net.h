@@ -0,0 +1,161 @@
+/*
+ * Sirius Low Level Control Protocol Network Server API
+ * Version 0.1
+ * CON - Controls Group
+ * LNLS - Brazilian Synchrotron Light Laboratory
+ */
+
+#ifndef SLLP_NET_H
+#define	SLLP_NET_H
+
+#include <stdint.h>
+
+#include "sllp_server.h"
+
+typedef struct sllp_net sllp_net_t;     // Type of the network server handle
+
+enum sllp_net_backend
+{
+    SLLP_NET_EPOLL,                 // Non-blocking sockets polled with epoll
+    SLLP_NET_IO_URING,              // io_uring, falling back to epoll if the
+                                    // kernel doesn't support it
+};
+
+/**
+ * Allocate a network server for a SLLP instance. The server accepts stream
+ * connections (TCP or Unix domain sockets) and answers every message received
+ * on them, in order, through the instance. Messages are framed by their
+ * header: answers with more than 127 bytes of payload are zero padded up to
+ * the size encoded in their header.
+ *
+ * Connections are served by a pool of worker threads, each one running its
+ * own event loop (see sllp_net_set_backend). If more than one worker is
+ * requested, sllp_net_start puts the instance in concurrent mode (see
+ * sllp_set_concurrent).
+ *
+ * @param sllp [input] Handle to the instance to be served. It must remain
+ *                     valid while the server exists.
+ * @param workers [input] How many worker threads to run, at least one.
+ *
+ * @return A handle to the server or NULL if either sllp is NULL, workers is
+ *         zero or there wasn't enough memory to do the allocation.
+ */
+sllp_net_t *sllp_net_new (sllp_instance_t *sllp, unsigned int workers);
+
+/**
+ * Stop a network server, if running, close all its sockets and deallocate it.
+ *
+ * @param net [input] Handle to the server to be deallocated.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: net is a NULL pointer.</li>
+ * </ul>
+ */
+enum sllp_err sllp_net_destroy (sllp_net_t *net);
+
+/**
+ * Choose how the workers wait for and perform socket I/O. Must be called
+ * before sllp_net_start. The default is SLLP_NET_EPOLL.
+ *
+ * With SLLP_NET_IO_URING, each worker drives its sockets through an io_uring
+ * instance: connections are accepted and read by multishot requests into a
+ * ring of provided buffers, and answers are built in place in buffers
+ * registered with the ring and sent as chains of linked writes, so that
+ * most round trips cost a single system call. It requires Linux 6.0; on
+ * older kernels, or if the ring can't be set up, the server falls back to
+ * SLLP_NET_EPOLL.
+ *
+ * @param net [input] Handle to the server.
+ * @param backend [input] The backend to use.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: net is a NULL pointer or the server is
+ *                               already running.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: backend is not a valid backend.</li>
+ * </ul>
+ */
+enum sllp_err sllp_net_set_backend (sllp_net_t *net,
+                                    enum sllp_net_backend backend);
+
+/**
+ * Tell which backend is in use. After sllp_net_start, it reflects a fallback
+ * from SLLP_NET_IO_URING to SLLP_NET_EPOLL, whether the kernel lacks support
+ * or a worker couldn't set its ring up.
+ *
+ * @param net [input] Handle to the server.
+ *
+ * @return The backend, SLLP_NET_EPOLL if net is a NULL pointer.
+ */
+enum sllp_net_backend sllp_net_get_backend (sllp_net_t *net);
+
+/**
+ * Listen for TCP connections. Must be called before sllp_net_start.
+ *
+ * @param net [input] Handle to the server.
+ * @param address [input] IPv4 address to bind to, or NULL for any address.
+ * @param port [input/output] Port to listen on. If it points to 0, an
+ *                            ephemeral port is chosen and written back.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: net or port is a NULL pointer, address is
+ *                               not a valid IPv4 address or the server is
+ *                               already running.</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: the server can't listen on more sockets.</li>
+ *   <li>SLLP_ERR_COMM: the socket couldn't be created, bound or put to
+ *                      listen.</li>
+ * </ul>
+ */
+enum sllp_err sllp_net_listen_tcp (sllp_net_t *net, const char *address,
+                                   uint16_t *port);
+
+/**
+ * Listen for connections on a Unix domain socket. Must be called before
+ * sllp_net_start. The socket file is removed when the server is destroyed.
+ *
+ * @param net [input] Handle to the server.
+ * @param path [input] Path of the socket file, which must not exist.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: net or path is a NULL pointer, path is too
+ *                               long or the server is already running.</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: the server can't listen on more sockets.</li>
+ *   <li>SLLP_ERR_COMM: the socket couldn't be created, bound or put to
+ *                      listen.</li>
+ * </ul>
+ */
+enum sllp_err sllp_net_listen_unix (sllp_net_t *net, const char *path);
+
+/**
+ * Start the worker threads. Returns immediately, the server runs until
+ * sllp_net_stop or sllp_net_destroy is called.
+ *
+ * @param net [input] Handle to the server.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: net is a NULL pointer or the server is
+ *                               already running.</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: a worker couldn't be created.</li>
+ * </ul>
+ */
+enum sllp_err sllp_net_start (sllp_net_t *net);
+
+/**
+ * Stop the worker threads and close every connection. The listening sockets
+ * are kept, so the server can be started again.
+ *
+ * @param net [input] Handle to the server.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: net is a NULL pointer or the server is not
+ *                               running.</li>
+ * </ul>
+ */
+enum sllp_err sllp_net_stop (sllp_net_t *net);
+
+#endif	/* SLLP_NET_H */
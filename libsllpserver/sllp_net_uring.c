@@ -0,0 +1,903 @@
+#include "sllp_net.h"
+#include "sllp_server.h"
+#include "message.h"
+#include "net_common.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#define RING_ENTRIES 256
+#define RX_BUFFERS 64               // Provided buffers, must be a power of 2
+#define TX_BUFFERS 64               // Registered buffers for answers
+#define RX_GROUP 0                  // ID of the provided buffers group
+#define STREAM_BUFFERS 16           // Most answers of a stream queued at once
+#define CONN_BUFFERS 16             // Most answers of a connection queued at
+                                    // once
+
+// Operations, stored in the two lower bits of the user_data of a request. The
+// rest is a pointer to the listener or connection it refers to.
+enum uring_op
+{
+    OP_STOP,
+    OP_ACCEPT,
+    OP_RECV,
+    OP_WRITE,
+};
+
+#define USER_DATA(ptr, op)  ((uint64_t)(uintptr_t)(ptr) | (op))
+#define USER_PTR(data)      ((void *)(uintptr_t)((data) & ~3ull))
+#define USER_OP(data)       ((enum uring_op)((data) & 3))
+
+// Received bytes a connection couldn't process yet, kept in a provided buffer
+struct uring_chunk
+{
+    uint16_t bid;
+    uint16_t pos, len;
+};
+
+struct uring_conn
+{
+    int fd;
+    struct uring_conn *prev, *next;
+
+    bool closing;                   // Shut down, waiting for its requests
+    bool recv_armed;                // Multishot receive in flight
+    unsigned int inflight;          // Writes in flight
+
+    // Answers waiting to be sent or being sent, in order, as indices of
+    // registered buffers. The first inflight ones belong to the chain of
+    // writes in flight, of which chain_done have completed.
+    uint16_t txq[TX_BUFFERS];
+    unsigned int txq_head, txq_count, chain_done;
+
+    // Received bytes not processed for lack of answer buffers
+    struct uring_chunk held[RX_BUFFERS];
+    unsigned int held_count;
+    bool stalled;
+
+    struct sllp_stream stream;      // Answers owed to the last message
+
+    uint16_t rx_len;                // Bytes of a message split between
+    uint8_t rx[SLLP_MAX_MESSAGE];   // receptions
+};
+
+struct uring
+{
+    int fd;
+
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int sq_entries, sq_local_tail;
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+struct uring_worker
+{
+    struct net_worker *worker;
+    struct uring ring;
+
+    struct io_uring_buf_ring *rx_ring;
+    uint8_t *rx_mem;
+    uint16_t rx_tail;
+    unsigned int rx_held;           // Provided buffers not in the kernel
+
+    uint8_t *tx_mem;
+    uint16_t tx_len[TX_BUFFERS], tx_pos[TX_BUFFERS];
+    uint16_t tx_free[TX_BUFFERS];
+    unsigned int tx_free_count;
+
+    struct uring_conn *conns;
+    bool starved;                   // A reception ran out of provided buffers
+    bool stopping;
+    unsigned int accepts_armed;
+};
+
+// <editor-fold defaultstate="collapsed" desc="Auxiliary functions">
+static bool ring_init (struct uring *ring, unsigned int entries,
+                       unsigned int flags);
+static void ring_exit (struct uring *ring);
+static struct io_uring_sqe *ring_sqe (struct uring *ring);
+static int ring_submit (struct uring *ring, unsigned int wait);
+static bool ring_pbuf_register (struct uring *ring, void *addr,
+                                unsigned int entries);
+
+static void worker_loop (struct uring_worker *uw);
+static void worker_stop (struct uring_worker *uw);
+
+static void arm_accept (struct uring_worker *uw, struct net_handle *lst);
+static void arm_recv (struct uring_worker *uw, struct uring_conn *conn);
+static void arm_stop (struct uring_worker *uw);
+
+static void on_accept (struct uring_worker *uw, struct net_handle *lst,
+                       struct io_uring_cqe *cqe);
+static void on_recv (struct uring_worker *uw, struct uring_conn *conn,
+                     struct io_uring_cqe *cqe);
+static void on_write (struct uring_worker *uw, struct uring_conn *conn,
+                      struct io_uring_cqe *cqe);
+
+static void rx_return (struct uring_worker *uw, uint16_t bid);
+static void conn_queue (struct uring_worker *uw, struct uring_conn *conn,
+                        uint16_t index, struct sllp_raw_packet *response);
+static bool conn_stream (struct uring_worker *uw, struct uring_conn *conn);
+static uint32_t conn_feed (struct uring_worker *uw, struct uring_conn *conn,
+                           uint8_t *data, uint32_t len);
+static bool conn_finish (struct uring_worker *uw, struct uring_conn *conn);
+static void conn_stall (struct uring_worker *uw, struct uring_conn *conn);
+static void conn_resume (struct uring_worker *uw, struct uring_conn *conn);
+static void conn_flush (struct uring_worker *uw, struct uring_conn *conn);
+static void conn_shutdown (struct uring_worker *uw, struct uring_conn *conn);
+static void conn_release (struct uring_worker *uw, struct uring_conn *conn);
+// </editor-fold>
+
+bool uring_supported (void)
+{
+    // Single issuer rings and multishot receives both arrived in Linux 6.0
+    struct uring ring;
+
+    if(!ring_init(&ring, 2, IORING_SETUP_SINGLE_ISSUER))
+        return false;
+
+    void *page = mmap(NULL, sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    bool supported = page != MAP_FAILED && ring_pbuf_register(&ring, page, 1);
+
+    ring_exit(&ring);
+
+    if(page != MAP_FAILED)
+        munmap(page, sizeof(struct io_uring_buf));
+
+    return supported;
+}
+
+bool uring_worker_run (struct net_worker *worker)
+{
+    struct uring_worker *uw = calloc(1, sizeof(*uw));
+
+    if(!uw)
+        return false;
+
+    uw->worker = worker;
+
+    if(!ring_init(&uw->ring, RING_ENTRIES, IORING_SETUP_SINGLE_ISSUER))
+        goto uring_err;
+
+    // Provided buffers for receptions
+    size_t rx_ring_size = RX_BUFFERS*sizeof(struct io_uring_buf);
+
+    uw->rx_ring = mmap(NULL, rx_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    uw->rx_mem = malloc(RX_BUFFERS*SLLP_MAX_MESSAGE);
+    uw->tx_mem = malloc(TX_BUFFERS*SLLP_MAX_MESSAGE);
+
+    if(uw->rx_ring == MAP_FAILED || !uw->rx_mem || !uw->tx_mem)
+        goto uring_err_mem;
+
+    if(!ring_pbuf_register(&uw->ring, uw->rx_ring, RX_BUFFERS))
+        goto uring_err_mem;
+
+    unsigned int i;
+    uw->rx_held = RX_BUFFERS;
+    for(i = 0; i < RX_BUFFERS; ++i)
+        rx_return(uw, i);
+
+    // Registered buffers for answers
+    struct iovec iov[TX_BUFFERS];
+    for(i = 0; i < TX_BUFFERS; ++i)
+    {
+        iov[i].iov_base = uw->tx_mem + i*SLLP_MAX_MESSAGE;
+        iov[i].iov_len = SLLP_MAX_MESSAGE;
+        uw->tx_free[i] = i;
+    }
+    uw->tx_free_count = TX_BUFFERS;
+
+    if(syscall(__NR_io_uring_register, uw->ring.fd, IORING_REGISTER_BUFFERS,
+               iov, TX_BUFFERS))
+        goto uring_err_mem;
+
+    // Writes to a connection its peer closed raise SIGPIPE in the thread that
+    // issues them, as they can't take MSG_NOSIGNAL. Keep it pending instead of
+    // ending the process.
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+    arm_stop(uw);
+    for(i = 0; i < worker->net->listeners_count; ++i)
+        arm_accept(uw, &worker->net->listeners[i]);
+
+    __atomic_store_n(&worker->ready, true, __ATOMIC_RELEASE);
+
+    worker_loop(uw);
+
+    ring_exit(&uw->ring);
+    munmap(uw->rx_ring, rx_ring_size);
+    free(uw->rx_mem);
+    free(uw->tx_mem);
+    free(uw);
+
+    return true;
+
+uring_err_mem:
+    ring_exit(&uw->ring);
+    if(uw->rx_ring != MAP_FAILED && uw->rx_ring)
+        munmap(uw->rx_ring, rx_ring_size);
+    free(uw->rx_mem);
+    free(uw->tx_mem);
+uring_err:
+    free(uw);
+
+    return false;
+}
+
+static bool ring_init (struct uring *ring, unsigned int entries,
+                       unsigned int flags)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = flags;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+
+    if(ring->fd < 0)
+        return false;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned int);
+    ring->cq_ring_size = p.cq_off.cqes +
+                         p.cq_entries*sizeof(struct io_uring_cqe);
+    ring->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+
+    if(ring->sq_ring == MAP_FAILED)
+        goto ring_init_err;
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ring = ring->sq_ring;
+    else
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_CQ_RING);
+
+        if(ring->cq_ring == MAP_FAILED)
+            goto ring_init_err_sq;
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if(ring->sqes == MAP_FAILED)
+        goto ring_init_err_cq;
+
+    uint8_t *sq = ring->sq_ring, *cq = ring->cq_ring;
+
+    ring->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return true;
+
+ring_init_err_cq:
+    if(ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+ring_init_err_sq:
+    munmap(ring->sq_ring, ring->sq_ring_size);
+ring_init_err:
+    close(ring->fd);
+    ring->fd = -1;
+
+    return false;
+}
+
+static void ring_exit (struct uring *ring)
+{
+    if(ring->fd < 0)
+        return;
+
+    munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+// Get a cleared submission entry, submitting the pending ones if the queue is
+// full
+static struct io_uring_sqe *ring_sqe (struct uring *ring)
+{
+    while(ring->sq_local_tail -
+          __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries)
+        ring_submit(ring, 0);
+
+    unsigned int index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ++ring->sq_local_tail;
+
+    return sqe;
+}
+
+static int ring_submit (struct uring *ring, unsigned int wait)
+{
+    unsigned int tail = *ring->sq_tail;
+    unsigned int count = ring->sq_local_tail - tail;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    return syscall(__NR_io_uring_enter, ring->fd, count, wait,
+                   wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static bool ring_pbuf_register (struct uring *ring, void *addr,
+                                unsigned int entries)
+{
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t) addr;
+    reg.ring_entries = entries;
+    reg.bgid = RX_GROUP;
+
+    return !syscall(__NR_io_uring_register, ring->fd,
+                    IORING_REGISTER_PBUF_RING, &reg, 1);
+}
+
+// Serve until asked to stop, then wait for the requests that may still write
+// to the worker's memory
+static void worker_loop (struct uring_worker *uw)
+{
+    while(!uw->stopping || uw->conns || uw->accepts_armed)
+    {
+        if(ring_submit(&uw->ring, 1) < 0 && errno != EINTR && errno != EBUSY)
+            return;
+
+        unsigned int head = *uw->ring.cq_head;
+        unsigned int tail = __atomic_load_n(uw->ring.cq_tail, __ATOMIC_ACQUIRE);
+
+        for(; head != tail; ++head)
+        {
+            struct io_uring_cqe *cqe = &uw->ring.cqes[head & *uw->ring.cq_mask];
+            void *ptr = USER_PTR(cqe->user_data);
+
+            switch(USER_OP(cqe->user_data))
+            {
+            case OP_STOP:
+                if(ptr && !uw->stopping)
+                    worker_stop(uw);
+                break;
+
+            case OP_ACCEPT:
+                on_accept(uw, ptr, cqe);
+                break;
+
+            case OP_RECV:
+                on_recv(uw, ptr, cqe);
+                break;
+
+            case OP_WRITE:
+                on_write(uw, ptr, cqe);
+                break;
+            }
+        }
+
+        __atomic_store_n(uw->ring.cq_head, head, __ATOMIC_RELEASE);
+
+        // Receptions that ran out of buffers can go on once some are back
+        if(uw->starved && uw->rx_held < RX_BUFFERS)
+        {
+            struct uring_conn *conn;
+            for(conn = uw->conns; conn; conn = conn->next)
+                if(!conn->recv_armed && !conn->closing && !conn->stalled)
+                    arm_recv(uw, conn);
+            uw->starved = false;
+        }
+    }
+}
+
+// Cancel the accepts and shut every connection down
+static void worker_stop (struct uring_worker *uw)
+{
+    uw->stopping = true;
+
+    unsigned int i;
+    for(i = 0; i < uw->worker->net->listeners_count; ++i)
+    {
+        struct io_uring_sqe *sqe = ring_sqe(&uw->ring);
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = USER_DATA(&uw->worker->net->listeners[i], OP_ACCEPT);
+        sqe->user_data = USER_DATA(NULL, OP_STOP);
+    }
+
+    struct uring_conn *conn, *next;
+    for(conn = uw->conns; conn; conn = next)
+    {
+        next = conn->next;
+        conn_shutdown(uw, conn);
+        conn_release(uw, conn);
+    }
+}
+
+static void arm_stop (struct uring_worker *uw)
+{
+    // Poll instead of reading, so that every worker sees the event
+    struct io_uring_sqe *sqe = ring_sqe(&uw->ring);
+    struct net_handle *stop = &uw->worker->net->stop;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = stop->fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = USER_DATA(stop, OP_STOP);
+}
+
+static void arm_accept (struct uring_worker *uw, struct net_handle *lst)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&uw->ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = lst->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = USER_DATA(lst, OP_ACCEPT);
+
+    ++uw->accepts_armed;
+}
+
+static void arm_recv (struct uring_worker *uw, struct uring_conn *conn)
+{
+    struct io_uring_sqe *sqe = ring_sqe(&uw->ring);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RX_GROUP;
+    sqe->user_data = USER_DATA(conn, OP_RECV);
+
+    conn->recv_armed = true;
+}
+
+static void on_accept (struct uring_worker *uw, struct net_handle *lst,
+                       struct io_uring_cqe *cqe)
+{
+    if(!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        --uw->accepts_armed;
+        if(!uw->stopping)
+            arm_accept(uw, lst);
+    }
+
+    if(cqe->res < 0)
+        return;
+
+    if(uw->stopping)
+    {
+        close(cqe->res);
+        return;
+    }
+
+    struct uring_conn *conn = malloc(sizeof(*conn));
+
+    if(!conn)
+    {
+        close(cqe->res);
+        return;
+    }
+
+    memset(conn, 0, offsetof(struct uring_conn, rx));
+    conn->fd = cqe->res;
+
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    conn->next = uw->conns;
+    if(uw->conns)
+        uw->conns->prev = conn;
+    uw->conns = conn;
+
+    arm_recv(uw, conn);
+}
+
+static void on_recv (struct uring_worker *uw, struct uring_conn *conn,
+                     struct io_uring_cqe *cqe)
+{
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    if(!more)
+        conn->recv_armed = false;
+
+    if(cqe->res > 0)
+    {
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        ++uw->rx_held;
+        uint8_t *data = uw->rx_mem + bid*SLLP_MAX_MESSAGE;
+        uint32_t used = 0;
+
+        if(!conn->closing && !conn->stalled)
+            used = conn_feed(uw, conn, data, cqe->res);
+
+        if(conn->closing || used == cqe->res)
+            rx_return(uw, bid);
+        else
+        {
+            // Keep the rest until answer buffers are available
+            struct uring_chunk *chunk = &conn->held[conn->held_count++];
+            chunk->bid = bid;
+            chunk->pos = used;
+            chunk->len = cqe->res;
+        }
+
+        conn_flush(uw, conn);
+    }
+    else if(cqe->res == -ENOBUFS && !conn->closing)
+        uw->starved = true;         // Rearmed once buffers are returned
+    else if(cqe->res != -ECANCELED && !more)
+        conn_shutdown(uw, conn);    // End of stream or error
+
+    // A stalled connection receives nothing more until it's resumed
+    if(!conn->recv_armed && !conn->closing && !conn->stalled &&
+       cqe->res != -ENOBUFS)
+        arm_recv(uw, conn);
+
+    conn_release(uw, conn);
+}
+
+static void on_write (struct uring_worker *uw, struct uring_conn *conn,
+                      struct io_uring_cqe *cqe)
+{
+    uint16_t index = conn->txq[(conn->txq_head + conn->chain_done) % TX_BUFFERS];
+
+    if(cqe->res > 0)
+        uw->tx_pos[index] += cqe->res;
+    else if(cqe->res != -ECANCELED)
+        conn_shutdown(uw, conn);
+
+    ++conn->chain_done;
+
+    if(--conn->inflight)
+        return;
+
+    // The chain is over: release the answers fully sent. A short write broke
+    // the chain, what's left is sent by the next one.
+    bool released = false;
+
+    while(conn->txq_count &&
+          uw->tx_pos[conn->txq[conn->txq_head]] ==
+          uw->tx_len[conn->txq[conn->txq_head]])
+    {
+        uw->tx_free[uw->tx_free_count++] = conn->txq[conn->txq_head];
+        conn->txq_head = (conn->txq_head + 1) % TX_BUFFERS;
+        --conn->txq_count;
+        released = true;
+    }
+
+    conn->chain_done = 0;
+
+    if(conn->closing)
+    {
+        conn_release(uw, conn);
+        released = true;
+    }
+    else
+        conn_flush(uw, conn);
+
+    // Let stalled connections use the released buffers
+    if(released)
+    {
+        struct uring_conn *c, *next;
+        for(c = uw->conns; c && uw->tx_free_count; c = next)
+        {
+            next = c->next;
+            if(c->stalled)
+                conn_resume(uw, c);
+        }
+    }
+}
+
+// Give a provided buffer back to the kernel
+static void rx_return (struct uring_worker *uw, uint16_t bid)
+{
+    struct io_uring_buf *buf = &uw->rx_ring->bufs[uw->rx_tail & (RX_BUFFERS-1)];
+
+    buf->addr = (uintptr_t)(uw->rx_mem + bid*SLLP_MAX_MESSAGE);
+    buf->len = SLLP_MAX_MESSAGE;
+    buf->bid = bid;
+
+    __atomic_store_n(&uw->rx_ring->tail, ++uw->rx_tail, __ATOMIC_RELEASE);
+    --uw->rx_held;
+}
+
+// Answer a message into a free registered buffer, queueing it to be sent.
+// Returns false, stalling the connection, if there are no free buffers or it
+// has as many answers queued as it may.
+static bool conn_answer (struct uring_worker *uw, struct uring_conn *conn,
+                         uint8_t *data, uint16_t len)
+{
+    // The answers owed to the last message go first
+    if(!conn_stream(uw, conn))
+        return false;
+
+    if(!uw->tx_free_count || conn->txq_count >= CONN_BUFFERS)
+    {
+        conn_stall(uw, conn);
+        return false;
+    }
+
+    uint16_t index = uw->tx_free[--uw->tx_free_count];
+    struct sllp_raw_packet request = { .data = data, .len = len };
+    struct sllp_raw_packet response = {
+        .data = uw->tx_mem + index*SLLP_MAX_MESSAGE
+    };
+
+    sllp_process_stream(uw->worker->net->sllp, &request, &response, NULL,
+                        NULL, &conn->stream);
+    conn_queue(uw, conn, index, &response);
+
+    // The message is answered even if the rest of its stream has to wait
+    conn_stream(uw, conn);
+
+    return true;
+}
+
+// Queue an answer prepared in a registered buffer, padded to the size its
+// header tells
+static void conn_queue (struct uring_worker *uw, struct uring_conn *conn,
+                        uint16_t index, struct sllp_raw_packet *response)
+{
+    uint16_t framed = HEADER_LEN + sllp_decode_size(response->data[1]);
+    memset(response->data + response->len, 0, framed - response->len);
+
+    uw->tx_len[index] = framed;
+    uw->tx_pos[index] = 0;
+    conn->txq[(conn->txq_head + conn->txq_count++) % TX_BUFFERS] = index;
+}
+
+// Queue the answers left of a stream, leaving buffers for other connections.
+// Returns false, stalling the connection, if some had to wait.
+static bool conn_stream (struct uring_worker *uw, struct uring_conn *conn)
+{
+    while(conn->stream.pending)
+    {
+        if(!uw->tx_free_count || conn->txq_count >= STREAM_BUFFERS)
+        {
+            conn_stall(uw, conn);
+            return false;
+        }
+
+        uint16_t index = uw->tx_free[--uw->tx_free_count];
+        struct sllp_raw_packet response = {
+            .data = uw->tx_mem + index*SLLP_MAX_MESSAGE
+        };
+
+        sllp_stream_next(uw->worker->net->sllp, &conn->stream, &response,
+                         NULL, NULL);
+        conn_queue(uw, conn, index, &response);
+    }
+
+    return true;
+}
+
+// Answer the complete messages in data. Returns how many bytes were consumed,
+// less than len if the answer buffers ran out.
+static uint32_t conn_feed (struct uring_worker *uw, struct uring_conn *conn,
+                           uint8_t *data, uint32_t len)
+{
+    uint32_t pos = 0;
+
+    // Complete a message split between receptions
+    if(conn->rx_len)
+    {
+        while(conn->rx_len < HEADER_LEN && pos < len)
+            conn->rx[conn->rx_len++] = data[pos++];
+
+        if(conn->rx_len < HEADER_LEN)
+            return pos;
+
+        uint16_t frame = HEADER_LEN + sllp_decode_size(conn->rx[1]);
+        uint32_t take = frame - conn->rx_len;
+
+        if(take > len - pos)
+            take = len - pos;
+
+        memcpy(conn->rx + conn->rx_len, data + pos, take);
+        conn->rx_len += take;
+        pos += take;
+
+        if(!conn_finish(uw, conn))
+            return pos;
+    }
+
+    // Answer messages in place
+    while(len - pos >= HEADER_LEN)
+    {
+        uint16_t frame = HEADER_LEN + sllp_decode_size(data[pos + 1]);
+
+        if(len - pos < frame)
+            break;
+
+        if(!conn_answer(uw, conn, data + pos, frame))
+            return pos;
+
+        pos += frame;
+    }
+
+    // Keep the start of a message split between receptions
+    conn->rx_len = len - pos;
+    if(conn->rx_len)
+        memcpy(conn->rx, data + pos, conn->rx_len);
+
+    return len;
+}
+
+// Answer the message split between receptions, kept in rx. Returns false if
+// it isn't complete yet or its answer has to wait.
+static bool conn_finish (struct uring_worker *uw, struct uring_conn *conn)
+{
+    if(conn->rx_len < HEADER_LEN)
+        return false;
+
+    uint16_t frame = HEADER_LEN + sllp_decode_size(conn->rx[1]);
+
+    if(conn->rx_len < frame || !conn_answer(uw, conn, conn->rx, frame))
+        return false;
+
+    conn->rx_len = 0;
+    return true;
+}
+
+// Stop answering a connection until answer buffers are released, and
+// receiving from it, so that its peer is held back by the socket's buffers
+static void conn_stall (struct uring_worker *uw, struct uring_conn *conn)
+{
+    conn->stalled = true;
+
+    if(!conn->recv_armed)
+        return;
+
+    struct io_uring_sqe *sqe = ring_sqe(&uw->ring);
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = USER_DATA(conn, OP_RECV);
+    sqe->user_data = USER_DATA(NULL, OP_STOP);
+}
+
+// Go on with the received bytes a connection had to hold, then receive again
+static void conn_resume (struct uring_worker *uw, struct uring_conn *conn)
+{
+    conn->stalled = false;
+
+    // First the rest of a stream, then the message split between receptions,
+    // if it's complete
+    if(conn_stream(uw, conn) && conn->rx_len)
+        conn_finish(uw, conn);
+
+    while(!conn->stalled && conn->held_count)
+    {
+        struct uring_chunk *chunk = &conn->held[0];
+        uint8_t *data = uw->rx_mem + chunk->bid*SLLP_MAX_MESSAGE;
+
+        chunk->pos += conn_feed(uw, conn, data + chunk->pos,
+                                chunk->len - chunk->pos);
+
+        if(chunk->pos < chunk->len)
+            break;
+
+        rx_return(uw, chunk->bid);
+        memmove(conn->held, conn->held + 1,
+                --conn->held_count*sizeof(conn->held[0]));
+    }
+
+    conn_flush(uw, conn);
+
+    if(!conn->stalled && !conn->recv_armed && !conn->closing)
+        arm_recv(uw, conn);
+}
+
+// Send the queued answers as a chain of linked writes, unless a chain is
+// already in flight
+static void conn_flush (struct uring_worker *uw, struct uring_conn *conn)
+{
+    if(conn->inflight || conn->closing || !conn->txq_count)
+        return;
+
+    unsigned int i;
+    for(i = 0; i < conn->txq_count; ++i)
+    {
+        uint16_t index = conn->txq[(conn->txq_head + i) % TX_BUFFERS];
+        struct io_uring_sqe *sqe = ring_sqe(&uw->ring);
+
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = conn->fd;
+        sqe->addr = (uintptr_t)(uw->tx_mem + index*SLLP_MAX_MESSAGE +
+                                uw->tx_pos[index]);
+        sqe->len = uw->tx_len[index] - uw->tx_pos[index];
+        sqe->buf_index = index;
+        sqe->off = -1;
+        sqe->user_data = USER_DATA(conn, OP_WRITE);
+
+        if(i + 1 < conn->txq_count)
+            sqe->flags = IOSQE_IO_LINK;
+    }
+
+    conn->inflight = conn->txq_count;
+}
+
+// Stop serving a connection. Its requests end with errors, then it's
+// released.
+static void conn_shutdown (struct uring_worker *uw, struct uring_conn *conn)
+{
+    if(conn->closing)
+        return;
+
+    conn->closing = true;
+    shutdown(conn->fd, SHUT_RDWR);
+
+    while(conn->held_count)
+        rx_return(uw, conn->held[--conn->held_count].bid);
+
+    conn->stalled = false;
+    conn->stream.pending = false;
+}
+
+// Free a connection being closed once it has no requests in flight
+static void conn_release (struct uring_worker *uw, struct uring_conn *conn)
+{
+    if(!conn->closing || conn->recv_armed || conn->inflight)
+        return;
+
+    while(conn->txq_count)
+    {
+        uw->tx_free[uw->tx_free_count++] = conn->txq[conn->txq_head];
+        conn->txq_head = (conn->txq_head + 1) % TX_BUFFERS;
+        --conn->txq_count;
+    }
+
+    if(conn->prev)
+        conn->prev->next = conn->next;
+    else
+        uw->conns = conn->next;
+
+    if(conn->next)
+        conn->next->prev = conn->prev;
+
+    close(conn->fd);
+    free(conn);
+}
@@ -1,49 +1,99 @@
 #include "sllp_server.h"
-#include "sllp_list.h"
 #include "common.h"
 #include "message.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+// <editor-fold defaultstate="collapsed" desc="Auxiliary functions">
+static void instance_init (struct sllp_instance *sllp);
+static enum sllp_err curve_check (const struct sllp_curve *curve);
+static enum sllp_err curve_alloc (struct sllp_instance *sllp,
+                                  const struct sllp_curve *curve,
+                                  struct curve_digests **digests,
+                                  struct curve_envelopes **envelopes);
+static void curve_add (struct sllp_instance *sllp, struct sllp_curve *curve,
+                       struct curve_digests *digests,
+                       struct curve_envelopes *envelopes);
+// </editor-fold>
+
 sllp_instance_t *sllp_new (void)
 {
     struct sllp_instance *sllp = malloc(sizeof(*sllp));
 
     if(!sllp)
         return NULL;
-    
-    sllp_list_init (&sllp->vars_list);
-    sllp_list_init (&sllp->groups_list);
-    sllp_list_init (&sllp->curves_list);
 
-    group_init(&sllp->group_all, GROUP_ALL_ID, false);
-    group_init(&sllp->group_read, GROUP_READ_ID, false);
-    group_init(&sllp->group_write, GROUP_WRITE_ID, true);
+    instance_init(sllp);
+
+    return sllp;
+}
+
+sllp_instance_t *sllp_new_static (void *buffer, size_t size)
+{
+    if(!buffer)
+        return NULL;
+
+    // The instance goes first, aligned like the rest of the arena
+    size_t pad = -(uintptr_t) buffer & (ARENA_ALIGN - 1);
+    size_t used = pad + ARENA_ROUND(sizeof(struct sllp_instance));
 
-    sllp_list_add (&sllp->groups_list, (void*) &sllp->group_all);
-    sllp_list_add (&sllp->groups_list, (void*) &sllp->group_read);
-    sllp_list_add (&sllp->groups_list, (void*) &sllp->group_write);
+    if(size < used)
+        return NULL;
+
+    struct sllp_instance *sllp = (struct sllp_instance *)
+                                 ((uint8_t *) buffer + pad);
+
+    instance_init(sllp);
 
-    memset(sllp->modified_list, 0, sizeof(sllp->modified_list));
+    sllp->arena.enabled = true;
+    sllp->arena.next = (uint8_t *) buffer + used;
+    sllp->arena.left = size - used;
 
     return sllp;
 }
 
+size_t sllp_static_size (unsigned int groups,
+                         const struct sllp_curve *const *curves,
+                         unsigned int count)
+{
+    size_t size = ARENA_ALIGN - 1 + ARENA_ROUND(sizeof(struct sllp_instance)) +
+                  groups*ARENA_ROUND(sizeof(struct sllp_group));
+
+    unsigned int i;
+    for(i = 0; i < count; ++i)
+    {
+        size += ARENA_ROUND(curve_digests_size(curves[i]));
+
+        if(curves[i]->sample_type)
+            size += ARENA_ROUND(curve_envelopes_size(curves[i]));
+    }
+
+    return size;
+}
+
 enum sllp_err sllp_destroy (sllp_instance_t* sllp)
 {
     if(!sllp)
         return SLLP_ERR_PARAM_INVALID;
 
-    struct sllp_list_element *g;
-    for(g = sllp->groups_list.head; g; g = g->next)
-        sllp_list_clear(&((struct sllp_group *) g->value)->vars_list);
-    
-    sllp_list_clear (&sllp->vars_list);
-    sllp_list_clear (&sllp->groups_list);
-    sllp_list_clear (&sllp->curves_list);
+    // Only the groups created by clients were allocated, including the ones
+    // removed afterwards
+    unsigned int i;
+    for(i = GROUP_STANDARD_COUNT; i < MAX_GROUPS; ++i)
+        instance_free(sllp, sllp->groups.list[i]);
 
-    free(sllp);
+    for(i = 0; i < sllp->curves.count; ++i)
+    {
+        if(sllp->curves.prefetch[i])
+            prefetch_destroy(sllp->curves.prefetch[i]);
+        instance_free(sllp, sllp->curves.digests[i]);
+        instance_free(sllp, sllp->curves.envelopes[i]);
+    }
+    free(sllp->curves.csum_buf);
+
+    if(!sllp->arena.enabled)
+        free(sllp);
 
     return SLLP_SUCCESS;
 }
@@ -63,30 +113,176 @@ enum sllp_err sllp_register_variable (sllp_instance_t *sllp,
         return SLLP_ERR_PARAM_INVALID;
 
     // Check vars limit
-    if(sllp->vars_list.count == MAX_VARIABLES)
+    if(sllp->vars.count == MAX_VARIABLES)
         return SLLP_ERR_OUT_OF_MEMORY; // TODO: improve error code?
 
-    // Add to the variables list
-    if(sllp_list_add(&sllp->vars_list, (void*) var))
-        return SLLP_ERR_OUT_OF_MEMORY;
-
-    // Adjust var id
-    var->id = sllp->vars_list.count - 1;
+    // Add to the variables table
+    var->id = sllp->vars.count;
+    sllp->vars.list[sllp->vars.count++] = var;
+    sllp->vars.info[var->id] = (var->writable ? SLLP_WRITABLE : 0) +
+                               var->size;
 
     // Add to the group containing all variables
-    if(sllp_list_add(&sllp->group_all.vars_list, (void*) var))
+    if(group_add_var(&sllp->group_all, var))
         return SLLP_ERR_OUT_OF_MEMORY;
 
-    sllp->group_all.data_size += var->size;
-
     // Add either to the WRITABLE or to the READ_ONLY group
     struct sllp_group *g;
     g = var->writable ? &sllp->group_write : &sllp->group_read;
 
-    if(sllp_list_add(&g->vars_list, (void*) var))
+    if(group_add_var(g, var))
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    group_list_update(sllp, &sllp->group_all);
+    group_list_update(sllp, g);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_register_command (sllp_instance_t *sllp, uint8_t code,
+                                     struct sllp_command *command)
+{
+    if(!sllp || !command || !command->handler)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(command->size > SLLP_MAX_PAYLOAD)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    if(command_is_builtin(code) || sllp->commands[code])
+        return SLLP_ERR_PARAM_INVALID;
+
+    sllp->commands[code] = command;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_register_table (sllp_instance_t *sllp,
+                                   const struct sllp_table *table)
+{
+    if(!sllp || !table)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(sllp->vars.count || sllp->curves.count ||
+       sllp->groups.count != GROUP_STANDARD_COUNT)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(table->vars_count > MAX_VARIABLES ||
+       table->groups_count > MAX_GROUPS - GROUP_STANDARD_COUNT ||
+       table->curves_count > MAX_CURVES)
         return SLLP_ERR_OUT_OF_MEMORY;
 
-    g->data_size += var->size;
+    // Check the whole table before touching the instance. The variables were
+    // already checked and numbered by the compiler
+    unsigned int i, j;
+    for(i = 0; i < table->groups_count; ++i)
+    {
+        const struct sllp_table_group *tg = &table->groups[i];
+        uint32_t seen[MAX_VARIABLES/32] = {0};
+
+        for(j = 0; j < tg->count; ++j)
+        {
+            uint8_t id = tg->vars[j];
+
+            if(id >= table->vars_count || seen[id/32] & 1u << id%32)
+                return SLLP_ERR_PARAM_INVALID;
+
+            seen[id/32] |= 1u << id%32;
+        }
+    }
+
+    for(i = 0; i < table->curves_count; ++i)
+    {
+        enum sllp_err err = curve_check(table->curves[i]);
+
+        if(err)
+            return err;
+    }
+
+    // Then allocate what it needs, undoing it all if something is missing
+    struct curve_digests *digests[MAX_CURVES];
+    struct curve_envelopes *envelopes[MAX_CURVES];
+    struct sllp_group *allocated[MAX_GROUPS] = {NULL};
+    uint8_t *arena_next = sllp->arena.next;
+    size_t arena_left = sllp->arena.left;
+    enum sllp_err err = SLLP_SUCCESS;
+
+    for(i = 0; i < table->curves_count && !err; ++i)
+        err = curve_alloc(sllp, table->curves[i], &digests[i], &envelopes[i]);
+
+    unsigned int curves_allocated = err ? i - 1 : i;
+
+    // Groups removed by clients are reused, like in CMD_CREATE_GROUP
+    for(i = GROUP_STANDARD_COUNT;
+        i < GROUP_STANDARD_COUNT + table->groups_count && !err; ++i)
+    {
+        if(sllp->groups.list[i])
+            continue;
+
+        if(!(allocated[i] = instance_alloc(sllp, sizeof(struct sllp_group))))
+            err = SLLP_ERR_OUT_OF_MEMORY;
+    }
+
+    if(err)
+    {
+        for(i = 0; i < curves_allocated; ++i)
+        {
+            instance_free(sllp, digests[i]);
+            instance_free(sllp, envelopes[i]);
+        }
+
+        for(i = 0; i < MAX_GROUPS; ++i)
+            instance_free(sllp, allocated[i]);
+
+        sllp->arena.next = arena_next;
+        sllp->arena.left = arena_left;
+
+        return err;
+    }
+
+    // Nothing can fail from here on
+    for(i = 0; i < table->vars_count; ++i)
+    {
+        struct sllp_var *var = table->vars[i];
+
+        sllp->vars.list[i] = var;
+        group_add_var(&sllp->group_all, var);
+        group_add_var(var->writable ? &sllp->group_write : &sllp->group_read,
+                      var);
+    }
+
+    sllp->vars.count = table->vars_count;
+    memcpy(sllp->vars.info, table->vars_list, table->vars_count);
+
+    for(i = 0; i < GROUP_STANDARD_COUNT; ++i)
+        group_list_update(sllp, sllp->groups.list[i]);
+
+    // Groups, as if created by a client
+    for(i = 0; i < table->groups_count; ++i)
+    {
+        const struct sllp_table_group *tg = &table->groups[i];
+        uint8_t id = sllp->groups.count;
+        struct sllp_group *grp = sllp->groups.list[id];
+
+        if(!grp)
+        {
+            grp = allocated[id];
+            grp->seq = 0;
+            sllp->groups.list[id] = grp;
+        }
+
+        group_init(grp, id, true);
+        sllp->groups.count++;
+
+        for(j = 0; j < tg->count; ++j)
+            group_add_var(grp, sllp->vars.list[tg->vars[j]]);
+
+        group_list_update(sllp, grp);
+    }
+
+    sllp->groups.fixed = sllp->groups.count;
+
+    for(i = 0; i < table->curves_count; ++i)
+        curve_add(sllp, table->curves[i], digests[i], envelopes[i]);
 
     return SLLP_SUCCESS;
 }
@@ -97,25 +293,78 @@ enum sllp_err sllp_register_curve (sllp_instance_t *sllp,
     if(!sllp || !curve)
         return SLLP_ERR_PARAM_INVALID;
 
-    // Check variable fields
-    if(!curve->read_block)
+    enum sllp_err err = curve_check(curve);
+
+    if(err)
+        return err;
+
+    // Check vars limit
+    if(sllp->curves.count == MAX_CURVES)
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    struct curve_digests *digests;
+    struct curve_envelopes *envelopes;
+
+    if((err = curve_alloc(sllp, curve, &digests, &envelopes)))
+        return err;
+
+    curve_add(sllp, curve, digests, envelopes);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_set_curve_prefetch (sllp_instance_t *sllp,
+                                       struct sllp_curve *curve,
+                                       unsigned int depth)
+{
+    if(!sllp || !curve)
         return SLLP_ERR_PARAM_INVALID;
 
-    if(curve->writable && !curve->write_block)
+    if(curve->id >= sllp->curves.count || sllp->curves.list[curve->id] != curve)
         return SLLP_ERR_PARAM_INVALID;
-    else if(!curve->writable && curve->write_block)
+
+    if(curve->get_block_ptr)
         return SLLP_ERR_PARAM_INVALID;
 
-    // Check vars limit
-    if(sllp->curves_list.count == MAX_CURVES)
-        return SLLP_ERR_OUT_OF_MEMORY;
+    if(depth > curve->nblocks)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    struct curve_prefetch **pf = &sllp->curves.prefetch[curve->id];
 
-    // Add to the curves list
-    if(sllp_list_add(&sllp->curves_list, (void*) curve))
+    if(*pf)
+    {
+        prefetch_destroy(*pf);
+        *pf = NULL;
+    }
+
+    if(depth && !(*pf = prefetch_new(curve, depth)))
         return SLLP_ERR_OUT_OF_MEMORY;
 
-    // Adjust var id
-    curve->id = sllp->curves_list.count - 1;
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_curve_block_changed (sllp_instance_t *sllp,
+                                        struct sllp_curve *curve,
+                                        uint8_t block)
+{
+    if(!sllp || !curve)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(curve->id >= sllp->curves.count || sllp->curves.list[curve->id] != curve)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(block > curve->nblocks)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    struct curve_digests *digests = sllp->curves.digests[curve->id];
+    struct curve_envelopes *envelopes = sllp->curves.envelopes[curve->id];
+
+    instance_lock(sllp);
+    digests->dirty[block/8] |= 1 << (block % 8);
+    ++digests->generations[block];
+    if(envelopes)
+        envelopes->stale[block/8] |= 1 << (block % 8);
+    instance_unlock(sllp);
 
     return SLLP_SUCCESS;
 }
@@ -130,6 +379,52 @@ enum sllp_err sllp_process_packet (sllp_instance_t *sllp,
     return packet_process(sllp, request, response);
 }
 
+enum sllp_err sllp_process_packet_iov (sllp_instance_t *sllp,
+                                       struct sllp_raw_packet *request,
+                                       struct sllp_raw_packet *response,
+                                       struct iovec *iov, int *iovcnt)
+{
+    if(!sllp || !request || !response || !iov || !iovcnt)
+        return SLLP_ERR_PARAM_INVALID;
+
+    return packet_process_iov(sllp, request, response, iov, iovcnt);
+}
+
+enum sllp_err sllp_process_stream (sllp_instance_t *sllp,
+                                   struct sllp_raw_packet *request,
+                                   struct sllp_raw_packet *response,
+                                   struct iovec *iov, int *iovcnt,
+                                   struct sllp_stream *stream)
+{
+    if(!sllp || !request || !response || !stream)
+        return SLLP_ERR_PARAM_INVALID;
+
+    return packet_process_stream(sllp, request, response, iov, iovcnt,
+                                 stream);
+}
+
+enum sllp_err sllp_stream_next (sllp_instance_t *sllp,
+                                struct sllp_stream *stream,
+                                struct sllp_raw_packet *response,
+                                struct iovec *iov, int *iovcnt)
+{
+    if(!sllp || !stream || !response)
+        return SLLP_ERR_PARAM_INVALID;
+
+    return packet_stream_next(sllp, stream, response, iov, iovcnt);
+}
+
+enum sllp_err sllp_process_batch (sllp_instance_t *sllp,
+                                  struct sllp_raw_packet *requests,
+                                  struct sllp_raw_packet *responses,
+                                  unsigned int n)
+{
+    if(!sllp || !requests || !responses)
+        return SLLP_ERR_PARAM_INVALID;
+
+    return packet_process_batch(sllp, requests, responses, n);
+}
+
 enum sllp_err sllp_register_hook(sllp_instance_t* sllp, sllp_hook_t hook)
 {
     if(!sllp || !hook)
@@ -139,3 +434,146 @@ enum sllp_err sllp_register_hook(sllp_instance_t* sllp, sllp_hook_t hook)
 
     return SLLP_SUCCESS;
 }
+
+enum sllp_err sllp_set_concurrent (sllp_instance_t *sllp, bool concurrent)
+{
+    if(!sllp)
+        return SLLP_ERR_PARAM_INVALID;
+
+    sllp->concurrent = concurrent;
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_publish_variable (sllp_instance_t *sllp,
+                                     struct sllp_var *var,
+                                     const uint8_t *value)
+{
+    if(!sllp || !var || !value)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(var->id >= sllp->vars.count || sllp->vars.list[var->id] != var)
+        return SLLP_ERR_PARAM_INVALID;
+
+    var_write_seq(sllp, var, value);
+
+    return SLLP_SUCCESS;
+}
+
+enum sllp_err sllp_var_groups (sllp_instance_t *sllp, struct sllp_var *var,
+                               uint8_t *ids, unsigned int *count)
+{
+    if(!sllp || !var || !ids || !count)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(var->id >= sllp->vars.count || sllp->vars.list[var->id] != var)
+        return SLLP_ERR_PARAM_INVALID;
+
+    unsigned int i, found = 0;
+
+    instance_lock(sllp);
+
+    for(i = 0; i < sllp->groups.count; ++i)
+        if(group_contains(sllp->groups.list[i], var->id))
+            ids[found++] = i;
+
+    instance_unlock(sllp);
+
+    *count = found;
+
+    return SLLP_SUCCESS;
+}
+
+// Empty tables, released sequence locks, hook unset, concurrent mode disabled
+// and the standard groups
+static void instance_init (struct sllp_instance *sllp)
+{
+    memset(sllp, 0, sizeof(*sllp));
+
+    group_init(&sllp->group_all, GROUP_ALL_ID, false);
+    group_init(&sllp->group_read, GROUP_READ_ID, false);
+    group_init(&sllp->group_write, GROUP_WRITE_ID, true);
+
+    sllp->groups.list[sllp->groups.count++] = &sllp->group_all;
+    sllp->groups.list[sllp->groups.count++] = &sllp->group_read;
+    sllp->groups.list[sllp->groups.count++] = &sllp->group_write;
+    sllp->groups.fixed = sllp->groups.count;
+
+    group_list_update(sllp, &sllp->group_all);
+    group_list_update(sllp, &sllp->group_read);
+    group_list_update(sllp, &sllp->group_write);
+}
+
+static enum sllp_err curve_check (const struct sllp_curve *curve)
+{
+    if(!curve)
+        return SLLP_ERR_PARAM_INVALID;
+
+    // Check curve fields
+    if(!curve->read_block && !curve->get_block_ptr)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(curve->writable && !curve->write_block)
+        return SLLP_ERR_PARAM_INVALID;
+    else if(!curve->writable && curve->write_block)
+        return SLLP_ERR_PARAM_INVALID;
+
+    if(curve->sample_type >= SLLP_SAMPLE_MAX)
+        return SLLP_ERR_PARAM_OUT_OF_RANGE;
+
+    return SLLP_SUCCESS;
+}
+
+static enum sllp_err curve_alloc (struct sllp_instance *sllp,
+                                  const struct sllp_curve *curve,
+                                  struct curve_digests **digests,
+                                  struct curve_envelopes **envelopes)
+{
+    // Digests of its blocks, all to be calculated
+    *digests = instance_alloc(sllp, curve_digests_size(curve));
+
+    if(!*digests)
+        return SLLP_ERR_OUT_OF_MEMORY;
+
+    memset((*digests)->dirty, 0xFF, sizeof((*digests)->dirty));
+    memset((*digests)->generations, 0, sizeof((*digests)->generations));
+
+    // Envelopes of its blocks, likewise
+    *envelopes = NULL;
+
+    if(curve->sample_type)
+    {
+        *envelopes = instance_alloc(sllp, curve_envelopes_size(curve));
+
+        if(!*envelopes)
+        {
+            instance_free(sllp, *digests);
+            return SLLP_ERR_OUT_OF_MEMORY;
+        }
+
+        // The sums follow the bins, whose size is a multiple of theirs
+        size_t bins = (curve->nblocks + 1)*ENVELOPE_BINS*2*
+                      sllp_sample_size(curve->sample_type);
+
+        (*envelopes)->sums = (struct envelope_sums *) ((*envelopes)->bins +
+                                                       bins);
+        memset((*envelopes)->stale, 0xFF, sizeof((*envelopes)->stale));
+    }
+
+    return SLLP_SUCCESS;
+}
+
+static void curve_add (struct sllp_instance *sllp, struct sllp_curve *curve,
+                       struct curve_digests *digests,
+                       struct curve_envelopes *envelopes)
+{
+    // Add to the curves table
+    curve->id = sllp->curves.count;
+    sllp->curves.info[curve->id][0] = curve->writable;
+    sllp->curves.info[curve->id][1] = curve->nblocks;
+    memcpy(sllp->curves.info[curve->id] + 2, curve->checksum,
+           CURVE_CSUM_SIZE);
+    sllp->curves.digests[curve->id] = digests;
+    sllp->curves.envelopes[curve->id] = envelopes;
+    sllp->curves.list[sllp->curves.count++] = curve;
+}
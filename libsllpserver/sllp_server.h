@@ -9,10 +9,14 @@
 #ifndef SLLP_SERVER_H
 #define	SLLP_SERVER_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 
-#define SLLP_MAX_MESSAGE 16386
+#include "sllp_protocol.h"
+
+#define SLLP_MAX_IOV     129        // Header plus one entry per variable
 
 enum sllp_operation
 {
@@ -20,17 +24,6 @@ enum sllp_operation
     SLLP_OP_WRITE,                  // Write command arrived
 };
 
-enum sllp_err
-{
-    SLLP_SUCCESS,                   // Operation executed successfully
-    SLLP_ERR_PARAM_INVALID,         // An invalid parameter was passed
-    SLLP_ERR_PARAM_OUT_OF_RANGE,    // A param not in the acceptable range was
-                                    // passed
-    SLLP_ERR_OUT_OF_MEMORY,         // Not enough memory to complete operation
-    
-    SLLP_ERR_MAX
-};
-
 typedef struct sllp_instance sllp_instance_t;   // Type of the sllp handle
 
 struct sllp_var
@@ -49,7 +42,10 @@ struct sllp_curve
     uint8_t id;                     // ID of the curve, used in the protocol.
     bool    writable;               // Determine if the curve is writable.
     uint8_t nblocks;                // How many 16kB blocks the curve contains.
-    uint8_t checksum[16];           // MD5 checksum of the curve
+    uint8_t sample_type;            // Optional. What the curve holds, from
+                                    // enum sllp_sample_type, for envelopes.
+    uint8_t checksum[16];           // Checksum of the curve: MD5 of the
+                                    // MD5 digests of its blocks, in order
 
     // Read a 16384 bytes block into data
     void (*read_block) (struct sllp_curve *curve, uint8_t block, uint8_t *data);
@@ -57,16 +53,78 @@ struct sllp_curve
     // Write a 16384 bytes block from data
     void (*write_block)(struct sllp_curve *curve, uint8_t block, uint8_t *data);
 
+    // Optional. Pointer to a 16384 bytes block resident in memory, which is
+    // then transmitted and hashed in place instead of being read.
+    const uint8_t *(*get_block_ptr) (struct sllp_curve *curve, uint8_t block);
+
+    // Optional. Read len bytes starting at offset into data, for requests
+    // of less than whole blocks. May span blocks. Without it, the blocks
+    // covered are read whole with read_block.
+    void (*read_range) (struct sllp_curve *curve, uint32_t offset,
+                        uint16_t len, uint8_t *data);
+
     void    *user;                  // The user can make use of this variable as
                                     // he wishes. It is not touched by SLLP.
 };
 
+// A command added by the user (see sllp_register_command)
+struct sllp_command
+{
+    uint16_t size;                  // Payload size of requests.
+    bool     at_least;              // Take requests of size bytes or more.
+
+    // Answer a request, whose payload size was already checked, writing the
+    // payload of the answer, of up to capacity (SLLP_MAX_PAYLOAD) bytes, to
+    // answer and its size to answer_size. Returns the command code of the
+    // answer, which is replaced by CMD_ERR_INVALID_PAYLOAD_SIZE if
+    // answer_size exceeds capacity.
+    uint8_t (*handler) (struct sllp_command *command, const uint8_t *payload,
+                        uint16_t size, uint8_t *answer, uint16_t capacity,
+                        uint16_t *answer_size);
+
+    void    *user;                  // The user can make use of this variable as
+                                    // he wishes. It is not touched by SLLP.
+};
+
+// A group declared at compile time: the IDs of its variables
+struct sllp_table_group
+{
+    const uint8_t *vars;
+    uint8_t       count;
+};
+
+// Variables, groups and curves declared at compile time. Built by sllp_table.h.
+struct sllp_table
+{
+    struct sllp_var *const *vars;   // In ID order, with their id filled in.
+    unsigned int vars_count;
+    const uint8_t *vars_list;       // Payload of CMD_VARS_LIST.
+
+    const struct sllp_table_group *groups;  // Following the standard ones.
+    unsigned int groups_count;
+
+    struct sllp_curve *const *curves;   // In ID order.
+    unsigned int curves_count;
+};
+
 struct sllp_raw_packet
 {
     uint8_t *data;
     uint16_t len;
 };
 
+// Answers still owed to a request answered with several messages, such as a
+// range of curve blocks. Set by sllp_process_stream, advanced by
+// sllp_stream_next.
+struct sllp_stream
+{
+    bool     pending;               // More answers are to be sent.
+
+    // Private
+    uint8_t  curve;
+    uint16_t next, last;
+};
+
 typedef void (*sllp_hook_t) (enum sllp_operation op, struct sllp_var **list);
 
 /**
@@ -81,7 +139,45 @@ typedef void (*sllp_hook_t) (enum sllp_operation op, struct sllp_var **list);
 sllp_instance_t *sllp_new (void);
 
 /**
- * Deallocate a SLLP instance
+ * Create a SLLP instance in memory provided by the caller, for targets where
+ * heap use causes jitter or fragmentation. The instance, the groups created
+ * by clients and the block digests and envelopes of the curves registered are
+ * all carved from buffer, so that processing packets never allocates memory.
+ * Groups removed by clients are reused by the next ones created; once the
+ * buffer is exhausted, group creation is refused.
+ *
+ * Checksum recalculations read and hash the blocks of curves without
+ * get_block_ptr one at a time, instead of in parallel batches. Read-ahead
+ * engines (see sllp_set_curve_prefetch) and network servers are still
+ * allocated on the heap.
+ *
+ * @param buffer [input] Memory for the instance, which must remain valid until
+ *                       sllp_destroy. See sllp_static_size.
+ * @param size [input] Size of buffer.
+ *
+ * @return A handle to the instance or NULL if buffer is a NULL pointer or too
+ *         small for the instance itself.
+ */
+sllp_instance_t *sllp_new_static (void *buffer, size_t size);
+
+/**
+ * Size of the buffer needed by sllp_new_static for a given use.
+ *
+ * @param groups [input] How many groups clients may create at a time, plus
+ *                       the groups of a table (see sllp_register_table).
+ * @param curves [input] The curves to be registered, with their nblocks and
+ *                       sample_type filled in. May be NULL if count is 0.
+ * @param count [input] How many curves there are.
+ *
+ * @return The size in bytes.
+ */
+size_t sllp_static_size (unsigned int groups,
+                         const struct sllp_curve *const *curves,
+                         unsigned int count);
+
+/**
+ * Deallocate a SLLP instance. The buffer of an instance created by
+ * sllp_new_static is left to the caller.
  * 
  * @param sllp [input] Handle to the instance to be deallocated.
  * 
@@ -115,15 +211,66 @@ enum sllp_err sllp_destroy (sllp_instance_t *sllp);
 enum sllp_err sllp_register_variable (sllp_instance_t *sllp,
                                       struct sllp_var *var);
 
+/**
+ * Register the variables, groups and curves of a table declared at compile
+ * time with sllp_table.h, in a single call. Their IDs are the ones fixed by the
+ * table, so the instance must have nothing registered yet. The variables are
+ * taken as they are, without the checks of sllp_register_variable, which the
+ * compiler already made, and CMD_QUERY_VARS_LIST is answered with the table's
+ * payload. The groups of the table are created as if by clients, but
+ * CMD_REMOVE_ALL_GROUPS leaves them in place.
+ *
+ * Static instances need room for the table's groups (see sllp_static_size).
+ * The whole table is checked and its memory allocated before anything is
+ * registered, so on error the instance is left as it was.
+ *
+ * @param sllp [input] Handle to the instance.
+ * @param table [input] The table, which must remain valid throughout the
+ *                      lifespan of the instance.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp or table is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp already has variables, groups or
+ *                               curves.</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: a group of the table names a variable
+ *                               twice or one that doesn't exist.</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: there's no room for the groups, or for the
+ *                               curves' block digests or envelopes.</li>
+ *   <li>Any error of sllp_register_curve for the curves.</li>
+ * </ul>
+ */
+enum sllp_err sllp_register_table (sllp_instance_t *sllp,
+                                   const struct sllp_table *table);
+
 /**
  * Register a curve with a SLLP instance. The memory pointed by te curve
  * parameter must remain valid throughout the entire lifespan of the sllp
  * instance. The id field of the curve parameter will be written by the SLLP
  * lib.
  *
- * The fields writable, nblocks and read_block must be filled correctly.
- * If writable is true, the field write_block must also be filled correctly.
- * Otherwise, write_block must be NULL.
+ * The fields writable, nblocks and either read_block or get_block_ptr must be
+ * filled correctly. If writable is true, the field write_block must also be
+ * filled correctly. Otherwise, write_block must be NULL.
+ *
+ * If get_block_ptr is set, read_block is never called. Blocks are transmitted
+ * from the memory it points to: sllp_process_packet_iov references them,
+ * unless in concurrent mode, and sllp_process_packet copies them once.
+ * read_range is then never called either, nor while read-ahead is enabled
+ * (see sllp_set_curve_prefetch).
+ *
+ * The lib keeps the MD5 digest of each block of the curve. Blocks written by
+ * clients have their digest updated right away; blocks changed by the
+ * application must be reported with sllp_curve_block_changed. Recalculating
+ * the checksum only reads the blocks whose digest is out of date, which at
+ * first are all of them.
+ *
+ * If sample_type is set, clients can query an envelope of the curve, the
+ * minimum and maximum sample of each of a number of points spanning it, and
+ * statistics of its blocks. Both come from a summary of each block, which is
+ * calculated from the data when a client writes the block, and read from the
+ * curve on the first query after it is reported changed with
+ * sllp_curve_block_changed, or ever.
  *
  * The user field is untouched.
  *
@@ -133,16 +280,74 @@ enum sllp_err sllp_register_variable (sllp_instance_t *sllp,
  * @return SLLP_SUCCESS or one of the following errors:
  * <ul>
  *   <li>SLLP_ERR_PARAM_INVALID: either sllp or curve is a NULL pointer.</li>
- *   <li>SLLP_ERR_PARAM_INVALID: curve->read_block is NULL.</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: both curve->read_block and
+ *                               curve->get_block_ptr are NULL.</li>
  *   <li>SLLP_ERR_PARAM_INVALID: curve->writable is true and curve->write_block
  *                               is NULL.</li>
  *   <li>SLLP_ERR_PARAM_INVALID: curve->writable is false and curve->write_block
  *                               is not NULL.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: curve->sample_type is not one of enum
+ *                                    sllp_sample_type.</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: there's no room for another curve or for
+ *                               its block digests or envelopes.</li>
  * </ul>
  */
 enum sllp_err sllp_register_curve (sllp_instance_t *sllp,
                                    struct sllp_curve *curve);
 
+/**
+ * Tell that the application changed a block of a curve, so that its digest is
+ * calculated again by the next checksum recalculation, and its envelope by
+ * the next envelope query.
+ *
+ * @param sllp [input] Handle to a SLLP instance.
+ * @param curve [input] A curve registered with sllp.
+ * @param block [input] The block that changed.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp or curve is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: curve is not registered with sllp.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: block is greater than
+ *                                    curve->nblocks.</li>
+ * </ul>
+ */
+enum sllp_err sllp_curve_block_changed (sllp_instance_t *sllp,
+                                        struct sllp_curve *curve,
+                                        uint8_t block);
+
+/**
+ * Read the blocks of a curve ahead of its transmission. Clients download a
+ * curve by requesting its blocks in order: with read-ahead, whenever block k
+ * is transmitted, a worker thread reads blocks k+1 to k+depth into memory,
+ * so that the following requests don't wait for read_block.
+ *
+ * With read-ahead enabled, read_block is called from the worker thread, but
+ * never at the same time as another call to read_block or write_block of the
+ * same curve. Writing a block discards its copy in memory.
+ *
+ * Must be called before processing any packet.
+ *
+ * @param sllp [input] Handle to a SLLP instance.
+ * @param curve [input] A curve registered with sllp.
+ * @param depth [input] How many blocks to read ahead. Zero disables the
+ *                      read-ahead.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp or curve is a NULL pointer.</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: curve is not registered with sllp.</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: curve has a get_block_ptr callback, so its
+ *                               blocks are already in memory.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: depth is greater than curve->nblocks.</li>
+ *   <li>SLLP_ERR_OUT_OF_MEMORY: the buffers or the worker thread couldn't be
+ *                               allocated.</li>
+ * </ul>
+ */
+enum sllp_err sllp_set_curve_prefetch (sllp_instance_t *sllp,
+                                       struct sllp_curve *curve,
+                                       unsigned int depth);
+
 /**
  * Register a function that will be called in two moments:
  *
@@ -171,6 +376,30 @@ enum sllp_err sllp_register_curve (sllp_instance_t *sllp,
  */
 enum sllp_err sllp_register_hook (sllp_instance_t *sllp, sllp_hook_t hook);
 
+/**
+ * Add a command to a SLLP instance, answered by a function of the user. Like
+ * the built-in ones, it's looked up by its code in a table, with the payload
+ * size of requests checked before the handler is called. Commands must be
+ * added before the instance processes any packet.
+ *
+ * @param sllp [input] Handle to a SLLP instance.
+ * @param code [input] Command code of requests.
+ * @param command [input] The command, which must remain valid throughout the
+ *                        lifespan of the instance.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li>SLLP_ERR_PARAM_INVALID: sllp or command is a NULL pointer, or
+ *                               command has no handler.</li>
+ *   <li>SLLP_ERR_PARAM_INVALID: code is already taken, by a built-in command
+ *                               or another added one.</li>
+ *   <li>SLLP_ERR_PARAM_OUT_OF_RANGE: command->size is beyond the largest
+ *                                    payload.</li>
+ * </ul>
+ */
+enum sllp_err sllp_register_command (sllp_instance_t *sllp, uint8_t code,
+                                     struct sllp_command *command);
+
 /**
  * Process a received message and prepare an answer.
  *
@@ -188,5 +417,189 @@ enum sllp_err sllp_process_packet (sllp_instance_t *sllp,
                                    struct sllp_raw_packet *request,
                                    struct sllp_raw_packet *response);
 
+/**
+ * Process a received message and prepare an answer described by a
+ * scatter/gather list, suitable for writev or sendmsg.
+ *
+ * Answers carrying values of variables reference them directly in the
+ * memory pointed by sllp_var::data, which must not change until the answer
+ * is sent. The message header, and any answer that has to be generated, is
+ * built in response, which must hold SLLP_MAX_MESSAGE bytes. response->len
+ * is set to the total length of the answer.
+ *
+ * @param sllp [input] Handle to a SLLP instance.
+ * @param request [input] The message to be processed.
+ * @param response [output] Storage for the header and generated answers.
+ * @param iov [output] Array of at least SLLP_MAX_IOV entries describing the
+ *                     answer, in order.
+ * @param iovcnt [output] How many entries of iov were filled.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SSLP_ERR_PARAM_INVALID: Either sllp, request, response, iov or
+ *                                iovcnt is a NULL pointer.</li>
+ * </ul>
+ */
+enum sllp_err sllp_process_packet_iov (sllp_instance_t *sllp,
+                                       struct sllp_raw_packet *request,
+                                       struct sllp_raw_packet *response,
+                                       struct iovec *iov, int *iovcnt);
+
+/**
+ * Process a received message, which may be answered with several messages.
+ * The first answer is prepared as by sllp_process_packet_iov, or as by
+ * sllp_process_packet if iov is NULL. If stream->pending is set afterwards,
+ * the others must be prepared by sllp_stream_next and sent, in order, before
+ * the answer to the next message. A transport loop looks like:
+ *
+ *     sllp_process_stream(sllp, &request, &response, iov, &iovcnt, &stream);
+ *     send the answer;
+ *     while(stream.pending)
+ *     {
+ *         sllp_stream_next(sllp, &stream, &response, iov, &iovcnt);
+ *         send the answer;
+ *     }
+ *
+ * Answers can be prepared as the transport is ready to take them, keeping
+ * the stream with the connection. The other sllp_process_* functions answer
+ * requests for several messages with CMD_ERR_OP_NOT_SUPPORTED.
+ *
+ * @param sllp [input] Handle to a SLLP instance.
+ * @param request [input] The message to be processed.
+ * @param response [output] Storage for the header and generated answers.
+ * @param iov [output] NULL, or array of at least SLLP_MAX_IOV entries
+ *                     describing the answer, in order.
+ * @param iovcnt [output] How many entries of iov were filled.
+ * @param stream [output] Answers left.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SSLP_ERR_PARAM_INVALID: Either sllp, request, response or stream is
+ *                                a NULL pointer, or iov isn't and iovcnt
+ *                                is.</li>
+ * </ul>
+ */
+enum sllp_err sllp_process_stream (sllp_instance_t *sllp,
+                                   struct sllp_raw_packet *request,
+                                   struct sllp_raw_packet *response,
+                                   struct iovec *iov, int *iovcnt,
+                                   struct sllp_stream *stream);
+
+/**
+ * Prepare the next answer of a stream, as sllp_process_stream prepares the
+ * first one.
+ *
+ * @param sllp [input] Handle to the SLLP instance that started the stream.
+ * @param stream [input] The stream, with pending set. It's advanced to the
+ *                       next answer.
+ * @param response [output] Storage for the header and generated answers.
+ * @param iov [output] NULL, or array of at least SLLP_MAX_IOV entries.
+ * @param iovcnt [output] How many entries of iov were filled.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SSLP_ERR_PARAM_INVALID: Either sllp, stream or response is a NULL
+ *                                pointer, iov isn't and iovcnt is, or no
+ *                                answer is pending.</li>
+ * </ul>
+ */
+enum sllp_err sllp_stream_next (sllp_instance_t *sllp,
+                                struct sllp_stream *stream,
+                                struct sllp_raw_packet *response,
+                                struct iovec *iov, int *iovcnt);
+
+/**
+ * Process a batch of received messages, preparing an answer for each one of
+ * them. The result is the same as calling sllp_process_packet for every
+ * request in order, except for the hook: a run of consecutive commands that
+ * read variables calls it only once, with SLLP_OP_READ and the union of the
+ * variables read by the whole run, before any of them is answered.
+ *
+ * @param sllp [input] Handle to a SLLP instance.
+ * @param requests [input] Array of n messages to be processed.
+ * @param responses [output] Array of n answers, responses[i] answering
+ *                           requests[i].
+ * @param n [input] How many messages to process.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SSLP_ERR_PARAM_INVALID: Either sllp, requests, or responses is
+ *                                a NULL pointer.</li>
+ * </ul>
+ */
+enum sllp_err sllp_process_batch (sllp_instance_t *sllp,
+                                  struct sllp_raw_packet *requests,
+                                  struct sllp_raw_packet *responses,
+                                  unsigned int n);
+
+/**
+ * Enable or disable the concurrent mode of a SLLP instance. It must be set
+ * after registering all variables and curves and before processing any
+ * packet.
+ *
+ * In concurrent mode, any number of threads may process packets for the same
+ * instance at the same time, while other threads update values through
+ * sllp_publish_variable. Each variable is guarded by a sequence lock: reading
+ * commands copy values without taking any lock and retry only when they
+ * overlap with an update, so they never see torn values. A group is read as a
+ * whole, yielding values that were all current at the same moment. Commands
+ * that create or remove groups, or write a group, are serialized among
+ * themselves.
+ *
+ * The hook function may be called from several threads at the same time,
+ * without any lock held, so it may process packets itself. In this mode
+ * sllp_process_packet_iov copies values into the response buffer
+ * instead of referencing them, as they could change before being sent.
+ *
+ * @param sllp [input] Handle to a SLLP instance.
+ * @param concurrent [input] Whether the concurrent mode is enabled.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SLLP_ERR_PARAM_INVALID: sllp is a NULL pointer.</li>
+ * </ul>
+ */
+enum sllp_err sllp_set_concurrent (sllp_instance_t *sllp, bool concurrent);
+
+/**
+ * Update the value of a registered variable. The new value is copied to the
+ * memory pointed by var->data under the variable's sequence lock, so that
+ * threads processing packets in concurrent mode never observe a partially
+ * written value.
+ *
+ * @param sllp [input] Handle to a SLLP instance.
+ * @param var [input] A variable registered with sllp.
+ * @param value [input] The new value, var->size bytes long.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SLLP_ERR_PARAM_INVALID: sllp, var or value is a NULL pointer.</li>
+ *   <li> SLLP_ERR_PARAM_INVALID: var is not registered with sllp.</li>
+ * </ul>
+ */
+enum sllp_err sllp_publish_variable (sllp_instance_t *sllp,
+                                     struct sllp_var *var,
+                                     const uint8_t *value);
+
+/**
+ * List the groups that contain a registered variable, standard ones included,
+ * in increasing order of ID. Each group is checked with a single bit test.
+ * In concurrent mode, the list is taken while no client changes the groups.
+ *
+ * @param sllp [input] Handle to a SLLP instance.
+ * @param var [input] A variable registered with sllp.
+ * @param ids [output] IDs of the groups, room for SLLP_MAX_GROUPS of them.
+ * @param count [output] How many groups contain var.
+ *
+ * @return SLLP_SUCCESS or one of the following errors:
+ * <ul>
+ *   <li> SLLP_ERR_PARAM_INVALID: sllp, var, ids or count is a NULL
+ *                                pointer.</li>
+ *   <li> SLLP_ERR_PARAM_INVALID: var is not registered with sllp.</li>
+ * </ul>
+ */
+enum sllp_err sllp_var_groups (sllp_instance_t *sllp, struct sllp_var *var,
+                               uint8_t *ids, unsigned int *count);
+
 #endif
 
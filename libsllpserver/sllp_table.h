@@ -0,0 +1,174 @@
+/*
+ * Sirius Low Level Control Protocol Compile-Time Tables
+ * Version 0.1
+ * CON - Controls Group
+ * LNLS - Brazilian Synchrotron Light Laboratory
+ *
+ * Declares the variables, groups and curves of a server at compile time, to be
+ * registered at once with sllp_register_table. Define the lists below, then
+ * include this header, in a single source file:
+ *
+ *   #define SLLP_TABLE_VARS(VAR)                                           \
+ *       VAR(voltage, 4, true)                                              \
+ *       VAR(status,  1, false)
+ *
+ *   #define SLLP_TABLE_GROUPS(GROUP)                                       \
+ *       GROUP(readings, SLLP_VAR_voltage, SLLP_VAR_status)
+ *
+ *   #define SLLP_TABLE_CURVES(CURVE)                                       \
+ *       CURVE(wave, true, 3, SLLP_SAMPLE_INT16, read_block, write_block)
+ *
+ *   #include "sllp_table.h"
+ *
+ *   sllp_register_table(sllp, &sllp_table);
+ *
+ * Any list may be left undefined. The entries are:
+ *
+ *   VAR(name, size, writable)
+ *   GROUP(name, variable IDs...)
+ *   CURVE(name, writable, nblocks, sample_type, read_block, write_block)
+ *
+ * Each entry gets the constant ID SLLP_VAR_name, SLLP_GROUP_name or
+ * SLLP_CURVE_name. The value of a variable is SLLP_TABLE_VALUE(name), an array
+ * of its size, and the structures themselves are SLLP_TABLE_VAR(name) and
+ * SLLP_TABLE_CURVE(name), for the fields not covered by the lists. Sizes and
+ * counts out of the protocol's limits fail to compile.
+ */
+
+#ifndef SLLP_TABLE_H
+#define	SLLP_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sllp_server.h"
+
+#ifndef SLLP_TABLE_VARS
+#define SLLP_TABLE_VARS(VAR)
+#endif
+
+#ifndef SLLP_TABLE_GROUPS
+#define SLLP_TABLE_GROUPS(GROUP)
+#endif
+
+#ifndef SLLP_TABLE_CURVES
+#define SLLP_TABLE_CURVES(CURVE)
+#endif
+
+#define SLLP_TABLE_VALUE(name)  sllp_table_value_##name
+#define SLLP_TABLE_VAR(name)    sllp_table_var_##name
+#define SLLP_TABLE_CURVE(name)  sllp_table_curve_##name
+
+// IDs
+#define SLLP_TABLE_VAR_ID(name, size, writable)     SLLP_VAR_##name,
+#define SLLP_TABLE_GROUP_ID(name, ...)              SLLP_GROUP_##name,
+#define SLLP_TABLE_CURVE_ID(name, writable, nblocks, sample_type, read, write) \
+    SLLP_CURVE_##name,
+
+enum
+{
+    SLLP_TABLE_VARS(SLLP_TABLE_VAR_ID)
+    SLLP_TABLE_VARS_COUNT
+};
+
+// Groups follow the standard ones: all, read only and writable variables
+enum
+{
+    SLLP_TABLE_GROUPS_BEFORE = 2,
+    SLLP_TABLE_GROUPS(SLLP_TABLE_GROUP_ID)
+    SLLP_TABLE_GROUPS_END
+};
+#define SLLP_TABLE_GROUPS_COUNT (SLLP_TABLE_GROUPS_END - 3)
+
+enum
+{
+    SLLP_TABLE_CURVES(SLLP_TABLE_CURVE_ID)
+    SLLP_TABLE_CURVES_COUNT
+};
+
+_Static_assert(SLLP_TABLE_VARS_COUNT <= SLLP_MAX_VARIABLES,
+               "too many variables");
+_Static_assert(SLLP_TABLE_GROUPS_END <= SLLP_MAX_GROUPS, "too many groups");
+_Static_assert(SLLP_TABLE_CURVES_COUNT <= SLLP_MAX_CURVES, "too many curves");
+
+// Variables
+#define SLLP_TABLE_VAR_DEF(name, size_, writable_)                          \
+    _Static_assert((size_) >= 1 && (size_) <= SLLP_MAX_VAR_SIZE,            \
+                   "size of variable " #name " out of range");              \
+    static uint8_t SLLP_TABLE_VALUE(name)[size_];                           \
+    static struct sllp_var SLLP_TABLE_VAR(name) = {                         \
+        .id = SLLP_VAR_##name,                                              \
+        .writable = (writable_),                                            \
+        .size = (size_),                                                    \
+        .data = SLLP_TABLE_VALUE(name),                                     \
+    };
+
+#define SLLP_TABLE_VAR_PTR(name, size, writable)    &SLLP_TABLE_VAR(name),
+#define SLLP_TABLE_VAR_ENTRY(name, size, writable)                          \
+    ((writable) ? SLLP_WRITABLE : 0) | (size),
+
+SLLP_TABLE_VARS(SLLP_TABLE_VAR_DEF)
+
+static struct sllp_var *const sllp_table_vars[] = {
+    SLLP_TABLE_VARS(SLLP_TABLE_VAR_PTR)
+    NULL
+};
+
+static const uint8_t sllp_table_vars_list[] = {
+    SLLP_TABLE_VARS(SLLP_TABLE_VAR_ENTRY)
+    0
+};
+
+// Groups
+#define SLLP_TABLE_GROUP_DEF(name, ...)                                     \
+    static const uint8_t sllp_table_group_##name[] = {__VA_ARGS__};         \
+    _Static_assert(sizeof(sllp_table_group_##name) <= SLLP_TABLE_VARS_COUNT,\
+                   "group " #name " has more entries than variables");
+
+#define SLLP_TABLE_GROUP_ENTRY(name, ...)                                   \
+    {sllp_table_group_##name, sizeof(sllp_table_group_##name)},
+
+SLLP_TABLE_GROUPS(SLLP_TABLE_GROUP_DEF)
+
+static const struct sllp_table_group sllp_table_groups[] = {
+    SLLP_TABLE_GROUPS(SLLP_TABLE_GROUP_ENTRY)
+    {NULL, 0}
+};
+
+// Curves
+#define SLLP_TABLE_CURVE_DEF(name, writable_, nblocks_, sample_type_,       \
+                             read, write)                                   \
+    _Static_assert((sample_type_) < SLLP_SAMPLE_MAX,                        \
+                   "sample type of curve " #name " out of range");          \
+    static struct sllp_curve SLLP_TABLE_CURVE(name) = {                     \
+        .id = SLLP_CURVE_##name,                                            \
+        .writable = (writable_),                                            \
+        .nblocks = (nblocks_),                                              \
+        .sample_type = (sample_type_),                                      \
+        .read_block = (read),                                               \
+        .write_block = (write),                                             \
+    };
+
+#define SLLP_TABLE_CURVE_PTR(name, writable, nblocks, sample_type, read,    \
+                             write)                                         \
+    &SLLP_TABLE_CURVE(name),
+
+SLLP_TABLE_CURVES(SLLP_TABLE_CURVE_DEF)
+
+static struct sllp_curve *const sllp_table_curves[] = {
+    SLLP_TABLE_CURVES(SLLP_TABLE_CURVE_PTR)
+    NULL
+};
+
+static const struct sllp_table sllp_table = {
+    .vars = sllp_table_vars,
+    .vars_count = SLLP_TABLE_VARS_COUNT,
+    .vars_list = sllp_table_vars_list,
+    .groups = sllp_table_groups,
+    .groups_count = SLLP_TABLE_GROUPS_COUNT,
+    .curves = sllp_table_curves,
+    .curves_count = SLLP_TABLE_CURVES_COUNT,
+};
+
+#endif	/* SLLP_TABLE_H */
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "test_common.h"
+
+#define NVARS		4
+#define VAR_SIZE	2
+#define NREQUESTS	10
+
+/* Variables 1 and 3 are writable, making up group 2 */
+static const uint8_t requests_data[NREQUESTS][2 + 1 + NVARS*VAR_SIZE] = {
+	{0x10, 1, 0},				/* Read variable 0 */
+	{0x12, 1, 0},				/* Read group of all */
+	{0x20, 3, 1, 0x12, 0x34},		/* Write variable 1 */
+	{0x10, 1, 1},				/* Read variable 1 */
+	{0x10, 1, 3},				/* Read variable 3 */
+	{0x10, 1, 99},				/* Read invalid variable */
+	{0x02, 0},				/* List variables */
+	{0x10, 1, 2},				/* Read variable 2 */
+	{0x22, 5, 2, 0x56, 0x78, 0x9A, 0xBC},	/* Write writable group */
+	{0x12, 1, 2},				/* Read writable group */
+};
+
+unsigned int reads, writes;
+unsigned int first_run;		/* Variables in the first read hook */
+
+void hook(enum sllp_operation op, struct sllp_var **list)
+{
+	unsigned int count = 0;
+
+	while(list[count])
+		++count;
+
+	if(op == SLLP_OP_READ && !reads++)
+		first_run = count;
+	else if(op == SLLP_OP_WRITE)
+		++writes;
+}
+
+/* An instance with NVARS variables stored in values, read and written
+ * through hook */
+sllp_instance_t *instance(struct sllp_var *vars, uint8_t (*values)[VAR_SIZE])
+{
+	sllp_instance_t *sllp = sllp_new();
+	unsigned int i;
+
+	for(i = 0; i < NVARS; ++i)
+	{
+		values[i][0] = i;
+		values[i][1] = 0xF0 | i;
+		vars[i].data = values[i];
+		vars[i].size = VAR_SIZE;
+		vars[i].writable = i % 2;
+		sllp_register_variable(sllp, &vars[i]);
+	}
+	sllp_register_hook(sllp, hook);
+
+	return sllp;
+}
+
+int main(void)
+{
+	struct sllp_var batch_vars[NVARS], single_vars[NVARS];
+	uint8_t batch_values[NVARS][VAR_SIZE], single_values[NVARS][VAR_SIZE];
+	static uint8_t batch_buf[NREQUESTS][SLLP_MAX_MESSAGE];
+	static uint8_t single_buf[NREQUESTS][SLLP_MAX_MESSAGE];
+	struct sllp_raw_packet requests[NREQUESTS];
+	struct sllp_raw_packet batch[NREQUESTS], single[NREQUESTS];
+	unsigned int i;
+
+	for(i = 0; i < NREQUESTS; ++i)
+	{
+		requests[i].data = (uint8_t *) requests_data[i];
+		requests[i].len = 2 + requests_data[i][1];
+		batch[i].data = batch_buf[i];
+		single[i].data = single_buf[i];
+	}
+
+	/* One by one */
+	sllp_instance_t *sllp = instance(single_vars, single_values);
+	for(i = 0; i < NREQUESTS; ++i)
+		sllp_process_packet(sllp, &requests[i], &single[i]);
+	check(reads == 6 && writes == 2, "hook called for each request");
+	sllp_destroy(sllp);
+
+	/* In a batch */
+	reads = writes = 0;
+	sllp = instance(batch_vars, batch_values);
+	check(sllp_process_batch(sllp, requests, batch, NREQUESTS) ==
+	      SLLP_SUCCESS, "process batch");
+
+	bool same = true;
+	for(i = 0; i < NREQUESTS; ++i)
+		same = same && batch[i].len == single[i].len &&
+		       !memcmp(batch[i].data, single[i].data, batch[i].len);
+	check(same, "answers match one by one processing");
+	check(batch_buf[5][0] == 0xE3 && batch_buf[8][0] == 0xE0 &&
+	      batch_buf[9][2] == 0x56,
+	      "invalid read refused and group written");
+	check(!memcmp(batch_values, single_values, sizeof(batch_values)),
+	      "values match one by one processing");
+
+	/* Runs 0-1, 3-4, 7 and 9 call the read hook once each, the first one
+	 * with every variable once */
+	check(reads == 4 && writes == 2, "hook called once per run of reads");
+	check(first_run == NVARS, "union of the variables read by a run");
+	sllp_destroy(sllp);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,732 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "test_common.h"
+#include "sllp_net.h"
+#include "sllp_client.h"
+#include "md5/md5.h"
+
+#define NVARS		32
+#define NWRITABLE	8	/* The first variables are writable */
+#define NBLOCKS		4
+#define WAVE_BLOCKS	64	/* A second, larger curve */
+#define READS		20000
+
+uint8_t values[NVARS][4];
+struct sllp_var vars[NVARS];
+uint8_t memory[NBLOCKS][BLOCK_SIZE];
+uint8_t waveform[WAVE_BLOCKS][BLOCK_SIZE];
+struct sllp_curve curve, wave;
+
+unsigned int sends = 0;
+
+int connect_tcp(uint16_t port)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+		return -1;
+	return fd;
+}
+
+/* A transport of our own, counting the sends */
+int counting_send(void *user, const uint8_t *data, size_t len)
+{
+	int fd = *(int *) user;
+
+	++sends;
+	while(len)
+	{
+		ssize_t n = send(fd, data, len, 0);
+		if(n <= 0)
+			return -1;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+ssize_t counting_recv(void *user, uint8_t *data, size_t len)
+{
+	return recv(*(int *) user, data, len, 0);
+}
+
+void test_discovery(sllp_client_t *client)
+{
+	struct sllp_client_var cvars[SLLP_MAX_VARIABLES];
+	struct sllp_client_group groups[SLLP_MAX_GROUPS];
+	struct sllp_client_curve curves[SLLP_MAX_CURVES];
+	unsigned int count, i;
+	bool ok;
+
+	check(sllp_client_get_vars(client, cvars, &count) == SLLP_SUCCESS &&
+	      count == NVARS, "variables list");
+	ok = true;
+	for(i = 0; i < count; ++i)
+		ok = ok && cvars[i].id == i && cvars[i].size == 4 &&
+		     cvars[i].writable == (i < NWRITABLE);
+	check(ok, "variables' sizes and permissions");
+
+	check(sllp_client_get_groups(client, groups, &count) == SLLP_SUCCESS &&
+	      count == 3, "groups list");
+	ok = groups[0].vars_count == NVARS && !groups[0].writable &&
+	     groups[2].vars_count == NWRITABLE && groups[2].writable;
+	for(i = 0; i < NVARS; ++i)
+		ok = ok && groups[0].vars[i] == i;
+	check(ok, "groups' variables");
+
+	check(sllp_client_get_curves(client, curves, &count) == SLLP_SUCCESS &&
+	      count == 2 && curves[0].writable &&
+	      curves[0].nblocks == NBLOCKS - 1 &&
+	      curves[1].nblocks == WAVE_BLOCKS - 1, "curves list");
+
+	uint8_t status[16];
+	uint16_t size = sizeof(status);
+	check(sllp_client_query_status(client, status, &size) ==
+	      SLLP_ERR_REFUSED, "status not supported by the server");
+}
+
+void test_variables(sllp_client_t *client)
+{
+	uint8_t value[SLLP_MAX_VAR_SIZE], size;
+	uint8_t new_value[4] = {0xDE, 0xAD, 0xBE, 0xEF};
+
+	check(sllp_client_read_var(client, 5, value, &size) == SLLP_SUCCESS &&
+	      size == 4 && !memcmp(value, values[5], 4), "read variable");
+	check(sllp_client_write_var(client, 1, new_value, 4) == SLLP_SUCCESS &&
+	      !memcmp(values[1], new_value, 4), "write variable");
+	check(sllp_client_write_var(client, NWRITABLE, new_value, 4) ==
+	      SLLP_ERR_REFUSED, "write read-only variable refused");
+	check(sllp_client_read_var(client, NVARS, value, &size) ==
+	      SLLP_ERR_REFUSED, "read invalid variable refused");
+}
+
+void test_groups(sllp_client_t *client)
+{
+	uint8_t ids[] = {3, 7, 1}, id;
+	uint8_t data[SLLP_MAX_MESSAGE];
+	uint16_t size;
+	struct sllp_client_group group;
+	unsigned int count;
+
+	check(sllp_client_create_group(client, ids, sizeof(ids), &id) ==
+	      SLLP_SUCCESS && id == 3, "create group");
+	check(sllp_client_get_group(client, id, &group) == SLLP_SUCCESS &&
+	      group.vars_count == 3 && !memcmp(group.vars, ids, 3),
+	      "query group");
+
+	uint8_t written[12];
+	memset(written, 0x5A, sizeof(written));
+	check(sllp_client_write_group(client, id, written, sizeof(written)) ==
+	      SLLP_SUCCESS && !memcmp(values[7], written, 4), "write group");
+	check(sllp_client_read_group(client, id, data, &size) == SLLP_SUCCESS &&
+	      size == sizeof(written) && !memcmp(data, written, size),
+	      "read group");
+
+	struct sllp_client_group groups[SLLP_MAX_GROUPS];
+	check(sllp_client_remove_all_groups(client) == SLLP_SUCCESS &&
+	      sllp_client_get_groups(client, groups, &count) == SLLP_SUCCESS &&
+	      count == 3, "remove all groups");
+}
+
+void test_curve(sllp_client_t *client)
+{
+	static uint8_t block[BLOCK_SIZE], read[BLOCK_SIZE];
+	uint8_t digests[256][SLLP_CURVE_CSUM_SIZE], expected[16];
+	unsigned int count, i;
+
+	for(i = 0; i < BLOCK_SIZE; ++i)
+		block[i] = i*7;
+
+	check(sllp_client_write_curve_block(client, 0, 2, block) ==
+	      SLLP_SUCCESS && !memcmp(memory[2], block, BLOCK_SIZE),
+	      "write curve block");
+	check(sllp_client_read_curve_block(client, 0, 2, read) ==
+	      SLLP_SUCCESS && !memcmp(read, block, BLOCK_SIZE),
+	      "read curve block");
+	check(sllp_client_read_curve_block(client, 0, NBLOCKS, read) ==
+	      SLLP_ERR_REFUSED, "read past the curve refused");
+
+	MD5_CTX ctx;
+	MD5Init(&ctx);
+	MD5Update(&ctx, block, BLOCK_SIZE);
+	MD5Final(expected, &ctx);
+
+	check(sllp_client_recalc_csum(client, 0) == SLLP_SUCCESS &&
+	      sllp_client_get_curve_csums(client, 0, digests, &count) ==
+	      SLLP_SUCCESS && count == NBLOCKS &&
+	      !memcmp(digests[2], expected, 16), "block digests");
+}
+
+void test_transfer(sllp_client_t *client)
+{
+	static uint8_t data[WAVE_BLOCKS][BLOCK_SIZE];
+	struct sllp_client_curve curves[SLLP_MAX_CURVES];
+	uint8_t checksum[SLLP_CURVE_CSUM_SIZE];
+	unsigned int count, i;
+
+	/* Checksums are computed when recalculated */
+	sllp_client_recalc_csum(client, 1);
+	sllp_client_get_curves(client, curves, &count);
+	check(sllp_client_download_curve(client, 1, &data[0][0], 0, checksum) ==
+	      SLLP_SUCCESS && !memcmp(data, waveform, sizeof(data)) &&
+	      !memcmp(checksum, curves[1].checksum, sizeof(checksum)),
+	      "download curve");
+	check(sllp_client_download_curve(client, 2, &data[0][0], 0, NULL) ==
+	      SLLP_ERR_PARAM_OUT_OF_RANGE, "download invalid curve");
+
+	/* Changed behind the server's back, the checksum is stale */
+	waveform[17][100] ^= 0xFF;
+	check(sllp_client_download_curve(client, 1, &data[0][0], 8, NULL) ==
+	      SLLP_ERR_CHECKSUM && data[17][100] == waveform[17][100],
+	      "download detects checksum mismatch");
+
+	for(i = 0; i < sizeof(data); ++i)
+		data[0][i] = i*13 + i/BLOCK_SIZE;
+	check(sllp_client_upload_curve(client, 1, &data[0][0], 0, checksum) ==
+	      SLLP_SUCCESS && !memcmp(data, waveform, sizeof(data)),
+	      "upload curve");
+	sllp_client_get_curves(client, curves, &count);
+	check(!memcmp(checksum, curves[1].checksum, sizeof(checksum)),
+	      "checksum recalculated after upload");
+
+	/* Files, mapped in memory */
+	char path[] = "/tmp/test_client_XXXXXX";
+	int fd = mkstemp(path);
+	check(sllp_client_download_curve_file(client, 1, path, 0, NULL) ==
+	      SLLP_SUCCESS && pread(fd, data, sizeof(data), 0) == sizeof(data) &&
+	      !memcmp(data, waveform, sizeof(data)), "download curve to file");
+
+	data[63][0] ^= 0xFF;
+	pwrite(fd, data, sizeof(data), 0);
+	check(sllp_client_upload_curve_file(client, 1, path, 4, NULL) ==
+	      SLLP_SUCCESS && !memcmp(data, waveform, sizeof(data)),
+	      "upload curve from file");
+	check(sllp_client_upload_curve_file(client, 0, path, 0, NULL) ==
+	      SLLP_ERR_PARAM_OUT_OF_RANGE, "upload file of the wrong size");
+	close(fd);
+	unlink(path);
+
+	/* A single request for many blocks */
+	memset(data, 0, sizeof(data));
+	check(sllp_client_read_curve_range(client, 1, 0, WAVE_BLOCKS - 1,
+					   &data[0][0]) == SLLP_SUCCESS &&
+	      !memcmp(data, waveform, sizeof(data)), "read range of blocks");
+	check(sllp_client_read_curve_range(client, 1, 10, 12, &data[0][0]) ==
+	      SLLP_SUCCESS && !memcmp(data, waveform[10], 3*BLOCK_SIZE),
+	      "read part of a curve");
+	check(sllp_client_read_curve_range(client, 1, 60, WAVE_BLOCKS, data[0]) ==
+	      SLLP_ERR_REFUSED && sllp_client_read_curve_range(client, 1, 3, 3,
+	      data[0]) == SLLP_SUCCESS && !memcmp(data[0], waveform[3],
+	      BLOCK_SIZE), "range past the curve refused");
+
+	/* Only the bytes needed */
+	uint8_t *wave = &waveform[0][0];
+	check(sllp_client_read_curve_data(client, 1, 5*BLOCK_SIZE - 50, 100,
+					  data[0]) == SLLP_SUCCESS &&
+	      !memcmp(data[0], wave + 5*BLOCK_SIZE - 50, 100),
+	      "read bytes across blocks");
+	check(sllp_client_read_curve_data(client, 1, 7, 1, data[0]) ==
+	      SLLP_SUCCESS && data[0][0] == wave[7], "read a single byte");
+	check(sllp_client_read_curve_data(client, 1, sizeof(waveform) - 1, 2,
+					  data[0]) == SLLP_ERR_REFUSED &&
+	      sllp_client_read_curve_data(client, 1, 0, BLOCK_SIZE + 1,
+					  data[0]) == SLLP_ERR_PARAM_OUT_OF_RANGE,
+	      "read past the curve refused");
+
+	double start = now();
+	for(i = 0; i < WAVE_BLOCKS; ++i)
+		sllp_client_read_curve_data(client, 1, i*BLOCK_SIZE + 100, 16,
+					    data[i]);
+	double partial = now() - start;
+
+	start = now();
+	for(i = 0; i < WAVE_BLOCKS; ++i)
+		sllp_client_read_curve_block(client, 1, i, data[i]);
+	double sequential = now() - start;
+
+	start = now();
+	sllp_client_download_curve(client, 1, &data[0][0], 0, NULL);
+	double windowed = now() - start;
+
+	start = now();
+	sllp_client_read_curve_range(client, 1, 0, WAVE_BLOCKS - 1, &data[0][0]);
+	double ranged = now() - start;
+
+	printf("sequential blocks: %.0f MB/s\n", sizeof(data)/sequential/1e6);
+	printf("windowed download: %.0f MB/s\n", sizeof(data)/windowed/1e6);
+	printf("range of blocks:   %.0f MB/s\n", sizeof(data)/ranged/1e6);
+	printf("16 bytes of a block: %.1f us, whole block: %.1f us\n",
+	       partial/WAVE_BLOCKS*1e6, sequential/WAVE_BLOCKS*1e6);
+
+	/* An overview, instead of the whole curve. Each of 1024 points spans
+	 * 4 bins of 128 samples. */
+	static int16_t envelope[1024][2];
+	int16_t samples[512], min = INT16_MAX, max = INT16_MIN;
+	uint8_t type;
+
+	memcpy(samples, waveform[5] + BLOCK_SIZE - sizeof(samples),
+	       sizeof(samples));
+	for(i = 0; i < 512; ++i)
+	{
+		if(samples[i] < min)
+			min = samples[i];
+		if(samples[i] > max)
+			max = samples[i];
+	}
+
+	start = now();
+	check(sllp_client_read_curve_envelope(client, 1, 1024, &type,
+					      (uint8_t *) envelope) ==
+	      SLLP_SUCCESS && type == SLLP_SAMPLE_INT16 &&
+	      envelope[16*6 - 1][0] == min && envelope[16*6 - 1][1] == max,
+	      "read envelope of a curve");
+	double overview = now() - start;
+	printf("overview of 1024 points: %.0f us, %zu bytes\n", overview*1e6,
+	       sizeof(envelope));
+
+	/* Statistics of the samples of a few blocks */
+	struct sllp_client_stats stats;
+	double sum = 0, squares = 0;
+	int16_t value;
+	min = INT16_MAX;
+	max = INT16_MIN;
+	for(i = 2*BLOCK_SIZE; i < 5*BLOCK_SIZE; i += 2)
+	{
+		memcpy(&value, &waveform[0][i], 2);
+		if(value < min)
+			min = value;
+		if(value > max)
+			max = value;
+		sum += value;
+		squares += (double) value*value;
+	}
+
+	start = now();
+	check(sllp_client_read_curve_stats(client, 1, 2, 4, &stats) ==
+	      SLLP_SUCCESS && stats.type == SLLP_SAMPLE_INT16 &&
+	      stats.count == 3*BLOCK_SIZE/2 && stats.min == min &&
+	      stats.max == max &&
+	      fabs(stats.mean - sum/stats.count) < 1e-3 &&
+	      fabs(stats.rms - sqrt(squares/stats.count)) < 1e-3,
+	      "read statistics of blocks");
+	printf("statistics of 3 blocks: %.0f us\n", (now() - start)*1e6);
+	check(sllp_client_read_curve_stats(client, 1, 4, 2, &stats) ==
+	      SLLP_ERR_PARAM_OUT_OF_RANGE &&
+	      sllp_client_read_curve_stats(client, 1, 0, WAVE_BLOCKS, &stats) ==
+	      SLLP_ERR_REFUSED && sllp_client_read_curve_stats(client, 0, 0, 0,
+	      &stats) == SLLP_ERR_REFUSED, "statistics refused");
+
+	check(sllp_client_read_curve_envelope(client, 0, 16, &type,
+					      (uint8_t *) envelope) ==
+	      SLLP_ERR_REFUSED && sllp_client_read_curve_envelope(client, 1,
+	      WAVE_BLOCKS*64 + 1, &type, (uint8_t *) envelope) ==
+	      SLLP_ERR_REFUSED, "envelope refused");
+}
+
+/* Round trips are counted by the sends of the counting transport */
+void test_cache(int fd)
+{
+	sllp_client_t *client = sllp_client_new(counting_send, counting_recv,
+						&fd);
+	struct sllp_client_var cvars[SLLP_MAX_VARIABLES];
+	struct sllp_client_group groups[SLLP_MAX_GROUPS], group;
+	struct sllp_client_curve curves[SLLP_MAX_CURVES];
+	struct sllp_client_value readings[SLLP_MAX_VARIABLES];
+	uint8_t data[SLLP_MAX_MESSAGE], ids[] = {9, 20, 4}, id;
+	unsigned int count;
+
+	sends = 0;
+	sllp_client_get_vars(client, cvars, &count);
+	sllp_client_get_groups(client, groups, &count);
+	sllp_client_get_curves(client, curves, &count);
+	check(sends == 4, "model queried once");
+
+	sends = 0;
+	sllp_client_get_vars(client, cvars, &count);
+	sllp_client_get_groups(client, groups, &count);
+	sllp_client_get_group(client, 1, &group);
+	sllp_client_get_curves(client, curves, &count);
+	check(sends == 0 && groups[0].data_size == 4*NVARS &&
+	      group.vars_count == NVARS - NWRITABLE, "model served from cache");
+
+	sends = 0;
+	check(sllp_client_read_group_values(client, 0, data, readings, &count) ==
+	      SLLP_SUCCESS && count == NVARS && readings[12].id == 12 &&
+	      readings[12].size == 4 && readings[12].data == data + 48 &&
+	      !memcmp(readings[12].data, values[12], 4) && sends == 1,
+	      "group reading split in values");
+
+	/* A new group is seen, the rest of the model is kept */
+	sllp_client_create_group(client, ids, sizeof(ids), &id);
+	sends = 0;
+	check(sllp_client_read_group_values(client, id, data, readings, &count) ==
+	      SLLP_SUCCESS && count == 3 && readings[1].id == 20 &&
+	      readings[1].data == data + 4 &&
+	      !memcmp(readings[2].data, values[4], 4) && sends == 3,
+	      "groups queried again after create");
+
+	sllp_client_remove_all_groups(client);
+	check(sllp_client_group_values(client, id, data, 12, readings, &count) ==
+	      SLLP_ERR_PARAM_OUT_OF_RANGE, "groups queried again after remove");
+
+	/* Checksums change when recalculated */
+	sllp_client_recalc_csum(client, 0);
+	sends = 0;
+	sllp_client_get_curves(client, curves, &count);
+	check(sends == 1, "curves queried again after recalc");
+
+	sllp_client_invalidate(client);
+	sends = 0;
+	sllp_client_get_vars(client, cvars, &count);
+	check(sends == 1, "invalidate");
+
+	sllp_client_destroy(client);
+}
+
+struct async_read
+{
+	unsigned int client;
+	unsigned int seq;
+	uint8_t id;
+};
+
+unsigned int completed, out_of_order, wrong, refused, lost;
+unsigned int next_seq[2];
+
+void read_done(sllp_client_t *client, enum sllp_err err, uint8_t code,
+	       const uint8_t *data, uint16_t size, void *user)
+{
+	struct async_read *read = user;
+
+	++completed;
+	if(err == SLLP_ERR_REFUSED)
+		++refused;
+	else if(err == SLLP_ERR_COMM)
+		++lost;
+	else if(err || size != 4 || memcmp(data, values[read->id], 4))
+		++wrong;
+
+	if(read->seq != next_seq[read->client]++)
+		++out_of_order;
+}
+
+void block_done(sllp_client_t *client, enum sllp_err err, uint8_t code,
+		const uint8_t *data, uint16_t size, void *user)
+{
+	*(bool *) user = !err && code == CMD_CURVE_BLOCK &&
+			 size == BLOCK_SIZE && !memcmp(data, memory[1], size);
+}
+
+void data_done(sllp_client_t *client, enum sllp_err err, uint8_t code,
+	       const uint8_t *data, uint16_t size, void *user)
+{
+	*(bool *) user = !err && code == CMD_CURVE_DATA && size >= 200 &&
+			 !memcmp(data, memory[1] + 100, 200);
+}
+
+void group_done(sllp_client_t *client, enum sllp_err err, uint8_t code,
+		const uint8_t *data, uint16_t size, void *user)
+{
+	*(bool *) user = !err && size == 130 &&
+			 !memcmp(data, values, sizeof(values));
+}
+
+/* Wait on the queue's descriptor, as an external loop would */
+void run_queue(sllp_client_queue_t *queue, unsigned int until)
+{
+	struct pollfd pfd = { .fd = sllp_client_queue_fd(queue),
+			      .events = POLLIN };
+
+	while(completed < until && poll(&pfd, 1, 1000) > 0)
+		sllp_client_queue_process(queue, 0);
+}
+
+void test_async(uint16_t port)
+{
+	static struct async_read reads[READS];
+	sllp_client_queue_t *queue = sllp_client_queue_new();
+	sllp_client_t *clients[2];
+	int fds[2];
+	unsigned int i;
+
+	for(i = 0; i < 2; ++i)
+	{
+		fds[i] = connect_tcp(port);
+		clients[i] = sllp_client_new_fd(fds[i]);
+	}
+
+	check(queue && sllp_client_attach(clients[0], queue) == SLLP_SUCCESS &&
+	      sllp_client_attach(clients[1], queue) == SLLP_SUCCESS,
+	      "attach clients to a queue");
+
+	sllp_client_t *custom = sllp_client_new(counting_send, counting_recv,
+						&fds[0]);
+	check(sllp_client_attach(custom, queue) == SLLP_ERR_PARAM_INVALID &&
+	      sllp_client_read_var_async(custom, 0, read_done, NULL) ==
+	      SLLP_ERR_PARAM_INVALID, "only sockets can be attached");
+	sllp_client_destroy(custom);
+
+	/* Reads spread over both connections, answered in order */
+	completed = out_of_order = wrong = refused = lost = 0;
+	next_seq[0] = next_seq[1] = 0;
+
+	double start = now();
+	for(i = 0; i < READS; ++i)
+	{
+		reads[i].client = i % 2;
+		reads[i].seq = i/2;
+		reads[i].id = i % NVARS;
+		sllp_client_read_var_async(clients[i % 2], reads[i].id,
+					   read_done, &reads[i]);
+	}
+	run_queue(queue, READS);
+	double elapsed = now() - start;
+
+	check(completed == READS && !wrong && !out_of_order,
+	      "asynchronous reads on two connections");
+	printf("asynchronous: %.0f reads/s\n", READS/elapsed);
+
+	/* Writes and reads keep their order */
+	uint8_t new_value[4] = {1, 2, 3, 4};
+	completed = 0;
+	next_seq[0] = 0;
+	reads[0] = (struct async_read) { .client = 0, .seq = 0, .id = 2 };
+	sllp_client_write_var_async(clients[0], 2, new_value, 4, NULL, NULL);
+	sllp_client_read_var_async(clients[0], 2, read_done, &reads[0]);
+	run_queue(queue, 1);
+	check(completed == 1 && !wrong && !memcmp(values[2], new_value, 4),
+	      "write then read");
+
+	bool block_ok = false, group_ok = false, data_ok = false;
+	memset(memory[1], 0x33, BLOCK_SIZE);
+	sllp_client_read_curve_block_async(clients[1], 0, 1, block_done,
+					   &block_ok);
+	sllp_client_read_group_async(clients[1], 0, group_done, &group_ok);
+	sllp_client_read_curve_data_async(clients[1], 0, BLOCK_SIZE + 100, 200,
+					  data_done, &data_ok);
+
+	/* A synchronous call waits for the asynchronous ones */
+	uint8_t value[SLLP_MAX_VAR_SIZE];
+	check(sllp_client_read_var(clients[1], 3, value, NULL) ==
+	      SLLP_SUCCESS && block_ok && group_ok && data_ok,
+	      "asynchronous block, group and data reads");
+
+	completed = refused = 0;
+	next_seq[0] = 0;
+	reads[0].id = NVARS;
+	sllp_client_read_var_async(clients[0], NVARS, read_done, &reads[0]);
+	run_queue(queue, 1);
+	check(refused == 1, "asynchronous error answer");
+
+	/* Requests still in flight are completed on destroy */
+	completed = lost = 0;
+	next_seq[0] = 0;
+	for(i = 0; i < 100; ++i)
+	{
+		reads[i] = (struct async_read) { .client = 0, .seq = i,
+						 .id = i % NVARS };
+		sllp_client_read_var_async(clients[0], reads[i].id, read_done,
+					   &reads[i]);
+	}
+	sllp_client_destroy(clients[0]);
+	check(completed == 100 && lost == 100, "destroy completes requests");
+
+	sllp_client_destroy(clients[1]);
+	sllp_client_queue_destroy(queue);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void test_pipelining(int fd)
+{
+	sllp_client_t *client = sllp_client_new(counting_send, counting_recv,
+						&fd);
+	static uint8_t buffers[READS][SLLP_MAX_VAR_SIZE], *bufs[READS];
+	static uint8_t ids[READS], sizes[READS];
+	unsigned int i;
+	bool ok;
+
+	for(i = 0; i < READS; ++i)
+	{
+		ids[i] = i % NVARS;
+		bufs[i] = buffers[i];
+	}
+
+	/* Requests of any kind, answered in order */
+	struct sllp_client_request reqs[3];
+	uint8_t answers[3][SLLP_MAX_MESSAGE];
+	uint8_t read_var = 9, read_group = 0;
+	for(i = 0; i < 3; ++i)
+	{
+		reqs[i].answer = answers[i];
+		reqs[i].answer_max = sizeof(answers[i]);
+	}
+	sends = 0;
+	sllp_client_submit(client, &reqs[0], CMD_READ_VAR, &read_var, 1);
+	sllp_client_submit(client, &reqs[1], CMD_QUERY_VARS_LIST, NULL, 0);
+	sllp_client_submit(client, &reqs[2], CMD_READ_GROUP, &read_group, 1);
+	ok = sllp_client_wait(client, &reqs[2]) == SLLP_SUCCESS &&
+	     reqs[0].done && reqs[1].done && sends == 1;
+	ok = ok && reqs[0].code == CMD_VAR_READING &&
+	     !memcmp(answers[0], values[9], 4);
+	ok = ok && reqs[1].code == CMD_VARS_LIST && reqs[1].size == NVARS;
+	ok = ok && reqs[2].code == CMD_GROUP_READING && reqs[2].size == 130 &&
+	     !memcmp(answers[2], values, sizeof(values));
+	check(ok, "submitted requests answered in order");
+
+	/* Many reads, few sends */
+	sends = 0;
+	memset(buffers, 0, sizeof(buffers));
+	ok = sllp_client_read_vars(client, ids, bufs, sizes, READS) ==
+	     SLLP_SUCCESS;
+	for(i = 0; i < READS; ++i)
+		ok = ok && sizes[i] == 4 &&
+		     !memcmp(buffers[i], values[i % NVARS], 4);
+	check(ok, "pipelined reads");
+	printf("%d reads in %u sends\n", READS, sends);
+
+	double start = now();
+	for(i = 0; i < READS; ++i)
+		sllp_client_read_var(client, ids[i], buffers[i], NULL);
+	double sequential = now() - start;
+
+	start = now();
+	sllp_client_read_vars(client, ids, bufs, NULL, READS);
+	double pipelined = now() - start;
+
+	printf("sequential: %.0f reads/s\n", READS/sequential);
+	printf("pipelined:  %.0f reads/s\n", READS/pipelined);
+
+	sllp_client_destroy(client);
+}
+
+/* Read-only curves of a block, whose checksum isn't calculated yet, are
+ * listed as zeros, like the padding of a long list */
+void test_zero_curves(void)
+{
+	static uint8_t block[BLOCK_SIZE];
+	struct sllp_curve zero_curves[8] = {{0}};
+	struct sllp_client_curve curves[SLLP_MAX_CURVES];
+	uint8_t digests[256][SLLP_CURVE_CSUM_SIZE];
+	unsigned int count, i;
+
+	sllp_instance_t *sllp = sllp_new();
+	for(i = 0; i < 8; ++i)
+	{
+		zero_curves[i].writable = i < 6;
+		zero_curves[i].nblocks = i < 6;
+		zero_curves[i].read_block = read_block;
+		zero_curves[i].write_block = i < 6 ? write_block : NULL;
+		zero_curves[i].user = block;
+		sllp_register_curve(sllp, &zero_curves[i]);
+	}
+
+	sllp_net_t *net = sllp_net_new(sllp, 1);
+	uint16_t port = 0;
+	sllp_net_listen_tcp(net, "127.0.0.1", &port);
+	sllp_net_start(net);
+	int fd = connect_tcp(port);
+	sllp_client_t *client = sllp_client_new_fd(fd);
+
+	check(sllp_client_get_curves(client, curves, &count) == SLLP_SUCCESS &&
+	      count == 8 && !curves[7].writable && curves[7].nblocks == 0,
+	      "curves listed as zeros kept");
+	check(sllp_client_get_curve_csums(client, 7, digests, &count) ==
+	      SLLP_SUCCESS && count == 1 &&
+	      sllp_client_get_curve_csums(client, 0, digests, &count) ==
+	      SLLP_SUCCESS && count == 2,
+	      "digests counted from the curves list");
+
+	sllp_client_destroy(client);
+	close(fd);
+	sllp_net_destroy(net);
+	sllp_destroy(sllp);
+}
+
+int main(void)
+{
+	sllp_instance_t *sllp = sllp_new();
+
+	int i;
+	for(i = 0; i < NVARS; ++i)
+	{
+		memset(values[i], i, sizeof(values[i]));
+		vars[i].data = values[i];
+		vars[i].size = sizeof(values[i]);
+		vars[i].writable = i < NWRITABLE;
+		sllp_register_variable(sllp, &vars[i]);
+	}
+
+	curve.writable = true;
+	curve.nblocks = NBLOCKS - 1;
+	curve.read_block = read_block;
+	curve.write_block = write_block;
+	curve.user = memory;
+	sllp_register_curve(sllp, &curve);
+
+	for(i = 0; i < WAVE_BLOCKS*BLOCK_SIZE; ++i)
+		waveform[0][i] = i*31 >> 5;
+	wave.writable = true;
+	wave.nblocks = WAVE_BLOCKS - 1;
+	wave.sample_type = SLLP_SAMPLE_INT16;
+	wave.read_block = read_block;
+	wave.write_block = write_block;
+	wave.user = waveform;
+	sllp_register_curve(sllp, &wave);
+
+	sllp_net_t *net = sllp_net_new(sllp, 1);
+	uint16_t port = 0;
+	sllp_net_listen_tcp(net, "127.0.0.1", &port);
+	check(sllp_net_start(net) == SLLP_SUCCESS, "start server");
+
+	int fd = connect_tcp(port);
+	sllp_client_t *client = sllp_client_new_fd(fd);
+	check(client != NULL, "connect");
+
+	test_discovery(client);
+	test_variables(client);
+	test_groups(client);
+	test_curve(client);
+	test_transfer(client);
+
+	int fd2 = connect_tcp(port);
+	test_cache(fd2);
+	test_pipelining(fd2);
+	close(fd2);
+
+	test_async(port);
+	test_zero_curves();
+
+	/* The server goes away */
+	sllp_net_stop(net);
+	uint8_t value[SLLP_MAX_VAR_SIZE];
+	check(sllp_client_read_var(client, 0, value, NULL) == SLLP_ERR_COMM &&
+	      sllp_client_read_var(client, 0, value, NULL) == SLLP_ERR_COMM,
+	      "connection lost");
+
+	sllp_client_destroy(client);
+	close(fd);
+	sllp_net_destroy(net);
+	sllp_destroy(sllp);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "test_common.h"
+
+#define CMD_ACQUIRE	0x50	/* Board-specific bulk read */
+#define CMD_SAMPLES	0x51
+#define CMD_LOG		0x52	/* Takes any text */
+#define CMD_OVERFLOW	0x53	/* Claims more than fits */
+
+#define ROUNDS		1000000
+
+/* Answers with count samples of a ramp starting at first */
+uint8_t acquire(struct sllp_command *command, const uint8_t *payload,
+		uint16_t size, uint8_t *answer, uint16_t capacity,
+		uint16_t *answer_size)
+{
+	unsigned int i;
+
+	if(capacity != SLLP_MAX_PAYLOAD)
+		return 0xE4;
+
+	++*(unsigned int *) command->user;
+
+	for(i = 0; i < payload[1]; ++i)
+		answer[i] = payload[0] + i;
+	*answer_size = payload[1];
+
+	return CMD_SAMPLES;
+}
+
+uint8_t log_text(struct sllp_command *command, const uint8_t *payload,
+		 uint16_t size, uint8_t *answer, uint16_t capacity,
+		 uint16_t *answer_size)
+{
+	memcpy(command->user, payload, size);
+	return 0xE0;
+}
+
+uint8_t overflow(struct sllp_command *command, const uint8_t *payload,
+		 uint16_t size, uint8_t *answer, uint16_t capacity,
+		 uint16_t *answer_size)
+{
+	*answer_size = capacity + 1;
+	return CMD_SAMPLES;
+}
+
+int main(void)
+{
+	unsigned int calls = 0;
+	char text[32] = {0};
+	struct sllp_command acquire_cmd = {
+		.size = 2,
+		.handler = acquire,
+		.user = &calls,
+	};
+	struct sllp_command log_cmd = {
+		.size = 1,
+		.at_least = true,
+		.handler = log_text,
+		.user = text,
+	};
+	struct sllp_command overflow_cmd = { .handler = overflow };
+	struct sllp_command no_handler = { .size = 0 };
+	struct sllp_command too_large = {
+		.size = SLLP_MAX_MESSAGE,
+		.handler = acquire,
+	};
+	uint8_t payload[8] = {10, 4};
+	unsigned int i;
+
+	sllp_instance_t *sllp = sllp_new();
+
+	check(process(sllp, CMD_ACQUIRE, payload, 2) == 0xE2,
+	      "unknown command not supported");
+
+	check(sllp_register_command(sllp, CMD_ACQUIRE, &acquire_cmd) ==
+	      SLLP_SUCCESS &&
+	      sllp_register_command(sllp, CMD_LOG, &log_cmd) == SLLP_SUCCESS &&
+	      sllp_register_command(sllp, CMD_OVERFLOW, &overflow_cmd) ==
+	      SLLP_SUCCESS,
+	      "register commands");
+	check(sllp_register_command(sllp, 0x10, &log_cmd) ==
+	      SLLP_ERR_PARAM_INVALID &&
+	      sllp_register_command(sllp, CMD_ACQUIRE, &log_cmd) ==
+	      SLLP_ERR_PARAM_INVALID,
+	      "taken codes refused");
+	check(sllp_register_command(sllp, 0x60, &no_handler) ==
+	      SLLP_ERR_PARAM_INVALID &&
+	      sllp_register_command(sllp, 0x60, &too_large) ==
+	      SLLP_ERR_PARAM_OUT_OF_RANGE,
+	      "invalid commands refused");
+
+	check(process(sllp, CMD_ACQUIRE, payload, 2) == CMD_SAMPLES &&
+	      response_buf[1] == 4 && response_buf[2] == 10 &&
+	      response_buf[5] == 13 && response.len == 6 && calls == 1,
+	      "custom command answered, given the capacity");
+	check(process(sllp, CMD_ACQUIRE, payload, 1) == 0xE5 &&
+	      process(sllp, CMD_ACQUIRE, payload, 3) == 0xE5 && calls == 1,
+	      "payload size checked before the handler");
+	check(process(sllp, CMD_LOG, (const uint8_t *) "hello", 5) == 0xE0 &&
+	      response.len == 2 && !strcmp(text, "hello") &&
+	      process(sllp, CMD_LOG, NULL, 0) == 0xE5,
+	      "minimum payload size");
+	check(process(sllp, CMD_OVERFLOW, NULL, 0) == 0xE5 && response.len == 2,
+	      "answer larger than the capacity refused");
+	check(process(sllp, 0x02, NULL, 0) == 0x03 &&
+	      process(sllp, 0x02, payload, 1) == 0xE5,
+	      "built-in commands unchanged");
+
+	/* Dispatch cost */
+	struct timespec start, end;
+	uint8_t vars_list[] = {0x02, 0x00};
+
+	memcpy(request_buf, vars_list, sizeof(vars_list));
+	request.len = sizeof(vars_list);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < ROUNDS; ++i)
+		sllp_process_packet(sllp, &request, &response);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("%-50s %.1f ns\n", "CMD_QUERY_VARS_LIST",
+	       elapsed_ns(&start, &end)/ROUNDS);
+
+	request_buf[0] = CMD_ACQUIRE;
+	request_buf[1] = 2;
+	request_buf[2] = 0;
+	request_buf[3] = 1;
+	request.len = 4;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < ROUNDS; ++i)
+		sllp_process_packet(sllp, &request, &response);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("%-50s %.1f ns\n", "custom command",
+	       elapsed_ns(&start, &end)/ROUNDS);
+
+	sllp_destroy(sllp);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <string.h>
+#include "test_common.h"
+
+int failures = 0;
+
+uint8_t request_buf[SLLP_MAX_MESSAGE], response_buf[SLLP_MAX_MESSAGE];
+struct sllp_raw_packet request = { .data = request_buf };
+struct sllp_raw_packet response = { .data = response_buf };
+
+void check(bool ok, const char *what)
+{
+	printf("%-50s %s\n", what, ok ? "OK" : "FAILED");
+	if(!ok)
+		++failures;
+}
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec)*1e9 +
+	       (end->tv_nsec - start->tv_nsec);
+}
+
+/* Sizes that can't be encoded exactly are zero padded, like answers */
+static void frame(uint8_t *buf, uint16_t *len, uint8_t code,
+		  const uint8_t *payload, uint16_t size)
+{
+	buf[0] = code;
+	uint16_t padded = sllp_decode_size(sllp_encode_size(size));
+
+	buf[1] = sllp_encode_size(size);
+	memcpy(buf + 2, payload, size);
+	memset(buf + 2 + size, 0, padded - size);
+	*len = 2 + padded;
+}
+
+void set_request(uint8_t code, const uint8_t *payload, uint16_t size)
+{
+	frame(request_buf, &request.len, code, payload, size);
+}
+
+uint8_t process(sllp_instance_t *sllp, uint8_t code, const uint8_t *payload,
+		uint16_t size)
+{
+	set_request(code, payload, size);
+	sllp_process_packet(sllp, &request, &response);
+
+	return response_buf[0];
+}
+
+uint8_t process_into(sllp_instance_t *sllp, uint8_t code,
+		     const uint8_t *payload, uint16_t size, uint8_t *answer)
+{
+	uint8_t buf[SLLP_MAX_MESSAGE];
+	struct sllp_raw_packet req = { .data = buf };
+	struct sllp_raw_packet ans = { .data = answer };
+
+	frame(buf, &req.len, code, payload, size);
+	sllp_process_packet(sllp, &req, &ans);
+
+	return answer[0];
+}
+
+void read_block(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+	memcpy(data, (uint8_t *) curve->user + block*BLOCK_SIZE, BLOCK_SIZE);
+}
+
+void write_block(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+	memcpy((uint8_t *) curve->user + block*BLOCK_SIZE, data, BLOCK_SIZE);
+}
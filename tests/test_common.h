@@ -0,0 +1,44 @@
+/*
+ * Helpers shared by the tests: checks, timing, requests processed by an
+ * instance and curves kept in memory.
+ */
+
+#ifndef TEST_COMMON_H
+#define	TEST_COMMON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "sllp_server.h"
+
+#define BLOCK_SIZE	SLLP_CURVE_BLOCK_SIZE
+
+extern int failures;
+
+extern uint8_t request_buf[SLLP_MAX_MESSAGE], response_buf[SLLP_MAX_MESSAGE];
+extern struct sllp_raw_packet request, response;
+
+/* Print the outcome of a check, counting it in failures if not ok */
+void check(bool ok, const char *what);
+
+/* Monotonic time in seconds */
+double now(void);
+double elapsed_ns(struct timespec *start, struct timespec *end);
+
+/* Frame a request of the given code and payload in request */
+void set_request(uint8_t code, const uint8_t *payload, uint16_t size);
+
+/* Process a request of the given code and payload, returning the answer's
+ * code. The answer is left in response */
+uint8_t process(sllp_instance_t *sllp, uint8_t code, const uint8_t *payload,
+		uint16_t size);
+
+/* Same, answering into a buffer of the caller, for several threads */
+uint8_t process_into(sllp_instance_t *sllp, uint8_t code,
+		     const uint8_t *payload, uint16_t size, uint8_t *answer);
+
+/* Blocks of a curve stored one after the other at curve->user */
+void read_block(struct sllp_curve *curve, uint8_t block, uint8_t *data);
+void write_block(struct sllp_curve *curve, uint8_t block, uint8_t *data);
+
+#endif	/* TEST_COMMON_H */
@@ -0,0 +1,345 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "md5/md5.h"
+
+#define NVARS		8
+#define VAR_SIZE	15	/* A group of every variable fits a short message */
+#define ROUNDS		100000
+#define DEADLINE	60	/* s, for a test stuck on a lock */
+
+uint8_t values[NVARS][VAR_SIZE];
+struct sllp_var vars[NVARS];
+uint8_t memory[BLOCK_SIZE];
+struct sllp_curve curve = {
+	.writable = true,
+	.read_block = read_block,
+	.write_block = write_block,
+	.user = memory,
+};
+
+/* A hook that processes requests of its own, which take the instance lock */
+sllp_instance_t *hooked;
+unsigned int hook_writes;
+
+void hook(enum sllp_operation op, struct sllp_var **list)
+{
+	uint8_t response[SLLP_MAX_MESSAGE], id = 0;
+
+	if(op != SLLP_OP_WRITE || hook_writes++)
+		return;
+
+	process_into(hooked, 0x30, &id, 1, response);
+	process_into(hooked, 0x32, NULL, 0, response);
+}
+
+void test_hook(sllp_instance_t *sllp)
+{
+	uint8_t response[SLLP_MAX_MESSAGE];
+	uint8_t payload[1 + 2*sizeof(values[0])] = {3};
+
+	hooked = sllp;
+	sllp_register_hook(sllp, hook);
+
+	payload[0] = 2;
+	process_into(sllp, 0x30, payload, 1, response);
+	payload[0] = 3;
+	check(process_into(sllp, 0x22, payload, 1 + sizeof(values[0]),
+			   response) == 0xE0 && hook_writes == 1,
+	      "hook of a group write may lock");
+
+	check(process_into(sllp, 0x22, payload, 1 + sizeof(values[0]),
+			   response) == 0xE3, "removed group refused");
+
+	sllp_register_hook(sllp, NULL);
+}
+
+/* Whether a value has all its bytes equal, as every writer here writes them */
+bool uniform(const uint8_t *value)
+{
+	unsigned int i;
+
+	for(i = 1; i < VAR_SIZE; ++i)
+		if(value[i] != value[0])
+			return false;
+
+	return true;
+}
+
+sllp_instance_t *shared;
+volatile bool done;
+
+/* Publishes 1, 2, 3... to every variable in turn, from the first one, until
+ * done */
+void *publisher(void *arg)
+{
+	uint8_t value[VAR_SIZE];
+	unsigned int k, i;
+
+	for(k = 1; !done; ++k)
+	{
+		memset(value, k, sizeof(value));
+		for(i = 0; i < *(unsigned int *) arg; ++i)
+			sllp_publish_variable(shared, &vars[i], value);
+	}
+
+	return NULL;
+}
+
+void test_publish(sllp_instance_t *sllp)
+{
+	uint8_t response[SLLP_MAX_MESSAGE], id = 0;
+	unsigned int count = 1, reads, torn = 0;
+	pthread_t thread;
+
+	shared = sllp;
+	done = false;
+	pthread_create(&thread, NULL, publisher, &count);
+
+	for(reads = 0; reads < ROUNDS; ++reads)
+		if(process_into(sllp, 0x10, &id, 1, response) != 0x11 ||
+		   !uniform(response + 2))
+			++torn;
+
+	done = true;
+	pthread_join(thread, NULL);
+
+	check(!torn, "published variable never read torn");
+}
+
+/* A group read sees values that were all current at once: the publisher goes
+ * from the first variable to the last, so each may only be one behind the
+ * ones before it */
+bool snapshot_ok(const uint8_t *data)
+{
+	unsigned int i;
+	uint8_t behind = 0;
+
+	for(i = 0; i < NVARS; ++i)
+	{
+		const uint8_t *value = data + i*VAR_SIZE;
+		uint8_t lag = data[0] - value[0];
+
+		if(!uniform(value) || lag > 1 || lag < behind)
+			return false;
+
+		behind = lag;
+	}
+
+	return true;
+}
+
+void test_group_snapshot(sllp_instance_t *sllp)
+{
+	uint8_t response[SLLP_MAX_MESSAGE], id = 0, zero[VAR_SIZE] = {0};
+	unsigned int count = NVARS, reads, bad = 0, i;
+	pthread_t thread;
+
+	for(i = 0; i < NVARS; ++i)
+		sllp_publish_variable(sllp, &vars[i], zero);
+
+	shared = sllp;
+	done = false;
+	pthread_create(&thread, NULL, publisher, &count);
+
+	for(reads = 0; reads < ROUNDS; ++reads)
+		if(process_into(sllp, 0x12, &id, 1, response) != 0x13 ||
+		   !snapshot_ok(response + 2))
+			++bad;
+
+	done = true;
+	pthread_join(thread, NULL);
+
+	check(!bad, "group read as a consistent snapshot");
+}
+
+/* Group writes of a value to every byte, against each other, and against the
+ * group being removed and created again */
+#define GROUP_ID	3
+
+void *group_writer(void *arg)
+{
+	uint8_t response[SLLP_MAX_MESSAGE];
+	uint8_t payload[1 + NVARS*VAR_SIZE];
+	bool *failed = arg;
+	unsigned int k;
+
+	payload[0] = GROUP_ID;
+	for(k = 0; !done; ++k)
+	{
+		memset(payload + 1, k, sizeof(payload) - 1);
+		uint8_t code = process_into(shared, 0x22, payload,
+					    sizeof(payload), response);
+
+		if(code != 0xE0 && code != 0xE3)
+			*failed = true;
+	}
+
+	return NULL;
+}
+
+void *group_recreator(void *arg)
+{
+	uint8_t response[SLLP_MAX_MESSAGE], ids[NVARS];
+	unsigned int i;
+
+	for(i = 0; i < NVARS; ++i)
+		ids[i] = i;
+
+	while(!done)
+	{
+		process_into(shared, 0x32, NULL, 0, response);
+		process_into(shared, 0x30, ids, NVARS, response);
+	}
+
+	return NULL;
+}
+
+bool group_uniform(const uint8_t *data)
+{
+	unsigned int i;
+
+	for(i = 0; i < NVARS*VAR_SIZE; ++i)
+		if(data[i] != data[0])
+			return false;
+
+	return true;
+}
+
+void test_group_writes(sllp_instance_t *sllp)
+{
+	uint8_t response[SLLP_MAX_MESSAGE], ids[NVARS], id = GROUP_ID;
+	unsigned int reads = 0, bad = 0, i;
+	bool failed[2] = {false, false};
+	pthread_t writers[2], recreator;
+
+	for(i = 0; i < NVARS; ++i)
+		ids[i] = i;
+	process_into(sllp, 0x32, NULL, 0, response);
+	process_into(sllp, 0x30, ids, NVARS, response);
+
+	shared = sllp;
+	done = false;
+	pthread_create(&writers[0], NULL, group_writer, &failed[0]);
+	pthread_create(&writers[1], NULL, group_writer, &failed[1]);
+	pthread_create(&recreator, NULL, group_recreator, NULL);
+
+	for(i = 0; i < ROUNDS; ++i)
+	{
+		uint8_t code = process_into(sllp, 0x12, &id, 1, response);
+
+		if(code == 0x13 && !group_uniform(response + 2))
+			++bad;
+		else if(code != 0x13 && code != 0xE3)
+			++bad;
+		else if(code == 0x13)
+			++reads;
+	}
+
+	done = true;
+	pthread_join(writers[0], NULL);
+	pthread_join(writers[1], NULL);
+	pthread_join(recreator, NULL);
+
+	check(reads && !bad, "group writes never read torn");
+	check(!failed[0] && !failed[1],
+	      "writes of a recreated group written or refused");
+}
+
+/* Writes the block of the curve full of zeros and of ones in turn, until
+ * done */
+void *block_writer(void *arg)
+{
+	static uint8_t payload[2 + BLOCK_SIZE], response[SLLP_MAX_MESSAGE];
+	unsigned int k;
+
+	payload[0] = curve.id;
+	for(k = 0; !done; ++k)
+	{
+		memset(payload + 2, k % 2 ? 0xFF : 0x00, BLOCK_SIZE);
+		process_into(shared, 0x41, payload, sizeof(payload), response);
+	}
+
+	return NULL;
+}
+
+/* MD5 digest of len bytes of data */
+void md5(uint8_t *data, unsigned int len, uint8_t *digest)
+{
+	MD5_CTX ctx;
+	MD5Init(&ctx);
+	MD5Update(&ctx, data, len);
+	MD5Final(digest, &ctx);
+}
+
+void test_digests(sllp_instance_t *sllp)
+{
+	uint8_t response[SLLP_MAX_MESSAGE], digests[2][16], checksums[2][16];
+	unsigned int reads, torn = 0, torn_list = 0;
+	pthread_t thread;
+
+	/* The checksum of a curve of a block is the digest of its digest */
+	memset(memory, 0x00, BLOCK_SIZE);
+	md5(memory, BLOCK_SIZE, digests[0]);
+	memset(memory, 0xFF, BLOCK_SIZE);
+	md5(memory, BLOCK_SIZE, digests[1]);
+	md5(digests[0], 16, checksums[0]);
+	md5(digests[1], 16, checksums[1]);
+
+	shared = sllp;
+	done = false;
+	pthread_create(&thread, NULL, block_writer, NULL);
+
+	for(reads = 0; reads < ROUNDS/10; ++reads)
+	{
+		if(process_into(sllp, 0x0A, &curve.id, 1, response) != 0x0B ||
+		   (memcmp(response + 3, digests[0], 16) &&
+		    memcmp(response + 3, digests[1], 16)))
+			++torn;
+
+		if(process_into(sllp, 0x08, NULL, 0, response) != 0x09 ||
+		   (memcmp(response + 4, checksums[0], 16) &&
+		    memcmp(response + 4, checksums[1], 16)))
+			++torn_list;
+	}
+
+	done = true;
+	pthread_join(thread, NULL);
+
+	check(!torn, "block digests never read torn");
+	check(!torn_list, "listed checksums never read torn");
+}
+
+int main(void)
+{
+	unsigned int i;
+
+	alarm(DEADLINE);
+
+	sllp_instance_t *sllp = sllp_new();
+
+	for(i = 0; i < NVARS; ++i)
+	{
+		vars[i].data = values[i];
+		vars[i].size = sizeof(values[i]);
+		vars[i].writable = true;
+		sllp_register_variable(sllp, &vars[i]);
+	}
+	sllp_register_curve(sllp, &curve);
+	sllp_set_concurrent(sllp, true);
+
+	test_hook(sllp);
+	test_publish(sllp);
+	test_group_snapshot(sllp);
+	test_group_writes(sllp);
+	test_digests(sllp);
+
+	sllp_destroy(sllp);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,859 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "sllp_curve_mmap.h"
+#include "md5/md5.h"
+#include "curve_envelope.h"
+
+#define NBLOCKS		16
+#define DEVICE_DELAY	2000	/* us per block read from the device */
+#define NETWORK_DELAY	2000	/* us per block sent to the client */
+
+uint8_t memory[NBLOCKS][BLOCK_SIZE];
+unsigned int device_reads = 0;
+
+/* A slow device */
+void slow_read_block(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+	usleep(DEVICE_DELAY);
+	memcpy(data, memory[block], BLOCK_SIZE);
+}
+
+/* A fast one, counting reads */
+void read_block_fast(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+	memcpy(data, memory[block], BLOCK_SIZE);
+	++device_reads;
+}
+
+/* A curve resident in memory */
+const uint8_t *get_block_ptr(struct sllp_curve *curve, uint8_t block)
+{
+	return memory[block];
+}
+
+bool transmit(sllp_instance_t *sllp, uint8_t id, uint8_t block)
+{
+	uint8_t payload[] = {id, block};
+
+	process(sllp, 0x40, payload, sizeof(payload));
+
+	return response.len == 4 + BLOCK_SIZE && response_buf[0] == 0x41 &&
+	       response_buf[2] == id && response_buf[3] == block &&
+	       !memcmp(response_buf + 4, memory[block], BLOCK_SIZE);
+}
+
+bool write_curve(sllp_instance_t *sllp, uint8_t id, uint8_t block,
+		 uint8_t value)
+{
+	request_buf[0] = 0x41;
+	request_buf[1] = 0xFF;
+	request_buf[2] = id;
+	request_buf[3] = block;
+	memset(request_buf + 4, value, BLOCK_SIZE);
+	request.len = 4 + BLOCK_SIZE;
+
+	sllp_process_packet(sllp, &request, &response);
+
+	return response.len == 2 && response_buf[0] == 0xE0;
+}
+
+/* Ask for len bytes of a curve, from offset */
+void read_request(uint8_t id, uint32_t offset, uint16_t len)
+{
+	request_buf[0] = 0x44;
+	request_buf[1] = 0x07;
+	request_buf[2] = id;
+	request_buf[3] = offset >> 24;
+	request_buf[4] = offset >> 16;
+	request_buf[5] = offset >> 8;
+	request_buf[6] = offset;
+	request_buf[7] = len >> 8;
+	request_buf[8] = len;
+	request.len = 9;
+}
+
+bool read_data(sllp_instance_t *sllp, uint8_t id, uint32_t offset,
+	       uint16_t len)
+{
+	read_request(id, offset, len);
+	sllp_process_packet(sllp, &request, &response);
+
+	return response.len >= 2 + len && response_buf[0] == 0x45 &&
+	       !memcmp(response_buf + 2, &memory[0][0] + offset, len);
+}
+
+bool recalc(sllp_instance_t *sllp, uint8_t id)
+{
+	return process(sllp, 0x42, &id, 1) == 0xE0 && response.len == 2;
+}
+
+void md5(uint8_t *data, unsigned int len, uint8_t *digest)
+{
+	MD5_CTX ctx;
+	MD5Init(&ctx);
+	MD5Update(&ctx, data, len);
+	MD5Final(digest, &ctx);
+}
+
+/* Checksum as the server derives it, from the digests of the blocks */
+void expected_checksum(uint8_t *checksum)
+{
+	uint8_t digests[NBLOCKS][16];
+
+	int i;
+	for(i = 0; i < NBLOCKS; ++i)
+		md5(memory[i], BLOCK_SIZE, digests[i]);
+
+	md5(&digests[0][0], sizeof(digests), checksum);
+}
+
+void test_checksums(sllp_instance_t *sllp, struct sllp_curve *curve)
+{
+	uint8_t checksum[16];
+
+	device_reads = 0;
+	expected_checksum(checksum);
+	check(recalc(sllp, curve->id) && device_reads == NBLOCKS &&
+	      !memcmp(curve->checksum, checksum, 16), "first recalculation");
+
+	device_reads = 0;
+	check(recalc(sllp, curve->id) && device_reads == 0,
+	      "recalculation without changes reads nothing");
+
+	check(write_curve(sllp, curve->id, 7, 0x55), "write block 7");
+	expected_checksum(checksum);
+	check(recalc(sllp, curve->id) && device_reads == 0 &&
+	      !memcmp(curve->checksum, checksum, 16),
+	      "written block hashed when received");
+
+	memset(memory[9], 0x33, BLOCK_SIZE);
+	check(sllp_curve_block_changed(sllp, curve, 9) == SLLP_SUCCESS,
+	      "report a changed block");
+	check(sllp_curve_block_changed(sllp, curve, NBLOCKS) ==
+	      SLLP_ERR_PARAM_OUT_OF_RANGE, "report a block out of the curve");
+	expected_checksum(checksum);
+	check(recalc(sllp, curve->id) && device_reads == 1 &&
+	      !memcmp(curve->checksum, checksum, 16),
+	      "only the changed block is read");
+
+	/* Per-block digests */
+	bool ok = process(sllp, 0x0A, &curve->id, 1) == 0x0B &&
+		  response_buf[2] == curve->id;
+	int i;
+	for(i = 0; i < NBLOCKS; ++i)
+	{
+		md5(memory[i], BLOCK_SIZE, checksum);
+		ok = ok && !memcmp(response_buf + 3 + 16*i, checksum, 16);
+	}
+	check(ok, "query block digests");
+}
+
+/* A device that holds reads until released, or for a while */
+#define GATE_TIMEOUT	0.2	/* s */
+
+volatile bool gate_reading, gate_open;
+unsigned int gate_reads;
+
+void gated_read_block(struct sllp_curve *curve, uint8_t block, uint8_t *data)
+{
+	double start = now();
+
+	__atomic_add_fetch(&gate_reads, 1, __ATOMIC_SEQ_CST);
+	gate_reading = true;
+	while(!gate_open && now() - start < GATE_TIMEOUT)
+		usleep(100);
+	memcpy(data, memory[block], BLOCK_SIZE);
+}
+
+struct gated_request
+{
+	sllp_instance_t *sllp;
+	uint8_t request[16];
+	uint16_t len;
+	uint8_t answer[SLLP_MAX_MESSAGE];
+};
+
+void *gated_process(void *arg)
+{
+	struct gated_request *gr = arg;
+	struct sllp_raw_packet req = { .data = gr->request, .len = gr->len };
+	struct sllp_raw_packet ans = { .data = gr->answer };
+
+	sllp_process_packet(gr->sllp, &req, &ans);
+	return NULL;
+}
+
+/* Time sllp_curve_block_changed takes on block 0, called changes times,
+ * while another thread's request is reading blocks of curve. The request is
+ * answered in answer. */
+double changed_while_reading(sllp_instance_t *sllp, struct sllp_curve *curve,
+			     const uint8_t *request, uint16_t len,
+			     uint8_t *answer, unsigned int changes)
+{
+	unsigned int i;
+
+	static struct gated_request gr;
+	pthread_t thread;
+
+	gr.sllp = sllp;
+	memcpy(gr.request, request, len);
+	gr.len = len;
+	gate_reading = gate_open = false;
+
+	pthread_create(&thread, NULL, gated_process, &gr);
+	while(!gate_reading)
+		usleep(100);
+
+	double start = now();
+	for(i = 0; i < changes; ++i)
+		sllp_curve_block_changed(sllp, curve, 0);
+	double elapsed = now() - start;
+
+	gate_open = true;
+	pthread_join(thread, NULL);
+	memcpy(answer, gr.answer, SLLP_MAX_MESSAGE);
+
+	return elapsed;
+}
+
+/* Slow reads of blocks don't hold other threads */
+void test_unlocked(void)
+{
+	sllp_instance_t *sllp = sllp_new();
+	struct sllp_curve curve = {
+		.nblocks = NBLOCKS - 1,
+		.sample_type = SLLP_SAMPLE_INT16,
+		.read_block = gated_read_block,
+	};
+	uint8_t answer[SLLP_MAX_MESSAGE];
+	uint8_t checksum[16];
+	int16_t pair[2];
+	int i;
+
+	for(i = 0; i < NBLOCKS; ++i)
+		memset(memory[i], i, BLOCK_SIZE);
+
+	sllp_register_curve(sllp, &curve);
+	sllp_set_concurrent(sllp, true);
+
+	uint8_t recalc_request[] = {0x42, 0x01, curve.id};
+	gate_reads = 0;
+	memset(memory[0], 0x77, BLOCK_SIZE);
+	double elapsed = changed_while_reading(sllp, &curve, recalc_request,
+					       sizeof(recalc_request), answer, 1);
+	check(answer[0] == 0xE0 && elapsed < GATE_TIMEOUT/2,
+	      "checksum recalculated without the lock");
+
+	gate_reads = 0;
+	gate_open = true;
+	expected_checksum(checksum);
+	check(recalc(sllp, curve.id) && gate_reads == 1 &&
+	      !memcmp(curve.checksum, checksum, 16),
+	      "block changed while hashed stays dirty");
+
+	uint8_t envelope_request[] = {0x46, 0x03, curve.id, 0, 1};
+	gate_reads = 0;
+	memset(memory[0], 0x66, BLOCK_SIZE);
+	elapsed = changed_while_reading(sllp, &curve, envelope_request,
+					sizeof(envelope_request), answer, 1);
+	check(answer[0] == 0x47 && gate_reads == NBLOCKS &&
+	      elapsed < GATE_TIMEOUT/2, "envelope calculated without the lock");
+
+	gate_reads = 0;
+	gate_open = true;
+	request.len = sizeof(envelope_request);
+	memcpy(request_buf, envelope_request, request.len);
+	sllp_process_packet(sllp, &request, &response);
+	memcpy(pair, response_buf + 3, sizeof(pair));
+	check(response_buf[0] == 0x47 && gate_reads == 1 &&
+	      pair[0] == 0x0101 && pair[1] == 0x6666,
+	      "block changed while summarized stays stale");
+
+	uint8_t stats_request[] = {0x48, 0x03, curve.id, 0, NBLOCKS - 1};
+	gate_reads = 0;
+	memset(memory[0], 0x55, BLOCK_SIZE);
+	sllp_curve_block_changed(sllp, &curve, 0);
+	elapsed = changed_while_reading(sllp, &curve, stats_request,
+					sizeof(stats_request), answer, 1);
+	check(answer[0] == 0x49 && gate_reads == 1 &&
+	      elapsed < GATE_TIMEOUT/2, "statistics without the lock");
+
+	/* As many changes as a byte counts don't go unnoticed */
+	gate_open = true;
+	recalc(sllp, curve.id);
+	sllp_curve_block_changed(sllp, &curve, 0);
+	changed_while_reading(sllp, &curve, recalc_request,
+			      sizeof(recalc_request), answer, 256);
+	gate_reads = 0;
+	gate_open = true;
+	check(recalc(sllp, curve.id) && gate_reads == 1,
+	      "block changed 256 times while hashed stays dirty");
+
+	gate_open = true;
+	process(sllp, 0x46, envelope_request + 2, 3);
+	sllp_curve_block_changed(sllp, &curve, 0);
+	changed_while_reading(sllp, &curve, envelope_request,
+			      sizeof(envelope_request), answer, 256);
+	gate_reads = 0;
+	gate_open = true;
+	check(process(sllp, 0x46, envelope_request + 2, 3) == 0x47 &&
+	      gate_reads == 1,
+	      "block changed 256 times while summarized stays stale");
+
+	sllp_destroy(sllp);
+}
+
+void test_resident(sllp_instance_t *sllp)
+{
+	struct sllp_curve resident = {
+		.writable = true,
+		.nblocks = NBLOCKS - 1,
+		.get_block_ptr = get_block_ptr,
+		.write_block = write_block,
+		.user = memory,
+	};
+	check(sllp_register_curve(sllp, &resident) == SLLP_SUCCESS,
+	      "register resident curve");
+	check(sllp_set_curve_prefetch(sllp, &resident, 1) ==
+	      SLLP_ERR_PARAM_INVALID, "no read-ahead for resident curve");
+
+	check(transmit(sllp, resident.id, 4), "transmit resident block");
+
+	/* Referenced in place */
+	struct iovec iov[SLLP_MAX_IOV];
+	int iovcnt;
+	request_buf[0] = 0x40;
+	request_buf[1] = 0x02;
+	request_buf[2] = resident.id;
+	request_buf[3] = 6;
+	request.len = 4;
+	sllp_process_packet_iov(sllp, &request, &response, iov, &iovcnt);
+	check(iovcnt == 3 && iov[0].iov_len == 2 && iov[1].iov_len == 2 &&
+	      ((uint8_t *) iov[1].iov_base)[1] == 6 &&
+	      iov[2].iov_base == memory[6] && iov[2].iov_len == BLOCK_SIZE &&
+	      response.len == 4 + BLOCK_SIZE, "resident block referenced in iov");
+
+	struct sllp_stream stream;
+	request_buf[0] = 0x43;
+	request_buf[1] = 0x03;
+	request_buf[3] = 8;
+	request_buf[4] = 9;
+	request.len = 5;
+	sllp_process_stream(sllp, &request, &response, iov, &iovcnt, &stream);
+	bool ok = iovcnt == 3 && iov[2].iov_base == memory[8] && stream.pending;
+	sllp_stream_next(sllp, &stream, &response, iov, &iovcnt);
+	check(ok && iovcnt == 3 && iov[2].iov_base == memory[9] &&
+	      !stream.pending, "resident range referenced in iov");
+
+	read_request(resident.id, 7*BLOCK_SIZE - 10, 30);
+	sllp_process_packet_iov(sllp, &request, &response, iov, &iovcnt);
+	check(iovcnt == 3 && iov[1].iov_base == memory[6] + BLOCK_SIZE - 10 &&
+	      iov[1].iov_len == 10 && iov[2].iov_base == memory[7] &&
+	      iov[2].iov_len == 20 && response.len == 32,
+	      "resident bytes referenced in iov");
+
+	uint8_t checksum[16];
+	expected_checksum(checksum);
+	check(recalc(sllp, resident.id) &&
+	      !memcmp(resident.checksum, checksum, 16),
+	      "resident curve hashed in place");
+}
+
+/* Ranges of blocks, answered with several messages */
+void test_stream(sllp_instance_t *sllp, uint8_t id)
+{
+	struct sllp_stream stream;
+	int i;
+	bool ok;
+
+	request_buf[0] = 0x43;
+	request_buf[1] = 0x03;
+	request_buf[2] = id;
+	request_buf[3] = 2;
+	request_buf[4] = 5;
+	request.len = 5;
+
+	sllp_process_packet(sllp, &request, &response);
+	check(response.len == 2 && response_buf[0] == 0xE2,
+	      "range refused without a stream");
+
+	ok = sllp_process_stream(sllp, &request, &response, NULL, NULL,
+				 &stream) == SLLP_SUCCESS;
+	for(i = 2; ok; ++i)
+	{
+		ok = response.len == 4 + BLOCK_SIZE && response_buf[0] == 0x41 &&
+		     response_buf[2] == id && response_buf[3] == i &&
+		     !memcmp(response_buf + 4, memory[i], BLOCK_SIZE);
+		if(!stream.pending)
+			break;
+		ok = ok && sllp_stream_next(sllp, &stream, &response, NULL,
+					    NULL) == SLLP_SUCCESS;
+	}
+	check(ok && i == 5, "stream a range of blocks");
+	check(sllp_stream_next(sllp, &stream, &response, NULL, NULL) ==
+	      SLLP_ERR_PARAM_INVALID, "nothing left in the stream");
+
+	request_buf[3] = 3;
+	request_buf[4] = NBLOCKS;
+	sllp_process_stream(sllp, &request, &response, NULL, NULL, &stream);
+	check(response.len == 2 && response_buf[0] == 0xE4 && !stream.pending,
+	      "range past the curve refused");
+}
+
+/* Bytes read through a callback of their own */
+unsigned int range_reads;
+
+void read_range(struct sllp_curve *curve, uint32_t offset, uint16_t len,
+		uint8_t *data)
+{
+	memcpy(data, &memory[0][0] + offset, len);
+	++range_reads;
+}
+
+/* Parts of a curve, by offset and length */
+void test_partial(sllp_instance_t *sllp, uint8_t id)
+{
+	check(read_data(sllp, id, 5*BLOCK_SIZE + 100, 20), "read inside a block");
+	check(read_data(sllp, id, 3*BLOCK_SIZE - 100, 200) &&
+	      response_buf[1] == 0x81, "read across blocks");
+	check(read_data(sllp, id, 0, BLOCK_SIZE) &&
+	      read_data(sllp, id, NBLOCKS*BLOCK_SIZE - BLOCK_SIZE, BLOCK_SIZE),
+	      "read whole blocks");
+
+	check(!read_data(sllp, id, NBLOCKS*BLOCK_SIZE - 10, 20) &&
+	      response_buf[0] == 0xE4, "read past the curve refused");
+	check(!read_data(sllp, id, 0, 0) && response_buf[0] == 0xE4,
+	      "empty read refused");
+	check(!read_data(sllp, id, 0, BLOCK_SIZE + 1) && response_buf[0] == 0xE4,
+	      "read longer than a block refused");
+	check(!read_data(sllp, 0xF0, 0, 10) && response_buf[0] == 0xE3,
+	      "read from an invalid curve refused");
+
+	struct sllp_curve ranged = {
+		.nblocks = NBLOCKS - 1,
+		.read_block = read_block_fast,
+		.read_range = read_range,
+	};
+	check(sllp_register_curve(sllp, &ranged) == SLLP_SUCCESS,
+	      "register curve reading ranges");
+	device_reads = range_reads = 0;
+	check(read_data(sllp, ranged.id, 2*BLOCK_SIZE - 3, 6) &&
+	      range_reads == 1 && !device_reads, "range read by its callback");
+	check(transmit(sllp, ranged.id, 1) && device_reads == 1,
+	      "blocks still read whole");
+}
+
+/* Curves of samples, for envelopes */
+#define SAMPLE_BLOCKS	4
+#define BINS		(SAMPLE_BLOCKS*64)
+
+uint8_t samples[SAMPLE_BLOCKS][BLOCK_SIZE];
+unsigned int sample_reads;
+
+void samples_read_block(struct sllp_curve *curve, uint8_t block,
+			uint8_t *data)
+{
+	memcpy(data, samples[block], BLOCK_SIZE);
+	++sample_reads;
+}
+
+const uint8_t *samples_get_block_ptr(struct sllp_curve *curve, uint8_t block)
+{
+	return samples[block];
+}
+
+double sample(uint8_t type, const uint8_t *data, unsigned int i)
+{
+	int16_t i16;
+	int32_t i32;
+	float f;
+
+	switch(type)
+	{
+	case SLLP_SAMPLE_INT16:
+		memcpy(&i16, data + 2*i, 2);
+		return i16;
+	case SLLP_SAMPLE_INT32:
+		memcpy(&i32, data + 4*i, 4);
+		return i32;
+	default:
+		memcpy(&f, data + 4*i, 4);
+		return f;
+	}
+}
+
+bool query_envelope(sllp_instance_t *sllp, uint8_t id, uint16_t points)
+{
+	uint8_t payload[] = {id, points >> 8, points};
+
+	return process(sllp, 0x46, payload, sizeof(payload)) == 0x47;
+}
+
+/* The last envelope answered matches one calculated sample by sample */
+bool envelope_ok(uint8_t type, uint16_t points)
+{
+	unsigned int size = sllp_sample_size(type);
+	unsigned int per_bin = BLOCK_SIZE/64/size;
+	unsigned int i, j;
+
+	if(response_buf[2] != type || response.len != 3 + 2*points*size)
+		return false;
+
+	for(i = 0; i < points; ++i)
+	{
+		unsigned int first = i*BINS/points*per_bin;
+		unsigned int end = (i + 1)*BINS/points*per_bin;
+		double min = sample(type, &samples[0][0], first), max = min;
+
+		for(j = first + 1; j < end; ++j)
+		{
+			double v = sample(type, &samples[0][0], j);
+			if(v < min)
+				min = v;
+			if(v > max)
+				max = v;
+		}
+
+		if(sample(type, response_buf + 3, 2*i) != min ||
+		   sample(type, response_buf + 3, 2*i + 1) != max)
+			return false;
+	}
+
+	return true;
+}
+
+bool query_stats(sllp_instance_t *sllp, uint8_t id, uint8_t first,
+		 uint8_t last)
+{
+	uint8_t payload[] = {id, first, last};
+
+	return process(sllp, 0x48, payload, sizeof(payload)) == 0x49;
+}
+
+/* The last statistics answered match ones calculated sample by sample */
+bool stats_ok(uint8_t type, uint8_t first, uint8_t last)
+{
+	unsigned int size = sllp_sample_size(type);
+	unsigned int per_block = BLOCK_SIZE/size;
+	double min, max, sum = 0, squares = 0, answer[2];
+	const uint8_t *sums = response_buf + 3 + 2*size;
+	unsigned int i;
+
+	if(response_buf[2] != type || response.len != 3 + 2*size + 16)
+		return false;
+
+	min = max = sample(type, samples[first], 0);
+	for(i = first*per_block; i < (last + 1)*per_block; ++i)
+	{
+		double v = sample(type, &samples[0][0], i);
+		if(v < min)
+			min = v;
+		if(v > max)
+			max = v;
+		sum += v;
+		squares += v*v;
+	}
+
+	answer[0] = sllp_decode_double(sums);
+	answer[1] = sllp_decode_double(sums + SLLP_DOUBLE_SIZE);
+
+	/* Integer sums are exact, and so are squares of 16-bit samples */
+	if(type != SLLP_SAMPLE_FLOAT32 && answer[0] != sum)
+		return false;
+	if(type == SLLP_SAMPLE_INT16 && answer[1] != squares)
+		return false;
+
+	return sample(type, response_buf + 3, 0) == min &&
+	       sample(type, response_buf + 3, 1) == max &&
+	       fabs(answer[0] - sum) <= 1e-6*sqrt(squares) &&
+	       fabs(answer[1] - squares) <= 1e-6*squares;
+}
+
+void test_envelope(sllp_instance_t *sllp)
+{
+	struct sllp_curve curve = {
+		.writable = true,
+		.nblocks = SAMPLE_BLOCKS - 1,
+		.sample_type = SLLP_SAMPLE_INT16,
+		.read_block = samples_read_block,
+		.write_block = write_block,
+		.user = samples,
+	};
+	unsigned int i;
+
+	srand(1);
+	for(i = 0; i < sizeof(samples); ++i)
+		samples[0][i] = rand();
+
+	check(sllp_register_curve(sllp, &curve) == SLLP_SUCCESS,
+	      "register curve of samples");
+
+	sample_reads = 0;
+	double start = now();
+	bool ok = query_envelope(sllp, curve.id, 100);
+	double first = now() - start;
+	check(ok && envelope_ok(SLLP_SAMPLE_INT16, 100) &&
+	      sample_reads == SAMPLE_BLOCKS, "envelope of 16-bit samples");
+
+	start = now();
+	ok = query_envelope(sllp, curve.id, BINS);
+	double cached = now() - start;
+	check(ok && envelope_ok(SLLP_SAMPLE_INT16, BINS) &&
+	      sample_reads == SAMPLE_BLOCKS, "envelope from the cache");
+	printf("envelope of %d blocks (%s): %.1f us, cached: %.1f us\n",
+	       SAMPLE_BLOCKS, envelope_engine(), first*1e6, cached*1e6);
+
+	check(!query_envelope(sllp, curve.id, BINS + 1) &&
+	      response_buf[0] == 0xE4 && !query_envelope(sllp, curve.id, 0) &&
+	      response_buf[0] == 0xE4, "envelope with too many points refused");
+	check(!query_envelope(sllp, 0xF0, 10) && response_buf[0] == 0xE3,
+	      "envelope of an invalid curve refused");
+	struct sllp_curve opaque = {
+		.nblocks = SAMPLE_BLOCKS - 1,
+		.get_block_ptr = samples_get_block_ptr,
+	};
+	sllp_register_curve(sllp, &opaque);
+	check(!query_envelope(sllp, opaque.id, 10) && response_buf[0] == 0xE2 &&
+	      !query_stats(sllp, opaque.id, 0, 0) && response_buf[0] == 0xE2,
+	      "envelope of opaque bytes refused");
+
+	check(query_stats(sllp, curve.id, 0, SAMPLE_BLOCKS - 1) &&
+	      stats_ok(SLLP_SAMPLE_INT16, 0, SAMPLE_BLOCKS - 1) &&
+	      query_stats(sllp, curve.id, 1, 2) &&
+	      stats_ok(SLLP_SAMPLE_INT16, 1, 2) && sample_reads == SAMPLE_BLOCKS,
+	      "statistics from the cache");
+	check(!query_stats(sllp, curve.id, 2, 1) && response_buf[0] == 0xE4 &&
+	      !query_stats(sllp, curve.id, 0, SAMPLE_BLOCKS) &&
+	      response_buf[0] == 0xE4, "statistics of invalid blocks refused");
+
+	uint8_t one[SLLP_DOUBLE_SIZE];
+	static const uint8_t one_be[] = {0x3F, 0xF0, 0, 0, 0, 0, 0, 0};
+	sllp_encode_double(1.0, one);
+	check(!memcmp(one, one_be, sizeof(one)) &&
+	      sllp_decode_double(one) == 1.0, "sums encoded big-endian");
+
+	/* Written blocks are summarized from the data written */
+	write_curve(sllp, curve.id, 2, 0x7F);
+	check(query_envelope(sllp, curve.id, 7) &&
+	      envelope_ok(SLLP_SAMPLE_INT16, 7) &&
+	      query_stats(sllp, curve.id, 2, 3) &&
+	      stats_ok(SLLP_SAMPLE_INT16, 2, 3) &&
+	      sample_reads == SAMPLE_BLOCKS, "summary of a written block");
+
+	samples[1][100] = 0x80;
+	samples[1][101] = 0x80;
+	sllp_curve_block_changed(sllp, &curve, 1);
+	check(query_envelope(sllp, curve.id, 7) &&
+	      envelope_ok(SLLP_SAMPLE_INT16, 7), "envelope of a changed block");
+
+	struct sllp_curve wide = {
+		.nblocks = SAMPLE_BLOCKS - 1,
+		.sample_type = SLLP_SAMPLE_INT32,
+		.get_block_ptr = samples_get_block_ptr,
+	};
+	check(sllp_register_curve(sllp, &wide) == SLLP_SUCCESS &&
+	      query_envelope(sllp, wide.id, 33) &&
+	      envelope_ok(SLLP_SAMPLE_INT32, 33) &&
+	      query_stats(sllp, wide.id, 0, SAMPLE_BLOCKS - 1) &&
+	      stats_ok(SLLP_SAMPLE_INT32, 0, SAMPLE_BLOCKS - 1),
+	      "envelope of 32-bit samples");
+
+	float *values = (float *) &samples[0][0];
+	for(i = 0; i < sizeof(samples)/sizeof(float); ++i)
+		values[i] = (float) (rand() - RAND_MAX/2)/1000;
+
+	struct sllp_curve real = {
+		.nblocks = SAMPLE_BLOCKS - 1,
+		.sample_type = SLLP_SAMPLE_FLOAT32,
+		.get_block_ptr = samples_get_block_ptr,
+	};
+	check(sllp_register_curve(sllp, &real) == SLLP_SUCCESS &&
+	      query_envelope(sllp, real.id, BINS) &&
+	      envelope_ok(SLLP_SAMPLE_FLOAT32, BINS) &&
+	      query_stats(sllp, real.id, 1, 3) &&
+	      stats_ok(SLLP_SAMPLE_FLOAT32, 1, 3), "envelope of floats");
+
+	struct sllp_curve unknown = {
+		.nblocks = 0,
+		.sample_type = SLLP_SAMPLE_MAX,
+		.get_block_ptr = samples_get_block_ptr,
+	};
+	check(sllp_register_curve(sllp, &unknown) ==
+	      SLLP_ERR_PARAM_OUT_OF_RANGE, "unknown sample type refused");
+}
+
+void test_mmap(sllp_instance_t *sllp)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/test_curve.%d", (int) getpid());
+
+	/* A 4 MiB waveform */
+	static uint8_t file[256][BLOCK_SIZE];
+	int i;
+	for(i = 0; i < 256; ++i)
+		memset(file[i], i, BLOCK_SIZE);
+
+	FILE *f = fopen(path, "w");
+	fwrite(file, 1, sizeof(file), f);
+	fclose(f);
+
+	struct sllp_curve_mmap mc;
+	check(sllp_curve_init_mmap(&mc, path, true) == SLLP_SUCCESS,
+	      "map file as curve");
+	check(mc.curve.nblocks == 255, "blocks of the mapped curve");
+	check(sllp_register_curve(sllp, &mc.curve) == SLLP_SUCCESS,
+	      "register mapped curve");
+
+	bool ok = true;
+	for(i = 0; i < 256; ++i)
+	{
+		uint8_t payload[] = {mc.curve.id, i};
+
+		process(sllp, 0x40, payload, sizeof(payload));
+		ok = ok && !memcmp(response_buf + 4, file[i], BLOCK_SIZE);
+	}
+	check(ok, "download mapped curve");
+
+	/* Upload */
+	for(i = 250; i < 256; ++i)
+	{
+		request_buf[0] = 0x41;
+		request_buf[1] = 0xFF;
+		request_buf[2] = mc.curve.id;
+		request_buf[3] = i;
+		memset(request_buf + 4, 0xA5, BLOCK_SIZE);
+		request.len = 4 + BLOCK_SIZE;
+		sllp_process_packet(sllp, &request, &response);
+		memset(file[i], 0xA5, BLOCK_SIZE);
+	}
+	check(sllp_curve_close_mmap(&mc) == SLLP_SUCCESS, "close mapped curve");
+
+	static uint8_t written[256][BLOCK_SIZE];
+	f = fopen(path, "r");
+	check(fread(written, 1, sizeof(written), f) == sizeof(written) &&
+	      !memcmp(written, file, sizeof(file)), "uploaded blocks in the file");
+	fclose(f);
+
+	/* Files that are not made of blocks */
+	truncate(path, 1000);
+	check(sllp_curve_init_mmap(&mc, path, false) ==
+	      SLLP_ERR_PARAM_OUT_OF_RANGE, "map file of partial block");
+	unlink(path);
+	check(sllp_curve_init_mmap(&mc, path, false) == SLLP_ERR_COMM,
+	      "map missing file");
+}
+
+/* Download the whole curve, as a client would, timing it */
+bool download(sllp_instance_t *sllp, uint8_t id, double *elapsed)
+{
+	bool ok = true;
+	double start = now();
+
+	int i;
+	for(i = 0; i < NBLOCKS; ++i)
+	{
+		ok = transmit(sllp, id, i) && ok;
+		usleep(NETWORK_DELAY);
+	}
+
+	*elapsed = now() - start;
+
+	return ok;
+}
+
+int main(void)
+{
+	sllp_instance_t *sllp = sllp_new();
+	struct sllp_curve curve = {
+		.writable = true,
+		.nblocks = NBLOCKS - 1,
+		.read_block = slow_read_block,
+		.write_block = write_block,
+		.user = memory,
+	};
+
+	int i;
+	for(i = 0; i < NBLOCKS; ++i)
+		memset(memory[i], i, BLOCK_SIZE);
+
+	check(sllp_register_curve(sllp, &curve) == SLLP_SUCCESS,
+	      "register curve");
+
+	double plain, prefetched;
+	check(download(sllp, curve.id, &plain), "download without read-ahead");
+
+	/* Read-ahead */
+	check(sllp_set_curve_prefetch(sllp, &curve, NBLOCKS) ==
+	      SLLP_ERR_PARAM_OUT_OF_RANGE, "read-ahead deeper than the curve");
+	check(sllp_set_curve_prefetch(sllp, &curve, 2) == SLLP_SUCCESS,
+	      "enable read-ahead");
+
+	check(download(sllp, curve.id, &prefetched), "download with read-ahead");
+	printf("download of %d blocks: %.1f ms without read-ahead, "
+	       "%.1f ms with it\n", NBLOCKS, plain*1e3, prefetched*1e3);
+	check(prefetched < plain, "read-ahead hides the device latency");
+
+	/* A write discards the copy read ahead */
+	check(transmit(sllp, curve.id, 2), "transmit block 2");
+	usleep(3*DEVICE_DELAY);
+	check(write_curve(sllp, curve.id, 3, 0xAA), "write block 3");
+	check(transmit(sllp, curve.id, 3) && memory[3][0] == 0xAA,
+	      "written block transmitted");
+
+	/* Out of order requests are still answered correctly */
+	bool ok = true;
+	for(i = NBLOCKS - 1; i >= 0; i -= 3)
+		ok = transmit(sllp, curve.id, i) && ok;
+	check(ok, "out of order transmits");
+
+	check(sllp_set_curve_prefetch(sllp, &curve, 0) == SLLP_SUCCESS,
+	      "disable read-ahead");
+	check(transmit(sllp, curve.id, 5), "transmit without read-ahead");
+
+	/* Checksums */
+	struct sllp_curve fast = {
+		.writable = true,
+		.nblocks = NBLOCKS - 1,
+		.read_block = read_block_fast,
+		.write_block = write_block,
+		.user = memory,
+	};
+	check(sllp_register_curve(sllp, &fast) == SLLP_SUCCESS,
+	      "register another curve");
+	test_checksums(sllp, &fast);
+
+	test_resident(sllp);
+	test_unlocked();
+	test_stream(sllp, fast.id);
+	test_partial(sllp, fast.id);
+
+	/* File-backed curves, in an instance of their own */
+	sllp_instance_t *files = sllp_new();
+	test_mmap(files);
+	sllp_destroy(files);
+
+	sllp_instance_t *typed = sllp_new();
+	test_envelope(typed);
+	sllp_destroy(typed);
+
+	struct sllp_curve read_only = {
+		.nblocks = NBLOCKS - 1,
+		.read_block = read_block_fast,
+	};
+	sllp_register_curve(sllp, &read_only);
+	write_curve(sllp, read_only.id, 0, 0);
+	check(response_buf[0] == 0xE6, "write to a read-only curve refused");
+
+	sllp_set_curve_prefetch(sllp, &curve, 1);
+	sllp_destroy(sllp);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
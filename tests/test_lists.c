@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "test_common.h"
+#include "common.h"
+
+#define NBLOCKS		2
+#define NVARS		100
+#define ROUNDS		1000000
+
+uint8_t memory[NBLOCKS][BLOCK_SIZE];
+uint8_t values[NVARS][2];
+
+struct iovec iov[SLLP_MAX_IOV];
+int iovcnt;
+
+/* Like process, flattening the scatter/gather answer into response_buf */
+uint8_t process_iov(sllp_instance_t *sllp, uint8_t code,
+		    const uint8_t *payload, uint8_t size)
+{
+	static uint8_t flat[SLLP_MAX_MESSAGE];
+	size_t len = 0;
+	int i;
+
+	set_request(code, payload, size);
+	sllp_process_packet_iov(sllp, &request, &response, iov, &iovcnt);
+
+	for(i = 0; i < iovcnt; ++i)
+	{
+		memcpy(flat + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	memcpy(response_buf, flat, len);
+	response.len = len;
+
+	return response_buf[0];
+}
+
+/* Whether the answers of both paths to a request match */
+bool same_answers(sllp_instance_t *sllp, uint8_t code, const uint8_t *payload,
+		  uint8_t size)
+{
+	uint8_t copied[SLLP_MAX_MESSAGE];
+
+	process(sllp, code, payload, size);
+	uint16_t len = response.len;
+	memcpy(copied, response_buf, len);
+
+	process_iov(sllp, code, payload, size);
+	return len == response.len && !memcmp(copied, response_buf, len);
+}
+
+/* IDs at the limits of the tables, 127 being the last one */
+void test_limits(void)
+{
+	static struct sllp_var vars[SLLP_MAX_VARIABLES + 1];
+	static struct sllp_curve curves[SLLP_MAX_CURVES + 1];
+	static uint8_t limit_values[SLLP_MAX_VARIABLES + 1];
+	uint8_t payload[2];
+	unsigned int i;
+	bool ok = true;
+
+	sllp_instance_t *sllp = sllp_new();
+
+	for(i = 0; i <= SLLP_MAX_VARIABLES; ++i)
+	{
+		vars[i].data = &limit_values[i];
+		vars[i].size = 1;
+		vars[i].writable = true;
+	}
+	for(i = 0; i < SLLP_MAX_VARIABLES; ++i)
+		ok = ok && sllp_register_variable(sllp, &vars[i]) ==
+			   SLLP_SUCCESS;
+	check(ok && vars[127].id == 127 &&
+	      sllp_register_variable(sllp, &vars[128]) ==
+	      SLLP_ERR_OUT_OF_MEMORY,
+	      "variables registered up to ID 127");
+
+	limit_values[127] = 0x7F;
+	payload[0] = 127;
+	payload[1] = 0x55;
+	check(process(sllp, 0x10, payload, 1) == 0x11 &&
+	      response_buf[2] == 0x7F &&
+	      process(sllp, 0x20, payload, 2) == 0xE0 &&
+	      limit_values[127] == 0x55,
+	      "variable 127 read and written");
+	payload[0] = 128;
+	check(process(sllp, 0x10, payload, 1) == 0xE3 &&
+	      process(sllp, 0x20, payload, 2) == 0xE3,
+	      "variable 128 refused");
+
+	/* Groups 3 to 127, each of a variable */
+	for(i = 3; i < SLLP_MAX_GROUPS; ++i)
+	{
+		payload[0] = i;
+		ok = ok && process(sllp, 0x30, payload, 1) == 0x31;
+	}
+	check(ok && response_buf[2] == (0x80 | 127) &&
+	      process(sllp, 0x30, payload, 1) == 0xE7,
+	      "groups created up to ID 127");
+
+	payload[0] = 127;
+	check(process(sllp, 0x06, payload, 1) == 0x07 &&
+	      response_buf[1] == 1 && response_buf[2] == 127 &&
+	      process(sllp, 0x12, payload, 1) == 0x13 &&
+	      response_buf[2] == 0x55,
+	      "group 127 queried and read");
+	payload[0] = 128;
+	check(process(sllp, 0x06, payload, 1) == 0xE3 &&
+	      process(sllp, 0x12, payload, 1) == 0xE3,
+	      "group 128 refused");
+
+	/* Curves of a block each */
+	for(i = 0; i <= SLLP_MAX_CURVES; ++i)
+	{
+		curves[i].read_block = read_block;
+		curves[i].user = memory;
+	}
+	for(i = 0; i < SLLP_MAX_CURVES; ++i)
+		ok = ok && sllp_register_curve(sllp, &curves[i]) ==
+			   SLLP_SUCCESS;
+	check(ok && curves[127].id == 127 &&
+	      sllp_register_curve(sllp, &curves[128]) ==
+	      SLLP_ERR_OUT_OF_MEMORY,
+	      "curves registered up to ID 127");
+
+	payload[0] = 127;
+	payload[1] = 0;
+	check(process(sllp, 0x40, payload, 2) == 0x41 &&
+	      response_buf[2] == 127,
+	      "curve 127 transmitted");
+	payload[0] = 128;
+	check(process(sllp, 0x40, payload, 2) == 0xE3 &&
+	      process(sllp, 0x42, payload, 1) == 0xE3,
+	      "curve 128 refused");
+
+	sllp_destroy(sllp);
+}
+
+/* Variables side by side in memory are read and written as one run */
+void test_runs(void)
+{
+	/* a, b and d follow each other, c is apart */
+	uint8_t store[8] = {0}, apart[1] = {0};
+	struct sllp_var vars[] = {
+		{ .data = store, .size = 2, .writable = true },
+		{ .data = store + 2, .size = 3, .writable = true },
+		{ .data = apart, .size = 1, .writable = true },
+		{ .data = store + 5, .size = 1, .writable = true },
+	};
+	uint8_t payload[8];
+	unsigned int i;
+
+	sllp_instance_t *sllp = sllp_new();
+	for(i = 0; i < 4; ++i)
+		sllp_register_variable(sllp, &vars[i]);
+
+	struct sllp_group *all = sllp->groups.list[0];
+	check(all->runs_count == 3 && all->runs[0].data == store &&
+	      all->runs[0].size == 5 && all->runs[2].data == store + 5,
+	      "standard group runs merged");
+
+	payload[0] = 0;
+	payload[1] = 1;
+	payload[2] = 3;
+	process(sllp, 0x30, payload, 3);
+	payload[0] = 1;
+	payload[1] = 0;
+	process(sllp, 0x30, payload, 2);
+	struct sllp_group *merged = sllp->groups.list[3];
+	struct sllp_group *reversed = sllp->groups.list[4];
+	check(merged->runs_count == 1 && merged->runs[0].data == store &&
+	      merged->runs[0].size == 6,
+	      "adjacent variables merged into one run");
+	check(reversed->runs_count == 2 && reversed->runs[0].data == store + 2 &&
+	      reversed->runs[1].data == store,
+	      "variables out of order kept apart");
+
+	/* Written and read across the merged run, in group order */
+	payload[0] = 3;
+	for(i = 0; i < 6; ++i)
+		payload[1 + i] = 0x10 + i;
+	check(process(sllp, 0x22, payload, 7) == 0xE0 &&
+	      !memcmp(store, payload + 1, 6) && apart[0] == 0,
+	      "merged run written");
+	payload[0] = 4;
+	check(process(sllp, 0x12, payload, 1) == 0x13 &&
+	      response_buf[1] == 5 && response_buf[2] == 0x12 &&
+	      response_buf[4] == 0x14 && response_buf[5] == 0x10 &&
+	      response_buf[6] == 0x11,
+	      "runs read in group order");
+
+	/* Scatter/gather answers reference the runs */
+	process_iov(sllp, 0x12, payload, 1);
+	check(iovcnt == 3 && iov[1].iov_base == store + 2 &&
+	      iov[2].iov_base == store,
+	      "one entry per run");
+
+	sllp_destroy(sllp);
+}
+
+int main(void)
+{
+	struct sllp_var vars[NVARS];
+	struct sllp_curve curve = {
+		.writable = true,
+		.nblocks = NBLOCKS - 1,
+		.read_block = read_block,
+		.write_block = write_block,
+		.user = memory,
+	};
+	uint8_t payload[BLOCK_SIZE + 2];
+	unsigned int i;
+
+	sllp_instance_t *sllp = sllp_new();
+
+	check(process(sllp, 0x04, NULL, 0) == 0x05 && response_buf[1] == 3 &&
+	      response_buf[2] == 0 && response_buf[3] == 0 &&
+	      response_buf[4] == 0x80,
+	      "standard groups listed while empty");
+
+	for(i = 0; i < NVARS; ++i)
+	{
+		vars[i].data = values[i];
+		vars[i].size = i % 2 ? 1 : 2;
+		vars[i].writable = i < NVARS/2;
+		sllp_register_variable(sllp, &vars[i]);
+	}
+	sllp_register_curve(sllp, &curve);
+
+	check(process(sllp, 0x02, NULL, 0) == 0x03 &&
+	      response_buf[1] == NVARS && response_buf[2] == 0x82 &&
+	      response_buf[3] == 0x81 && response_buf[2 + NVARS - 1] == 0x01,
+	      "variables listed as registered");
+	check(process(sllp, 0x04, NULL, 0) == 0x05 && response_buf[1] == 3 &&
+	      response_buf[2] == NVARS && response_buf[3] == NVARS/2 &&
+	      response_buf[4] == (0x80 | NVARS/2),
+	      "standard groups listed");
+
+	payload[0] = 0;
+	check(process(sllp, 0x06, payload, 1) == 0x07 &&
+	      response_buf[1] == NVARS && response_buf[2] == 0 &&
+	      response_buf[2 + NVARS - 1] == NVARS - 1,
+	      "group queried");
+
+	payload[0] = 7;
+	payload[1] = 3;
+	payload[2] = 5;
+	check(process(sllp, 0x30, payload, 3) == 0x31 &&
+	      process(sllp, 0x04, NULL, 0) == 0x05 && response_buf[1] == 4 &&
+	      response_buf[5] == (0x80 | 3),
+	      "created group listed");
+	payload[0] = 3;
+	check(process(sllp, 0x06, payload, 1) == 0x07 &&
+	      response_buf[1] == 3 && response_buf[2] == 7 &&
+	      response_buf[3] == 3 && response_buf[4] == 5,
+	      "created group queried");
+	check(process(sllp, 0x32, NULL, 0) == 0xE0 &&
+	      process(sllp, 0x04, NULL, 0) == 0x05 && response_buf[1] == 3,
+	      "removed groups unlisted");
+
+	payload[0] = 60;
+	check(process(sllp, 0x30, payload, 1) == 0x31 &&
+	      process(sllp, 0x04, NULL, 0) == 0x05 && response_buf[1] == 4 &&
+	      response_buf[5] == 1,
+	      "recreated group listed");
+
+	payload[0] = 8;
+	payload[1] = 9;
+	payload[2] = 8;
+	check(process(sllp, 0x30, payload, 3) == 0xE4 &&
+	      process(sllp, 0x04, NULL, 0) == 0x05 && response_buf[1] == 4,
+	      "group naming a variable twice refused");
+
+	/* Groups containing a variable */
+	uint8_t ids[SLLP_MAX_GROUPS];
+	unsigned int count;
+	check(sllp_var_groups(sllp, &vars[60], ids, &count) == SLLP_SUCCESS &&
+	      count == 3 && ids[0] == 0 && ids[1] == 1 && ids[2] == 3,
+	      "groups containing a variable");
+	check(sllp_var_groups(sllp, &vars[7], ids, &count) == SLLP_SUCCESS &&
+	      count == 2 && ids[0] == 0 && ids[1] == 2,
+	      "variable only in standard groups");
+	struct sllp_var stranger = vars[7];
+	check(sllp_var_groups(sllp, &stranger, ids, &count) ==
+	      SLLP_ERR_PARAM_INVALID,
+	      "unregistered variable refused");
+
+	/* Checksums follow the writes once recalculated */
+	process(sllp, 0x08, NULL, 0);
+	uint8_t before[SLLP_CURVE_CSUM_SIZE];
+	memcpy(before, response_buf + 4, sizeof(before));
+	payload[0] = curve.id;
+	payload[1] = 1;
+	memset(payload + 2, 0x5A, BLOCK_SIZE);
+	request_buf[0] = 0x41;
+	request_buf[1] = 0xFF;
+	memcpy(request_buf + 2, payload, BLOCK_SIZE + 2);
+	request.len = 2 + BLOCK_SIZE + 2;
+	sllp_process_packet(sllp, &request, &response);
+	check(response_buf[0] == 0xE0, "curve block written");
+	check(process(sllp, 0x42, payload, 1) == 0xE0 &&
+	      process(sllp, 0x08, NULL, 0) == 0x09 &&
+	      response_buf[1] == SLLP_CURVE_INFO_SIZE &&
+	      response_buf[2] == 1 && response_buf[3] == NBLOCKS - 1 &&
+	      !memcmp(response_buf + 4, curve.checksum, sizeof(before)) &&
+	      memcmp(response_buf + 4, before, sizeof(before)),
+	      "recalculated checksum listed");
+
+	/* Lists referenced in place */
+	payload[0] = 3;
+	check(same_answers(sllp, 0x02, NULL, 0) &&
+	      same_answers(sllp, 0x04, NULL, 0) &&
+	      same_answers(sllp, 0x06, payload, 1) &&
+	      same_answers(sllp, 0x08, NULL, 0),
+	      "scatter/gather answers match");
+	process_iov(sllp, 0x02, NULL, 0);
+	check(iovcnt == 2 && iov[1].iov_len == NVARS,
+	      "variables list referenced in place");
+
+	/* Answering costs a copy */
+	struct timespec start, end;
+
+	set_request(0x02, NULL, 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < ROUNDS; ++i)
+		sllp_process_packet(sllp, &request, &response);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("%-50s %.1f ns\n", "CMD_QUERY_VARS_LIST",
+	       elapsed_ns(&start, &end)/ROUNDS);
+
+	payload[0] = 0;
+	set_request(0x06, payload, 1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < ROUNDS; ++i)
+		sllp_process_packet(sllp, &request, &response);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("%-50s %.1f ns\n", "CMD_QUERY_GROUP",
+	       elapsed_ns(&start, &end)/ROUNDS);
+
+	/* Membership is checked with a bit per variable */
+	for(i = 0; i < NVARS; ++i)
+		payload[i] = NVARS - 1 - i;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < ROUNDS/100; ++i)
+	{
+		process(sllp, 0x32, NULL, 0);
+		process(sllp, 0x30, payload, NVARS);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("%-50s %.1f ns\n", "CMD_CREATE_GROUP of every variable",
+	       elapsed_ns(&start, &end)/(ROUNDS/100));
+	check(response_buf[0] == 0x31, "group of every variable created");
+	process(sllp, 0x32, NULL, 0);
+	payload[0] = 60;
+	process(sllp, 0x30, payload, 1);
+
+	/* Concurrent mode copies what may change */
+	sllp_set_concurrent(sllp, true);
+	payload[0] = 3;
+	check(process(sllp, 0x06, payload, 1) == 0x07 &&
+	      response_buf[1] == 1 && response_buf[2] == 60,
+	      "group queried in concurrent mode");
+	check(process_iov(sllp, 0x04, NULL, 0) == 0x05 && iovcnt == 1 &&
+	      response_buf[1] == 4,
+	      "groups list copied in concurrent mode");
+
+	sllp_destroy(sllp);
+
+	test_limits();
+	test_runs();
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
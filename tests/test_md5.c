@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "test_common.h"
+#include "md5/md5.h"
+#include "md5/md5_mb.h"
+
+#define NBUFFERS	64
+#define ROUNDS		20
+
+uint8_t buffers[NBUFFERS][BLOCK_SIZE];
+
+void reference(uint8_t *data, unsigned int len, uint8_t *digest)
+{
+	MD5_CTX ctx;
+	MD5Init(&ctx);
+	MD5Update(&ctx, data, len);
+	MD5Final(digest, &ctx);
+}
+
+/* Test suite of RFC 1321 */
+bool test_rfc1321(void)
+{
+	static const char *inputs[] = {
+		"",
+		"a",
+		"abc",
+		"message digest",
+		"abcdefghijklmnopqrstuvwxyz",
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+		"1234567890123456789012345678901234567890"
+		"1234567890123456789012345678901234567890",
+	};
+	static const char *digests[] = {
+		"d41d8cd98f00b204e9800998ecf8427e",
+		"0cc175b9c0f1b6a831c399e269772661",
+		"900150983cd24fb0d6963f7d28e17f72",
+		"f96b697d7cb7938d525a2f31aaf161d0",
+		"c3fcd3d76192e4007dfb496cca67e13b",
+		"d174ab98d277d9f5a5611c2c9f419d9f",
+		"57edf4a22be3c955ac49da2e2107b67a",
+	};
+
+	bool ok = true;
+	int i;
+	for(i = 0; i < sizeof(inputs)/sizeof(inputs[0]); ++i)
+	{
+		uint8_t digest[16];
+		char hex[33];
+		int j;
+
+		md5_digest((const uint8_t *) inputs[i], strlen(inputs[i]), digest);
+		for(j = 0; j < 16; ++j)
+			sprintf(hex + 2*j, "%02x", digest[j]);
+
+		ok = ok && !strcmp(hex, digests[i]);
+	}
+	return ok;
+}
+
+/* Every length around the padding boundaries, single and multi-buffer */
+bool test_lengths(void)
+{
+	const uint8_t *data[17];
+	uint8_t expected[17][16], digests[17][16];
+	bool ok = true;
+
+	unsigned int len, n, i;
+	for(len = 0; len <= 300; ++len)
+	{
+		for(i = 0; i < 17; ++i)
+		{
+			data[i] = buffers[i] + i;
+			reference(buffers[i] + i, len, expected[i]);
+		}
+
+		md5_digest(data[0], len, digests[0]);
+		ok = ok && !memcmp(digests[0], expected[0], 16);
+
+		for(n = 1; n <= 17; ++n)
+		{
+			memset(digests, 0, sizeof(digests));
+			md5_digest_mb(data, len, digests, n);
+			ok = ok && !memcmp(digests, expected, n*16) &&
+			     (n == 17 || digests[n][0] == 0);
+		}
+	}
+	return ok;
+}
+
+bool test_blocks(void)
+{
+	const uint8_t *data[NBUFFERS];
+	uint8_t expected[NBUFFERS][16], digests[NBUFFERS][16];
+
+	int i;
+	for(i = 0; i < NBUFFERS; ++i)
+	{
+		data[i] = buffers[i];
+		reference(buffers[i], BLOCK_SIZE, expected[i]);
+	}
+
+	md5_digest_mb(data, BLOCK_SIZE, digests, NBUFFERS);
+	return !memcmp(digests, expected, sizeof(digests));
+}
+
+void benchmark(void)
+{
+	const uint8_t *data[NBUFFERS];
+	uint8_t digests[NBUFFERS][16];
+	double mb = (double) ROUNDS*NBUFFERS*BLOCK_SIZE/(1 << 20);
+	double start;
+	int i, r;
+
+	for(i = 0; i < NBUFFERS; ++i)
+		data[i] = buffers[i];
+
+	start = now();
+	for(r = 0; r < ROUNDS; ++r)
+		for(i = 0; i < NBUFFERS; ++i)
+			reference(buffers[i], BLOCK_SIZE, digests[i]);
+	printf("reference:    %6.0f MB/s\n", mb/(now() - start));
+
+	start = now();
+	for(r = 0; r < ROUNDS; ++r)
+		for(i = 0; i < NBUFFERS; ++i)
+			md5_digest(buffers[i], BLOCK_SIZE, digests[i]);
+	printf("single:       %6.0f MB/s\n", mb/(now() - start));
+
+	start = now();
+	for(r = 0; r < ROUNDS; ++r)
+		md5_digest_mb(data, BLOCK_SIZE, digests, NBUFFERS);
+	printf("multi-buffer: %6.0f MB/s (%s)\n", mb/(now() - start),
+	       md5_mb_engine());
+}
+
+int main(void)
+{
+	int i, j;
+
+	srand(1);
+	for(i = 0; i < NBUFFERS; ++i)
+		for(j = 0; j < BLOCK_SIZE; ++j)
+			buffers[i][j] = rand();
+
+	check(test_rfc1321(), "RFC 1321 test suite");
+	check(test_lengths(), "lengths 0 to 300, 1 to 17 buffers");
+	check(test_blocks(), "curve blocks");
+
+	benchmark();
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
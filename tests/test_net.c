@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "test_common.h"
+#include "sllp_net.h"
+
+#define NVARS		32
+#define ROUND_TRIPS	20000
+#define PIPELINE	64
+#define DEEP_PIPELINE	1024
+#define NBLOCKS		200
+#define GREEDY		2048	/* Blocks asked by a client that doesn't read */
+
+uint8_t values[NVARS][4];
+struct sllp_var vars[NVARS];
+uint8_t memory[NBLOCKS][BLOCK_SIZE];
+struct sllp_curve curve;
+
+bool send_all(int fd, const uint8_t *data, size_t len)
+{
+	while(len)
+	{
+		ssize_t n = send(fd, data, len, 0);
+		if(n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool recv_all(int fd, uint8_t *data, size_t len)
+{
+	while(len)
+	{
+		ssize_t n = recv(fd, data, len, 0);
+		if(n <= 0)
+			return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+/* Receive a whole answer, framed by its header */
+int recv_answer(int fd, uint8_t *buf)
+{
+	if(!recv_all(fd, buf, 2))
+		return -1;
+
+	uint16_t size = buf[1] < 0x80 ? buf[1] : 128*(buf[1] & 0x7F) + 130;
+
+	if(!recv_all(fd, buf + 2, size))
+		return -1;
+
+	return size + 2;
+}
+
+int connect_tcp(uint16_t port)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+		return -1;
+	return fd;
+}
+
+int connect_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+		return -1;
+	return fd;
+}
+
+void test_connection(int fd, const char *name)
+{
+	uint8_t buf[SLLP_MAX_MESSAGE];
+	char what[64];
+	int len;
+
+	/* Discovery */
+	uint8_t query_vars_list[] = {0x02, 0x00};
+	send_all(fd, query_vars_list, sizeof(query_vars_list));
+	len = recv_answer(fd, buf);
+	snprintf(what, sizeof(what), "%s: variables list", name);
+	check(len == 2 + NVARS && buf[0] == 0x03 && buf[2] == 0x04, what);
+
+	/* Answer padded to its encoded size */
+	uint8_t read_all[] = {0x12, 0x01, 0x00};
+	send_all(fd, read_all, sizeof(read_all));
+	len = recv_answer(fd, buf);
+	snprintf(what, sizeof(what), "%s: read group of %d bytes", name, NVARS*4);
+	check(len == 2 + 130 && buf[0] == 0x13 &&
+	      !memcmp(buf + 2, values, sizeof(values)), what);
+
+	/* Message split between receptions */
+	send_all(fd, read_all, 1);
+	usleep(10000);
+	send_all(fd, read_all + 1, sizeof(read_all) - 1);
+	len = recv_answer(fd, buf);
+	snprintf(what, sizeof(what), "%s: split message", name);
+	check(len == 2 + 130 && buf[0] == 0x13, what);
+
+	/* Pipelined requests are answered in order */
+	uint8_t reqs[PIPELINE][3];
+	int i;
+	for(i = 0; i < PIPELINE; ++i)
+	{
+		reqs[i][0] = 0x10;
+		reqs[i][1] = 0x01;
+		reqs[i][2] = i % NVARS;
+	}
+	send_all(fd, &reqs[0][0], sizeof(reqs));
+
+	bool ok = true;
+	for(i = 0; i < PIPELINE; ++i)
+	{
+		len = recv_answer(fd, buf);
+		ok = ok && len == 6 && buf[0] == 0x11 &&
+		     !memcmp(buf + 2, values[i % NVARS], 4);
+	}
+	snprintf(what, sizeof(what), "%s: %d pipelined reads", name, PIPELINE);
+	check(ok, what);
+
+	/* More requests in flight than the server has answer buffers */
+	uint8_t deep[DEEP_PIPELINE][3];
+	for(i = 0; i < DEEP_PIPELINE; ++i)
+		memcpy(deep[i], read_all, sizeof(read_all));
+	send_all(fd, &deep[0][0], sizeof(deep));
+
+	ok = true;
+	for(i = 0; i < DEEP_PIPELINE; ++i)
+	{
+		len = recv_answer(fd, buf);
+		ok = ok && len == 2 + 130 && !memcmp(buf + 2, values, sizeof(values));
+	}
+	snprintf(what, sizeof(what), "%s: %d pipelined group reads", name,
+		 DEEP_PIPELINE);
+	check(ok, what);
+
+	/* A range of blocks, then a request waiting for the whole stream */
+	uint8_t range[] = {0x43, 0x03, 0x00, 0x00, NBLOCKS - 1,
+			   0x10, 0x01, 0x07};
+	double start = now();
+	send_all(fd, range, sizeof(range));
+	ok = true;
+	for(i = 0; i < NBLOCKS; ++i)
+	{
+		len = recv_answer(fd, buf);
+		ok = ok && len == 4 + BLOCK_SIZE && buf[0] == 0x41 &&
+		     buf[3] == i && !memcmp(buf + 4, memory[i], BLOCK_SIZE);
+	}
+	double elapsed = now() - start;
+	len = recv_answer(fd, buf);
+	snprintf(what, sizeof(what), "%s: range of %d blocks", name, NBLOCKS);
+	check(ok && len == 6 && buf[0] == 0x11 && buf[2] == 7, what);
+	printf("%s: range of %d blocks, %.0f MB/s\n", name, NBLOCKS,
+	       NBLOCKS*BLOCK_SIZE/elapsed/1e6);
+
+	range[3] = 5;
+	range[4] = 4;
+	send_all(fd, range, 5);
+	len = recv_answer(fd, buf);
+	snprintf(what, sizeof(what), "%s: reversed range refused", name);
+	check(len == 2 && buf[0] == 0xE4, what);
+
+	/* Round trip throughput */
+	uint8_t read_var[] = {0x10, 0x01, 0x05};
+	start = now();
+	for(i = 0; i < ROUND_TRIPS; ++i)
+	{
+		send_all(fd, read_var, sizeof(read_var));
+		recv_answer(fd, buf);
+	}
+	elapsed = now() - start;
+	printf("%s: %d round trips, %.0f requests/s\n", name, ROUND_TRIPS,
+	       ROUND_TRIPS/elapsed);
+
+	/* Pipelined throughput */
+	start = now();
+	for(i = 0; i < ROUND_TRIPS/PIPELINE; ++i)
+	{
+		send_all(fd, &reqs[0][0], sizeof(reqs));
+		int j;
+		for(j = 0; j < PIPELINE; ++j)
+			recv_answer(fd, buf);
+	}
+	elapsed = now() - start;
+	printf("%s: pipelined by %d, %.0f requests/s\n", name, PIPELINE,
+	       (ROUND_TRIPS/PIPELINE)*PIPELINE/elapsed);
+}
+
+void test_backend(sllp_instance_t *sllp, enum sllp_net_backend backend,
+		  const char *name)
+{
+	char path[64], what[64];
+	snprintf(path, sizeof(path), "/tmp/test_net.%d.sock", (int) getpid());
+
+	sllp_net_t *net = sllp_net_new(sllp, 2);
+	uint16_t port = 0;
+
+	printf("%s backend\n", name);
+	check(sllp_net_set_backend(net, backend) == SLLP_SUCCESS, "set backend");
+	check(sllp_net_listen_tcp(net, "127.0.0.1", &port) == SLLP_SUCCESS,
+	      "listen on TCP");
+	check(sllp_net_listen_unix(net, path) == SLLP_SUCCESS,
+	      "listen on Unix socket");
+	check(sllp_net_start(net) == SLLP_SUCCESS, "start");
+	check(sllp_net_set_backend(net, SLLP_NET_EPOLL) == SLLP_ERR_PARAM_INVALID,
+	      "can't change backend while running");
+
+	if(sllp_net_get_backend(net) != backend)
+		printf("%s not supported, fell back to epoll\n", name);
+
+	snprintf(what, sizeof(what), "%s TCP", name);
+	int fd = connect_tcp(port);
+	check(fd >= 0, "connect over TCP");
+	if(fd >= 0)
+	{
+		test_connection(fd, what);
+		close(fd);
+	}
+
+	snprintf(what, sizeof(what), "%s Unix", name);
+	fd = connect_unix(path);
+	check(fd >= 0, "connect over Unix socket");
+	if(fd >= 0)
+	{
+		test_connection(fd, what);
+		close(fd);
+	}
+
+	/* Connections still open are closed on stop */
+	fd = connect_tcp(port);
+	uint8_t buf[SLLP_MAX_MESSAGE], read_var[] = {0x10, 0x01, 0x00};
+	send_all(fd, read_var, sizeof(read_var));
+	recv_answer(fd, buf);
+	check(sllp_net_stop(net) == SLLP_SUCCESS, "stop");
+	check(fd >= 0 && recv(fd, buf, 1, 0) == 0, "connection closed on stop");
+	close(fd);
+
+	sllp_net_destroy(net);
+	check(access(path, F_OK) != 0, "socket file removed");
+}
+
+/* A client that stops reading its answers doesn't starve the others */
+void test_fairness(sllp_instance_t *sllp, enum sllp_net_backend backend,
+		   const char *name)
+{
+	char path[64], what[64];
+	snprintf(path, sizeof(path), "/tmp/test_net.%d.sock", (int) getpid());
+
+	sllp_net_t *net = sllp_net_new(sllp, 1);
+	sllp_net_set_backend(net, backend);
+	sllp_net_listen_unix(net, path);
+	sllp_net_start(net);
+
+	static uint8_t transmits[GREEDY][4];
+	int i;
+	for(i = 0; i < GREEDY; ++i)
+	{
+		transmits[i][0] = 0x40;
+		transmits[i][1] = 0x02;
+		transmits[i][2] = 0x00;
+		transmits[i][3] = i % NBLOCKS;
+	}
+
+	int greedy = connect_unix(path);
+	send_all(greedy, &transmits[0][0], sizeof(transmits));
+	usleep(100000);
+
+	int fd = connect_unix(path);
+	struct timeval timeout = { .tv_sec = 2 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	uint8_t buf[SLLP_MAX_MESSAGE], read_var[] = {0x10, 0x01, 0x03};
+	send_all(fd, read_var, sizeof(read_var));
+	int len = recv_answer(fd, buf);
+	snprintf(what, sizeof(what), "%s: answered beside a stalled client", name);
+	check(len == 6 && buf[0] == 0x11 && buf[2] == 3, what);
+
+	close(fd);
+	close(greedy);
+	sllp_net_stop(net);
+	sllp_net_destroy(net);
+}
+
+/* A worker that can't set its ring up serves with epoll, and tells */
+void test_fallback(sllp_instance_t *sllp)
+{
+	sllp_net_t *net = sllp_net_new(sllp, 1);
+	uint16_t port = 0;
+
+	sllp_net_set_backend(net, SLLP_NET_IO_URING);
+	sllp_net_listen_tcp(net, "127.0.0.1", &port);
+
+	/* Room for the epoll instance, not for the ring */
+	struct rlimit saved, limit;
+	getrlimit(RLIMIT_NOFILE, &saved);
+	limit = saved;
+	int fd = dup(0);
+	close(fd);
+	limit.rlim_cur = fd + 1;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	enum sllp_err err = sllp_net_start(net);
+	setrlimit(RLIMIT_NOFILE, &saved);
+
+	check(err == SLLP_SUCCESS &&
+	      sllp_net_get_backend(net) == SLLP_NET_EPOLL,
+	      "ring set up failure falls back to epoll");
+
+	fd = connect_tcp(port);
+	uint8_t buf[SLLP_MAX_MESSAGE], read_var[] = {0x10, 0x01, 0x03};
+	send_all(fd, read_var, sizeof(read_var));
+	check(recv_answer(fd, buf) == 6 && buf[0] == 0x11,
+	      "answered after the fallback");
+
+	close(fd);
+	sllp_net_stop(net);
+	sllp_net_destroy(net);
+}
+
+int main(void)
+{
+	sllp_instance_t *sllp = sllp_new();
+
+	int i;
+	for(i = 0; i < NVARS; ++i)
+	{
+		memset(values[i], i, sizeof(values[i]));
+		vars[i].data = values[i];
+		vars[i].size = sizeof(values[i]);
+		vars[i].writable = false;
+		sllp_register_variable(sllp, &vars[i]);
+	}
+
+	for(i = 0; i < NBLOCKS*BLOCK_SIZE; ++i)
+		memory[0][i] = i*7 + i/BLOCK_SIZE;
+	curve.nblocks = NBLOCKS - 1;
+	curve.read_block = read_block;
+	curve.user = memory;
+	sllp_register_curve(sllp, &curve);
+
+	test_backend(sllp, SLLP_NET_EPOLL, "epoll");
+	test_backend(sllp, SLLP_NET_IO_URING, "io_uring");
+	test_fairness(sllp, SLLP_NET_EPOLL, "epoll");
+	test_fairness(sllp, SLLP_NET_IO_URING, "io_uring");
+	test_fallback(sllp);
+
+	sllp_destroy(sllp);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "test_common.h"
+
+#define NBLOCKS		4
+#define NVARS		8
+#define NGROUPS		2	/* Groups clients may create at a time */
+
+uint8_t memory[NBLOCKS][BLOCK_SIZE];
+uint8_t values[NVARS][4];
+
+/* Heap in use, by the allocator's count */
+size_t heap_used(void)
+{
+	return mallinfo2().uordblks;
+}
+
+int main(void)
+{
+	struct sllp_var vars[NVARS];
+	struct sllp_curve curve = {
+		.writable = true,
+		.nblocks = NBLOCKS - 1,
+		.sample_type = SLLP_SAMPLE_INT16,
+		.read_block = read_block,
+		.write_block = write_block,
+		.user = memory,
+	};
+	const struct sllp_curve *curves[] = {&curve};
+	unsigned int i;
+
+	size_t size = sllp_static_size(NGROUPS, curves, 1);
+	uint8_t *buffer = malloc(size);
+
+	check(!sllp_new_static(NULL, size) && !sllp_new_static(buffer, 16),
+	      "buffer missing or too small refused");
+
+	sllp_instance_t *sllp = sllp_new_static(buffer, size);
+	check(sllp != NULL, "create static instance");
+
+	for(i = 0; i < NVARS; ++i)
+	{
+		vars[i].data = values[i];
+		vars[i].size = sizeof(values[i]);
+		vars[i].writable = true;
+		sllp_register_variable(sllp, &vars[i]);
+	}
+	check(sllp_register_curve(sllp, &curve) == SLLP_SUCCESS,
+	      "register curve in the buffer");
+
+	/* Everything from here on is carved from the buffer */
+	size_t before = heap_used();
+	uint8_t payload[BLOCK_SIZE + 2];
+	uint8_t results[16];
+	unsigned int n = 0;
+
+	for(i = 0; i < NVARS; ++i)
+		payload[i] = i;
+	results[n++] = process(sllp, 0x30, payload, 2) == 0x31;
+	results[n++] = process(sllp, 0x30, payload, 3) == 0x31;
+	results[n++] = process(sllp, 0x30, payload, 1) == 0xE7;
+	results[n++] = process(sllp, 0x32, NULL, 0) == 0xE0;
+	results[n++] = process(sllp, 0x30, payload + 1, 4) == 0x31;
+
+	payload[0] = 3;
+	results[n++] = process(sllp, 0x12, payload, 1) == 0x13;
+	memset(payload + 1, 0x55, 4);
+	results[n++] = process(sllp, 0x20, payload, 5) == 0xE0 &&
+		       values[3][0] == 0x55;
+
+	payload[0] = curve.id;
+	payload[1] = 2;
+	memset(payload + 2, 0x11, BLOCK_SIZE);
+	results[n++] = process(sllp, 0x41, payload, BLOCK_SIZE + 2) == 0xE0;
+	results[n++] = process(sllp, 0x40, payload, 2) == 0x41 &&
+		       response_buf[4] == 0x11;
+	results[n++] = process(sllp, 0x42, payload, 1) == 0xE0;
+	payload[1] = 0;
+	payload[2] = 16;
+	results[n++] = process(sllp, 0x46, payload, 3) == 0x47;
+	payload[1] = 0;
+	payload[2] = NBLOCKS - 1;
+	results[n++] = process(sllp, 0x48, payload, 3) == 0x49;
+
+	size_t after = heap_used();
+
+	bool ok = true;
+	for(i = 0; i < n; ++i)
+		ok = ok && results[i];
+	check(ok, "commands answered");
+	check(after == before, "no heap used processing packets");
+
+	check(sllp_destroy(sllp) == SLLP_SUCCESS, "destroy static instance");
+	free(buffer);
+
+	/* The groups created by clients don't fit */
+	size = sllp_static_size(0, curves, 1);
+	buffer = malloc(size);
+	sllp = sllp_new_static(buffer, size);
+	sllp_register_variable(sllp, &vars[0]);
+	check(sllp_register_curve(sllp, &curve) == SLLP_SUCCESS &&
+	      process(sllp, 0x30, payload + 1, 1) == 0xE7,
+	      "group refused once the buffer is exhausted");
+
+	struct sllp_curve other = curve;
+	check(sllp_register_curve(sllp, &other) == SLLP_ERR_OUT_OF_MEMORY,
+	      "curve refused once the buffer is exhausted");
+	sllp_destroy(sllp);
+	free(buffer);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
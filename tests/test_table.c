@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "test_common.h"
+
+#define NBLOCKS		2
+
+uint8_t memory[NBLOCKS][BLOCK_SIZE];
+
+#define SLLP_TABLE_VARS(VAR)	\
+	VAR(voltage, 4, true)	\
+	VAR(status, 1, false)	\
+	VAR(label, 127, false)	\
+	VAR(setpoint, 2, true)
+
+#define SLLP_TABLE_GROUPS(GROUP)				\
+	GROUP(readings, SLLP_VAR_voltage, SLLP_VAR_status)	\
+	GROUP(control, SLLP_VAR_setpoint)
+
+#define SLLP_TABLE_CURVES(CURVE)	\
+	CURVE(wave, true, NBLOCKS - 1, SLLP_SAMPLE_INT16, read_block, \
+	      write_block)
+
+#include "sllp_table.h"
+
+/* Whether nothing was registered in sllp */
+bool untouched(sllp_instance_t *sllp)
+{
+	return process(sllp, 0x02, NULL, 0) == 0x03 && response_buf[1] == 0 &&
+	       process(sllp, 0x04, NULL, 0) == 0x05 && response_buf[1] == 3 &&
+	       process(sllp, 0x08, NULL, 0) == 0x09 && response_buf[1] == 0;
+}
+
+int main(void)
+{
+	uint8_t payload[8];
+	unsigned int i;
+
+	check(SLLP_VAR_setpoint == 3 && SLLP_TABLE_VARS_COUNT == 4 &&
+	      SLLP_GROUP_readings == 3 && SLLP_GROUP_control == 4 &&
+	      SLLP_TABLE_GROUPS_COUNT == 2 && SLLP_CURVE_wave == 0,
+	      "IDs fixed at compile time");
+
+	SLLP_TABLE_CURVE(wave).user = memory;
+
+	sllp_instance_t *sllp = sllp_new();
+	check(sllp_register_table(sllp, &sllp_table) == SLLP_SUCCESS,
+	      "register table");
+	check(sllp_register_table(sllp, &sllp_table) == SLLP_ERR_PARAM_INVALID,
+	      "second table refused");
+
+	/* Same list as variables registered one by one */
+	struct sllp_var vars[SLLP_TABLE_VARS_COUNT];
+	sllp_instance_t *reference = sllp_new();
+	for(i = 0; i < SLLP_TABLE_VARS_COUNT; ++i)
+	{
+		vars[i] = *sllp_table_vars[i];
+		sllp_register_variable(reference, &vars[i]);
+	}
+	process(reference, 0x02, NULL, 0);
+	uint8_t expected[2 + SLLP_TABLE_VARS_COUNT];
+	memcpy(expected, response_buf, sizeof(expected));
+	check(process(sllp, 0x02, NULL, 0) == 0x03 &&
+	      !memcmp(response_buf, expected, sizeof(expected)),
+	      "precomputed variables list");
+	sllp_destroy(reference);
+
+	SLLP_TABLE_VALUE(voltage)[0] = 0xAB;
+	SLLP_TABLE_VALUE(status)[0] = 0xCD;
+	payload[0] = SLLP_GROUP_readings;
+	check(process(sllp, 0x12, payload, 1) == 0x13 &&
+	      response_buf[1] == 5 && response_buf[2] == 0xAB &&
+	      response_buf[6] == 0xCD,
+	      "read declared group");
+
+	payload[0] = SLLP_GROUP_control;
+	payload[1] = 0x12;
+	payload[2] = 0x34;
+	check(process(sllp, 0x22, payload, 3) == 0xE0 &&
+	      SLLP_TABLE_VALUE(setpoint)[1] == 0x34,
+	      "write declared group");
+
+	payload[0] = SLLP_VAR_voltage;
+	payload[1] = SLLP_VAR_setpoint;
+	check(process(sllp, 0x30, payload, 2) == 0x31 &&
+	      (response_buf[2] & 0x7F) == SLLP_TABLE_GROUPS_END,
+	      "client group after the declared ones");
+	check(process(sllp, 0x32, NULL, 0) == 0xE0 &&
+	      process(sllp, 0x04, NULL, 0) == 0x05 &&
+	      response_buf[1] == SLLP_TABLE_GROUPS_END,
+	      "declared groups survive removal");
+
+	payload[0] = SLLP_CURVE_wave;
+	payload[1] = 1;
+	check(process(sllp, 0x40, payload, 2) == 0x41,
+	      "declared curve registered");
+	sllp_destroy(sllp);
+
+	/* Variables registered after the table aren't left out of the list */
+	sllp = sllp_new();
+	sllp_register_table(sllp, &sllp_table);
+	struct sllp_var extra = { .size = 1, .data = payload };
+	sllp_register_variable(sllp, &extra);
+	check(process(sllp, 0x02, NULL, 0) == 0x03 &&
+	      response_buf[1] == SLLP_TABLE_VARS_COUNT + 1 &&
+	      response_buf[2 + SLLP_TABLE_VARS_COUNT] == 1,
+	      "variable registered after the table listed");
+	sllp_destroy(sllp);
+
+	/* A static instance with room for the declared groups */
+	const struct sllp_curve *curves[] = {&SLLP_TABLE_CURVE(wave)};
+	size_t size = sllp_static_size(SLLP_TABLE_GROUPS_COUNT, curves, 1);
+	void *buffer = malloc(size);
+	sllp = sllp_new_static(buffer, size);
+	check(sllp_register_table(sllp, &sllp_table) == SLLP_SUCCESS,
+	      "register table in a static instance");
+	sllp_destroy(sllp);
+	free(buffer);
+
+	/* Invalid group */
+	static const uint8_t twice[] = {SLLP_VAR_status, SLLP_VAR_status};
+	struct sllp_table_group bad_group = {twice, sizeof(twice)};
+	struct sllp_table bad = sllp_table;
+	bad.groups = &bad_group;
+	bad.groups_count = 1;
+	bad.curves_count = 0;
+	sllp = sllp_new();
+	check(sllp_register_table(sllp, &bad) == SLLP_ERR_PARAM_INVALID,
+	      "group naming a variable twice refused");
+	check(untouched(sllp), "instance untouched by an invalid group");
+
+	/* Invalid curve after valid groups */
+	struct sllp_curve no_read = { .sample_type = SLLP_SAMPLE_INT16 };
+	struct sllp_curve *bad_curves[] = {&SLLP_TABLE_CURVE(wave), &no_read};
+	bad = sllp_table;
+	bad.curves = bad_curves;
+	bad.curves_count = 2;
+	check(sllp_register_table(sllp, &bad) == SLLP_ERR_PARAM_INVALID &&
+	      untouched(sllp), "instance untouched by an invalid curve");
+	check(sllp_register_table(sllp, &sllp_table) == SLLP_SUCCESS,
+	      "table registered after the refused ones");
+	sllp_destroy(sllp);
+
+	/* A static instance without room for the curve */
+	size = sllp_static_size(SLLP_TABLE_GROUPS_COUNT, NULL, 0);
+	buffer = malloc(size);
+	sllp = sllp_new_static(buffer, size);
+	check(sllp_register_table(sllp, &sllp_table) == SLLP_ERR_OUT_OF_MEMORY &&
+	      untouched(sllp), "instance untouched without memory");
+	sllp_destroy(sllp);
+	free(buffer);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}